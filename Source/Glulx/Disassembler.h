@@ -216,7 +216,7 @@ private:
    }
 
    //! Decode an op
-   virtual unsigned decodeOp(std::string& text, const uint8_t* raw, bool pack) const override
+   virtual unsigned decodeOp(std::string& text, const uint8_t* raw, uint32_t /* size */, bool pack) const override
    {
       unsigned n = 0;
 
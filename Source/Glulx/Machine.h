@@ -8,8 +8,8 @@
 #include <cmath>
 #include <cstring>
 
-#include "common/Log.h"
 #include "common/Machine.h"
+#include "common/Observer.h"
 
 #include "Glulx/State.h"
 #include "Glulx/Story.h"
@@ -17,13 +17,15 @@
 
 namespace Glulx {
 
-//! Glulx machine implementation
-class Machine : public IF::Machine
+//! Glulx machine implementation, reporting events to an OBSERVER
+template <typename OBSERVER = IF::NullObserver>
+class BasicMachine : public IF::Machine
 {
 public:
-   Machine(Console& console_, const Options& options_, const Glulx::Story& story_)
+   BasicMachine(Console& console_, const Options& options_, const Glulx::Story& story_)
       : IF::Machine(console_, options_)
       , state(story_, (const char*)options.save_dir, options.undo, options.seed)
+      , observer(options_, story_)
    {
    }
 
@@ -38,30 +40,19 @@ public:
          // PC after reset points at the first function not code
          call(state.getPC(), 0);
 
-         if (options.trace)
+         while(!state.isQuitRequested())
          {
-            while(!state.isQuitRequested())
-            {
-               inst_addr = state.getPC();
-               dis.trace(dis_text, inst_addr, state.memory.data() + inst_addr);
-               trace.write(dis_text);
-               fetchDecodeExecute();
-            }
-         }
-         else
-         {
-            while(!state.isQuitRequested())
-            {
-               inst_addr = state.getPC();
-               fetchDecodeExecute();
-            }
+            inst_addr = state.getPC();
+            observer.instruction(inst_addr, state.memory);
+            fetchDecodeExecute();
          }
       }
       catch(const char* message)
       {
          if (strcmp(message, "quit") != 0)
          {
-            (void) dis.disassemble(dis_text, inst_addr, state.memory.data() + inst_addr);
+            (void) dis.disassemble(dis_text, inst_addr, state.memory.data() + inst_addr,
+                                  state.memory.size() - inst_addr);
             dis_text += " \"";
             dis_text += message;
             dis_text += "\"";
@@ -77,14 +68,17 @@ public:
       return ok;
    }
 
-private:
+protected:
+   // Protected so that the instruction decode can be exercised on its own
+   // e.g. by a benchmark
+
    static const unsigned MAX_OPERAND = 4;
 
    State                state;
    IF::Memory::Address  ramstart{0};
    IF::Stack::Offset    local{0};
    Disassembler         dis;
-   Log                  trace{"trace.log"};
+   OBSERVER             observer;
 
    //! Decoded instruction address modes
    uint8_t  mode[MAX_OPERAND];
@@ -167,6 +161,14 @@ private:
       }
    }
 
+   //! Write memory for an instruction
+   template <typename TYPE>
+   void write(uint32_t address, TYPE value)
+   {
+      observer.write(address, sizeof(TYPE));
+      state.memory.write<TYPE>(address, value);
+   }
+
    //! Store a 32-bit integer operand 
    template <typename TYPE>
    void storeOperand(unsigned i, TYPE value)
@@ -180,7 +182,7 @@ private:
       case 0x4: throw "bad address mode";
       case 0x5:
       case 0x6:
-      case 0x7: state.memory.write<TYPE>(addr[i], value); break;
+      case 0x7: write<TYPE>(addr[i], value); break;
       case 0x8: state.stack.push32(value); break;
       case 0x9:
       case 0xA:
@@ -188,7 +190,7 @@ private:
       case 0xC: throw "bad address mode";
       case 0xD:
       case 0xE:
-      case 0xF: state.memory.write<TYPE>(ramstart + addr[i], value); break;
+      case 0xF: write<TYPE>(ramstart + addr[i], value); break;
       }
    }
 
@@ -251,6 +253,8 @@ private:
 
       state.frame_ptr = state.stack.size();
 
+      observer.call(address, state.frame_ptr);
+
       state.stack.push32(0); // Place holder for frame length
       state.stack.push32(0); // Place holder for local pos
 
@@ -283,6 +287,8 @@ private:
 
    void doReturn(uint32_t value)
    {
+      observer.ret(state.frame_ptr);
+
       state.stack.shrink(state.frame_ptr);
       state.frame_ptr = state.stack.pop32();
       state.jump(state.stack.pop32());
@@ -341,9 +347,9 @@ private:
       case  0x49: /* aloads   */ fetchA(3); uSt(2, state.memory.read16(uLd(0) + 4 * uLd(1))); break;
       case  0x4A: /* aloadb   */ fetchA(3); uSt(2, state.memory.read8(uLd(0) + 4 * uLd(1))); break;
       case  0x4B: /* aloadbit */ fetchA(3); break;
-      case  0x4C: /* astore   */ fetchA(3); state.memory.write32(uLd(0) + 4 * uLd(1), uLd(2)); break;
-      case  0x4D: /* astores  */ fetchA(3); state.memory.write16(uLd(0) + 4 * uLd(1), uLd(2)); break;
-      case  0x4E: /* astoreb  */ fetchA(3); state.memory.write8(uLd(0) + 4 * uLd(1), uLd(2)); break;
+      case  0x4C: /* astore   */ fetchA(3); write<uint32_t>(uLd(0) + 4 * uLd(1), uLd(2)); break;
+      case  0x4D: /* astores  */ fetchA(3); write<uint16_t>(uLd(0) + 4 * uLd(1), uLd(2)); break;
+      case  0x4E: /* astoreb  */ fetchA(3); write<uint8_t>(uLd(0) + 4 * uLd(1), uLd(2)); break;
       case  0x4F: /* astorebit*/ fetchA(3); break;
       case  0x50: /* stkcount */ fetchA(1); uSt(0, (state.stack.size() - local) / 4); break;
       case  0x51: /* stkpeek  */ fetchA(2); break;
@@ -367,7 +373,7 @@ private:
 
       case 0x120: /* quit       */ state.quit(); break;
       case 0x121: /* verify     */ fetchA(1); uSt(0, 0); break;
-      case 0x122: /* restart    */ state.reset(); break;
+      case 0x122: /* restart    */ state.settleSaves(); state.reset(); break;
       case 0x123: /* save       */ fetchA(2); uSt(1, state.save() ? 0 : 1); break;
       case 0x124: /* restore    */ fetchA(2); uSt(1, state.restore() ? 0 : 1); break;
       case 0x125: /* saveundo   */ fetchA(1); uSt(0, state.saveUndo() ? 0 : 1); break;
@@ -441,5 +447,8 @@ private:
    }
 };
 
+//! Glulx machine with no observer
+using Machine = BasicMachine<>;
+
 } // namespace Glulx
 
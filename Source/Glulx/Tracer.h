@@ -0,0 +1,40 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+
+#include "common/Log.h"
+#include "common/Observer.h"
+
+#include "Glulx/Disassembler.h"
+#include "Glulx/Story.h"
+
+namespace Glulx {
+
+//! Observer that logs each instruction to "trace.log"
+class Tracer : public IF::NullObserver
+{
+public:
+   Tracer(const Options& options, const Story& story)
+      : IF::NullObserver(options, story)
+      , log(std::string(options.log_prefix) + "trace.log")
+   {
+   }
+
+   void instruction(IF::Memory::Address addr, const IF::Memory& memory)
+   {
+      dis.trace(text, addr, memory.data() + addr, memory.size() - addr);
+      log.write(text);
+   }
+
+private:
+   Disassembler dis;
+   Log          log;
+   std::string  text;
+};
+
+} // namespace Glulx
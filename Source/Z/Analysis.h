@@ -0,0 +1,278 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "PLT/File.h"
+
+#include "common/Buffer.h"
+
+#include "Z/Header.h"
+#include "Z/Story.h"
+
+namespace Z {
+
+//! Structures derived from a story image that are worth keeping between
+//! runs. Currently an index of the standard dictionary.
+//
+//  The cache file is a flat big-endian layout of fixed size records...
+//
+//     0  "ZifA"
+//     4  format version (16-bit) and padding
+//     8  story identity (NUL padded to IDENTITY_SIZE bytes)
+//    40  dictionary address
+//    44  number of dictionary entries
+//    48  dictionary index records, each a 3 word key and an entry address
+//
+//  ...and is only used when the header fields all match the story
+class Analysis
+{
+public:
+   //! Increment when the layout changes
+   static const uint16_t FORMAT_VERSION = 1;
+
+   //! Get the filename for the cache file of a story
+   static std::string cacheFilename(const std::string& dir, const Story& story)
+   {
+      std::string path = dir;
+      path += '/';
+      path += story.getFilename();
+      path += '_';
+      path += story.getIdentity();
+      path += ".zan";
+      return path;
+   }
+
+   Analysis() = default;
+
+   //! Get the analysis of a story, shared by all the machines of the
+   //! process. The cache file is only read (or written) the first time
+   static std::shared_ptr<const Analysis> get(const Story& story, const std::string& dir)
+   {
+      static std::mutex                                             mutex;
+      static std::map<std::string, std::shared_ptr<const Analysis>> loaded;
+
+      std::string path = cacheFilename(dir, story);
+
+      std::unique_lock<std::mutex> lock(mutex);
+
+      std::shared_ptr<const Analysis>& analysis = loaded[path];
+      if (!analysis)
+      {
+         auto prepared = std::make_shared<Analysis>();
+         prepared->prepare(story, dir);
+         analysis = prepared;
+      }
+
+      return analysis;
+   }
+
+   //! Load the analysis from the cache file or analyse the story (and
+   //! update the cache file)
+   void prepare(const Story& story, const std::string& dir)
+   {
+      std::string path = cacheFilename(dir, story);
+
+      if (read(story, path)) return;
+
+      analyse(story);
+
+      // Make sure the cache directory exists
+      (void) PLT::File::createDir(dir.c_str());
+
+      (void) write(story, path);
+   }
+
+   //! Address of the indexed dictionary (0 if none)
+   uint32_t getDictionary() const { return dict; }
+
+   //! Find the entry address for an encoded word in the indexed dictionary
+   //! \return 0 if not found
+   uint16_t findWord(const uint16_t* key) const
+   {
+      Entry target;
+      memcpy(target.key, key, sizeof(target.key));
+
+      auto it = std::lower_bound(index.begin(), index.end(), target, lessThan);
+      if ((it == index.end()) || (memcmp(it->key, key, sizeof(it->key)) != 0))
+      {
+         return 0;
+      }
+
+      return it->addr;
+   }
+
+private:
+   static const unsigned IDENTITY_SIZE = 32;
+   static const unsigned HEADER_SIZE   = 8 + IDENTITY_SIZE + 8;
+   static const unsigned ENTRY_SIZE    = 8;
+
+   //! Dictionary index record
+   struct Entry
+   {
+      uint16_t key[3];
+      uint16_t addr;
+   };
+
+   uint32_t           dict{0};
+   std::vector<Entry> index;
+
+   static bool lessThan(const Entry& lhs, const Entry& rhs)
+   {
+      return std::lexicographical_compare(lhs.key, lhs.key + 3, rhs.key, rhs.key + 3);
+   }
+
+   //! Build the derived structures from the story image
+   void analyse(const Story& story)
+   {
+      dict = 0;
+      index.clear();
+
+      const Header*  header = story.getHeader();
+      const uint8_t* image  = story.data();
+
+      // Only a dictionary in static memory can be relied upon not to change
+      if ((header->dict < header->stat) || ((header->dict + 4u) > story.size())) return;
+
+      uint32_t addr         = header->dict;
+      uint8_t  num_sep      = image[addr];
+      uint8_t  entry_length = image[addr + 1 + num_sep];
+      int16_t  num_entry    = (image[addr + 2 + num_sep] << 8) | image[addr + 3 + num_sep];
+      uint32_t first        = addr + 4 + num_sep;
+      unsigned key_words    = header->version <= 3 ? 2 : 3;
+
+      // A negative count indicates an unsorted dictionary
+      unsigned n = num_entry < 0 ? -num_entry : num_entry;
+
+      if ((entry_length < key_words * 2) ||
+          ((first + n * entry_length) > story.size()) ||
+          ((first + n * entry_length) > 0x10000)) return;
+
+      index.resize(n);
+
+      for(unsigned i = 0; i < n; i++)
+      {
+         uint32_t entry_addr = first + i * entry_length;
+         Entry&   entry      = index[i];
+
+         for(unsigned j = 0; j < 3; j++)
+         {
+            entry.key[j] = j < key_words ? (image[entry_addr + j * 2] << 8) | image[entry_addr + j * 2 + 1]
+                                         : 0;
+         }
+
+         entry.addr = entry_addr;
+      }
+
+      // Keep the first of any duplicate entries as the linear search did
+      std::stable_sort(index.begin(), index.end(), lessThan);
+
+      dict = addr;
+   }
+
+   //! Fill in the fixed header fields
+   static void encodeHeader(IF::Buffer& buffer, const Story& story, uint32_t dict_, uint32_t n)
+   {
+      std::string identity = story.getIdentity();
+      identity.resize(IDENTITY_SIZE, '\0');
+
+      buffer.push("ZifA", 4);
+      buffer.push16(FORMAT_VERSION);
+      buffer.push16(0);
+      buffer.push(identity.data(), IDENTITY_SIZE);
+      buffer.push32(dict_);
+      buffer.push32(n);
+   }
+
+   //! Write the cache file, to a temporary file first so that other
+   //! processes never read a partial file
+   bool write(const Story& story, const std::string& path) const
+   {
+      IF::Buffer buffer;
+
+      buffer.reserve(HEADER_SIZE + index.size() * ENTRY_SIZE);
+
+      encodeHeader(buffer, story, dict, index.size());
+
+      for(const auto& entry : index)
+      {
+         buffer.push16(entry.key[0]);
+         buffer.push16(entry.key[1]);
+         buffer.push16(entry.key[2]);
+         buffer.push16(entry.addr);
+      }
+
+      std::string tmp = path + '.' + std::to_string(getpid()) + ".tmp";
+
+      if (!buffer.write(tmp) || (rename(tmp.c_str(), path.c_str()) != 0))
+      {
+         (void) remove(tmp.c_str());
+         return false;
+      }
+
+      return true;
+   }
+
+   //! Read and validate the cache file
+   bool read(const Story& story, const std::string& path)
+   {
+      IF::Buffer buffer;
+      if (!buffer.read(path) || (buffer.size() < HEADER_SIZE)) return false;
+
+      uint32_t n = (buffer.size() - HEADER_SIZE) / ENTRY_SIZE;
+
+      const uint8_t* raw = buffer.read(HEADER_SIZE);
+      uint32_t       dict_ = (raw[40] << 24) | (raw[41] << 16) | (raw[42] << 8) | raw[43];
+
+      IF::Buffer expected;
+      encodeHeader(expected, story, dict_, n);
+
+      if ((buffer.size() != (HEADER_SIZE + n * ENTRY_SIZE)) ||
+          (memcmp(raw, expected.data(), HEADER_SIZE) != 0) ||
+          ((dict_ != 0) && (dict_ != story.getHeader()->dict)))
+      {
+         return false;
+      }
+
+      index.resize(n);
+
+      for(auto& entry : index)
+      {
+         entry.key[0] = buffer.read16();
+         entry.key[1] = buffer.read16();
+         entry.key[2] = buffer.read16();
+         entry.addr   = buffer.read16();
+
+         if (entry.addr >= story.size())
+         {
+            index.clear();
+            return false;
+         }
+      }
+
+      if (!std::is_sorted(index.begin(), index.end(), lessThan))
+      {
+         index.clear();
+         return false;
+      }
+
+      dict = dict_;
+      return true;
+   }
+};
+
+} // namespace Z
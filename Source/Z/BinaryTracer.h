@@ -0,0 +1,397 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common/Observer.h"
+
+#include "Z/Story.h"
+
+namespace Z {
+
+//! A record of a binary trace. Every record is the same size, big-endian...
+//
+//     0  PC of the instruction (32-bit), or one of the kinds of event
+//     4  op-code (bits 0-7), flags (bits 8-11), number of operands (bits 12-15)
+//     6  result stored (16-bit)
+//     8  operands (8 x 16-bit)
+//
+//  The operand words of an event hold...
+//
+//     CHECKPOINT  instructions traced (64-bit), routine running (32-bit),
+//                 with the call depth as the result
+//     CALL        routine (32-bit) and its frame pointer (32-bit)
+//     RETURN      frame pointer (32-bit) of the routine returning
+//     OUTPUT      character as the result
+//     INPUT       character as the result
+//
+struct TraceRecord
+{
+   enum Kind : uint32_t
+   {
+      CHECKPOINT = 0xFFFFFFFF,
+      CALL       = 0xFFFFFFFE,
+      RETURN     = 0xFFFFFFFD,
+      OUTPUT     = 0xFFFFFFFC,
+      INPUT      = 0xFFFFFFFB,
+      FIRST_KIND = INPUT
+   };
+
+   enum Flag : uint16_t
+   {
+      EXT    = 1 << 8,   //!< Op-code is of the extended form
+      STORE  = 1 << 9,   //!< A result was stored
+      BRANCH = 1 << 10,  //!< A branch condition was tested
+      TAKEN  = 1 << 11   //!< The branch was followed
+   };
+
+   static const unsigned SIZE         = 24;
+   static const unsigned MAX_OPERANDS = 8;
+
+   uint32_t pc{0};
+   uint16_t info{0};
+   uint16_t result{0};
+   uint16_t operand[MAX_OPERANDS] = {};
+
+   bool     isEvent() const { return pc >= FIRST_KIND; }
+   uint8_t  getOpcode() const { return info & 0xFF; }
+   unsigned getNumOperands() const { return info >> 12; }
+   bool     hasFlag(Flag flag) const { return (info & flag) != 0; }
+
+   void addOperand(uint16_t value)
+   {
+      unsigned n = getNumOperands();
+      if (n < MAX_OPERANDS)
+      {
+         operand[n] = value;
+         info = (info & 0x0FFF) | ((n + 1) << 12);
+      }
+   }
+
+   //! 32-bit value from a pair of operand words
+   uint32_t get32(unsigned i) const { return (uint32_t(operand[i]) << 16) | operand[i + 1]; }
+
+   void set32(unsigned i, uint32_t value)
+   {
+      operand[i]     = value >> 16;
+      operand[i + 1] = value & 0xFFFF;
+   }
+
+   void encode(uint8_t* raw) const
+   {
+      put16(raw + 0, pc >> 16);
+      put16(raw + 2, pc & 0xFFFF);
+      put16(raw + 4, info);
+      put16(raw + 6, result);
+
+      for(unsigned i = 0; i < MAX_OPERANDS; i++)
+      {
+         put16(raw + 8 + 2 * i, operand[i]);
+      }
+   }
+
+   void decode(const uint8_t* raw)
+   {
+      pc     = (uint32_t(get16(raw + 0)) << 16) | get16(raw + 2);
+      info   = get16(raw + 4);
+      result = get16(raw + 6);
+
+      for(unsigned i = 0; i < MAX_OPERANDS; i++)
+      {
+         operand[i] = get16(raw + 8 + 2 * i);
+      }
+   }
+
+private:
+   static void put16(uint8_t* raw, uint16_t value)
+   {
+      raw[0] = value >> 8;
+      raw[1] = value & 0xFF;
+   }
+
+   static uint16_t get16(const uint8_t* raw)
+   {
+      return (raw[0] << 8) | raw[1];
+   }
+};
+
+//! The routines active, followed from the calls and returns of a trace
+class TraceStack
+{
+public:
+   void call(uint32_t routine, uint32_t frame_ptr)
+   {
+      frames.push_back(Frame{routine, frame_ptr});
+   }
+
+   //! Return from the given frame, and any frames above it (throw)
+   void ret(uint32_t frame_ptr)
+   {
+      while(!frames.empty())
+      {
+         bool found = frames.back().frame_ptr == frame_ptr;
+         frames.pop_back();
+         if (found) break;
+      }
+   }
+
+   //! Check against a checkpoint, and start again from it if the frames
+   //! differ. The routines below the one running are then not known
+   void sync(uint32_t routine, unsigned depth)
+   {
+      if ((getDepth() == depth) && (getRoutine() == routine)) return;
+
+      frames.assign(depth, Frame{0, 0});
+      if (depth != 0) frames.back().routine = routine;
+   }
+
+   unsigned getDepth() const { return unsigned(frames.size()); }
+
+   //! Routine running, 0 if not known
+   uint32_t getRoutine() const { return frames.empty() ? 0 : frames.back().routine; }
+
+private:
+   struct Frame
+   {
+      uint32_t routine;
+      uint32_t frame_ptr;
+   };
+
+   std::vector<Frame> frames;
+};
+
+//! Observer that writes a compact binary trace to "trace.bin", to be
+//! decoded with zdmp --trace. Records go through a large buffer and the
+//! buffer is written out whenever the game waits for input
+class BinaryTracer : public IF::NullObserver
+{
+public:
+   //! Instructions between checkpoints
+   static const uint64_t CHECKPOINT_INTERVAL = 0x10000;
+
+   static const uint16_t FORMAT_VERSION = 1;
+
+   BinaryTracer(const Options& options, const Story& story)
+      : IF::NullObserver(options, story)
+   {
+      std::string filename = std::string(options.log_prefix) + "trace.bin";
+
+      fp = fopen(filename.c_str(), "wb");
+      if (fp == nullptr) return;
+
+      buffer.reserve(BUFFER_SIZE);
+
+      // File header
+      std::string identity = story.getIdentity();
+      uint8_t     header[12] = {'Z', 'i', 'f', 'T',
+                                FORMAT_VERSION >> 8, FORMAT_VERSION & 0xFF,
+                                0, TraceRecord::SIZE,
+                                0, 0, 0, uint8_t(identity.size())};
+      (void) fwrite(header, sizeof(header), 1, fp);
+      (void) fwrite(identity.data(), identity.size(), 1, fp);
+   }
+
+   ~BinaryTracer()
+   {
+      if (fp == nullptr) return;
+
+      finishInstruction();
+      flush();
+      fclose(fp);
+   }
+
+   void instruction(IF::Memory::Address addr, const IF::Memory& memory)
+   {
+      if (fp == nullptr) return;
+
+      finishInstruction();
+
+      if ((count % CHECKPOINT_INTERVAL) == 0)
+      {
+         TraceRecord checkpoint;
+         checkpoint.pc     = TraceRecord::CHECKPOINT;
+         checkpoint.result = stack.getDepth();
+         checkpoint.set32(0, uint32_t(count >> 32));
+         checkpoint.set32(2, uint32_t(count));
+         checkpoint.set32(4, stack.getRoutine());
+         writeRecord(checkpoint);
+      }
+
+      count++;
+
+      current    = TraceRecord{};
+      current.pc = addr;
+
+      uint8_t opcode = memory.fetch8(addr);
+      if (opcode == 0xBE)
+      {
+         current.info = TraceRecord::EXT | memory.fetch8(addr + 1);
+      }
+      else
+      {
+         current.info = opcode;
+      }
+
+      in_instruction = true;
+   }
+
+   void operand(uint16_t value) { current.addOperand(value); }
+
+   void store(uint16_t value)
+   {
+      current.info  |= TraceRecord::STORE;
+      current.result = value;
+   }
+
+   void branch(bool taken)
+   {
+      current.info |= taken ? TraceRecord::BRANCH | TraceRecord::TAKEN
+                            : TraceRecord::BRANCH;
+   }
+
+   void call(IF::Memory::Address addr, uint32_t frame_ptr)
+   {
+      stack.call(addr, frame_ptr);
+
+      TraceRecord event;
+      event.pc = TraceRecord::CALL;
+      event.set32(0, addr);
+      event.set32(2, frame_ptr);
+      events.push_back(event);
+   }
+
+   void ret(uint32_t frame_ptr)
+   {
+      stack.ret(frame_ptr);
+
+      TraceRecord event;
+      event.pc = TraceRecord::RETURN;
+      event.set32(0, frame_ptr);
+      events.push_back(event);
+   }
+
+   void output(uint16_t zscii)
+   {
+      TraceRecord event;
+      event.pc     = TraceRecord::OUTPUT;
+      event.result = zscii;
+      events.push_back(event);
+   }
+
+   void input(uint16_t zscii)
+   {
+      TraceRecord event;
+      event.pc     = TraceRecord::INPUT;
+      event.result = zscii;
+      events.push_back(event);
+   }
+
+   //! Keep the trace up to date while waiting for the player, the record
+   //! of the read instruction follows once it has completed
+   void requestInput()
+   {
+      if (fp != nullptr) flush();
+   }
+
+private:
+   static const size_t BUFFER_SIZE = 1 << 20;
+
+   FILE*                    fp{nullptr};
+   std::vector<uint8_t>     buffer;
+   uint64_t                 count{0};
+   bool                     in_instruction{false};
+   TraceRecord              current;
+   std::vector<TraceRecord> events;       //!< Of the current instruction
+   TraceStack               stack;
+
+   //! Write the record of the current instruction, then its events
+   void finishInstruction()
+   {
+      if (in_instruction)
+      {
+         writeRecord(current);
+         in_instruction = false;
+      }
+
+      for(const auto& event : events)
+      {
+         writeRecord(event);
+      }
+      events.clear();
+   }
+
+   void writeRecord(const TraceRecord& record)
+   {
+      if ((buffer.size() + TraceRecord::SIZE) > BUFFER_SIZE) flush();
+
+      size_t size = buffer.size();
+      buffer.resize(size + TraceRecord::SIZE);
+      record.encode(buffer.data() + size);
+   }
+
+   void flush()
+   {
+      (void) fwrite(buffer.data(), buffer.size(), 1, fp);
+      (void) fflush(fp);
+      buffer.clear();
+   }
+};
+
+//! Reads the records of a trace written by BinaryTracer
+class TraceReader
+{
+public:
+   ~TraceReader()
+   {
+      if (fp != nullptr) fclose(fp);
+   }
+
+   //! Open a trace file and read the identity of the story traced
+   //! \return false if the file is missing or not a trace
+   bool open(const std::string& path, std::string& identity)
+   {
+      fp = fopen(path.c_str(), "rb");
+      if (fp == nullptr) return false;
+
+      uint8_t header[12];
+      if ((fread(header, sizeof(header), 1, fp) != 1) ||
+          (memcmp(header, "ZifT", 4) != 0) ||
+          (((header[4] << 8) | header[5]) != BinaryTracer::FORMAT_VERSION) ||
+          (((header[6] << 8) | header[7]) != TraceRecord::SIZE))
+      {
+         return false;
+      }
+
+      size_t length = (header[8] << 24) | (header[9] << 16) | (header[10] << 8) | header[11];
+      if (length > MAX_IDENTITY) return false;
+
+      identity.resize(length);
+      return (length == 0) || (fread(&identity[0], length, 1, fp) == 1);
+   }
+
+   //! Read the next record
+   //! \return false at the end of the trace
+   bool next(TraceRecord& record)
+   {
+      uint8_t raw[TraceRecord::SIZE];
+      if ((fp == nullptr) || (fread(raw, sizeof(raw), 1, fp) != 1)) return false;
+
+      record.decode(raw);
+      return true;
+   }
+
+private:
+   static const size_t MAX_IDENTITY = 256;
+
+   FILE* fp{nullptr};
+};
+
+} // namespace Z
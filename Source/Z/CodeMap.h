@@ -0,0 +1,128 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Z/Disassembler.h"
+#include "Z/Header.h"
+
+namespace Z {
+
+//! The routines and strings in high memory of a story. Routines are found
+//! one after another from the start of high memory, using the disassembler
+//! to follow the code of each, and the strings follow the last routine.
+//! A routine that is not where the last one ended can be added when it is
+//! known to be called
+class CodeMap
+{
+public:
+   struct Routine
+   {
+      uint32_t addr;   //!< Of the header
+      uint32_t code;   //!< First instruction
+      uint32_t end;
+   };
+
+   struct String
+   {
+      uint32_t addr;
+      uint32_t end;
+   };
+
+   CodeMap(const uint8_t* memory_, uint32_t size_)
+      : memory(memory_)
+      , size(size_)
+      , header((const Header*)memory_)
+      , dis(header->version)
+   {
+      align = header->version <= 3 ? 2 :
+              header->version <= 7 ? 4 : 8;
+
+      uint32_t addr = alignUp(header->himem);
+
+      while(addr < size)
+      {
+         Routine routine{addr, 0, 0};
+         if (!dis.findRoutine(memory, size, addr, routine.code, routine.end)) break;
+
+         routines.push_back(routine);
+         addr = alignUp(routine.end);
+      }
+
+      findStrings(addr);
+   }
+
+   //! Add a routine that is known to be called
+   //! \return false if there is no routine at addr
+   bool addRoutine(uint32_t addr)
+   {
+      auto it = std::lower_bound(routines.begin(), routines.end(), addr,
+                                 [](const Routine& routine, uint32_t addr){ return routine.addr < addr; });
+
+      if ((it != routines.end()) && (it->addr == addr)) return true;
+
+      Routine routine{addr, 0, 0};
+      if (!dis.findRoutine(memory, size, addr, routine.code, routine.end)) return false;
+
+      routines.insert(it, routine);
+      return true;
+   }
+
+   const std::vector<Routine>& getRoutines() const { return routines; }
+   const std::vector<String>&  getStrings() const { return strings; }
+
+   //! Call a function with the address of each instruction of a routine
+   template <typename FUNCTION>
+   void forEachInstruction(const Routine& routine, FUNCTION function) const
+   {
+      for(uint32_t pc = routine.code; pc < routine.end; )
+      {
+         Disassembler::Flow flow = dis.getFlow(memory, size, pc);
+         if (flow.length == 0) break;
+
+         function(pc);
+         pc += flow.length;
+      }
+   }
+
+private:
+   const uint8_t*       memory;
+   uint32_t             size;
+   const Header*        header;
+   Disassembler         dis;
+   uint32_t             align;
+   std::vector<Routine> routines;
+   std::vector<String>  strings;
+
+   uint32_t alignUp(uint32_t addr) const
+   {
+      return (addr + align - 1) & ~(align - 1);
+   }
+
+   //! Each string ends with a word that has the top bit set
+   void findStrings(uint32_t addr)
+   {
+      while((addr + 1) < size)
+      {
+         uint32_t end = addr;
+
+         while(((end + 1) < size) && ((memory[end] & 0x80) == 0))
+         {
+            end += 2;
+         }
+
+         if ((end + 1) >= size) break;
+
+         strings.push_back(String{addr, end + 2});
+         addr = alignUp(end + 2);
+      }
+   }
+};
+
+} // namespace Z
@@ -5,7 +5,9 @@
 
 #pragma once
 
+#include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <string>
 
 #include "common/Disassembler.h"
@@ -24,11 +26,23 @@ enum OperandType : uint8_t
 class Disassembler : public IF::Disassembler
 {
 public:
-   Disassembler(unsigned version)
+   //! How control leaves an instruction
+   struct Flow
+   {
+      unsigned length{0};     //!< Bytes, 0 if not a legal instruction
+      bool     ends{false};   //!< Control does not go on to the next instruction
+      bool     jumps{false};  //!< Control may go to the target
+      uint32_t target{0};
+   };
+
+   //! Output types are '_' none, 'S' store, 'B' branch, 'X' store and
+   //! branch, 'l' literal string
+   Disassembler(unsigned version_)
+      : version(version_)
    {
       // Ops supported on all versions
-      declOp( 0x0, '0', 'S', "rtrue");
-      declOp( 0x1, '0', 'S', "rfalse");
+      declOp( 0x0, '0', '_', "rtrue");
+      declOp( 0x1, '0', '_', "rfalse");
       declOp( 0x2, '0', 'l', "print");
       declOp( 0x3, '0', 'l', "print_ret");
       declOp( 0x4, '0', '_', "nop");
@@ -38,8 +52,8 @@ public:
       declOp( 0xB, '0', '_', "new_line");
 
       declOp( 0x0, '1', 'B', "jz");
-      declOp( 0x1, '1', '_', "get_sibling");
-      declOp( 0x2, '1', '_', "get_child");
+      declOp( 0x1, '1', 'X', "get_sibling");
+      declOp( 0x2, '1', 'X', "get_child");
       declOp( 0x3, '1', 'S', "get_parent");
       declOp( 0x4, '1', 'S', "get_prop_len");
       declOp( 0x5, '1', '_', "inc");
@@ -84,12 +98,12 @@ public:
       declOp(0x06, 'V', '_', "print_num");
       declOp(0x07, 'V', 'S', "random");
       declOp(0x08, 'V', '_', "push");
-      declOp(0x09, 'V', '_', "pull");
+      declOp(0x09, 'V', version == 6 ? 'S' : '_', "pull");
 
       // Version specific ops
       if (version <= 3)
       {
-         declOp(0x00, 'V', '_', "call");
+         declOp(0x00, 'V', 'S', "call");
       }
 
       if (version == 3)
@@ -105,12 +119,13 @@ public:
          declOp(0x0B, 'V', '_', "set_window");
          declOp(0x13, 'V', '_', "output_stream");
          declOp(0x14, 'V', '_', "input_stream");
+         declOp(0x15, 'V', '_', "sound_effect");
       }
 
       if (version <= 4)
       {
-         declOp(0x5,  '0', 'B', "save");
-         declOp(0x6,  '0', 'B', "restore");
+         declOp(0x5,  '0', version == 4 ? 'S' : 'B', "save");
+         declOp(0x6,  '0', version == 4 ? 'S' : 'B', "restore");
          declOp(0x9,  '0', '_', "pop");
 
          declOp(0xF,  '1', 'S', "not");
@@ -123,20 +138,19 @@ public:
          declOp( 0xC, '0', '_', "nop");
 
          declOp( 0x8, '1', 'S', "call_1s");
-         declOp( 0xF, '1', '_', "call_1n");
 
-         declOp(0x19, '2', '_', "call_2s");
+         declOp(0x19, '2', 'S', "call_2s");
 
-         declOp(0x00, 'V', '_', "call_vs");
-         declOp(0x0C, 'V', '_', "call_vs2");
+         declOp(0x00, 'V', 'S', "call_vs");
+         declOp(0x0C, 'V', 'S', "call_vs2");
          declOp(0x0D, 'V', '_', "erase_window");
          declOp(0x0E, 'V', '_', "erase_line");
          declOp(0x0F, 'V', '_', "set_cursor");
          declOp(0x10, 'V', '_', "get_cursor");
          declOp(0x11, 'V', '_', "set_text_style");
          declOp(0x12, 'V', '_', "buffer_mode");
-         declOp(0x16, 'V', '_', "read_char");
-         declOp(0x17, 'V', '_', "scan_table");
+         declOp(0x16, 'V', 'S', "read_char");
+         declOp(0x17, 'V', 'X', "scan_table");
       }
 
       if (version >= 5)
@@ -144,20 +158,21 @@ public:
          declOp( 0x9, '0', 'S', "catch");
          declOp( 0xF, '0', 'B', "piracy");
 
+         declOp( 0xF, '1', '_', "call_1n");
+
          declOp(0x1A, '2', '_', "call_2n");
          declOp(0x1B, '2', '_', "set_colour");
          declOp(0x1C, '2', '_', "throw");
 
-         declOp(0x04, 'V', '_', "aread");
-         declOp(0x15, 'V', '_', "sound_effect");
-         declOp(0x18, 'V', '_', "not");
+         declOp(0x04, 'V', 'S', "aread");
+         declOp(0x18, 'V', 'S', "not");
          declOp(0x19, 'V', '_', "call_vn");
          declOp(0x1A, 'V', '_', "call_vn2");
          declOp(0x1B, 'V', '_', "tokenise");
          declOp(0x1C, 'V', '_', "encode_text");
          declOp(0x1D, 'V', '_', "copy_table");
          declOp(0x1E, 'V', '_', "print_table");
-         declOp(0x1F, 'V', '_', "check_arg_count");
+         declOp(0x1F, 'V', 'B', "check_arg_count");
 
          declOp(0x00, 'E', 'S', "save_table");
          declOp(0x01, 'E', 'S', "restore_table");
@@ -167,7 +182,7 @@ public:
          declOp(0x09, 'E', 'S', "save_undo");
          declOp(0x0A, 'E', 'S', "restore_undo");
          declOp(0x0B, 'E', '_', "print_unicode");
-         declOp(0x0C, 'E', '_', "check_unicode");
+         declOp(0x0C, 'E', 'S', "check_unicode");
       }
 
       if (version == 6)
@@ -190,15 +205,157 @@ public:
          declOp(0x1B, 'E', 'B', "make_menu");
          declOp(0x1C, 'E', '_', "picture_table");
       }
+
+      markEnd("rtrue");
+      markEnd("rfalse");
+      markEnd("print_ret");
+      markEnd("restart");
+      markEnd("ret_popped");
+      markEnd("quit");
+      markEnd("ret");
+      markEnd("jump");
+      markEnd("throw");
+   }
+
+   //! Decode the flow of control of the instruction at addr
+   Flow getFlow(const uint8_t* memory, uint32_t size, uint32_t addr) const
+   {
+      Flow flow;
+
+      if ((addr + MAX_LENGTH) > size) return flow;
+
+      const uint8_t* raw = memory + addr;
+      unsigned       n   = 0;
+
+      uint8_t   code   = raw[n++];
+      const Op* decode = &op[code];
+
+      if (code == 0xBE)
+      {
+         code = raw[n++];
+         if (code >= 0x20) return flow;
+         decode = &opE[code];
+      }
+
+      if (!decode->isInitialised()) return flow;
+
+      uint16_t operand = 0;
+
+      switch(decode->in_type)
+      {
+      case '1':
+         operand = decode->variant == OP_LARGE_CONST ? (raw[n] << 8) | raw[n + 1] : raw[n];
+         n += opSize(decode->variant);
+         break;
+
+      case '2':
+         n += 2;
+         break;
+
+      case 'V':
+         n += varOperandsSize(decode->variant, raw + n);
+         break;
+      }
+
+      switch(decode->out_type)
+      {
+      case 'S':
+         n++;
+         break;
+
+      case 'X':
+         n++;
+         // fall through
+
+      case 'B':
+         {
+            bool    if_true;
+            int16_t offset = getBranch(raw + n, n, if_true);
+            if ((offset != 0) && (offset != 1))
+            {
+               flow.jumps  = true;
+               flow.target = addr + n + offset - 2;
+            }
+         }
+         break;
+
+      case 'l':
+         {
+            unsigned length = literalSize(memory, size, addr + n);
+            if (length == 0) return flow;
+            n += length;
+         }
+         break;
+      }
+
+      if (strcmp(decode->mnemonic, "jump") == 0)
+      {
+         flow.jumps  = true;
+         flow.target = addr + n + int16_t(operand) - 2;
+      }
+
+      flow.length = n;
+      flow.ends   = decode->ends;
+
+      return flow;
+   }
+
+   //! Find the extent of the routine with its header at addr, by following
+   //! its code up to an instruction that does not go on, with no branch
+   //! beyond it
+   //! \return false if this does not look like a routine
+   bool findRoutine(const uint8_t* memory, uint32_t size, uint32_t addr,
+                    uint32_t& code, uint32_t& end) const
+   {
+      if (addr >= size) return false;
+
+      unsigned locals = memory[addr];
+      if (locals > 15) return false;
+
+      code = addr + 1 + (version <= 4 ? 2 * locals : 0);
+
+      uint32_t pc       = code;
+      uint32_t furthest = code;
+
+      while(true)
+      {
+         if ((pc - addr) > MAX_ROUTINE_SIZE) return false;
+
+         Flow flow = getFlow(memory, size, pc);
+         if (flow.length == 0) return false;
+
+         if (flow.jumps)
+         {
+            if (flow.target < code) return false;
+            if (flow.target > furthest) furthest = flow.target;
+         }
+
+         pc += flow.length;
+
+         if (flow.ends && (pc > furthest)) break;
+      }
+
+      // Compilers may close a routine with an rtrue or rfalse that can not
+      // be reached. Neither can be the header of a routine
+      if ((pc < size) && ((memory[pc] == 0xB0) || (memory[pc] == 0xB1))) pc++;
+
+      end = pc;
+      return true;
    }
 
 private:
+   //! Longest instruction, not counting a literal string (bytes)
+   static const unsigned MAX_LENGTH = 1 + 1 + 2 + 8 * 2 + 1 + 2;
+
+   static const uint32_t MAX_ROUTINE_SIZE = 0x10000;
+
    struct Op
    {
       const char* mnemonic{""};
       char        in_type{'\0'};
       char        out_type{'\0'};
       uint8_t     variant{0};
+      bool        ends{false};
 
       bool isInitialised() const { return in_type != '\0'; }
 
@@ -213,9 +370,85 @@ private:
       }
    };
 
-   Op     op[0x100];
-   Op     opE[0x20];
-   size_t max_mnemonic_len{0};
+   unsigned version;
+   Op       op[0x100];
+   Op       opE[0x20];
+   size_t   max_mnemonic_len{0};
+
+   //! Mark an op after which control does not go on to the next instruction
+   void markEnd(const char* mnemonic)
+   {
+      for(Op& decode : op)
+      {
+         if (strcmp(decode.mnemonic, mnemonic) == 0) decode.ends = true;
+      }
+
+      for(Op& decode : opE)
+      {
+         if (strcmp(decode.mnemonic, mnemonic) == 0) decode.ends = true;
+      }
+   }
+
+   //! Size of an operand (bytes)
+   static unsigned opSize(unsigned op_type)
+   {
+      return op_type == OP_LARGE_CONST ? 2 :
+             op_type == OP_NONE        ? 0 : 1;
+   }
+
+   //! Size of a variable number of operands, with their types (bytes)
+   static unsigned varOperandsSize(unsigned n, const uint8_t* code)
+   {
+      unsigned bytes    = n == 8 ? 2 : 1;
+      uint16_t op_types = n == 8 ? (code[0] << 8) | code[1] : code[0] << 8;
+
+      for(unsigned i = 0; i < n; ++i)
+      {
+         OperandType type = OperandType(op_types >> 14);
+         if(type == OP_NONE) break;
+
+         bytes += opSize(type);
+
+         op_types <<= 2;
+      }
+
+      return bytes;
+   }
+
+   //! Decode a branch and add its size to n
+   static int16_t getBranch(const uint8_t* code, unsigned& n, bool& if_true)
+   {
+      uint8_t type        = code[0];
+      bool    long_branch = (type & 0b01000000) == 0;
+      int16_t offset      =  type & 0b00111111;
+
+      if_true = (type & 0b10000000) != 0;
+
+      if (long_branch)
+      {
+         // 14-bit signed offset
+         offset = (offset << 8) | code[1];
+         if (offset >= 0x2000) offset -= 0x4000;
+         n += 2;
+      }
+      else
+      {
+         n += 1;
+      }
+
+      return offset;
+   }
+
+   //! Size of the literal string at addr, 0 if it does not end in memory
+   static unsigned literalSize(const uint8_t* memory, uint32_t size, uint32_t addr)
+   {
+      for(uint32_t pc = addr; (pc + 1) < size; pc += 2)
+      {
+         if ((memory[pc] & 0x80) != 0) return pc + 2 - addr;
+      }
+
+      return 0;
+   }
 
    //! Declare op
    void declOp(uint8_t code, char in, char out, const char* mnemonic)
@@ -336,7 +569,7 @@ private:
    }
 
    //! Decode a single op
-   virtual unsigned decodeOp(std::string& text, const uint8_t* raw, bool pack) const override
+   virtual unsigned decodeOp(std::string& text, const uint8_t* raw, uint32_t size, bool pack) const override
    {
       unsigned  n = 0;
 
@@ -350,6 +583,13 @@ private:
           decode = &opE[code & 0x1F];
       }
 
+      if (!decode->isInitialised())
+      {
+         // Not an instruction, e.g. where a faulty story has gone wrong
+         text = "illegal";
+         return n;
+      }
+
       text = decode->mnemonic;
 
       if (pack)
@@ -399,6 +639,11 @@ private:
 
       case 'l':
          text += " literal-string...";
+         {
+            // A string without an end runs to the end of memory
+            unsigned length = literalSize(raw, size, n);
+            n = length != 0 ? n + length : size;
+         }
          break;
 
       case 'S':
@@ -407,21 +652,22 @@ private:
          fmtVar(text, raw[n++]);
          break;
 
+      case 'X':
       case 'B':
          {
+            if (decode->out_type == 'X')
+            {
+               // Result then label
+               text += " ->";
+               fmtVar(text, raw[n++]);
+            }
+
             // Label
-            uint8_t type        = raw[n++];
-            bool    if_true     = (type & 0b10000000) != 0;
-            bool    long_branch = (type & 0b01000000) == 0;
-            int16_t offset      =  type & 0b00111111;
+            bool    if_true;
+            int16_t offset = getBranch(raw + n, n, if_true);
 
             text += if_true ? " ?T " : " ?F ";
 
-            if (long_branch)
-            {
-               offset = (offset << 8) | raw[n++];
-            }
-
             if (offset == 0)
             {
                text += "false";
@@ -0,0 +1,555 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "common/Coverage.h"
+#include "common/Observer.h"
+#include "common/Profiler.h"
+#include "common/Sampler.h"
+#include "common/State.h"
+#include "common/Stats.h"
+#include "common/Symbols.h"
+
+#include "Z/Disassembler.h"
+#include "Z/Story.h"
+#include "Z/Stream.h"
+
+namespace Z {
+
+//! Observer marking the instructions executed, the routines called and the
+//! bytes of memory read and written by a story. An interactive game writes
+//! them to "coverage.zcv", the runs of resumable machines are merged in
+//! IF::CoverageStore for their owner to write
+class CoverageObserver : public IF::NullObserver
+{
+public:
+   CoverageObserver(const Options& options_, const Story& story_)
+      : IF::NullObserver(options_, story_)
+      , options(options_)
+      , story(story_)
+   {
+   }
+
+   ~CoverageObserver()
+   {
+      // Runs sharing the process are merged and written together
+      if (resumable)
+      {
+         IF::CoverageStore::get().add(story.getIdentity(), story.getFilename(), coverage);
+      }
+   }
+
+   void begin(const IF::State& state, bool resumable_, Stream& /* report */)
+   {
+      resumable = resumable_;
+      coverage.resize(state.memory.size());
+   }
+
+   void end(Stream& report)
+   {
+      if (resumable) return;
+
+      std::string filename = std::string((const char*)options.log_prefix) + "coverage.zcv";
+      if (!coverage.write(filename, story.getIdentity()))
+      {
+         report.warning("Failed to write coverage");
+      }
+   }
+
+   void instruction(IF::Memory::Address addr, const IF::Memory& /* memory */)
+   {
+      coverage.markCode(addr);
+   }
+
+   void call(IF::Memory::Address addr, uint32_t /* frame_ptr */)
+   {
+      coverage.markRoutine(addr);
+   }
+
+   void read(IF::Memory::Address addr, uint32_t size)
+   {
+      coverage.markRead(addr, size);
+   }
+
+   void write(IF::Memory::Address addr, uint32_t size)
+   {
+      coverage.markWrite(addr, size);
+   }
+
+private:
+   const Options& options;
+   const Story&   story;
+   IF::Coverage   coverage;
+   bool           resumable{false};
+};
+
+//! Observer counting the instructions executed and the time spent in each
+//! routine, written to "profile.log" and, as call paths for flame graph
+//! tools, to "profile.folded"
+class ProfileObserver : public IF::NullObserver
+{
+public:
+   ProfileObserver(const Options& options_, const Story& story)
+      : IF::NullObserver(options_, story)
+      , options(options_)
+      , version(story.getVersion())
+      , dis(story.getVersion())
+   {
+   }
+
+   void begin(const IF::State& state_, bool /* resumable */, Stream& report)
+   {
+      state = &state_;
+
+      if ((strlen(options.symbols) != 0) && !symbols.load((const char*)options.symbols))
+      {
+         report.warning("Failed to read symbol file");
+      }
+   }
+
+   //! Write the routine table and the call paths of the profile
+   void end(Stream& report)
+   {
+      profiler.finish(instructions);
+
+      std::string prefix = (const char*)options.log_prefix;
+
+      FILE* fp = fopen((prefix + "profile.log").c_str(), "w");
+      if (fp == nullptr)
+      {
+         report.warning("Failed to write profile");
+      }
+      else
+      {
+         profiler.writeTable(fp, symbols,
+                             [this](uint32_t addr)
+                             {
+                                // Skip the local variable count and, before v5, their initial values
+                                const uint8_t* code       = state->memory.data() + addr;
+                                unsigned       num_locals = code[0];
+                                uint32_t       entry      = addr + 1 + (version <= 4 ? 2 * num_locals : 0);
+
+                                std::string text;
+                                (void) dis.disassemble(text, entry, state->memory.data() + entry,
+                                                       state->memory.size() - entry);
+                                return "L" + std::to_string(num_locals) + "  " + text;
+                             });
+         fclose(fp);
+      }
+
+      fp = fopen((prefix + "profile.folded").c_str(), "w");
+      if (fp == nullptr)
+      {
+         report.warning("Failed to write profile call paths");
+      }
+      else
+      {
+         profiler.writeCollapsed(fp, symbols);
+         fclose(fp);
+      }
+   }
+
+   void resume() { profiler.resume(); }
+   void pause()  { profiler.pause(); }
+
+   void instruction(IF::Memory::Address /* addr */, const IF::Memory& /* memory */)
+   {
+      instructions++;
+   }
+
+   void call(IF::Memory::Address addr, uint32_t frame_ptr)
+   {
+      profiler.enter(addr, frame_ptr, instructions);
+   }
+
+   void ret(uint32_t frame_ptr)
+   {
+      profiler.leave(frame_ptr, instructions);
+   }
+
+private:
+   const Options&   options;
+   unsigned         version;
+   Disassembler     dis;
+   IF::Symbols      symbols;
+   IF::Profiler     profiler;
+   const IF::State* state{nullptr};
+   uint64_t         instructions{0};
+};
+
+//! Observer joining the process wide sampling of running machines, see
+//! IF::Sampler. The samples are written to "sample.log" and
+//! "sample.folded" when an interactive game finishes, a resumable
+//! machine leaves that to its owner
+class SampleObserver : public IF::NullObserver
+                     , private IF::Sampler::Source
+{
+public:
+   SampleObserver(const Options& options_, const Story& story_)
+      : IF::NullObserver(options_, story_)
+      , options(options_)
+      , story(story_)
+      , dis(story_.getVersion())
+   {
+   }
+
+   void begin(const IF::State& state_, bool resumable_, Stream& report)
+   {
+      state     = &state_;
+      resumable = resumable_;
+
+      if ((strlen(options.symbols) != 0) && !symbols.load((const char*)options.symbols))
+      {
+         report.warning("Failed to read symbol file");
+      }
+
+      if (!IF::Sampler::get().start(options.sample))
+      {
+         report.warning("Sampling is not supported");
+         return;
+      }
+
+      allocate();
+
+      profile = IF::Sampler::get().getProfile(story.getIdentity(), story.getFilename(),
+                                              state->memory.size());
+
+      // Before v6 execution starts inside the main routine rather than with a call
+      if (story.getVersion() != 6) profile->markRoutine(story.getHeader()->init_pc - 1);
+   }
+
+   void end(Stream& report)
+   {
+      if (!profile) return;
+
+      drainSamples();
+
+      // An interactive game has the process to itself
+      if (!resumable)
+      {
+         IF::Sampler::get().stop();
+
+         std::string prefix = (const char*)options.log_prefix;
+         if (!IF::Sampler::get().write(prefix + "sample.log", prefix + "sample.folded"))
+         {
+            report.warning("Failed to write samples");
+         }
+      }
+   }
+
+   void resume()
+   {
+      if (profile && (running++ == 0)) enter();
+   }
+
+   void pause()
+   {
+      if ((running != 0) && (--running == 0)) leave();
+   }
+
+   void instruction(IF::Memory::Address addr, const IF::Memory& /* memory */)
+   {
+      inst_addr = addr;
+   }
+
+   void call(IF::Memory::Address addr, uint32_t /* frame_ptr */)
+   {
+      if (profile) profile->markRoutine(addr);
+   }
+
+   void requestInput()
+   {
+      if (profile) drainSamples();
+   }
+
+private:
+   const Options&                     options;
+   const Story&                       story;
+   Disassembler                       dis;
+   IF::Symbols                        symbols;
+   std::shared_ptr<IF::SampleProfile> profile;   //!< Not set if sampling is not supported
+   const IF::State*                   state{nullptr};
+   bool                               resumable{false};
+   unsigned                           running{0};
+   IF::Memory::Address                inst_addr{0};
+
+   //! Record where the machine is, called from the sampling signal handler
+   virtual void fill(IF::Sample& sample) const override
+   {
+      const uint8_t* stack = state->stack.data();
+      uint32_t       size  = state->stack.size();
+      uint32_t       fp    = state->frame_ptr;
+
+      sample.pc     = inst_addr;
+      sample.opcode = inst_addr < state->memory.size() ? state->memory.data()[inst_addr] : 0;
+      sample.depth  = 0;
+
+      // Follow the frame pointers saved by State::call()
+      while((fp >= 6) && (fp <= size) && (sample.depth < IF::Sample::MAX_DEPTH))
+      {
+         sample.frames[sample.depth++] = (stack[fp - 5] << 16) | (stack[fp - 4] << 8) | stack[fp - 3];
+
+         uint32_t caller = (stack[fp - 2] << 8) | stack[fp - 1];
+         if (caller >= fp) break;
+         fp = caller;
+      }
+   }
+
+   //! Add the samples recorded to the profile of the story
+   void drainSamples()
+   {
+      drain(*profile,
+            [this](uint32_t addr)
+            {
+               std::string text;
+               if (addr < state->memory.size())
+               {
+                  (void) dis.disassemble(text, addr, state->memory.data() + addr,
+                                         state->memory.size() - addr);
+               }
+               return text;
+            },
+            [this](uint32_t addr)
+            {
+               return symbols.getName(addr);
+            });
+   }
+};
+
+//! Observer counting instruction forms, calls and, from each input to the
+//! next input request, the instructions and time of each turn, for the
+//! machine statistics
+class StatsObserver : public IF::NullObserver
+{
+public:
+   StatsObserver(const Options& options, const Story& story)
+      : IF::NullObserver(options, story)
+   {
+   }
+
+   void begin(const IF::State& /* state */, bool /* resumable */, Stream& /* report */)
+   {
+      // The start-up sequence is measured as the first turn
+      startTurn();
+   }
+
+   void instruction(IF::Memory::Address addr, const IF::Memory& memory)
+   {
+      instructions++;
+
+      if (addr < memory.size()) form_count[getForm(memory.data()[addr])]++;
+   }
+
+   void call(IF::Memory::Address /* addr */, uint32_t /* frame_ptr */)
+   {
+      calls++;
+   }
+
+   void input(uint16_t /* zscii */)
+   {
+      if (!in_turn) startTurn();
+   }
+
+   void requestInput()
+   {
+      endTurn();
+   }
+
+   void stats(IF::StatsWriter& writer) const
+   {
+      writer.begin("forms");
+      writer.add("0op", form_count[FORM_0OP]);
+      writer.add("1op", form_count[FORM_1OP]);
+      writer.add("2op", form_count[FORM_2OP]);
+      writer.add("var", form_count[FORM_VAR]);
+      writer.add("ext", form_count[FORM_EXT]);
+      writer.end();
+
+      writer.add("calls", calls);
+
+      writer.begin("startup");
+      writer.add("instructions", startup_instructions);
+      writer.add("us",           startup_us);
+      writer.end();
+
+      writer.add("turn_instructions", turn_instructions);
+      writer.add("turn_us",           turn_us);
+   }
+
+private:
+   using Clock = std::chrono::steady_clock;
+
+   //! Instruction forms
+   enum Form
+   {
+      FORM_0OP, FORM_1OP, FORM_2OP, FORM_VAR, FORM_EXT, NUM_FORMS
+   };
+
+   uint64_t          instructions{0};
+   uint64_t          form_count[NUM_FORMS] = {};
+   uint64_t          calls{0};
+   uint64_t          startup_instructions{0};
+   uint64_t          startup_us{0};
+   IF::Histogram     turn_instructions;   //!< From input to the next input request
+   IF::Histogram     turn_us;
+   bool              in_turn{false};
+   bool              started{false};
+   uint64_t          turn_start_instructions{0};
+   Clock::time_point turn_start;
+
+   //! Form of an instruction from its first byte, as decoded by the machine
+   static Form getForm(uint8_t opcode)
+   {
+      if (opcode < 0x80) return FORM_2OP;
+      if (opcode < 0xB0) return FORM_1OP;
+      if (opcode < 0xC0) return opcode == 0xBE ? FORM_EXT : FORM_0OP;
+      if (opcode < 0xE0) return FORM_2OP;
+      return FORM_VAR;
+   }
+
+   //! Input has been received
+   void startTurn()
+   {
+      in_turn                 = true;
+      turn_start_instructions = instructions;
+      turn_start              = Clock::now();
+   }
+
+   //! Input is requested, the first request ends the start-up sequence
+   void endTurn()
+   {
+      if (!in_turn) return;
+
+      in_turn = false;
+
+      uint64_t turn = instructions - turn_start_instructions;
+      uint64_t us   = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - turn_start).count();
+
+      if (!started)
+      {
+         started              = true;
+         startup_instructions = turn;
+         startup_us           = us;
+      }
+      else
+      {
+         turn_instructions.add(turn);
+         turn_us.add(us);
+      }
+   }
+};
+
+//! Observer for the measurement tools enabled by the options, the profiler,
+//! the sampler, the statistics and the coverage, which may be used together. A machine
+//! is only built with this observer when one of them is enabled, so that
+//! the default machine has no checks for them
+class Instruments : public IF::NullObserver
+{
+public:
+   Instruments(const Options& options, const Story& story)
+      : IF::NullObserver(options, story)
+   {
+      if (options.profile)     profile.reset(new ProfileObserver(options, story));
+      if (options.sample != 0) sample.reset(new SampleObserver(options, story));
+      if (options.stats)       statistics.reset(new StatsObserver(options, story));
+      if (options.coverage)    coverage.reset(new CoverageObserver(options, story));
+   }
+
+   //! Check if the options enable any of the tools
+   static bool isEnabled(const Options& options)
+   {
+      return options.profile || (options.sample != 0) || options.stats || options.coverage;
+   }
+
+   void begin(const IF::State& state, bool resumable, Stream& report)
+   {
+      if (profile)    profile->begin(state, resumable, report);
+      if (sample)     sample->begin(state, resumable, report);
+      if (statistics) statistics->begin(state, resumable, report);
+      if (coverage)   coverage->begin(state, resumable, report);
+   }
+
+   void end(Stream& report)
+   {
+      if (profile)  profile->end(report);
+      if (sample)   sample->end(report);
+      if (coverage) coverage->end(report);
+   }
+
+   void resume()
+   {
+      if (profile) profile->resume();
+      if (sample)  sample->resume();
+   }
+
+   void pause()
+   {
+      if (profile) profile->pause();
+      if (sample)  sample->pause();
+   }
+
+   void instruction(IF::Memory::Address addr, const IF::Memory& memory)
+   {
+      if (profile)    profile->instruction(addr, memory);
+      if (sample)     sample->instruction(addr, memory);
+      if (statistics) statistics->instruction(addr, memory);
+      if (coverage)   coverage->instruction(addr, memory);
+   }
+
+   void call(IF::Memory::Address addr, uint32_t frame_ptr)
+   {
+      if (profile)    profile->call(addr, frame_ptr);
+      if (sample)     sample->call(addr, frame_ptr);
+      if (statistics) statistics->call(addr, frame_ptr);
+      if (coverage)   coverage->call(addr, frame_ptr);
+   }
+
+   void ret(uint32_t frame_ptr)
+   {
+      if (profile) profile->ret(frame_ptr);
+   }
+
+   void read(IF::Memory::Address addr, uint32_t size)
+   {
+      if (coverage) coverage->read(addr, size);
+   }
+
+   void write(IF::Memory::Address addr, uint32_t size)
+   {
+      if (coverage) coverage->write(addr, size);
+   }
+
+   void input(uint16_t zscii)
+   {
+      if (statistics) statistics->input(zscii);
+   }
+
+   void requestInput()
+   {
+      if (sample)     sample->requestInput();
+      if (statistics) statistics->requestInput();
+   }
+
+   void stats(IF::StatsWriter& writer) const
+   {
+      if (statistics) statistics->stats(writer);
+   }
+
+private:
+   std::unique_ptr<ProfileObserver>  profile;
+   std::unique_ptr<SampleObserver>   sample;
+   std::unique_ptr<StatsObserver>    statistics;
+   std::unique_ptr<CoverageObserver> coverage;
+};
+
+} // namespace Z
@@ -10,16 +10,26 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <climits>
 #include <cstring>
+#include <memory>
 #include <string>
 
+#include "common/BlorbCache.h"
+#include "common/ConsoleRecorder.h"
+#include "common/Journal.h"
 #include "common/Machine.h"
+#include "common/Observer.h"
+#include "common/Snapshot.h"
+#include "common/Stats.h"
 
+#include "Z/Analysis.h"
 #include "Z/Config.h"
 #include "Z/Disassembler.h"
 #include "Z/Header.h"
 #include "Z/Object.h"
 #include "Z/Parser.h"
+#include "Z/Resumable.h"
 #include "Z/State.h"
 #include "Z/Stream.h"
 #include "Z/Text.h"
@@ -28,129 +38,392 @@
 
 namespace Z {
 
-//! Z machine implementation
-class Machine : public IF::Machine
+//! Z machine implementation, reporting events to an OBSERVER
+template <typename OBSERVER = IF::NullObserver>
+class BasicMachine : public IF::Machine
+                   , public Resumable
 {
 public:
-   Machine(Console& console_, const Options& options_, const Story& story_)
+   BasicMachine(Console& console_, const Options& options_, const Story& story_)
       : IF::Machine(console_, options_)
+      , story(story_)
       , story_is_valid(story_.isValid())
+      , warm_enable(!options_.cold && !options_.print && !options_.trace && !options_.trace_bin && !options_.profile && !options_.coverage)
+      , journal_enable(!options_.batch)
       , state(story_, (const char*)options.save_dir, options.undo, options.seed)
       , dis(story_.getVersion())
-      , stream(console, options_, story_.getVersion(), state.memory)
-      , screen(console, stream, story_.getVersion())
+      , recorder(console_)
+      , stream(recorder, options_, story_.getVersion(), state.memory)
+      , screen(recorder, stream, story_.getVersion())
       , object(state.memory)
       , text(story_.getHeader(), state.memory)
       , parser(story_.getVersion())
+      , observer(options_, story_)
    {
       header = (Header*)state.memory.data();
 
       object.init(header->obj, header->version);
 
+      analysis = Analysis::get(story_, (const char*)options.save_dir);
+      parser.setAnalysis(analysis.get());
+
       initDecoder(story_.getVersion());
    }
 
+   //! Use pictures and sounds from a Blorb resource file
+   bool openResources(const std::string& filename)
+   {
+      return resources.open(filename);
+   }
+
    //! Play a Z file.
    //! \return true if there were no errors
    bool play(bool restore)
    {
-      std::string text;
+      begin(restore);
 
-      text = "Version  : z";
-      text += std::to_string(header->version);
-      stream.info(text);
+      while(run(UINT_MAX) != QUIT);
 
-      text = "Checksum : ";
-      // The proper C++ way of doing this is not appealing
-      const char* hex_digs = "0123456789ABCDEF";
-      uint16_t checksum = header->checksum;
-      text += hex_digs[(checksum >>  4) & 0xF];
-      text += hex_digs[(checksum >>  0) & 0xF];
-      text += hex_digs[(checksum >> 12) & 0xF];
-      text += hex_digs[(checksum >>  8) & 0xF];
-      stream.info(text);
+      bool ok = end();
 
-      if((header->version >= 3) && !story_is_valid)
-      {
-         if (header->version == 3)
-         {
-            // Some v3 games do not have a checksum
-            stream.info("Checksum fail");
-         }
-         else
-         {
-            stream.warning("Checksum fail");
-         }
-      }
+      console.waitForKey();
 
-      reset(restore);
+      stream.info("quit");
 
-      bool ok = true;
+      return ok;
+   }
+
+   //! Start a Z file for resumable execution with run(). Input is not
+   //! read from the console but must be supplied with provideLine() or
+   //! provideChar() when requested
+   virtual void start(bool restore) override
+   {
+      resumable = true;
+      begin(restore);
+   }
+
+   //! Execute until input is required, the game finishes or the
+   //! given number of instructions have been executed
+   virtual Status run(unsigned max_instructions) override
+   {
+      if (halted) return QUIT;
+
+      Running running(observer);
 
       try
       {
-         if(options.trace)
+         if (resume_op != nullptr)
          {
-            while(!state.isQuitRequested())
-            {
-               inst_addr = state.getPC();
-               dis.trace(dis_text, inst_addr, state.memory.data() + inst_addr);
-               stream.getTrace().write(dis_text);
-               fetchDecodeExecute();
-            }
+            if (!isInputReady()) return wait_status;
+
+            resume();
          }
-         else
+
+         for(unsigned n = 0; n < max_instructions; n++)
          {
-            while(!state.isQuitRequested())
+            if (state.isQuitRequested())
             {
-               inst_addr = state.getPC();
-               fetchDecodeExecute();
+               if (header->version <= 3) showStatus();
+               halted = true;
+               return QUIT;
             }
-         }
 
-         if (header->version <= 3) showStatus();
+            inst_addr = state.getPC();
+
+            observer.instruction(inst_addr, state.memory);
+
+            fetchDecodeExecute();
+            instruction_count++;
+
+            if (resume_op != nullptr) return wait_status;
+         }
       }
       catch(const char* message)
       {
          if (strcmp(message, "quit") != 0)
          {
-            (void) dis.disassemble(dis_text, inst_addr, state.memory.data() + inst_addr);
+            (void) dis.disassemble(dis_text, inst_addr, state.memory.data() + inst_addr,
+                                  state.memory.size() - inst_addr);
             dis_text += " \"";
             dis_text += message;
             dis_text += "\"";
             stream.error(dis_text);
-            ok = false;
+            failed = true;
+            fault  = dis_text;
          }
+
+         halted = true;
+         return QUIT;
       }
 
+      return recorder.takeOutput() ? OUTPUT_READY : QUANTUM_EXPIRED;
+   }
+
+   //! Supply a line of input after run() returned NEED_LINE
+   virtual void provideLine(const std::string& line) override
+   {
+      for(uint8_t ch : line)
+      {
+         if (Stream::isInputChar(ch) && (ch != '\n')) pending_input += ch;
+      }
+
+      pending_input += '\n';
+   }
+
+   //! Supply a character of input after run() returned NEED_CHAR
+   virtual void provideChar(uint8_t ch) override
+   {
+      if (Stream::isInputChar(ch)) pending_input += ch;
+   }
+
+   //! Time limit for the input requested (ms), 0 if there is no limit
+   virtual unsigned getInputTimeout() const override { return wait_timeout * 100; }
+
+   //! Signal that the time limit for the input requested has expired
+   virtual void provideTimeout() override
+   {
+      if (wait_timeout != 0) pending_timeout = true;
+   }
+
+   //! Encode the state of a machine that is waiting for input after
+   //! run() returned NEED_LINE or NEED_CHAR, including the undo history
+   virtual bool saveSnapshot(IF::Buffer& buffer) override
+   {
+      if (resume_op == nullptr) return false;
+
+      IF::Snapshot snapshot;
+
+      snapshot.add("KEY ").pushString(story.getIdentity());
+      snapshot.encodeState(story, state, resume_pc);
+      encodeWait(snapshot);
+      state.encodeUndo(snapshot.add("UNDO"));
+
+      snapshot.encode(buffer);
+      return true;
+   }
+
+   //! Restore a machine waiting for input, from an encoding made by
+   //! saveSnapshot(). Execution then continues with run(). After a failure
+   //! the machine must be restarted
+   virtual bool restoreSnapshot(IF::Buffer& buffer) override
+   {
+      IF::Snapshot snapshot;
+      if (!snapshot.decode(buffer)) return false;
+
+      IF::Buffer* undo = snapshot.find("UNDO");
+
+      return decodeWait(snapshot, nullptr) &&
+             ((undo == nullptr) || state.decodeUndo(*undo));
+   }
+
+   //! Encode the changes to the state of a machine waiting for input since
+   //! the previous update, for a follower machine to apply with
+   //! applyUpdate(). The first update holds the whole state, the undo
+   //! history is not included
+   virtual bool encodeUpdate(IF::Buffer& buffer) override
+   {
+      if (resume_op == nullptr) return false;
+
+      IF::Snapshot update;
+
+      update.add("KEY ").pushString(story.getIdentity());
+      (void) replica.encode(update.add("JRNL"), story, state, resume_pc, "");
+      encodeWait(update);
+
+      update.encode(buffer);
+      return true;
+   }
+
+   //! Make the next update hold the whole state, for a new follower
+   virtual void restartUpdates() override { replica.restart(); }
+
+   //! Bring a follower machine up to date with an update from
+   //! encodeUpdate(), leaving it waiting for the same input. After a
+   //! failure the follower needs an update holding the whole state
+   virtual bool applyUpdate(IF::Buffer& buffer) override
+   {
+      IF::Snapshot update;
+      if (!update.decode(buffer)) return false;
+
+      IF::Buffer* jrnl = update.find("JRNL");
+
+      return (jrnl != nullptr) && decodeWait(update, jrnl);
+   }
+
+   //! Resources used by the machine so far
+   virtual Usage getUsage() const override
+   {
+      return Usage{instruction_count, stream.getOutputCount(),
+                   state.getUndoSize(), state.getLargestSave(),
+                   state.memory.size(), state.memory.getSharedSize()};
+   }
+
+   //! Share memory pages that are the same as those of other machines in
+   //! this process. Must not be called while run() is executing
+   virtual void shareMemory() override
+   {
+      state.memory.share();
+   }
+
+   //! Limit the memory held by the undo buffers and the size of each save
+   //! file (bytes, 0 for no limit). The story is told that an undo or save
+   //! that would exceed the limit failed
+   virtual void setStateLimits(size_t max_undo_bytes, size_t max_save_bytes) override
+   {
+      state.setLimits(max_undo_bytes, max_save_bytes);
+   }
+
+   //! Fail any save or restore by the story, for a machine whose effects
+   //! must stay in memory
+   void blockFiles() { state.blockFiles(); }
+
+   //! Check if the story has tried to save or restore since blockFiles()
+   bool isFileAccessBlocked() const { return state.isFileAccessBlocked(); }
+
+   //! Hash of the dynamic state, see IF::State::fingerprint()
+   uint64_t fingerprint() const { return state.fingerprint(); }
+
+   //! Check if run() returned QUIT because of an error
+   virtual bool hasFailed() const override { return failed; }
+
+   //! The error that stopped the machine, after the disassembled instruction
+   //! that caused it
+   virtual const std::string& getFault() const override { return fault; }
+
+   //! Read the score and moves shown on the status line of a v1-3 story
+   //! \return false if the story does not show a score
+   bool getScore(int16_t& score, uint16_t& moves)
+   {
+      if ((header->version > 3) || isTimeGame()) return false;
+
+      score = int16_t(state.varRead(16+1));
+      moves = state.varRead(16+2);
+      return true;
+   }
+
+   //! Run time statistics as JSON text. Instruction forms, calls and turn
+   //! figures are added by the observer, see StatsObserver
+   virtual std::string getStats() const override
+   {
+      IF::StatsWriter        writer;
+      const IF::SavableState::SaveCounts& saves = state.getSaveCounts();
+
+      writer.add("instructions", instruction_count);
+
+      observer.stats(writer);
+
+      writer.add("zchars_decoded",     text.getDecodeCount());
+      writer.add("dictionary_lookups", parser.getLookupCount());
+      writer.add("undo_saves",         saves.undo_saves);
+      writer.add("undo_save_bytes",    saves.undo_bytes);
+      writer.add("saves",              saves.saves);
+      writer.add("save_bytes",         saves.save_bytes);
+      writer.add("output_chars",       stream.getOutputCount());
+      writer.add("console_writes",     recorder.getWriteCount());
+
+      writer.begin("memory");
+      writer.add("story",            story.size());
+      writer.add("dynamic",          header->stat);
+      writer.add("game",             state.memory.size());
+      writer.add("shared",           state.memory.getSharedSize());
+      writer.add("stack",            state.stack.getMaxSize());
+      writer.add("stack_high_water", state.stack.getHighWater());
+      writer.add("undo",             state.getUndoSize());
+      writer.add("largest_save",     state.getLargestSave());
+      writer.add("startup_output",   recorder.getRecordSize());
+      writer.end();
+
+      return writer.finish();
+   }
+
+   //! Finish after run() returned QUIT
+   //! \return true if there were no errors
+   virtual bool end() override
+   {
       // Save last position
       if (state.restoreUndo())
       {
          state.save("last");
       }
 
-      console.waitForKey();
+      // Complete any saves still being written
+      if (!state.flushSaves())
+      {
+         stream.warning("Failed to write save file");
+      }
 
-      stream.info("quit");
+      if (journal_enable) state.closeJournal();
 
-      return ok;
+      observer.end(stream);
+
+      if (options.stats && !resumable)
+      {
+         std::string filename = std::string((const char*)options.log_prefix) + "stats.json";
+         FILE*       fp       = fopen(filename.c_str(), "w");
+         if ((fp == nullptr) || (fputs(getStats().c_str(), fp) < 0))
+         {
+            stream.warning("Failed to write statistics");
+         }
+         if (fp != nullptr) fclose(fp);
+      }
+
+      return !failed;
    }
 
 private:
-   typedef void (Machine::*OpPtr)();
+   typedef void (BasicMachine::*OpPtr)();
 
    static const unsigned MAX_OPERANDS = 8;
 
-   Config       config;
-   bool         story_is_valid;
-   State        state;
-   Disassembler dis;
-   Stream       stream;
-   Screen       screen;
-   Object       object;
-   Text         text;
-   Parser       parser;
-   Header*      header{};
+   //! Longest list accepted by picture_table
+   static const unsigned MAX_PICTURES = 1024;
+
+   //! Variable form op-codes of the read instructions
+   enum ReadOp : uint8_t
+   {
+      OP_READ      = 0x04,
+      OP_READ_CHAR = 0x16
+   };
+
+   Config          config;
+   const Story&    story;
+   bool            story_is_valid;
+   bool            warm_enable;
+   bool            journal_enable;
+   std::string     journal_input;
+   State           state;
+   Disassembler    dis;
+   ConsoleRecorder recorder;   //!< All output is via this so start-up output can be saved
+   Stream          stream;
+   Screen          screen;
+   Object          object;
+   Text            text;
+   Parser          parser;
+   OBSERVER        observer;
+   Header*         header{};
+   BlorbCache      resources;
+
+   std::shared_ptr<const Analysis> analysis;
+
+   // Resumable execution
+   bool                resumable{false};       //!< Input is supplied by provideLine() etc.
+   bool                halted{false};
+   bool                failed{false};
+   std::string         fault;                  //!< Set when failed
+   std::string         pending_input;
+   bool                pending_timeout{false};
+   Status              wait_status{NEED_LINE};
+   uint16_t            wait_timeout{0};        //!< 100ms units
+   OpPtr               resume_op{nullptr};     //!< Read instruction waiting for input
+   bool                resuming{false};
+   IF::Memory::Address resume_inst_addr{0};
+   IF::Memory::Address resume_pc{0};
+   unsigned            resume_num_arg{0};
+   uint16_t            resume_uarg[MAX_OPERANDS];
+
+   uint64_t            instruction_count{0};
+
+   IF::Journal         replica;   //!< Changes sent to follower machines
 
    unsigned     num_arg;
    union
@@ -171,6 +444,100 @@ private:
    // allocations to a minimum
    std::string work_str;
 
+   //! Tells the observer that story code is running while in scope
+   class Running
+   {
+   public:
+      Running(OBSERVER& observer_)
+         : observer(observer_)
+      {
+         observer.resume();
+      }
+
+      ~Running()
+      {
+         observer.pause();
+      }
+
+   private:
+      OBSERVER& observer;
+   };
+
+   //! Write a character to the output streams
+   void writeChar(uint16_t zscii)
+   {
+      observer.output(zscii);
+      stream.writeChar(zscii);
+   }
+
+   //! Write a signed number to the output streams
+   void writeNumber(int16_t value)
+   {
+      for(char ch : std::to_string(value))
+      {
+         writeChar(ch);
+      }
+   }
+
+   //! Store the result of an instruction in the variable that follows it
+   void storeResult(uint16_t value)
+   {
+      storeResult(state.fetch8(), value);
+   }
+
+   //! Store the result of an instruction in a variable already fetched
+   void storeResult(uint8_t index, uint16_t value)
+   {
+      observer.store(value);
+      state.varWrite(index, value);
+   }
+
+   //! Read a byte of memory for an instruction
+   uint8_t read8(uint32_t addr)
+   {
+      markRead(addr, 1);
+      return state.memory.read8(addr);
+   }
+
+   //! Read a word of memory for an instruction
+   uint16_t read16(uint32_t addr)
+   {
+      markRead(addr, 2);
+      return state.memory.read16(addr);
+   }
+
+   //! Write a byte of memory for an instruction
+   void write8(uint32_t addr, uint8_t value)
+   {
+      markWrite(addr, 1);
+      state.memory.write8(addr, value);
+   }
+
+   //! Write a word of memory for an instruction
+   void write16(uint32_t addr, uint16_t value)
+   {
+      markWrite(addr, 2);
+      state.memory.write16(addr, value);
+   }
+
+   void markRead(uint32_t addr, uint32_t size)
+   {
+      observer.read(addr, size);
+   }
+
+   void markWrite(uint32_t addr, uint32_t size)
+   {
+      observer.write(addr, size);
+   }
+
+   //! Report the parse buffer used by tokenise, the limit read and the word
+   //! count and an entry of 4 bytes for each word written
+   void markParse(uint32_t parse)
+   {
+      markRead(parse, 1);
+      markWrite(parse + 1, 1 + 4 * state.memory.read8(parse + 1));
+   }
+
    //! Check for v3 time games
    bool isTimeGame() const
    {
@@ -193,6 +560,8 @@ private:
          offset = int16_t(offset << 2) >> 2;
       }
 
+      observer.branch(cond == branch_if_true);
+
       if(cond == branch_if_true)
       {
          if((offset == 0) || (offset == 1))
@@ -220,10 +589,10 @@ private:
          // this is legal, just return false
          switch(call_type)
          {
-         case 0:  state.varWrite(state.fetch8(), 0); break;
+         case 0:  storeResult(0); break;
          case 1:  /* throw return value away */ break;
          case 2:  state.push(0); break;
-         case 3:  state.varWrite(state.fetch8(), 0); break;
+         case 3:  storeResult(0); break;
          default: throw "bad call type"; break;
          }
          return;
@@ -231,6 +600,8 @@ private:
 
       state.call(call_type, target);
 
+      observer.call(target, state.getFramePtr());
+
       uint8_t num_locals = state.fetch8();
 
       state.push(argc);
@@ -261,13 +632,15 @@ private:
          frame_ptr = state.getFramePtr();
       }
 
+      observer.ret(frame_ptr);
+
       uint8_t  call_type = state.returnFromFrame(frame_ptr);
 
       switch(call_type)
       {
-      case 0: state.varWrite(state.fetch8(), value); break;
+      case 0: storeResult(value);  break;
       case 1: /* throw return value away */ break;
-      case 2: state.push(value);            break;
+      case 2: state.push(value);   break;
 
       case 3:
          {
@@ -275,15 +648,22 @@ private:
             uint16_t timeout        = state.pop();
             if (value == 0)
             {
+               // Keep waiting, a resume continues as the read_char
+               num_arg = 3;
+               uarg[0] = 1;
+               uarg[1] = timeout;
+               uarg[2] = packed_routine;
+
                uint16_t zscii;
-               if (readChar(timeout, /* echo */ false, packed_routine, zscii))
+               if (waitForInput(NEED_CHAR, timeout, &BasicMachine::opV_read_char) &&
+                   readChar(timeout, /* echo */ false, packed_routine, zscii))
                {
-                  state.varWrite(state.fetch8(), zscii);
+                  storeResult(zscii);
                }
             }
             else
             {
-               state.varWrite(state.fetch8(), value);
+               storeResult(value);
             }
          }
          break;
@@ -292,9 +672,104 @@ private:
       }
    }
 
+   //! For resumable execution, check that the input for a read instruction
+   //! is available, otherwise suspend the instruction until it is provided
+   bool waitForInput(Status status, uint16_t timeout, OpPtr op)
+   {
+      if (!resuming) observer.requestInput();
+
+      if (!resumable) return true;
+
+      // A time out only applies to the request it was provided for
+      if (!resuming) pending_timeout = false;
+
+      wait_status  = status;
+      wait_timeout = timeout;
+
+      if (isInputReady()) return true;
+
+      // Make sure any prompt is visible
+      stream.flush();
+
+      resume_op        = op;
+      resume_inst_addr = inst_addr;
+      resume_pc        = state.getPC();
+      resume_num_arg   = num_arg;
+      memcpy(resume_uarg, uarg, sizeof(resume_uarg));
+
+      return false;
+   }
+
+   //! Check if the input for a suspended read instruction is available
+   bool isInputReady() const
+   {
+      if (pending_timeout) return true;
+
+      return wait_status == NEED_CHAR ? !pending_input.empty()
+                                      : pending_input.find('\n') != std::string::npos;
+   }
+
+   //! Continue a suspended read instruction after its operands were fetched
+   void resume()
+   {
+      OpPtr op = resume_op;
+      resume_op = nullptr;
+
+      inst_addr = resume_inst_addr;
+      state.jump(resume_pc);
+      num_arg = resume_num_arg;
+      memcpy(uarg, resume_uarg, sizeof(uarg));
+
+      resuming = true;
+      (this->*op)();
+      resuming = false;
+   }
+
+   //! Discard the rest of a line of input supplied with provideLine(), when
+   //! the read instruction has taken as much as fits in its buffer
+   void discardLine()
+   {
+      if (!resumable) return;
+
+      size_t end = pending_input.find('\n');
+      if (end == std::string::npos)
+      {
+         pending_input.clear();
+         return;
+      }
+
+      // Read the newline, so that it is echoed
+      pending_input.erase(0, end);
+
+      uint16_t zscii;
+      (void) readChar(/* timeout */ 0, /* echo */ true, /* routine */ 0, zscii);
+   }
+
    bool readChar(uint16_t timeout, bool echo, uint16_t routine, uint16_t& zscii)
    {
-      if(!stream.readChar(zscii, timeout, echo))
+      bool available;
+
+      if (resumable)
+      {
+         available = !pending_input.empty();
+         if (available)
+         {
+            stream.inputChar(zscii, pending_input[0], echo);
+            pending_input.erase(0, 1);
+         }
+         else
+         {
+            pending_timeout = false;
+         }
+      }
+      else
+      {
+         observer.pause();
+         available = stream.readChar(zscii, timeout, echo);
+         observer.resume();
+      }
+
+      if(!available)
       {
          // Timeout
          if(routine != 0)
@@ -308,6 +783,10 @@ private:
 
       // Character available
 
+      if (journal_enable) journal_input += char(zscii);
+
+      observer.input(zscii);
+
       // Newline is 13 in ZSCII
       if (zscii == '\n') zscii = 13;
 
@@ -376,7 +855,9 @@ private:
 
    uint32_t streamText(uint32_t addr)
    {
-      return text.print([this](uint16_t ch){ stream.writeChar(ch); }, addr);
+      uint32_t end = text.print([this](uint16_t ch){ writeChar(ch); }, addr);
+      markRead(addr, end - addr);
+      return end;
    }
 
    //! Read filename from memory
@@ -433,7 +914,7 @@ private:
    {
       uint8_t ret = state.fetch8();
       state.varWrite(ret, 2);
-      state.varWrite(ret, state.save() ? 1 : 0);
+      storeResult(ret, state.save() ? 1 : 0);
    }
 
    //! v1 restore ?(label)
@@ -442,7 +923,7 @@ private:
    //! v4 restore -> (result)
    void op0_restore_v4()
    {
-      if(!reset(/* restore */ true)) state.varWrite(state.fetch8(), 0);
+      if(!reset(/* restore */ true)) storeResult(0);
    }
 
    //! restart
@@ -455,13 +936,13 @@ private:
    void op0_pop() { state.pop(); }
 
    //! catch -> (result)
-   void op0_catch() { state.varWrite(state.fetch8(), state.getFramePtr()); }
+   void op0_catch() { storeResult(state.getFramePtr()); }
 
    //! quit
    void op0_quit() { state.quit(); }
 
    //! new_line
-   void op0_new_line() { stream.writeChar('\n'); }
+   void op0_new_line() { writeChar('\n'); }
 
    //! show_status
    void op0_show_status() { showStatus(); }
@@ -480,24 +961,24 @@ private:
    void op1_get_sibling()
    {
       uint16_t obj = object.getSibling(uarg[0]);
-      state.varWrite(state.fetch8(), obj);
+      storeResult(obj);
       branch(obj != 0);
    }
 
    void op1_get_parent()
    {
       uint16_t obj = object.getParent(uarg[0]);
-      state.varWrite(state.fetch8(), obj);
+      storeResult(obj);
    }
 
    void op1_get_child()
    {
       uint16_t obj = object.getChild(uarg[0]);
-      state.varWrite(state.fetch8(), obj);
+      storeResult(obj);
       branch(obj != 0);
    }
 
-   void op1_get_prop_len()  { state.varWrite(state.fetch8(), object.propSize(uarg[0])); }
+   void op1_get_prop_len()  { storeResult(object.propSize(uarg[0])); }
 
    void op1_inc()           { state.varWrite(uarg[0], state.varRead(uarg[0]) + 1); }
 
@@ -517,7 +998,7 @@ private:
 
    void op1_print_paddr()   { streamText(header->unpackAddr(uarg[0], /* routine */false)); }
 
-   void op1_load()          { state.varWrite(state.fetch8(), state.varRead(uarg[0], true)); }
+   void op1_load()          { storeResult(state.varRead(uarg[0], true)); }
 
    void op1_not()           { state.varWrite(uarg[0], ~uarg[0]); }
 
@@ -552,8 +1033,8 @@ private:
 
    void op2_jin()           { branch(object.getParent(uarg[0]) == uarg[1]); }
    void op2_test_bitmap()   { branch((uarg[0] & uarg[1]) == uarg[1]); }
-   void op2_or()            { state.varWrite(state.fetch8(), uarg[0] | uarg[1]); }
-   void op2_and()           { state.varWrite(state.fetch8(), uarg[0] & uarg[1]); }
+   void op2_or()            { storeResult(uarg[0] | uarg[1]); }
+   void op2_and()           { storeResult(uarg[0] & uarg[1]); }
    void op2_test_attr()     { branch(object.getAttr(uarg[0], uarg[1])); }
    void op2_set_attr()      { object.setAttr(uarg[0], uarg[1], true); }
    void op2_clear_attr()    { object.setAttr(uarg[0], uarg[1], false); }
@@ -563,7 +1044,7 @@ private:
    //! 2OP:15 0F loadw array word_index -> (result)
    void op2_loadw()
    {
-      state.varWrite(state.fetch8(), state.memory.read16(uarg[0]+2*uarg[1]));
+      storeResult(read16(uarg[0]+2*uarg[1]));
    }
 
    //! 2OP:16 10 loadb array byte_index -> (result)
@@ -571,15 +1052,15 @@ private:
    //  which must lie in static or dynamic memory)
    void op2_loadb()
    {
-      state.varWrite(state.fetch8(), state.memory.read8(uarg[0] + uarg[1]));
+      storeResult(read8(uarg[0] + uarg[1]));
    }
 
-   void op2_get_prop()      { state.varWrite(state.fetch8(), object.getProp(uarg[0], uarg[1])); }
-   void op2_get_prop_addr() { state.varWrite(state.fetch8(), object.getPropAddr(uarg[0], uarg[1])); }
-   void op2_get_next_prop() { state.varWrite(state.fetch8(), object.getPropNext(uarg[0], uarg[1])); }
-   void op2_add()           { state.varWrite(state.fetch8(), sarg[0] + sarg[1]); }
-   void op2_sub()           { state.varWrite(state.fetch8(), sarg[0] - sarg[1]); }
-   void op2_mul()           { state.varWrite(state.fetch8(), sarg[0] * sarg[1]); }
+   void op2_get_prop()      { storeResult(object.getProp(uarg[0], uarg[1])); }
+   void op2_get_prop_addr() { storeResult(object.getPropAddr(uarg[0], uarg[1])); }
+   void op2_get_next_prop() { storeResult(object.getPropNext(uarg[0], uarg[1])); }
+   void op2_add()           { storeResult(sarg[0] + sarg[1]); }
+   void op2_sub()           { storeResult(sarg[0] - sarg[1]); }
+   void op2_mul()           { storeResult(sarg[0] * sarg[1]); }
 
    void op2_div()
    {
@@ -588,7 +1069,7 @@ private:
          throw "div by zero";
          return;
       }
-      state.varWrite(state.fetch8(), sarg[0] / sarg[1]);
+      storeResult(sarg[0] / sarg[1]);
    }
 
    void op2_mod()
@@ -598,7 +1079,7 @@ private:
          throw "div by zero";
          return;
       }
-      state.varWrite(state.fetch8(), sarg[0] % sarg[1]);
+      storeResult(sarg[0] % sarg[1]);
    }
 
    void op2_call_2s()           { subCall(0, uarg[0], 1, &uarg[1]); }
@@ -611,17 +1092,17 @@ private:
    void opV_call()
    {
       if (uarg[0] == 0)
-         state.varWrite(state.fetch8(), 0);
+         storeResult(0);
       else
          subCall(0, uarg[0], num_arg-1, &uarg[1]);
    }
 
    void opV_call_vs()        { opV_call(); }
-   void opV_not()            { state.varWrite(state.fetch8(), ~uarg[0]); }
+   void opV_not()            { storeResult(~uarg[0]); }
    void opV_call_vn()        { subCall(1, uarg[0], num_arg-1, &uarg[1]); }
    void opV_call_vn2()       { opV_call_vn(); }
-   void opV_storew()         { state.memory.write16(uarg[0] + 2*uarg[1], uarg[2]); }
-   void opV_storeb()         { state.memory.write8(uarg[0] + uarg[1], uarg[2]); }
+   void opV_storew()         { write16(uarg[0] + 2*uarg[1], uarg[2]); }
+   void opV_storeb()         { write8(uarg[0] + uarg[1], uarg[2]); }
    void opV_put_prop()       { object.setProp(uarg[0], uarg[1], uarg[2]); }
 
    //! V1 sread text parse
@@ -634,10 +1115,17 @@ private:
       uint16_t timeout = TIMER && (num_arg >= 3) ? uarg[2] : 0;
       uint16_t routine = TIMER && (num_arg >= 4) ? uarg[3] : 0;
 
-      if(SHOW_STATUS) showStatus();
+      if (!resuming)
+      {
+         inputRequest();
+
+         if(SHOW_STATUS) showStatus();
+      }
+
+      if (!waitForInput(NEED_LINE, timeout, &BasicMachine::opV_sread<TIMER,SHOW_STATUS>)) return;
 
       uint8_t  len   = 0;
-      uint8_t  max   = state.memory.read8(buffer++) - 1;
+      uint8_t  max   = read8(buffer++) - 1;
       uint16_t start = buffer;
 
       while(len < max)
@@ -661,17 +1149,22 @@ private:
          }
          else if(zscii == 13)
          {
-            state.memory.write8(buffer, '\0');
             break;
          }
          else
          {
-            state.memory.write8(buffer++, tolower(zscii));
+            write8(buffer++, tolower(zscii));
             len++;
          }
       }
 
+      // A line longer than the buffer is cut short
+      if (len == max) discardLine();
+
+      write8(buffer, '\0');
+
       parser.tokenise(state.memory, parse, start, header->dict, false);
+      markParse(parse);
    }
 
    //! aread text parse timeout routine -> (result)
@@ -682,11 +1175,15 @@ private:
       uint16_t timeout = num_arg >= 3 ? uarg[2] : 0;
       uint16_t routine = num_arg >= 4 ? uarg[3] : 0;
 
-      uint8_t max = state.memory.read8(buffer++);
-      uint8_t len = state.memory.read8(buffer++);
+      if (!resuming) inputRequest();
+
+      if (!waitForInput(NEED_LINE, timeout, &BasicMachine::opV_aread)) return;
+
+      uint8_t max = read8(buffer++);
+      uint8_t len = read8(buffer++);
 
       uint16_t start  = buffer;
-      uint8_t  status = 0;
+      uint8_t  status = 13;
 
       buffer += len;
 
@@ -711,30 +1208,33 @@ private:
          }
          else if(zscii == 13)
          {
-            state.memory.write8(buffer, '\0');
-            state.memory.write8(start - 1, len);
-            status = uint8_t(zscii);
+            write8(buffer, '\0');
             break;
          }
          else
          {
-            state.memory.write8(buffer++, tolower(zscii));
+            write8(buffer++, tolower(zscii));
             len++;
          }
       }
 
-      uint8_t ret = state.fetch8();
-      state.varWrite(ret, status);
+      // A line longer than the buffer is cut short
+      if (len == max) discardLine();
+
+      write8(start - 1, len);
+
+      storeResult(status);
 
       if(parse != 0)
       {
          parser.tokenise(state.memory, parse, start, header->dict, false);
+         markParse(parse);
       }
    }
 
-   void opV_print_char()     { stream.writeChar(uarg[0]); }
-   void opV_print_num()      { stream.writeNumber(sarg[0]); }
-   void opV_random()         { state.varWrite(state.fetch8(), state.randomOp(sarg[0])); }
+   void opV_print_char()     { writeChar(uarg[0]); }
+   void opV_print_num()      { writeNumber(sarg[0]); }
+   void opV_random()         { storeResult(state.randomOp(sarg[0])); }
    void opV_push()           { state.push(uarg[0]); }
 
    void opV_pull_v1()
@@ -758,7 +1258,9 @@ private:
          value = state.pop();
       }
 
-      state.varWrite(state.fetch8(), value, true);
+      uint8_t index = state.fetch8();
+      observer.store(value);
+      state.varWrite(index, value, true);
    }
 
    void opV_split_window()   { screen.splitWindow(uarg[0]); }
@@ -838,9 +1340,13 @@ private:
       uint16_t routine = num_arg >= 3 ? uarg[2] : 0;
       uint16_t zscii;
 
+      if (!resuming) inputRequest();
+
+      if (!waitForInput(NEED_CHAR, timeout, &BasicMachine::opV_read_char)) return;
+
       if(readChar(timeout, /* echo */ false, routine, zscii))
       {
-         state.varWrite(state.fetch8(), zscii);
+         storeResult(zscii);
       }
    }
 
@@ -866,7 +1372,7 @@ private:
          table += form & 0x7F;
       }
 
-      state.varWrite(state.fetch8(), result);
+      storeResult(result);
 
       branch(result != 0);
    }
@@ -880,6 +1386,7 @@ private:
 
       // Test +2 to skip max len and actual len
       parser.tokenise(state.memory, parse, text + 2, dict, flag);
+      markParse(parse);
    }
 
    void opV_encode_text() { throw "op encode_text unimplemeneted"; }
@@ -890,6 +1397,9 @@ private:
       uint16_t to   = uarg[1];
       int16_t  size = sarg[2];
 
+      if (to != 0) markRead(from, abs(size));
+      markWrite(to == 0 ? from : to, abs(size));
+
       if(to == 0)
       {
          for(int16_t i = 0; i<size; i++)
@@ -921,18 +1431,18 @@ private:
       uint16_t skip   = num_arg == 4 ? uarg[3] : 0;
 
       unsigned line, col;
-      console.getCursorPos(line, col);
+      recorder.getCursorPos(line, col);
 
       for(unsigned l = 0; l < height; l++)
       {
          for(unsigned c = 0; c < width; c++)
          {
             uint8_t ch = state.memory.fetch8(addr++);
-            stream.writeChar(ch);
+            writeChar(ch);
          }
 
          stream.flush();
-         console.moveCursor(line + l + 1, col);
+         recorder.moveCursor(line + l + 1, col);
 
          addr += skip;
       }
@@ -956,16 +1466,15 @@ private:
 
          std::string filename;
          readFilename(name, filename);
-         FILE* fp = fopen(filename.c_str(), "w");
-         if (fp != nullptr)
+
+         IF::Buffer data;
+         data.reserve(bytes);
+         for(unsigned i=0; i<bytes; i++)
          {
-            for(unsigned i=0; i<bytes; i++)
-            {
-               fputc(state.memory.read8(table + i), fp);
-            }
-            fclose(fp);
-            ok = true;
+            data.push8(state.memory.read8(table + i));
          }
+
+         ok = state.saveData(filename, data);
       }
       else
       {
@@ -973,7 +1482,7 @@ private:
          ok = state.save();
       }
 
-      state.varWrite(ret, ok ? 1 : 0);
+      storeResult(ret, ok ? 1 : 0);
    }
 
    void opE_restore_table()
@@ -988,6 +1497,7 @@ private:
 
          std::string filename;
          readFilename(name, filename);
+
          FILE* fp = fopen(filename.c_str(), "r");
          if (fp != nullptr)
          {
@@ -1003,42 +1513,42 @@ private:
             fclose(fp);
          }
 
-         state.varWrite(state.fetch8(), bytes);
+         storeResult(bytes);
       }
       else if(!reset(/* restore */ true))
       {
-         state.varWrite(state.fetch8(), 0);
+         storeResult(0);
       }
    }
 
    void opE_log_shift()
    {
       if(sarg[1] < 0)
-         state.varWrite(state.fetch8(), uarg[0] >> -sarg[1]);
+         storeResult(uarg[0] >> -sarg[1]);
       else
-         state.varWrite(state.fetch8(), uarg[0] << sarg[1]);
+         storeResult(uarg[0] << sarg[1]);
    }
 
    void opE_art_shift()
    {
       if(sarg[1] < 0)
-         state.varWrite(state.fetch8(), sarg[0] >> -sarg[1]);
+         storeResult(sarg[0] >> -sarg[1]);
       else
-         state.varWrite(state.fetch8(), sarg[0] << sarg[1]);
+         storeResult(sarg[0] << sarg[1]);
    }
 
    void opE_save_undo()
    {
       uint8_t ret = state.fetch8();
       state.varWrite(ret, 2);
-      state.varWrite(ret, state.saveUndo() ? 1 : 0);
+      storeResult(ret, state.saveUndo() ? 1 : 0);
    }
 
    void opE_restore_undo()
    {
       if(!state.restoreUndo())
       {
-         state.varWrite(state.fetch8(), 0);
+         storeResult(0);
       }
    }
 
@@ -1048,34 +1558,34 @@ private:
 
       if ((code >= 0x20) && (code <= 0x7E))
       {
-         stream.writeChar(code);
+         writeChar(code);
       }
       else
       {
          switch(code)
          {
          case 0x00A9: // Copyright
-            stream.writeChar('(');
-            stream.writeChar('C');
-            stream.writeChar(')');
+            writeChar('(');
+            writeChar('C');
+            writeChar(')');
             break;
 
          case 0x0219: // Latin small s with comma below
-            stream.writeChar('s');
+            writeChar('s');
             break;
 
          case 0x2014: // Em dash
-            stream.writeChar('-');
+            writeChar('-');
             break;
 
          case 0x2026: // Horizontal ellipses
-            stream.writeChar('.');
-            stream.writeChar('.');
-            stream.writeChar('.');
+            writeChar('.');
+            writeChar('.');
+            writeChar('.');
             break;
 
          case 0x2212: // Minus sign
-            stream.writeChar('-');
+            writeChar('-');
             break;
 
          default:
@@ -1111,36 +1621,48 @@ private:
          }
       }
 
-      state.varWrite(state.fetch8(), bit_mask);
+      storeResult(bit_mask);
    }
 
-   void opE_draw_picture() { TODO_WARN("op draw_picture unimplemented"); }
+   void opE_draw_picture()
+   {
+      uint16_t pict_no = uarg[0];
+
+      if (resources.getPicture(pict_no) == nullptr)
+      {
+         TODO_WARN("op draw_picture picture not found");
+      }
+      else
+      {
+         TODO_WARN("op draw_picture unimplemented");
+      }
+   }
 
    void opE_picture_data()
    {
-      TODO_WARN("op picture_data unimplemented");
-
       uint16_t pict_no = uarg[0];
       uint16_t array   = uarg[1];
       bool     valid{false};
-      uint16_t value1{0};
-      uint16_t value2{0};
 
       if (pict_no == 0)
       {
-         value1 = 0; // TODO number of available pictures
-         value2 = 0; // TODO picture file release number
+         unsigned num_pictures = resources.numPictures();
+
+         state.memory.write16(array + 0, num_pictures);
+         state.memory.write16(array + 2, resources.getRelease());
+         valid = num_pictures != 0;
       }
-      // TODO
-      // else if (isValidPictur(pict_no))
-      // {
-      //    value1 = height;
-      //    value2 = width;
-      //    valid  = true;
-      // }
+      else
+      {
+         unsigned width, height;
 
-      state.memory.write16(array + 0, value1);
-      state.memory.write16(array + 2, value2);
+         valid = resources.getPictureSize(pict_no, width, height);
+         if (valid)
+         {
+            state.memory.write16(array + 0, height);
+            state.memory.write16(array + 2, width);
+         }
+      }
 
       branch(valid);
    }
@@ -1154,7 +1676,7 @@ private:
    void opE_set_font()
    {
       bool ok = stream.setFont(uarg[0]);
-      state.varWrite(state.fetch8(), ok);
+      storeResult(ok);
    }
 
    void opE_move_window()
@@ -1189,7 +1711,7 @@ private:
       uint16_t wind = uarg[0];
       uint16_t prop = uarg[1];
 
-      state.varWrite(state.fetch8(), screen.getWindowProp(wind, prop));
+      storeResult(screen.getWindowProp(wind, prop));
    }
 
    void opE_scroll_window()
@@ -1255,7 +1777,7 @@ private:
    {
       uint16_t formatted_table = uarg[0];
 
-      text.printForm([this](uint16_t ch){ stream.writeChar(ch); }, formatted_table);
+      text.printForm([this](uint16_t ch){ writeChar(ch); }, formatted_table);
    }
 
    void opE_make_menu()
@@ -1271,179 +1793,194 @@ private:
       throw "make_menu unimplemented";
    }
 
-   void opE_picture_table() { TODO_WARN("picture_table unimplemented"); }
+   //! EXT:28
+   //  picture_table table
+   void opE_picture_table()
+   {
+      // Zero terminated list of pictures that will be needed soon, a
+      // missing terminator stops at the end of memory or MAX_PICTURES
+      uint32_t addr = uarg[0];
+
+      for(unsigned i = 0; (i < MAX_PICTURES) && ((addr + 1) < state.memory.size()); i++, addr += 2)
+      {
+         uint16_t pict_no = state.memory.read16(addr);
+         if (pict_no == 0) break;
+
+         resources.prefetchPicture(pict_no);
+      }
+   }
 
    void initDecoder(unsigned version)
    {
       // Zero operand instructions
-      op0[0x0] =                &Machine::op0_rtrue;
-      op0[0x1] =                &Machine::op0_rfalse;
-      op0[0x2] =                &Machine::op0_print;
-      op0[0x3] =                &Machine::op0_print_ret;
-      op0[0x4] =                &Machine::op0_nop;
-      op0[0x5] = version <= 3 ? &Machine::op0_save_v1
-               : version == 4 ? &Machine::op0_save_v4
-                              : &Machine::ILLEGAL;
-      op0[0x6] = version <= 3 ? &Machine::op0_restore_v1
-               : version == 4 ? &Machine::op0_restore_v4
-                              : &Machine::ILLEGAL;
-      op0[0x7] =                &Machine::op0_restart;
-      op0[0x8] =                &Machine::op0_ret_popped;
-      op0[0x9] = version <= 4 ? &Machine::op0_pop
-                              : &Machine::op0_catch;
-      op0[0xA] =                &Machine::op0_quit;
-      op0[0xB] =                &Machine::op0_new_line;
-      op0[0xC] = version <= 2 ? &Machine::ILLEGAL
-               : version == 3 ? &Machine::op0_show_status
-                              : &Machine::op0_nop;
-      op0[0xD] = version >= 3 ? &Machine::op0_verify
-                              : &Machine::ILLEGAL;
-      op0[0xE] =                &Machine::ILLEGAL;   // "extend" decoded elsewhere
-      op0[0xF] = version >= 5 ? &Machine::op0_piracy
-                              : &Machine::ILLEGAL;
+      op0[0x0] =                &BasicMachine::op0_rtrue;
+      op0[0x1] =                &BasicMachine::op0_rfalse;
+      op0[0x2] =                &BasicMachine::op0_print;
+      op0[0x3] =                &BasicMachine::op0_print_ret;
+      op0[0x4] =                &BasicMachine::op0_nop;
+      op0[0x5] = version <= 3 ? &BasicMachine::op0_save_v1
+               : version == 4 ? &BasicMachine::op0_save_v4
+                              : &BasicMachine::ILLEGAL;
+      op0[0x6] = version <= 3 ? &BasicMachine::op0_restore_v1
+               : version == 4 ? &BasicMachine::op0_restore_v4
+                              : &BasicMachine::ILLEGAL;
+      op0[0x7] =                &BasicMachine::op0_restart;
+      op0[0x8] =                &BasicMachine::op0_ret_popped;
+      op0[0x9] = version <= 4 ? &BasicMachine::op0_pop
+                              : &BasicMachine::op0_catch;
+      op0[0xA] =                &BasicMachine::op0_quit;
+      op0[0xB] =                &BasicMachine::op0_new_line;
+      op0[0xC] = version <= 2 ? &BasicMachine::ILLEGAL
+               : version == 3 ? &BasicMachine::op0_show_status
+                              : &BasicMachine::op0_nop;
+      op0[0xD] = version >= 3 ? &BasicMachine::op0_verify
+                              : &BasicMachine::ILLEGAL;
+      op0[0xE] =                &BasicMachine::ILLEGAL;   // "extend" decoded elsewhere
+      op0[0xF] = version >= 5 ? &BasicMachine::op0_piracy
+                              : &BasicMachine::ILLEGAL;
 
       // One operand instructions
-      op1[0x0] =                &Machine::op1_jz;
-      op1[0x1] =                &Machine::op1_get_sibling;
-      op1[0x2] =                &Machine::op1_get_child;
-      op1[0x3] =                &Machine::op1_get_parent;
-      op1[0x4] =                &Machine::op1_get_prop_len;
-      op1[0x5] =                &Machine::op1_inc;
-      op1[0x6] =                &Machine::op1_dec;
-      op1[0x7] =                &Machine::op1_print_addr;
-      op1[0x8] = version >= 4 ? &Machine::op1_call_1s
-                              : &Machine::ILLEGAL;
-      op1[0x9] =                &Machine::op1_remove_obj;
-      op1[0xA] =                &Machine::op1_print_obj;
-      op1[0xB] =                &Machine::op1_ret;
-      op1[0xC] =                &Machine::op1_jump;
-      op1[0xD] =                &Machine::op1_print_paddr;
-      op1[0xE] =                &Machine::op1_load;
-      op1[0xF] = version <= 4 ? &Machine::op1_not
-                              : &Machine::op1_call_1n;
+      op1[0x0] =                &BasicMachine::op1_jz;
+      op1[0x1] =                &BasicMachine::op1_get_sibling;
+      op1[0x2] =                &BasicMachine::op1_get_child;
+      op1[0x3] =                &BasicMachine::op1_get_parent;
+      op1[0x4] =                &BasicMachine::op1_get_prop_len;
+      op1[0x5] =                &BasicMachine::op1_inc;
+      op1[0x6] =                &BasicMachine::op1_dec;
+      op1[0x7] =                &BasicMachine::op1_print_addr;
+      op1[0x8] = version >= 4 ? &BasicMachine::op1_call_1s
+                              : &BasicMachine::ILLEGAL;
+      op1[0x9] =                &BasicMachine::op1_remove_obj;
+      op1[0xA] =                &BasicMachine::op1_print_obj;
+      op1[0xB] =                &BasicMachine::op1_ret;
+      op1[0xC] =                &BasicMachine::op1_jump;
+      op1[0xD] =                &BasicMachine::op1_print_paddr;
+      op1[0xE] =                &BasicMachine::op1_load;
+      op1[0xF] = version <= 4 ? &BasicMachine::op1_not
+                              : &BasicMachine::op1_call_1n;
 
       // Two operand instructions
-      op2[0x00] =                &Machine::ILLEGAL;
-      op2[0x01] =                &Machine::op2_je;
-      op2[0x02] =                &Machine::op2_jl;
-      op2[0x03] =                &Machine::op2_jg;
-      op2[0x04] =                &Machine::op2_dec_chk;
-      op2[0x05] =                &Machine::op2_inc_chk;
-      op2[0x06] =                &Machine::op2_jin;
-      op2[0x07] =                &Machine::op2_test_bitmap;
-      op2[0x08] =                &Machine::op2_or;
-      op2[0x09] =                &Machine::op2_and;
-      op2[0x0A] =                &Machine::op2_test_attr;
-      op2[0x0B] =                &Machine::op2_set_attr;
-      op2[0x0C] =                &Machine::op2_clear_attr;
-      op2[0x0D] =                &Machine::op2_store;
-      op2[0x0E] =                &Machine::op2_insert_obj;
-      op2[0x0F] =                &Machine::op2_loadw;
-      op2[0x10] =                &Machine::op2_loadb;
-      op2[0x11] =                &Machine::op2_get_prop;
-      op2[0x12] =                &Machine::op2_get_prop_addr;
-      op2[0x13] =                &Machine::op2_get_next_prop;
-      op2[0x14] =                &Machine::op2_add;
-      op2[0x15] =                &Machine::op2_sub;
-      op2[0x16] =                &Machine::op2_mul;
-      op2[0x17] =                &Machine::op2_div;
-      op2[0x18] =                &Machine::op2_mod;
-      op2[0x19] = version >= 4 ? &Machine::op2_call_2s
-                               : &Machine::ILLEGAL;
-      op2[0x1A] = version >= 5 ? &Machine::op2_call_2n
-                               : &Machine::ILLEGAL;
-      op2[0x1B] = version >= 5 ? &Machine::op2_set_colour
-                               : &Machine::ILLEGAL;
-      op2[0x1C] = version >= 5 ? &Machine::op2_throw
-                               : &Machine::ILLEGAL;
-      op2[0x1D] =                &Machine::ILLEGAL;
-      op2[0x1E] =                &Machine::ILLEGAL;
-      op2[0x1F] =                &Machine::ILLEGAL;
+      op2[0x00] =                &BasicMachine::ILLEGAL;
+      op2[0x01] =                &BasicMachine::op2_je;
+      op2[0x02] =                &BasicMachine::op2_jl;
+      op2[0x03] =                &BasicMachine::op2_jg;
+      op2[0x04] =                &BasicMachine::op2_dec_chk;
+      op2[0x05] =                &BasicMachine::op2_inc_chk;
+      op2[0x06] =                &BasicMachine::op2_jin;
+      op2[0x07] =                &BasicMachine::op2_test_bitmap;
+      op2[0x08] =                &BasicMachine::op2_or;
+      op2[0x09] =                &BasicMachine::op2_and;
+      op2[0x0A] =                &BasicMachine::op2_test_attr;
+      op2[0x0B] =                &BasicMachine::op2_set_attr;
+      op2[0x0C] =                &BasicMachine::op2_clear_attr;
+      op2[0x0D] =                &BasicMachine::op2_store;
+      op2[0x0E] =                &BasicMachine::op2_insert_obj;
+      op2[0x0F] =                &BasicMachine::op2_loadw;
+      op2[0x10] =                &BasicMachine::op2_loadb;
+      op2[0x11] =                &BasicMachine::op2_get_prop;
+      op2[0x12] =                &BasicMachine::op2_get_prop_addr;
+      op2[0x13] =                &BasicMachine::op2_get_next_prop;
+      op2[0x14] =                &BasicMachine::op2_add;
+      op2[0x15] =                &BasicMachine::op2_sub;
+      op2[0x16] =                &BasicMachine::op2_mul;
+      op2[0x17] =                &BasicMachine::op2_div;
+      op2[0x18] =                &BasicMachine::op2_mod;
+      op2[0x19] = version >= 4 ? &BasicMachine::op2_call_2s
+                               : &BasicMachine::ILLEGAL;
+      op2[0x1A] = version >= 5 ? &BasicMachine::op2_call_2n
+                               : &BasicMachine::ILLEGAL;
+      op2[0x1B] = version >= 5 ? &BasicMachine::op2_set_colour
+                               : &BasicMachine::ILLEGAL;
+      op2[0x1C] = version >= 5 ? &BasicMachine::op2_throw
+                               : &BasicMachine::ILLEGAL;
+      op2[0x1D] =                &BasicMachine::ILLEGAL;
+      op2[0x1E] =                &BasicMachine::ILLEGAL;
+      op2[0x1F] =                &BasicMachine::ILLEGAL;
 
       // Variable operand instructions
-      opV[0x00] = version <= 3 ? &Machine::opV_call
-                               : &Machine::opV_call_vs;
-      opV[0x01] =                &Machine::opV_storew;
-      opV[0x02] =                &Machine::opV_storeb;
-      opV[0x03] =                &Machine::opV_put_prop;
-      opV[0x04] = version <= 3 ? &Machine::opV_sread<false,true>
-                : version == 4 ? &Machine::opV_sread<true,false>
-                               : &Machine::opV_aread;
-      opV[0x05] =                &Machine::opV_print_char;
-      opV[0x06] =                &Machine::opV_print_num;
-      opV[0x07] =                &Machine::opV_random;
-      opV[0x08] =                &Machine::opV_push;
-      opV[0x09] = version == 6 ? &Machine::opV_pull_v6
-                               : &Machine::opV_pull_v1;
-      opV[0x0A] = version >= 3 ? &Machine::opV_split_window
-                               : &Machine::ILLEGAL;
-      opV[0x0B] = version >= 3 ? &Machine::opV_set_window
-                               : &Machine::ILLEGAL;
-      opV[0x0C] = version >= 4 ? &Machine::opV_call_vs2
-                               : &Machine::ILLEGAL;
-      opV[0x0D] = version >= 4 ? &Machine::opV_erase_window
-                               : &Machine::ILLEGAL;
-      opV[0x0E] = version >= 4 ? &Machine::opV_erase_line_v4
-                : version >= 6 ? &Machine::opV_erase_line_v6
-                               : &Machine::ILLEGAL;
-      opV[0x0F] = version >= 4 ? &Machine::opV_set_cursor_v4
-                : version >= 6 ? &Machine::opV_set_cursor_v6
-                               : &Machine::ILLEGAL;
-      opV[0x10] = version >= 4 ? &Machine::opV_get_cursor      : &Machine::ILLEGAL;
-      opV[0x11] = version >= 4 ? &Machine::opV_set_text_style  : &Machine::ILLEGAL;
-      opV[0x12] = version >= 4 ? &Machine::opV_buffer_mode     : &Machine::ILLEGAL;
-      opV[0x13] = version >= 3 ? &Machine::opV_output_stream   : &Machine::ILLEGAL;
-      opV[0x14] = version >= 3 ? &Machine::opV_input_stream    : &Machine::ILLEGAL;
-      opV[0x15] = version >= 5 ? &Machine::opV_sound_effect    : &Machine::ILLEGAL;
-      opV[0x16] = version >= 4 ? &Machine::opV_read_char       : &Machine::ILLEGAL;
-      opV[0x17] = version >= 4 ? &Machine::opV_scan_table      : &Machine::ILLEGAL;
-      opV[0x18] = version >= 5 ? &Machine::opV_not             : &Machine::ILLEGAL;
-      opV[0x19] = version >= 5 ? &Machine::opV_call_vn         : &Machine::ILLEGAL;
-      opV[0x1A] = version >= 5 ? &Machine::opV_call_vn2        : &Machine::ILLEGAL;
-      opV[0x1B] = version >= 5 ? &Machine::opV_tokenise        : &Machine::ILLEGAL;
-      opV[0x1C] = version >= 5 ? &Machine::opV_encode_text     : &Machine::ILLEGAL;
-      opV[0x1D] = version >= 5 ? &Machine::opV_copy_table      : &Machine::ILLEGAL;
-      opV[0x1E] = version >= 5 ? &Machine::opV_print_table     : &Machine::ILLEGAL;
-      opV[0x1F] = version >= 5 ? &Machine::opV_check_arg_count : &Machine::ILLEGAL;
+      opV[0x00] = version <= 3 ? &BasicMachine::opV_call
+                               : &BasicMachine::opV_call_vs;
+      opV[0x01] =                &BasicMachine::opV_storew;
+      opV[0x02] =                &BasicMachine::opV_storeb;
+      opV[0x03] =                &BasicMachine::opV_put_prop;
+      opV[0x04] = version <= 3 ? &BasicMachine::opV_sread<false,true>
+                : version == 4 ? &BasicMachine::opV_sread<true,false>
+                               : &BasicMachine::opV_aread;
+      opV[0x05] =                &BasicMachine::opV_print_char;
+      opV[0x06] =                &BasicMachine::opV_print_num;
+      opV[0x07] =                &BasicMachine::opV_random;
+      opV[0x08] =                &BasicMachine::opV_push;
+      opV[0x09] = version == 6 ? &BasicMachine::opV_pull_v6
+                               : &BasicMachine::opV_pull_v1;
+      opV[0x0A] = version >= 3 ? &BasicMachine::opV_split_window
+                               : &BasicMachine::ILLEGAL;
+      opV[0x0B] = version >= 3 ? &BasicMachine::opV_set_window
+                               : &BasicMachine::ILLEGAL;
+      opV[0x0C] = version >= 4 ? &BasicMachine::opV_call_vs2
+                               : &BasicMachine::ILLEGAL;
+      opV[0x0D] = version >= 4 ? &BasicMachine::opV_erase_window
+                               : &BasicMachine::ILLEGAL;
+      opV[0x0E] = version >= 4 ? &BasicMachine::opV_erase_line_v4
+                : version >= 6 ? &BasicMachine::opV_erase_line_v6
+                               : &BasicMachine::ILLEGAL;
+      opV[0x0F] = version >= 4 ? &BasicMachine::opV_set_cursor_v4
+                : version >= 6 ? &BasicMachine::opV_set_cursor_v6
+                               : &BasicMachine::ILLEGAL;
+      opV[0x10] = version >= 4 ? &BasicMachine::opV_get_cursor      : &BasicMachine::ILLEGAL;
+      opV[0x11] = version >= 4 ? &BasicMachine::opV_set_text_style  : &BasicMachine::ILLEGAL;
+      opV[0x12] = version >= 4 ? &BasicMachine::opV_buffer_mode     : &BasicMachine::ILLEGAL;
+      opV[0x13] = version >= 3 ? &BasicMachine::opV_output_stream   : &BasicMachine::ILLEGAL;
+      opV[0x14] = version >= 3 ? &BasicMachine::opV_input_stream    : &BasicMachine::ILLEGAL;
+      opV[0x15] = version >= 5 ? &BasicMachine::opV_sound_effect    : &BasicMachine::ILLEGAL;
+      opV[0x16] = version >= 4 ? &BasicMachine::opV_read_char       : &BasicMachine::ILLEGAL;
+      opV[0x17] = version >= 4 ? &BasicMachine::opV_scan_table      : &BasicMachine::ILLEGAL;
+      opV[0x18] = version >= 5 ? &BasicMachine::opV_not             : &BasicMachine::ILLEGAL;
+      opV[0x19] = version >= 5 ? &BasicMachine::opV_call_vn         : &BasicMachine::ILLEGAL;
+      opV[0x1A] = version >= 5 ? &BasicMachine::opV_call_vn2        : &BasicMachine::ILLEGAL;
+      opV[0x1B] = version >= 5 ? &BasicMachine::opV_tokenise        : &BasicMachine::ILLEGAL;
+      opV[0x1C] = version >= 5 ? &BasicMachine::opV_encode_text     : &BasicMachine::ILLEGAL;
+      opV[0x1D] = version >= 5 ? &BasicMachine::opV_copy_table      : &BasicMachine::ILLEGAL;
+      opV[0x1E] = version >= 5 ? &BasicMachine::opV_print_table     : &BasicMachine::ILLEGAL;
+      opV[0x1F] = version >= 5 ? &BasicMachine::opV_check_arg_count : &BasicMachine::ILLEGAL;
 
       // Externded instructions
       for(unsigned i = 0; i <= 0x1F; i++)
       {
-         opE[i] = &Machine::ILLEGAL;
+         opE[i] = &BasicMachine::ILLEGAL;
       }
 
       if(version < 5) return;
 
-      opE[0x00] = &Machine::opE_save_table;
-      opE[0x01] = &Machine::opE_restore_table;
-      opE[0x02] = &Machine::opE_log_shift;
-      opE[0x03] = &Machine::opE_art_shift;
-      opE[0x04] = &Machine::opE_set_font;
-      opE[0x09] = &Machine::opE_save_undo;
-      opE[0x0A] = &Machine::opE_restore_undo;
-      opE[0x0B] = &Machine::opE_print_unicode;
-      opE[0x0C] = &Machine::opE_check_unicode;
+      opE[0x00] = &BasicMachine::opE_save_table;
+      opE[0x01] = &BasicMachine::opE_restore_table;
+      opE[0x02] = &BasicMachine::opE_log_shift;
+      opE[0x03] = &BasicMachine::opE_art_shift;
+      opE[0x04] = &BasicMachine::opE_set_font;
+      opE[0x09] = &BasicMachine::opE_save_undo;
+      opE[0x0A] = &BasicMachine::opE_restore_undo;
+      opE[0x0B] = &BasicMachine::opE_print_unicode;
+      opE[0x0C] = &BasicMachine::opE_check_unicode;
 
       if(version != 6) return;
 
-      opE[0x05] = &Machine::opE_draw_picture;
-      opE[0x06] = &Machine::opE_picture_data;
-      opE[0x07] = &Machine::opE_erase_picture;
-      opE[0x08] = &Machine::opE_set_margins;
-
-      opE[0x10] = &Machine::opE_move_window;
-      opE[0x11] = &Machine::opE_window_size;
-      opE[0x12] = &Machine::opE_window_style;
-      opE[0x13] = &Machine::opE_get_wind_prop;
-      opE[0x14] = &Machine::opE_scroll_window;
-      opE[0x15] = &Machine::opE_pop_stack;
-      opE[0x16] = &Machine::opE_read_mouse;
-      opE[0x17] = &Machine::opE_mouse_window;
-      opE[0x18] = &Machine::opE_push_stack;
-      opE[0x19] = &Machine::opE_put_wind_prop;
-      opE[0x1A] = &Machine::opE_print_form;
-      opE[0x1B] = &Machine::opE_make_menu;
-      opE[0x1C] = &Machine::opE_picture_table;
+      opE[0x05] = &BasicMachine::opE_draw_picture;
+      opE[0x06] = &BasicMachine::opE_picture_data;
+      opE[0x07] = &BasicMachine::opE_erase_picture;
+      opE[0x08] = &BasicMachine::opE_set_margins;
+
+      opE[0x10] = &BasicMachine::opE_move_window;
+      opE[0x11] = &BasicMachine::opE_window_size;
+      opE[0x12] = &BasicMachine::opE_window_style;
+      opE[0x13] = &BasicMachine::opE_get_wind_prop;
+      opE[0x14] = &BasicMachine::opE_scroll_window;
+      opE[0x15] = &BasicMachine::opE_pop_stack;
+      opE[0x16] = &BasicMachine::opE_read_mouse;
+      opE[0x17] = &BasicMachine::opE_mouse_window;
+      opE[0x18] = &BasicMachine::opE_push_stack;
+      opE[0x19] = &BasicMachine::opE_put_wind_prop;
+      opE[0x1A] = &BasicMachine::opE_print_form;
+      opE[0x1B] = &BasicMachine::opE_make_menu;
+      opE[0x1C] = &BasicMachine::opE_picture_table;
    }
 
    //============================================================================
@@ -1462,6 +1999,8 @@ private:
       default: assert(!"bad operand type"); return;
       }
 
+      observer.operand(operand);
+
       uarg[num_arg++] = operand;
 
       assert(num_arg <= 8);
@@ -1539,6 +2078,43 @@ private:
       (this->*opE[op_code & 0x1F])();
    }
 
+   //! Report the story details and reset the interpreter
+   void begin(bool restore)
+   {
+      observer.begin(state, resumable, stream);
+
+      std::string text;
+
+      text = "Version  : z";
+      text += std::to_string(header->version);
+      stream.info(text);
+
+      text = "Checksum : ";
+      // The proper C++ way of doing this is not appealing
+      const char* hex_digs = "0123456789ABCDEF";
+      uint16_t checksum = header->checksum;
+      text += hex_digs[(checksum >>  4) & 0xF];
+      text += hex_digs[(checksum >>  0) & 0xF];
+      text += hex_digs[(checksum >> 12) & 0xF];
+      text += hex_digs[(checksum >>  8) & 0xF];
+      stream.info(text);
+
+      if((header->version >= 3) && !story_is_valid)
+      {
+         if (header->version == 3)
+         {
+            // Some v3 games do not have a checksum
+            stream.info("Checksum fail");
+         }
+         else
+         {
+            stream.warning("Checksum fail");
+         }
+      }
+
+      reset(restore);
+   }
+
    //! Reset the interpreter to initial conditions
    bool reset(bool restore)
    {
@@ -1546,22 +2122,259 @@ private:
 
       if (restore)
       {
-         ok = state.restore();
+         // After a crash the journal holds the most recent state, the
+         // journal only covers writable memory so start from the story
+         if (journal_enable) state.reset();
+
+         ok = (journal_enable && state.recoverJournal()) || state.restore();
       }
       else
       {
+         state.settleSaves();
          state.reset();
+
+         if (warm_enable)
+         {
+            if (loadWarmStart()) return true;
+
+            // Re-initialise anything a failed load may have left behind
+            state.reset();
+
+            // Record start-up output for the snapshot taken at the first input
+            recorder.start();
+         }
       }
 
       if (ok)
       {
          screen.reset();
          header->reset(console, config);
+         state.memory.changed();
       }
 
       return ok;
    }
 
+   //! Get the filename for the warm start snapshot
+   std::string getWarmFilename() const
+   {
+      std::string path = (const char*)options.save_dir;
+      path += '/';
+      path += story.getFilename();
+      path += '_';
+      path += story.getIdentity();
+      path += ".warm";
+      return path;
+   }
+
+   //! Everything that must match for a warm start snapshot to be used
+   void encodeWarmKey(IF::Buffer& key) const
+   {
+      key.pushString(story.getIdentity());
+      key.push32(story.size());
+      key.push32(options.seed);
+      key.push16(console.getAttr(Console::LINES));
+      key.push16(console.getAttr(Console::COLS));
+   }
+
+   //! Resume from the warm start snapshot, if there is a valid one
+   bool loadWarmStart()
+   {
+      IF::Snapshot snapshot;
+      if (!snapshot.read(getWarmFilename())) return false;
+
+      IF::Buffer  expected_key;
+      IF::Buffer* key = snapshot.find("KEY ");
+      encodeWarmKey(expected_key);
+      if ((key == nullptr) ||
+          (key->size() != expected_key.size()) ||
+          (memcmp(key->data(), expected_key.data(), key->size()) != 0))
+      {
+         stream.info("Warm start snapshot is stale");
+         return false;
+      }
+
+      IF::Buffer* strm = snapshot.find("STRM");
+      IF::Buffer* scrn = snapshot.find("SCRN");
+      IF::Buffer* cons = snapshot.find("CONS");
+
+      IF::Buffer initial_stream;
+      stream.encode(initial_stream);
+
+      if ((strm == nullptr) || (scrn == nullptr) || (cons == nullptr) ||
+          !snapshot.decodeState(story, state) ||
+          !stream.decode(*strm) ||
+          !screen.decode(*scrn))
+      {
+         (void) stream.decode(initial_stream);
+         stream.warning("Warm start snapshot is corrupt");
+         return false;
+      }
+
+      // Redraw the output from the start-up sequence
+      return recorder.replay(*cons);
+   }
+
+   //! Encode the suspended read instruction and the output state
+   void encodeWait(IF::Snapshot& snapshot) const
+   {
+      IF::Buffer& wait = snapshot.add("WAIT");
+      wait.push8(resume_op == &BasicMachine::opV_read_char ? uint8_t(OP_READ_CHAR) : uint8_t(OP_READ));
+      wait.push32(resume_inst_addr);
+      wait.push8(wait_status);
+      wait.push16(wait_timeout);
+      wait.push8(resume_num_arg);
+      for(unsigned i = 0; i < resume_num_arg; i++)
+      {
+         wait.push16(resume_uarg[i]);
+      }
+
+      stream.encode(snapshot.add("STRM"));
+      screen.encode(snapshot.add("SCRN"));
+
+      unsigned row, col;
+      screen.getCursor(row, col);
+      IF::Buffer& curs = snapshot.add("CURS");
+      curs.push16(row);
+      curs.push16(col);
+   }
+
+   //! Restore a machine waiting for input from the state in a snapshot,
+   //! or from journal records when given
+   bool decodeWait(IF::Snapshot& snapshot, IF::Buffer* records)
+   {
+      IF::Buffer* key  = snapshot.find("KEY ");
+      IF::Buffer* wait = snapshot.find("WAIT");
+      IF::Buffer* strm = snapshot.find("STRM");
+      IF::Buffer* scrn = snapshot.find("SCRN");
+      IF::Buffer* curs = snapshot.find("CURS");
+
+      if ((key == nullptr) || (wait == nullptr) || (strm == nullptr) || (scrn == nullptr) ||
+          (curs == nullptr) || (key->readString() != story.getIdentity()))
+      {
+         return false;
+      }
+
+      unsigned            row        = curs->read16();
+      unsigned            col        = curs->read16();
+      uint8_t             op         = wait->read8();
+      IF::Memory::Address inst_addr_ = wait->read32();
+      uint8_t             status     = wait->read8();
+      uint16_t            timeout    = wait->read16();
+      unsigned            num_arg_   = wait->read8();
+
+      if (((op != OP_READ) && (op != OP_READ_CHAR)) ||
+          ((status != NEED_LINE) && (status != NEED_CHAR)) ||
+          (num_arg_ > MAX_OPERANDS))
+      {
+         return false;
+      }
+
+      for(unsigned i = 0; i < num_arg_; i++)
+      {
+         resume_uarg[i] = wait->read16();
+      }
+
+      if (!wait->isOk()) return false;
+
+      // Snapshots and journal checkpoints cover all of writable memory.
+      // The rest is never written, leaving it alone keeps it shared with
+      // other machines
+      if ((records == nullptr) || IF::Journal::isCheckpoint(*records))
+      {
+         state.resetRegisters();
+      }
+
+      bool decoded = records == nullptr ? snapshot.decodeState(story, state)
+                                        : replica.apply(*records, story, state);
+
+      if (!decoded || !stream.decode(*strm) || !screen.decode(*scrn))
+      {
+         return false;
+      }
+
+      screen.restoreConsole(row, col);
+
+      resumable        = true;
+      halted           = false;
+      failed           = false;
+      fault            = "";
+      pending_timeout  = false;
+      pending_input.clear();
+      wait_status      = Status(status);
+      wait_timeout     = timeout;
+      resume_op        = opV[op];
+      resume_inst_addr = inst_addr_;
+      resume_pc        = state.getPC();
+      resume_num_arg   = num_arg_;
+
+      return true;
+   }
+
+   //! Called before reading input, saves the warm start snapshot at the
+   //! first and records the state in the journal
+   void inputRequest()
+   {
+      if (!recorder.isRecording() && !journal_enable) return;
+
+      // The state is saved at the start of the read instruction, which can
+      // only be re-executed if no operand was popped from the stack
+      bool restartable = !isStackOperand();
+
+      if (recorder.stop() && restartable)
+      {
+         saveWarmStart();
+      }
+
+      if (journal_enable && restartable)
+      {
+         state.journalTurn(inst_addr, journal_input);
+         journal_input.clear();
+      }
+   }
+
+   //! Save the state of the machine at the start of the current instruction
+   void saveWarmStart()
+   {
+      IF::Snapshot snapshot;
+
+      encodeWarmKey(snapshot.add("KEY "));
+      snapshot.encodeState(story, state, inst_addr);
+      stream.encode(snapshot.add("STRM"));
+      screen.encode(snapshot.add("SCRN"));
+      recorder.encode(snapshot.add("CONS"));
+
+      // Make sure the save directory exists
+      (void) PLT::File::createDir((const char*)options.save_dir);
+
+      if (!snapshot.write(getWarmFilename()))
+      {
+         stream.warning("Failed to write warm start snapshot");
+      }
+   }
+
+   //! Check if the current (variable form) instruction popped an operand
+   //! from the stack, in which case it can not simply be re-executed
+   bool isStackOperand() const
+   {
+      const uint8_t* inst  = state.memory.data() + inst_addr;
+      uint8_t        types = inst[1];
+      unsigned       pos   = 2;
+
+      for(unsigned i = 0; i < 4; i++)
+      {
+         switch((types >> (6 - 2 * i)) & 0b11)
+         {
+         case 0b00: pos += 2; break;
+         case 0b01: pos += 1; break;
+         case 0b10: if (inst[pos++] == 0) return true; break;
+         case 0b11: return false;
+         }
+      }
+
+      return false;
+   }
+
    void fetchDecodeExecute()
    {
       uint8_t opcode = state.fetch8();
@@ -1606,5 +2419,8 @@ private:
    }
 };
 
+//! Z machine with no observer
+using Machine = BasicMachine<>;
+
 } // namespace Z
 
@@ -10,13 +10,17 @@
 
 #include "common/Memory.h"
 
+#include "Z/Analysis.h"
+
 namespace Z {
 
 //! Translator of input commands into tokens
 class Parser
 {
 private:
-   uint8_t version;
+   uint8_t         version;
+   const Analysis* analysis{nullptr};
+   uint64_t        lookup_count{0};
 
    //! Encoded word
    class ZWord
@@ -125,6 +129,15 @@ public:
    {
    }
 
+   //! Use the dictionary index from a story analysis
+   void setAnalysis(const Analysis* analysis_)
+   {
+      analysis = analysis_;
+   }
+
+   //! Number of words looked up in a dictionary so far
+   uint64_t getLookupCount() const { return lookup_count; }
+
    //! Translate input command into list of tokens in memory
    void tokenise(IF::Memory& memory, uint32_t out, uint32_t in, uint32_t dict, bool partial)
    {
@@ -175,17 +188,28 @@ public:
 
             uint16_t entry = 0;
 
-            for(uint16_t j = 0; j < num_entry; j++)
+            lookup_count++;
+
+            if((analysis != nullptr) && (dict == analysis->getDictionary()))
             {
-               entry = first + j * entry_length;
+               uint16_t key[3] = {zword[0], zword[1], zword.size() > 2 ? zword[2] : uint16_t(0)};
 
-               if(compare(memory, entry, zword) == 0)
-               {
-                  break;
-               }
-               else if((j == num_entry - 1) && !partial)
+               entry = analysis->findWord(key);
+            }
+            else
+            {
+               for(uint16_t j = 0; j < num_entry; j++)
                {
-                  entry = 0;
+                  entry = first + j * entry_length;
+
+                  if(compare(memory, entry, zword) == 0)
+                  {
+                     break;
+                  }
+                  else if(j == num_entry - 1)
+                  {
+                     entry = 0;
+                  }
                }
             }
 
@@ -0,0 +1,58 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "common/Buffer.h"
+#include "common/Machine.h"
+
+namespace Z {
+
+//! Resumable execution of a Z machine, whatever its observer. See
+//! BasicMachine for the details of each operation
+class Resumable
+{
+public:
+   //! Resources used by the machine so far
+   struct Usage
+   {
+      uint64_t instructions;   //!< Instructions executed
+      uint64_t output;         //!< Characters written to any output stream
+      size_t   undo_bytes;     //!< Memory held by the undo buffers
+      size_t   save_bytes;     //!< Size of the largest save file
+      size_t   memory_bytes;   //!< Size of the VM memory
+      size_t   shared_bytes;   //!< VM memory shared with other machines
+   };
+
+   virtual ~Resumable() = default;
+
+   virtual void start(bool restore) = 0;
+   virtual IF::Machine::Status run(unsigned max_instructions) = 0;
+   virtual bool end() = 0;
+
+   virtual void provideLine(const std::string& line) = 0;
+   virtual void provideChar(uint8_t ch) = 0;
+   virtual unsigned getInputTimeout() const = 0;
+   virtual void provideTimeout() = 0;
+
+   virtual bool saveSnapshot(IF::Buffer& buffer) = 0;
+   virtual bool restoreSnapshot(IF::Buffer& buffer) = 0;
+   virtual bool encodeUpdate(IF::Buffer& buffer) = 0;
+   virtual void restartUpdates() = 0;
+   virtual bool applyUpdate(IF::Buffer& buffer) = 0;
+
+   virtual Usage getUsage() const = 0;
+   virtual void shareMemory() = 0;
+   virtual void setStateLimits(size_t max_undo_bytes, size_t max_save_bytes) = 0;
+   virtual bool hasFailed() const = 0;
+   virtual const std::string& getFault() const = 0;
+   virtual std::string getStats() const = 0;
+};
+
+} // namespace Z
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "common/Buffer.h"
 #include "common/Console.h"
 
 #include "Z/Stream.h"
@@ -436,6 +437,84 @@ public:
       }
    }
 
+   //! Save window state into a snapshot section
+   void encode(IF::Buffer& out) const
+   {
+      out.push8(index);
+
+      for(const auto& win : window)
+      {
+         out.push16(win.pos.x);
+         out.push16(win.pos.y);
+         out.push16(win.size.x);
+         out.push16(win.size.y);
+         out.push16(win.cursor.x);
+         out.push16(win.cursor.y);
+         out.push16(win.left_margin);
+         out.push16(win.right_margin);
+         out.push16(win.newline_handler);
+         out.push16(win.interrupt_countdown);
+         out.push8(win.text_style);
+         out.push16(win.colour_data);
+         out.push8(win.font_number);
+         out.push8(win.font_size);
+         out.push8(win.attr);
+         out.push16(win.line_count);
+         out.push8(win.printer_enabled);
+         out.push8(win.buffering);
+      }
+   }
+
+   //! Restore window state from a snapshot section
+   bool decode(IF::Buffer& in)
+   {
+      unsigned index_ = in.read8();
+      ZWindow  window_[MAX_WINDOW];
+
+      for(auto& win : window_)
+      {
+         win.pos.x               = in.read16();
+         win.pos.y               = in.read16();
+         win.size.x              = in.read16();
+         win.size.y              = in.read16();
+         win.cursor.x            = in.read16();
+         win.cursor.y            = in.read16();
+         win.left_margin         = in.read16();
+         win.right_margin        = in.read16();
+         win.newline_handler     = in.read16();
+         win.interrupt_countdown = in.read16();
+         win.text_style          = in.read8();
+         win.colour_data         = in.read16();
+         win.font_number         = in.read8();
+         win.font_size           = in.read8();
+         win.attr                = in.read8();
+         win.line_count          = in.read16();
+         win.printer_enabled     = in.read8() != 0;
+         win.buffering           = in.read8() != 0;
+      }
+
+      if (!in.isOk() || (index_ >= MAX_WINDOW)) return false;
+
+      index = index_;
+      for(unsigned i = 0; i < MAX_WINDOW; i++)
+      {
+         window[i] = window_[i];
+      }
+
+      return true;
+   }
+
+   //! Bring a new console into line with the window state after a
+   //! decode(), when the console output is not being replayed
+   void restoreConsole(unsigned row, unsigned col)
+   {
+      unsigned top = window[UPPER_WINDOW].size.y != 0 ? window[LOWER_WINDOW].pos.y : 1;
+
+      console.setScrollRegion(top, getHeight());
+      console.moveCursor(row, col);
+      stream.setCol(col);
+   }
+
 private:
    Console&  console;
    Stream&   stream;
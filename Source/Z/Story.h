@@ -5,6 +5,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cctype>
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
@@ -135,12 +137,17 @@ public:
    //! Initialise VM memory for this Z-story image
    virtual void prepareMemory(IF::Memory& memory) const override
    {
+      // Nothing loaded yet
+      if (size() == 0) return;
+
       const Header* header = getHeader();
 
       memory.resize(header->getMemoryLimit());
       memory.limitWrite(0, header->stat);
 
-      memcpy(memory.data(), header, sizeof(Header));
+      // The whole image, static and high memory are not written again
+      // when a snapshot is restored
+      memcpy(memory.data(), data(), std::min(size_t(size()), memory.size()));
    }
 
    //! Reset VM memory for this Z-story image
@@ -176,6 +183,24 @@ public:
       ifhd_chunk->push(&ifhd, 13);
    }
 
+   //! Identify story by release, serial number and checksum
+   virtual std::string getIdentity() const override
+   {
+      const Header* header = getHeader();
+
+      char serial[7];
+      for(unsigned i = 0; i < 6; i++)
+      {
+         serial[i] = isalnum(header->serial[i]) ? header->serial[i] : '_';
+      }
+      serial[6] = '\0';
+
+      char text[32];
+      snprintf(text, sizeof(text), "%u.%s.%04X",
+               unsigned(header->release), serial, unsigned(header->checksum));
+      return text;
+   }
+
    //! Decode Quetzal header chunk
    virtual bool decodeQuetzalHeader(STB::IFF::Document& doc, uint32_t& pc) const override
    {
@@ -6,7 +6,9 @@
 #pragma once
 
 #include <cassert>
+#include <cstring>
 
+#include "common/Buffer.h"
 #include "common/Console.h"
 #include "common/Log.h"
 #include "common/Options.h"
@@ -30,7 +32,9 @@ public:
           unsigned       version_,
           IF::Memory&    memory_)
       : console(console_)
+      , printer(std::string(options_.log_prefix) + "print.log")
       , memory(memory_)
+      , snooper(std::string(options_.log_prefix) + "key.log")
    {
       console_enable                  = true;
       console_extended_colours_enable = version_ == 6;
@@ -53,8 +57,6 @@ public:
       {
          message_filter = WARNING;
       }
-
-      trace_enable = options_.trace;
    }
 
    bool getBuffering() const { return buffer_enable; }
@@ -169,6 +171,16 @@ public:
       memory.write16(memory_len_ptr, 0);
    }
 
+   //! Check if a character from the console is acceptable as input
+   static bool isInputChar(uint8_t ch)
+   {
+      return (ch == '\b') ||
+             (ch == '\n') ||
+             (ch == 27) ||
+             ((ch >= 32) && (ch <= 126)) ||
+             ((ch >= 129) && (ch <= 254));
+   }
+
    //! Read ZSCII character
    bool readChar(uint16_t& zscii, unsigned timeout_100ms, bool echo)
    {
@@ -176,46 +188,41 @@ public:
 
       uint8_t ch;
 
-      while(true)
+      do
       {
-         if (console.read(ch, timeout_100ms * 100))
-         {
-            if (ch == '\b')
-            {
-               break;
-            }
-            else if ((ch == '\n') ||
-                     (ch == 27) ||
-                     ((ch >= 32) && (ch <= 126)) ||
-                     ((ch >= 129) && (ch <= 254)))
-            {
-               if(echo)
-               {
-                  // Echo input to enabled output streams
-                  if(console_enable)                       console.write(ch);
-                  if(printer_enable && printer_echo_input) print(ch);
-                  if(snooper_enable)                       snooper.write(ch);
-                  if(trace_enable)                         trace_log.writePart("IN <= \"", ch, "\"\n");
-
-                  if(ch == '\n') buffer_col = 1;
-               }
-               break;
-            }
-         }
-         else
+         if (!console.read(ch, timeout_100ms * 100))
          {
             // Timeout
             return false;
          }
       }
+      while(!isInputChar(ch));
+
+      if(echo) echoChar(ch);
 
       zscii = ch;
       return true;
    }
 
+   //! Take a ZSCII character of input that was supplied without reading
+   //! the console
+   void inputChar(uint16_t& zscii, uint8_t ch, bool echo)
+   {
+      flushOutputBuffer();
+
+      if(echo) echoChar(ch);
+
+      zscii = ch;
+   }
+
+   //! Number of characters written by the story, to any stream
+   uint64_t getOutputCount() const { return output_count; }
+
    //! Write ZSCII character (may be buffered)
    void writeChar(uint16_t zscii)
    {
+      output_count++;
+
       if(memory_enable)
       {
          memory.write16(memory_len_ptr, memory.read16(memory_len_ptr) + 1);
@@ -229,8 +236,6 @@ public:
       {
          send(zscii);
       }
-
-      if(trace_enable)   trace_log.writePart("OUT => \"", char(zscii), "\"\n");
    }
 
    //! Delete the last character written
@@ -241,34 +246,6 @@ public:
       send('\b');
    }
 
-   //! Write signed integer value (may be buffered)
-   void writeNumber(int16_t value_)
-   {
-      int32_t value = value_; // So that 32768 can be represented
-
-      if(value < 0)
-      {
-         writeChar('-');
-         value = -value;
-      }
-
-      int place = 10000;
-
-      while((place > 1) && (value < place))
-      {
-         place = place / 10;
-      }
-
-      for(; place; place = place / 10)
-      {
-         unsigned digit = value / place;
-
-         writeChar('0' + digit);
-
-         value -= place * digit;
-      }
-   }
-
    void error(const std::string& text)
    {
       message(ERROR, text);
@@ -284,14 +261,55 @@ public:
       message(INFO, text);
    }
 
-   void trace(const std::string& string)
+   //! Save stream state into a snapshot section
+   void encode(IF::Buffer& out) const
    {
-      trace_log.write(string);
+      out.push8(console_enable);
+      out.push8(console_text_style);
+      out.push8(buffer_enable);
+      out.push8(buffer_size);
+      out.push(buffer, buffer_size);
+      out.push32(buffer_col);
+      out.push8(printer_enable);
+      out.push32(printer_newline_count);
+      out.push8(memory_enable);
+      out.push16(memory_width);
+      out.push32(memory_len_ptr);
+      out.push32(memory_ptr);
    }
 
-   Log& getTrace()
+   //! Restore stream state from a snapshot section
+   bool decode(IF::Buffer& in)
    {
-      return trace_log;
+      bool           console_enable_        = in.read8() != 0;
+      uint8_t        console_text_style_    = in.read8();
+      bool           buffer_enable_         = in.read8() != 0;
+      uint8_t        buffer_size_           = in.read8();
+      const uint8_t* buffer_                = in.read(buffer_size_);
+      unsigned       buffer_col_            = in.read32();
+      bool           printer_enable_        = in.read8() != 0;
+      unsigned       printer_newline_count_ = in.read32();
+      bool           memory_enable_         = in.read8() != 0;
+      int16_t        memory_width_          = in.read16();
+      uint32_t       memory_len_ptr_        = in.read32();
+      uint32_t       memory_ptr_            = in.read32();
+
+      if (!in.isOk() || (buffer_size_ > MAX_WORD_LENGTH)) return false;
+
+      console_enable        = console_enable_;
+      console_text_style    = console_text_style_;
+      buffer_enable         = buffer_enable_;
+      buffer_size           = buffer_size_;
+      memcpy(buffer, buffer_, buffer_size_);
+      buffer_col            = buffer_col_;
+      printer_enable        = printer_enable_;
+      printer_newline_count = printer_newline_count_;
+      memory_enable         = memory_enable_;
+      memory_width          = memory_width_;
+      memory_len_ptr        = memory_len_ptr_;
+      memory_ptr            = memory_ptr_;
+
+      return true;
    }
 
 private:
@@ -343,6 +361,18 @@ private:
       }
    }
 
+   //! Echo input to enabled output streams
+   void echoChar(uint8_t ch)
+   {
+      if (ch == '\b') return;
+
+      if(console_enable)                       console.write(ch);
+      if(printer_enable && printer_echo_input) print(ch);
+      if(snooper_enable)                       snooper.write(ch);
+
+      if(ch == '\n') buffer_col = 1;
+   }
+
    //! Flush any output that has been buffered
    void flushOutputBuffer()
    {
@@ -474,7 +504,7 @@ private:
    bool     printer_enable{false};
    bool     printer_echo_input{false};
    unsigned printer_newline_count{1};
-   Log      printer{"print.log"};
+   Log      printer;
 
    // Memory stream state
    bool        memory_enable{false};
@@ -485,13 +515,13 @@ private:
 
    // Input snooper stream state
    bool snooper_enable{false};
-   Log  snooper{"key.log"};
+   Log  snooper;
 
    // Debug state
-   bool trace_enable{false};
-   Log  trace_log{"trace.log"};
 
    MessageLevel message_filter{ERROR};
+
+   uint64_t output_count{0};
 };
 
 } // namespace Z
@@ -48,6 +48,8 @@ private:
    uint8_t  alphabet;
    uint16_t zscii{0};
 
+   uint64_t zchar_count{0};
+
    void reset(State state_, uint8_t alphabet_)
    {
       state      = state_;
@@ -178,6 +180,8 @@ private:
    //! Decode text packed into a 16bit word
    bool defetch16(const Writer& writer, uint16_t word)
    {
+      zchar_count += 3;
+
       decodeZChar(writer, (word >> 10) & 0x1F);
       decodeZChar(writer, (word >>  5) & 0x1F);
       decodeZChar(writer, (word >>  0) & 0x1F);
@@ -228,6 +232,9 @@ public:
       }
    }
 
+   //! Number of Z-characters decoded so far
+   uint64_t getDecodeCount() const { return zchar_count; }
+
    //! Write packed text starting at the given address
    uint32_t print(const Writer& writer, uint32_t addr)
    {
@@ -0,0 +1,52 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+
+#include "common/Log.h"
+#include "common/Observer.h"
+
+#include "Z/Disassembler.h"
+#include "Z/Story.h"
+
+namespace Z {
+
+//! Observer that logs each instruction, and the characters output and
+//! input, to "trace.log"
+class Tracer : public IF::NullObserver
+{
+public:
+   Tracer(const Options& options, const Story& story)
+      : IF::NullObserver(options, story)
+      , dis(story.getVersion())
+      , log(std::string(options.log_prefix) + "trace.log")
+   {
+   }
+
+   void instruction(IF::Memory::Address addr, const IF::Memory& memory)
+   {
+      dis.trace(text, addr, memory.data() + addr, memory.size() - addr);
+      log.write(text);
+   }
+
+   void output(uint16_t zscii)
+   {
+      log.writePart("OUT => \"", char(zscii), "\"\n");
+   }
+
+   void input(uint16_t zscii)
+   {
+      log.writePart("IN <= \"", char(zscii), "\"\n");
+   }
+
+private:
+   Disassembler dis;
+   Log          log;
+   std::string  text;
+};
+
+} // namespace Z
@@ -0,0 +1,242 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Control flow decoding, routine discovery and bounds of the Z disassembler
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Z/CodeMap.h"
+#include "Z/Disassembler.h"
+#include "Z/test/TestStory.h"
+
+#include "common/test/Check.h"
+
+using Bytes = std::vector<uint8_t>;
+
+//! Memory with the given code at address 0 and room for any instruction after it
+static Bytes memoryWith(const Bytes& code)
+{
+   Bytes memory(code);
+   memory.resize(code.size() + 32, 0);
+   return memory;
+}
+
+static Z::Disassembler::Flow flowOf(const Bytes& code, unsigned version = 5)
+{
+   Z::Disassembler dis(version);
+   Bytes           memory = memoryWith(code);
+   return dis.getFlow(memory.data(), memory.size(), 0);
+}
+
+static void testFlow()
+{
+   Z::Disassembler::Flow flow;
+
+   // print_num sp
+   flow = flowOf({0xE6, 0xBF, 0x00});
+   CHECK((flow.length == 3) && !flow.ends && !flow.jumps);
+
+   // call_vs #1234 -> sp
+   flow = flowOf({0xE0, 0x3F, 0x12, 0x34, 0x00});
+   CHECK((flow.length == 5) && !flow.ends && !flow.jumps);
+
+   // get_sibling L00 -> sp ?T +5, a store then a short branch
+   flow = flowOf({0xA1, 0x10, 0x00, 0xC5});
+   CHECK((flow.length == 4) && flow.jumps && (flow.target == (4 + 5 - 2)));
+
+   // jz L00 ?F -16, a long branch back
+   flow = flowOf({0xA0, 0x10, 0x3F, 0xF0});
+   CHECK((flow.length == 4) && flow.jumps && (flow.target == uint32_t(4 - 16 - 2)));
+
+   // jz L00 ?T rtrue, a return rather than a jump
+   flow = flowOf({0xA0, 0x10, 0xC1});
+   CHECK((flow.length == 3) && !flow.jumps && !flow.ends);
+
+   // check_arg_count #1 ?T +3
+   flow = flowOf({0xFF, 0x7F, 0x01, 0xC3});
+   CHECK((flow.length == 4) && flow.jumps && (flow.target == (4 + 3 - 2)));
+
+   // jump +5
+   flow = flowOf({0x8C, 0x00, 0x05});
+   CHECK((flow.length == 3) && flow.ends && flow.jumps && (flow.target == (3 + 5 - 2)));
+
+   // print "..." with a literal of two words
+   flow = flowOf({0xB2, 0x11, 0xAA, 0x94, 0xA5});
+   CHECK((flow.length == 5) && !flow.ends);
+
+   // print_ret "..."
+   flow = flowOf({0xB3, 0x94, 0xA5});
+   CHECK((flow.length == 3) && flow.ends);
+
+   flow = flowOf({0xB0});
+   CHECK((flow.length == 1) && flow.ends);
+
+   flow = flowOf({0xBA});
+   CHECK((flow.length == 1) && flow.ends);
+
+   // save_undo -> sp, an extended op
+   flow = flowOf({0xBE, 0x09, 0xFF, 0x00});
+   CHECK((flow.length == 4) && !flow.ends);
+
+   // save stores in version 4, branches in version 3 and is gone by version 5
+   flow = flowOf({0xB5, 0x00}, 4);
+   CHECK((flow.length == 2) && !flow.jumps);
+   flow = flowOf({0xB5, 0xC8}, 3);
+   CHECK((flow.length == 2) && flow.jumps && (flow.target == (2 + 8 - 2)));
+   CHECK(flowOf({0xB5}, 5).length == 0);
+
+   // Not instructions
+   CHECK(flowOf({0x00}).length == 0);
+   CHECK(flowOf({0xBE, 0x40}).length == 0);
+}
+
+static void testFlowBounds()
+{
+   Z::Disassembler dis(5);
+
+   // A literal that does not end before memory does
+   Bytes literal{0xB2, 0x11, 0xAA, 0x11, 0xAA};
+   literal.resize(64, 0x11);
+   CHECK(dis.getFlow(literal.data(), literal.size(), 0).length == 0);
+
+   // Too near the end of memory to be sure of decoding
+   Bytes code{0xE6, 0xBF, 0x00};
+   CHECK(dis.getFlow(code.data(), code.size(), 0).length == 0);
+   CHECK(dis.getFlow(code.data(), code.size(), 100).length == 0);
+}
+
+static void testRoutine()
+{
+   Z::Disassembler dis(5);
+   uint32_t        code;
+   uint32_t        end;
+
+   Bytes memory = memoryWith({
+      0x00,                // no locals
+      0xA0, 0x01, 0x43,    // jz L00 ?F +3, over the rtrue
+      0xB0,                // rtrue
+      0xE6, 0xBF, 0x00,    // print_num sp
+      0xB1,                // rfalse
+      0xB0                 // rtrue that can not be reached
+   });
+
+   CHECK(dis.findRoutine(memory.data(), memory.size(), 0, code, end));
+   CHECK((code == 1) && (end == 10));
+
+   // Locals with initial values before version 5
+   Z::Disassembler dis3(3);
+
+   memory = memoryWith({0x02, 0x00, 0x01, 0x00, 0x02, 0xB0});
+   CHECK(dis3.findRoutine(memory.data(), memory.size(), 0, code, end));
+   CHECK((code == 5) && (end == 6));
+
+   // Too many locals
+   memory = memoryWith({0x10, 0xB0});
+   CHECK(!dis.findRoutine(memory.data(), memory.size(), 0, code, end));
+
+   // A jump before the start of the code, into initial values that
+   // happen to decode as rtrue
+   memory = memoryWith({0x01, 0xB0, 0xB0, 0x8C, 0xFF, 0xFD});
+   CHECK(!dis3.findRoutine(memory.data(), memory.size(), 0, code, end));
+
+   // An illegal instruction
+   memory = memoryWith({0x00, 0xE6, 0xBF, 0x00, 0x00});
+   CHECK(!dis.findRoutine(memory.data(), memory.size(), 0, code, end));
+
+   // Code that runs to the end of memory
+   memory = Bytes(64, 0xB4);
+   memory[0] = 0x00;
+   CHECK(!dis.findRoutine(memory.data(), memory.size(), 0, code, end));
+
+   CHECK(!dis.findRoutine(memory.data(), memory.size(), 64, code, end));
+}
+
+static void testCodeMap()
+{
+   Bytes image = TestStory::build({
+      // Routine at CODE
+      0x00,
+      0xA0, 0x01, 0x43,                // jz L00 ?F +3
+      0xB0,                            // rtrue
+      0xE6, 0xBF, 0x00,                // print_num sp
+      0xB1,                            // rfalse
+      0xB0,                            // rtrue that can not be reached
+      0x00, 0x00,
+
+      // Routine at CODE + 0x0C
+      0x00,
+      0xB2, 0x11, 0xAA, 0x94, 0xA5,    // print "..."
+      0x8C, 0xFF, 0xFA,                // jump back to the print
+      0x00, 0x00, 0x00,
+
+      // Strings at CODE + 0x18
+      0x11, 0xAA, 0x94, 0xA5,
+      0x11, 0xAA, 0x11, 0xAA, 0x94, 0xA5, 0x00, 0x00,
+      0x11, 0xAA, 0x11, 0xAA, 0x11, 0xAA, 0x94, 0xA5
+   });
+
+   Z::CodeMap map(image.data(), image.size());
+
+   const auto& routines = map.getRoutines();
+   CHECK(routines.size() == 2);
+   if (routines.size() == 2)
+   {
+      CHECK((routines[0].addr == TestStory::CODE) &&
+            (routines[0].code == TestStory::CODE + 0x01) &&
+            (routines[0].end  == TestStory::CODE + 0x0A));
+
+      CHECK((routines[1].addr == TestStory::CODE + 0x0C) &&
+            (routines[1].code == TestStory::CODE + 0x0D) &&
+            (routines[1].end  == TestStory::CODE + 0x15));
+   }
+
+   const auto& strings = map.getStrings();
+   CHECK(strings.size() == 3);
+   if (strings.size() == 3)
+   {
+      CHECK((strings[0].addr == TestStory::CODE + 0x18) && (strings[0].end == TestStory::CODE + 0x1C));
+      CHECK((strings[1].addr == TestStory::CODE + 0x1C) && (strings[1].end == TestStory::CODE + 0x22));
+      CHECK((strings[2].addr == TestStory::CODE + 0x24) && (strings[2].end == TestStory::CODE + 0x2C));
+   }
+
+   unsigned instructions = 0;
+   map.forEachInstruction(routines[0], [&](uint32_t){ instructions++; });
+   CHECK(instructions == 5);
+
+   // Not a routine
+   CHECK(!map.addRoutine(TestStory::CODE + 0x18));
+   CHECK(map.addRoutine(TestStory::CODE + 0x0C));
+   CHECK(map.getRoutines().size() == 2);
+}
+
+static void testDisassembleBounds()
+{
+   Z::Disassembler dis(5);
+   std::string     text;
+
+   // A literal without an end stops at the end of the bytes given
+   Bytes literal{0xB2, 0x11, 0xAA, 0x11};
+   CHECK(dis.disassemble(text, 0, literal.data(), literal.size()) == literal.size());
+   CHECK(text.find("print") != std::string::npos);
+
+   CHECK(dis.trace(text, 0, literal.data(), literal.size()) == literal.size());
+   CHECK(text.find("B2 11 AA 11    ") != std::string::npos);
+
+   Bytes print{0xB2, 0x94, 0xA5, 0xE6};
+   CHECK(dis.disassemble(text, 0, print.data(), print.size()) == 3);
+}
+
+int main()
+{
+   testFlow();
+   testFlowBounds();
+   testRoutine();
+   testCodeMap();
+   testDisassembleBounds();
+
+   return Check::result();
+}
@@ -0,0 +1,146 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Resumable execution of the Z machine across requests for input
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "common/BufferConsole.h"
+#include "common/Options.h"
+
+#include "Z/Machine.h"
+#include "Z/Story.h"
+#include "Z/test/TestStory.h"
+
+#include "common/test/Check.h"
+
+//! Reads a key, then a line into the text buffer, then another key
+static const std::vector<uint8_t> CODE =
+{
+   0xE5, 0x7F, '>',                       // print_char '>'
+   0xF6, 0x7F, 0x01, 0x00,                // read_char 1 -> sp
+   0xE5, 0xBF, 0x00,                      // print_char sp
+   0xE4, 0x1F, 0x00, 0x40, 0x00, 0x00,    // aread TEXT 0 -> sp
+   0xE6, 0xBF, 0x00,                      // print_num sp
+   0xD0, 0x1F, 0x00, 0x41, 0x00, 0x00,    // loadb TEXT 1 -> sp
+   0xE6, 0xBF, 0x00,                      // print_num sp
+   0xD0, 0x1F, 0x00, 0x42, 0x00, 0x00,    // loadb TEXT 2 -> sp
+   0xE5, 0xBF, 0x00,                      // print_char sp
+   0xBB,                                  // new_line
+   0xF6, 0x7F, 0x01, 0x00,                // read_char 1 -> sp
+   0xE5, 0xBF, 0x00,                      // print_char sp
+   0xBB,                                  // new_line
+   0xBA                                   // quit
+};
+
+static const unsigned INSTRUCTIONS = 14;
+
+//! Input for the program and the response to each
+struct Step
+{
+   bool        need_line;  //!< Status before the input
+   std::string input;
+   std::string output;     //!< Output after the input
+};
+
+static const std::vector<Step> STEPS =
+{
+   {false, "k",           "k"},
+   // The rest of a line longer than the buffer is discarded, and not
+   // taken by the next read_char
+   {true,  "hello world", "hell\n134h\n"},
+   {false, "z",           "z\n"}
+};
+
+static bool isRunning(IF::Machine::Status status)
+{
+   return (status == IF::Machine::OUTPUT_READY) ||
+          (status == IF::Machine::QUANTUM_EXPIRED);
+}
+
+//! Run the machine until it stops, counting the calls to run()
+static IF::Machine::Status runToInput(Z::Machine& machine, unsigned quantum, unsigned& calls)
+{
+   IF::Machine::Status status;
+
+   do
+   {
+      status = machine.run(quantum);
+      calls++;
+   }
+   while(isRunning(status));
+
+   return status;
+}
+
+//! Play the program through, running the given number of instructions at a time
+static void play(const Z::Story& story, unsigned quantum)
+{
+   BufferConsole console;
+   Options       options;
+
+   options.batch.set(true);
+   options.seed.set(1);
+   options.cold.set(true);
+   options.save_dir.set(".");
+
+   Z::Machine machine(console, options, story);
+   machine.start(/* restore */ false);
+
+   unsigned            calls  = 0;
+   IF::Machine::Status status = runToInput(machine, quantum, calls);
+
+   CHECK(status == IF::Machine::NEED_CHAR);
+   CHECK(console.takeText() == ">");
+
+   for(const auto& step : STEPS)
+   {
+      IF::Machine::Status expect = step.need_line ? IF::Machine::NEED_LINE
+                                                  : IF::Machine::NEED_CHAR;
+      CHECK(status == expect);
+
+      // Nothing happens until the input is provided
+      CHECK(machine.run(quantum) == expect);
+      CHECK(console.takeText() == "");
+
+      if (step.need_line)
+         machine.provideLine(step.input);
+      else
+         machine.provideChar(step.input[0]);
+
+      status = runToInput(machine, quantum, calls);
+      CHECK(console.takeText() == step.output);
+   }
+
+   CHECK(status == IF::Machine::QUIT);
+   CHECK(machine.run(quantum) == IF::Machine::QUIT);
+   CHECK(machine.end());
+   CHECK(!machine.hasFailed());
+
+   CHECK(machine.getUsage().instructions == INSTRUCTIONS);
+
+   // No more than the quantum executed by each call
+   CHECK(calls >= (INSTRUCTIONS + quantum - 1) / quantum);
+}
+
+int main()
+{
+   std::vector<uint8_t> image = TestStory::build(CODE);
+
+   Z::Story story;
+   if (!CHECK(story.load(image.data(), image.size(), "test.z5"))) return Check::result();
+
+   play(story, UINT_MAX);
+   play(story, 1);
+   play(story, 3);
+
+   (void) remove(Z::Analysis::cacheFilename(".", story).c_str());
+
+   return Check::result();
+}
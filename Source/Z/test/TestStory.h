@@ -0,0 +1,59 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//! Minimal version 5 story for the unit tests. The given code starts at
+//! CODE, the start of high memory, and dynamic memory is all zero apart
+//! from the header and an empty text buffer at TEXT
+class TestStory
+{
+public:
+   static const uint16_t TEXT    = 0x0040; //!< Text buffer for aread
+   static const uint16_t GLOBALS = 0x0100; //!< Global variables
+   static const uint16_t CODE    = 0x1000; //!< Static and high memory start here
+
+   //! Characters the text buffer holds
+   static const uint8_t TEXT_MAX = 4;
+
+   static std::vector<uint8_t> build(const std::vector<uint8_t>& code)
+   {
+      // The length of a version 5 story is a multiple of 4 bytes
+      std::vector<uint8_t> image((CODE + code.size() + 3) & ~3, 0);
+
+      image[0x00] = 5;
+      setWord(image, 0x04, CODE);
+      setWord(image, 0x06, CODE);
+      setWord(image, 0x0C, GLOBALS);
+      setWord(image, 0x0E, CODE);
+      setWord(image, 0x1A, image.size() / 4);
+
+      image[TEXT] = TEXT_MAX;
+
+      for(size_t i = 0; i < code.size(); i++)
+      {
+         image[CODE + i] = code[i];
+      }
+
+      uint16_t checksum = 0;
+      for(size_t i = 0x40; i < image.size(); i++)
+      {
+         checksum += image[i];
+      }
+      setWord(image, 0x1C, checksum);
+
+      return image;
+   }
+
+private:
+   static void setWord(std::vector<uint8_t>& image, size_t addr, uint16_t value)
+   {
+      image[addr]     = uint8_t(value >> 8);
+      image[addr + 1] = uint8_t(value);
+   }
+};
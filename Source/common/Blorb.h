@@ -5,25 +5,16 @@
 
 #pragma once
 
-#include "STB/IFF.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
 
+//! Blorb resource file, only the chunk headers and resource index are read
+//! when the file is opened, resource data is read on demand
 class Blorb
 {
-private:
-   //! Resource index entry
-   struct RIdx
-   {
-      struct Entry
-      {
-         STB::IFF::Ident  type;
-         STB::IFF::UInt32 index;
-         STB::IFF::UInt32 offset;
-      };
-
-      STB::IFF::UInt32 num_entries;
-      Entry            entry[0];
-   };
-
 public:
    enum class Resource
    {
@@ -32,47 +23,242 @@ public:
       SND
    };
 
+   //! Resource index entry
+   struct Entry
+   {
+      Resource resource;
+      unsigned number;
+      uint32_t offset; //!< File offset of the resource chunk header
+   };
+
    Blorb() = default;
 
-   bool findResource(const std::string& filename,
+   ~Blorb()
+   {
+      close();
+   }
+
+   //! Return true if a Blorb file is open
+   bool isOpen() const { return fp != nullptr; }
+
+   //! Get the release number from the RelN chunk (0 if not present)
+   uint16_t getRelease() const { return release; }
+
+   //! Open a Blorb file
+   bool open(const std::string& filename_)
+   {
+      if (isOpen() && (filename == filename_)) return true;
+
+      close();
+
+      fp = fopen(filename_.c_str(), "r");
+      if (fp == nullptr) return false;
+
+      long end = (fseek(fp, 0, SEEK_END) == 0) ? ftell(fp) : -1;
+      file_size = end < 0 ? 0 : uint64_t(end);
+
+      if (!readIndex())
+      {
+         close();
+         return false;
+      }
+
+      filename = filename_;
+      return true;
+   }
+
+   //! Close the Blorb file
+   void close()
+   {
+      if (fp != nullptr)
+      {
+         fclose(fp);
+         fp = nullptr;
+      }
+
+      filename  = "";
+      file_size = 0;
+      release   = 0;
+      index.clear();
+   }
+
+   //! Number of resources of the given type
+   unsigned count(Resource resource) const
+   {
+      unsigned n = 0;
+
+      for(const auto& entry : index)
+      {
+         if (entry.resource == resource) n++;
+      }
+
+      return n;
+   }
+
+   //! Find an entry in the resource index
+   const Entry* find(Resource resource, unsigned number) const
+   {
+      for(const auto& entry : index)
+      {
+         if ((entry.resource == resource) && (entry.number == number))
+         {
+            return &entry;
+         }
+      }
+
+      return nullptr;
+   }
+
+   //! Read the type and size of a resource chunk
+   //! \return false if the chunk can not be read or runs past the end of the file
+   bool readChunkHeader(const Entry& entry, std::string& type, uint32_t& size)
+   {
+      uint8_t header[8];
+
+      if (!readAt(entry.offset, header, sizeof(header))) return false;
+
+      type.assign((const char*)header, 4);
+      size = getBig32(header + 4);
+      return isInFile(entry.offset + 8, size);
+   }
+
+   //! Read bytes from the body of a resource chunk
+   bool readChunk(const Entry& entry, uint32_t offset, void* buffer, uint32_t size)
+   {
+      return readAt(entry.offset + 8 + offset, buffer, size);
+   }
+
+   //! Find a resource returning the chunk type and offset of the chunk body
+   bool findResource(const std::string& filename_,
                      Resource           resource,
-                     unsigned           index,
+                     unsigned           number,
                      std::string&       type,
                      uint32_t&          offset)
    {
-      STB::IFF::Document doc;
+      if (!open(filename_)) return false;
 
-      if (!doc.read(filename, "FORM", "IFRS"))
-         return false;
+      const Entry* entry = find(resource, number);
+      if (entry == nullptr) return false;
+
+      uint32_t size;
+      if (!readChunkHeader(*entry, type, size)) return false;
+
+      offset = entry->offset + 8;
+      return true;
+   }
+
+   //! Decode a big-endian 32-bit value
+   static uint32_t getBig32(const uint8_t* raw)
+   {
+      return (uint32_t(raw[0]) << 24) |
+             (uint32_t(raw[1]) << 16) |
+             (uint32_t(raw[2]) <<  8) |
+                       raw[3];
+   }
+
+   //! Decode a big-endian 16-bit value
+   static uint16_t getBig16(const uint8_t* raw)
+   {
+      return (uint16_t(raw[0]) << 8) | raw[1];
+   }
+
+private:
+   std::string        filename{};
+   FILE*              fp{nullptr};
+   uint64_t           file_size{0};
+   uint16_t           release{0};
+   std::vector<Entry> index;
+
+   //! Check that a range of bytes lies within the file
+   bool isInFile(uint64_t offset, uint64_t size) const
+   {
+      return (offset + size) <= file_size;
+   }
+
+   //! Read bytes from an absolute file offset
+   bool readAt(uint32_t offset, void* buffer, uint32_t size)
+   {
+      if (fp == nullptr) return false;
+      if (fseek(fp, offset, SEEK_SET) != 0) return false;
+      return fread(buffer, size, 1, fp) == 1;
+   }
 
-      const RIdx* ridx = doc.load<RIdx>("RIdx");
-      if (ridx == nullptr) return false;
+   //! Walk the top-level chunk headers, loading just the RIdx and RelN chunks
+   bool readIndex()
+   {
+      uint8_t header[12];
 
-      const char* resource_type{};
+      if (!readAt(0, header, sizeof(header))) return false;
 
-      switch(resource)
+      if ((memcmp(header, "FORM", 4) != 0) || (memcmp(header + 8, "IFRS", 4) != 0))
       {
-      case Resource::EXEC: resource_type = "Exec"; break;
-      case Resource::PICT: resource_type = "Pict"; break;
-      case Resource::SND:  resource_type = "Snd "; break;
+         return false;
       }
 
-      for(uint32_t i = 0; i<ridx->num_entries; i++)
+      uint32_t end    = getBig32(header + 4) + 8;
+      uint32_t offset = sizeof(header);
+
+      while((offset + 8) <= end)
       {
-         if((ridx->entry[i].type == resource_type) &&
-            (ridx->entry[i].index == index))
+         uint8_t chunk[8];
+         if (!readAt(offset, chunk, sizeof(chunk))) break;
+
+         uint32_t size = getBig32(chunk + 4);
+
+         if (memcmp(chunk, "RIdx", 4) == 0)
          {
-            STB::IFF::Chunk* ch = doc.findChunk(ridx->entry[i].offset);
-            if (ch != nullptr)
+            if (!readRIdx(offset + 8, size)) return false;
+         }
+         else if (memcmp(chunk, "RelN", 4) == 0)
+         {
+            uint8_t raw[2];
+            if (readAt(offset + 8, raw, sizeof(raw)))
             {
-               ch->getType().get(type);
-               offset = ridx->entry[i].offset + 8;
-               return true;
+               release = getBig16(raw);
             }
          }
+
+         // Chunks are padded to an even length
+         offset += 8 + size + (size & 1);
       }
 
-      return false;
+      return true;
    }
-};
 
+   //! Decode the resource index chunk
+   bool readRIdx(uint32_t offset, uint32_t size)
+   {
+      if ((size < 4) || !isInFile(offset, size)) return false;
+
+      std::vector<uint8_t> raw(size);
+
+      if (!readAt(offset, raw.data(), size)) return false;
+
+      uint32_t num_entries = getBig32(raw.data());
+      if (num_entries > ((size - 4) / 12)) return false;
+
+      index.reserve(num_entries);
+
+      for(uint32_t i = 0; i < num_entries; i++)
+      {
+         const uint8_t* entry = raw.data() + 4 + i * 12;
+         Entry          next;
+
+         if (memcmp(entry, "Exec", 4) == 0)
+            next.resource = Resource::EXEC;
+         else if (memcmp(entry, "Pict", 4) == 0)
+            next.resource = Resource::PICT;
+         else if (memcmp(entry, "Snd ", 4) == 0)
+            next.resource = Resource::SND;
+         else
+            continue;
+
+         next.number = getBig32(entry + 4);
+         next.offset = getBig32(entry + 8);
+
+         index.push_back(next);
+      }
+
+      return true;
+   }
+};
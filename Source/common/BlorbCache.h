@@ -0,0 +1,280 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common/Blorb.h"
+
+//! Cache of picture and sound resources from a Blorb file.
+//  Dimensions are read from the image headers without loading the image.
+//  Resource data is loaded on first use into an LRU cache of bounded size
+class BlorbCache
+{
+public:
+   static const size_t DEFAULT_BUDGET = 4 * 1024 * 1024;
+
+   //! A cached picture or sound resource
+   struct Resource
+   {
+      std::string          type{};       //!< Chunk type e.g. "PNG ", "JPEG", "Rect", "OGGV"
+      uint32_t             size{0};      //!< Size of the chunk body (bytes)
+      bool                 have_info{false};
+      bool                 valid{false};
+      unsigned             width{0};
+      unsigned             height{0};
+      std::vector<uint8_t> data{};       //!< Chunk body when loaded
+      uint32_t             last_use{0};
+   };
+
+   BlorbCache(size_t budget_ = DEFAULT_BUDGET)
+      : budget(budget_)
+   {
+   }
+
+   //! Open a Blorb file
+   bool open(const std::string& filename)
+   {
+      pictures.clear();
+      sounds.clear();
+      loaded_bytes = 0;
+
+      return blorb.open(filename);
+   }
+
+   //! Number of pictures available
+   unsigned numPictures() const { return blorb.count(Blorb::Resource::PICT); }
+
+   //! Release number of the resource file
+   uint16_t getRelease() const { return blorb.getRelease(); }
+
+   //! Current size of loaded resource data (bytes)
+   size_t getLoadedBytes() const { return loaded_bytes; }
+
+   //! Get picture dimensions, from the image header only
+   bool getPictureSize(unsigned number, unsigned& width, unsigned& height)
+   {
+      Resource* pict = getInfo(Blorb::Resource::PICT, number);
+      if ((pict == nullptr) || !pict->valid) return false;
+
+      width  = pict->width;
+      height = pict->height;
+      return true;
+   }
+
+   //! Get a picture, loading it on first use
+   const Resource* getPicture(unsigned number)
+   {
+      return load(Blorb::Resource::PICT, number);
+   }
+
+   //! Get a sound, loading it on first use
+   const Resource* getSound(unsigned number)
+   {
+      return load(Blorb::Resource::SND, number);
+   }
+
+   //! Hint that a picture will be drawn soon
+   void prefetchPicture(unsigned number)
+   {
+      (void) load(Blorb::Resource::PICT, number);
+   }
+
+private:
+   //! Number of following picture headers read on an info miss. Games
+   //  that query picture_data tend to walk the picture numbers in order
+   static const unsigned READ_AHEAD = 16;
+
+   using Map = std::map<unsigned, Resource>;
+
+   Blorb    blorb;
+   Map      pictures;
+   Map      sounds;
+   size_t   budget;
+   size_t   loaded_bytes{0};
+   uint32_t use_count{0};
+
+   Map& getMap(Blorb::Resource type)
+   {
+      return type == Blorb::Resource::PICT ? pictures : sounds;
+   }
+
+   //! Get resource information, reading the resource header if necessary
+   Resource* getInfo(Blorb::Resource type, unsigned number)
+   {
+      Map& map = getMap(type);
+
+      auto it = map.find(number);
+      if (it != map.end()) return &it->second;
+
+      if (blorb.find(type, number) == nullptr) return nullptr;
+
+      if (type == Blorb::Resource::PICT)
+      {
+         for(unsigned i = 1; i <= READ_AHEAD; i++)
+         {
+            if (map.find(number + i) == map.end())
+            {
+               (void) readInfo(type, number + i);
+            }
+         }
+      }
+
+      return readInfo(type, number);
+   }
+
+   //! Read and decode the header of a resource
+   Resource* readInfo(Blorb::Resource type, unsigned number)
+   {
+      const Blorb::Entry* entry = blorb.find(type, number);
+      if (entry == nullptr) return nullptr;
+
+      Resource& res = getMap(type)[number];
+
+      res.have_info = true;
+      res.valid     = blorb.readChunkHeader(*entry, res.type, res.size);
+
+      if (res.valid && (type == Blorb::Resource::PICT))
+      {
+         if (res.type == "PNG ")
+            res.valid = readPNGSize(*entry, res);
+         else if (res.type == "JPEG")
+            res.valid = readJPEGSize(*entry, res);
+         else if (res.type == "Rect")
+            res.valid = readRectSize(*entry, res);
+         else
+            res.valid = false;
+      }
+
+      return &res;
+   }
+
+   //! Load the resource data, evicting least recently used data if over budget
+   const Resource* load(Blorb::Resource type, unsigned number)
+   {
+      Resource* res = getInfo(type, number);
+      if ((res == nullptr) || !res->valid) return nullptr;
+
+      res->last_use = ++use_count;
+
+      if (res->data.empty() && (res->size != 0))
+      {
+         // Not loaded if larger than the whole cache
+         if (res->size > budget) return nullptr;
+
+         evict(res->size);
+
+         res->data.resize(res->size);
+         if (!blorb.readChunk(*blorb.find(type, number), 0, res->data.data(), res->size))
+         {
+            res->data.clear();
+            res->data.shrink_to_fit();
+            res->valid = false;
+            return nullptr;
+         }
+
+         loaded_bytes += res->size;
+      }
+
+      return res;
+   }
+
+   //! Free least recently used data until there is room for the given size
+   void evict(size_t size)
+   {
+      while((loaded_bytes + size) > budget)
+      {
+         Resource* oldest = nullptr;
+
+         for(Map* map : {&pictures, &sounds})
+         {
+            for(auto& it : *map)
+            {
+               Resource& res = it.second;
+               if (!res.data.empty() && ((oldest == nullptr) || (res.last_use < oldest->last_use)))
+               {
+                  oldest = &res;
+               }
+            }
+         }
+
+         if (oldest == nullptr) break;
+
+         loaded_bytes -= oldest->data.size();
+         oldest->data.clear();
+         oldest->data.shrink_to_fit();
+      }
+   }
+
+   //! Width and height from the PNG IHDR chunk
+   bool readPNGSize(const Blorb::Entry& entry, Resource& res)
+   {
+      uint8_t raw[24];
+
+      if ((res.size < sizeof(raw)) || !blorb.readChunk(entry, 0, raw, sizeof(raw))) return false;
+      if (memcmp(raw + 12, "IHDR", 4) != 0) return false;
+
+      res.width  = Blorb::getBig32(raw + 16);
+      res.height = Blorb::getBig32(raw + 20);
+      return true;
+   }
+
+   //! Width and height from the JPEG start-of-frame segment
+   bool readJPEGSize(const Blorb::Entry& entry, Resource& res)
+   {
+      uint8_t  raw[9];
+      uint32_t offset = 2; // Skip SOI marker
+
+      while((offset + 4) <= res.size)
+      {
+         if (!blorb.readChunk(entry, offset, raw, 4)) return false;
+         if (raw[0] != 0xFF) return false;
+
+         uint8_t marker = raw[1];
+         if (marker == 0xFF)
+         {
+            // Fill byte
+            offset++;
+            continue;
+         }
+
+         uint16_t length = Blorb::getBig16(raw + 2);
+
+         if ((marker >= 0xC0) && (marker <= 0xCF) &&
+             (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC))
+         {
+            if (((offset + sizeof(raw)) > res.size) ||
+                !blorb.readChunk(entry, offset, raw, sizeof(raw))) return false;
+
+            res.height = Blorb::getBig16(raw + 5);
+            res.width  = Blorb::getBig16(raw + 7);
+            return true;
+         }
+
+         offset += 2 + length;
+      }
+
+      return false;
+   }
+
+   //! Width and height from a placeholder Rect chunk
+   bool readRectSize(const Blorb::Entry& entry, Resource& res)
+   {
+      uint8_t raw[8];
+
+      if ((res.size < sizeof(raw)) || !blorb.readChunk(entry, 0, raw, sizeof(raw))) return false;
+
+      res.width  = Blorb::getBig32(raw);
+      res.height = Blorb::getBig32(raw + 4);
+
+      // Nothing to load for a placeholder
+      res.size = 0;
+      return true;
+   }
+};
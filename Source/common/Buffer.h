@@ -0,0 +1,179 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace IF {
+
+//! Byte buffer with big-endian encoding and bounds checked decoding
+class Buffer
+{
+public:
+   Buffer() = default;
+
+   //! Get buffer size (bytes)
+   size_t size() const { return raw.size(); }
+
+   //! Check if buffer is empty
+   bool empty() const { return raw.empty(); }
+
+   //! Pointer to the raw buffer contents
+   const uint8_t* data() const { return raw.data(); }
+
+   //! Return false if a read has run past the end of the buffer
+   bool isOk() const { return ok; }
+
+   //! Return true when all of the buffer has been read
+   bool isEnd() const { return read_pos >= raw.size(); }
+
+   //! Discard contents
+   void clear()
+   {
+      raw.clear();
+      rewind();
+   }
+
+   //! Restart reading from the start of the buffer
+   void rewind()
+   {
+      read_pos = 0;
+      ok       = true;
+   }
+
+   //! Reserve space for the given size (bytes)
+   void reserve(size_t size) { raw.reserve(size); }
+
+   //! Release memory held by the buffer
+   void release()
+   {
+      std::vector<uint8_t>().swap(raw);
+      rewind();
+   }
+
+   void push8(uint8_t value) { raw.push_back(value); }
+
+   void push16(uint16_t value)
+   {
+      push8(uint8_t(value >> 8));
+      push8(uint8_t(value));
+   }
+
+   void push32(uint32_t value)
+   {
+      push16(uint16_t(value >> 16));
+      push16(uint16_t(value));
+   }
+
+   void push64(uint64_t value)
+   {
+      push32(uint32_t(value >> 32));
+      push32(uint32_t(value));
+   }
+
+   void push(const void* data_, size_t size_)
+   {
+      const uint8_t* bytes = (const uint8_t*)data_;
+      raw.insert(raw.end(), bytes, bytes + size_);
+   }
+
+   //! Push a length prefixed string
+   void pushString(const std::string& text)
+   {
+      push32(text.size());
+      push(text.data(), text.size());
+   }
+
+   uint8_t read8()
+   {
+      if (read_pos >= raw.size())
+      {
+         ok = false;
+         return 0;
+      }
+      return raw[read_pos++];
+   }
+
+   uint16_t read16()
+   {
+      uint16_t value = read8() << 8;
+      return value | read8();
+   }
+
+   uint32_t read32()
+   {
+      uint32_t value = uint32_t(read16()) << 16;
+      return value | read16();
+   }
+
+   uint64_t read64()
+   {
+      uint64_t value = uint64_t(read32()) << 32;
+      return value | read32();
+   }
+
+   //! Read a block of bytes, returning a pointer into the buffer
+   const uint8_t* read(size_t size_)
+   {
+      if ((raw.size() - read_pos) < size_)
+      {
+         ok = false;
+         return nullptr;
+      }
+
+      const uint8_t* ptr = raw.data() + read_pos;
+      read_pos += size_;
+      return ptr;
+   }
+
+   //! Read a length prefixed string
+   std::string readString()
+   {
+      uint32_t       len   = read32();
+      const uint8_t* bytes = read(len);
+      return bytes != nullptr ? std::string((const char*)bytes, len) : "";
+   }
+
+   //! Write buffer contents to a file
+   bool write(const std::string& path) const
+   {
+      FILE* fp = fopen(path.c_str(), "w");
+      if (fp == nullptr) return false;
+
+      bool ok_ = raw.empty() || (fwrite(raw.data(), raw.size(), 1, fp) == 1);
+      return (fclose(fp) == 0) && ok_;
+   }
+
+   //! Replace buffer contents with the contents of a file
+   bool read(const std::string& path)
+   {
+      clear();
+
+      FILE* fp = fopen(path.c_str(), "r");
+      if (fp == nullptr) return false;
+
+      uint8_t block[4096];
+      size_t  n;
+      while((n = fread(block, 1, sizeof(block), fp)) != 0)
+      {
+         push(block, n);
+      }
+
+      bool ok_ = ferror(fp) == 0;
+      fclose(fp);
+      return ok_;
+   }
+
+private:
+   std::vector<uint8_t> raw;
+   size_t               read_pos{0};
+   bool                 ok{true};
+};
+
+} // namespace IF
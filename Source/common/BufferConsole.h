@@ -0,0 +1,243 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/Console.h"
+
+//! Console without a terminal. Keeps a character grid of the screen,
+//! collects the text written to the main (scrolling) window and notes
+//! window events, for use by programs that drive a game directly
+class BufferConsole : public Console
+{
+public:
+   //! Change to the layout of the screen
+   struct Event
+   {
+      enum Type
+      {
+         CLEAR,   //!< Screen cleared
+         SPLIT    //!< Lines above the main window changed, value is the new number
+      };
+
+      Type     type;
+      unsigned value;
+   };
+
+   BufferConsole(unsigned lines_ = 24, unsigned cols_ = 80)
+      : lines(lines_)
+      , cols(cols_)
+      , bottom(lines_)
+   {
+      grid.resize(lines, std::string(cols, ' '));
+   }
+
+   //! Reserve lines at the top of the screen for a status line that is
+   //! not part of the main window (needed for v1-3 Z stories)
+   void setStatusLines(unsigned n) { status_lines = n; }
+
+   //! Return the text written to the main window since the previous call
+   std::string takeText()
+   {
+      std::string text_;
+      std::swap(text_, text);
+      return text_;
+   }
+
+   //! Also keep the text written to the main window for takeTranscript()
+   void enableTranscript() { transcript_enable = true; }
+
+   //! Return the text written to the main window since the previous call,
+   //! independently of takeText()
+   std::string takeTranscript()
+   {
+      std::string transcript_;
+      std::swap(transcript_, transcript);
+      return transcript_;
+   }
+
+   //! Return the events since the previous call
+   std::vector<Event> takeEvents()
+   {
+      std::vector<Event> events_;
+      std::swap(events_, events);
+      return events_;
+   }
+
+   //! Return a line of the screen, with trailing spaces removed
+   std::string getLine(unsigned line) const
+   {
+      if ((line < 1) || (line > lines)) return "";
+
+      const std::string& row = grid[line - 1];
+      size_t end = row.find_last_not_of(' ');
+      return end == std::string::npos ? "" : row.substr(0, end + 1);
+   }
+
+   //! Replace a line of the screen
+   void setLine(unsigned line_, const std::string& row)
+   {
+      if ((line_ < 1) || (line_ > lines)) return;
+
+      grid[line_ - 1] = row.substr(0, cols);
+      grid[line_ - 1].resize(cols, ' ');
+   }
+
+   //! Number of lines above the main window
+   unsigned getUpperLines() const { return getFirstTextLine() - 1; }
+
+   //! Return the top line of the screen if it is not part of the main window
+   std::string getStatusLine() const
+   {
+      return getFirstTextLine() > 1 ? getLine(1) : "";
+   }
+
+   virtual unsigned getAttr(Attr attr) const override
+   {
+      switch(attr)
+      {
+      case LINES:        return lines;
+      case COLS:         return cols;
+      case FONT_HEIGHT:  return 1;
+      case FONT_WIDTH:   return 1;
+      case FIXED_FONT:   return true;
+      case READ_TIMEOUT: return true;
+      default:           return 0;
+      }
+   }
+
+   virtual void getCursorPos(unsigned& line_, unsigned& col_) override
+   {
+      line_ = line;
+      col_  = col;
+   }
+
+   virtual bool setFont(unsigned font_idx) override { return font_idx == 1; }
+
+   virtual void setFontStyle(FontStyle) override {}
+
+   virtual void setBackgroundColour(Colour) override {}
+
+   virtual void setForegroundColour(Colour) override {}
+
+   virtual void setCursorVisibility(bool) override {}
+
+   virtual void moveCursor(unsigned line_, unsigned col_) override
+   {
+      line = line_ < 1 ? 1 : line_ > lines ? lines : line_;
+      col  = col_  < 1 ? 1 : col_;
+   }
+
+   virtual void eraseLine() override
+   {
+      if (col <= cols)
+      {
+         grid[line - 1].replace(col - 1, cols - col + 1, cols - col + 1, ' ');
+      }
+   }
+
+   virtual void waitForKey() override {}
+
+   //! There is never any input from this console
+   virtual bool read(uint8_t&, unsigned) override { return false; }
+
+   virtual void setScrollRegion(unsigned top_, unsigned bottom_) override
+   {
+      top    = top_ < 1 ? 1 : top_;
+      bottom = bottom_ > lines ? lines : bottom_;
+
+      events.push_back(Event{Event::SPLIT, top - 1});
+   }
+
+   virtual void clearLines(unsigned first, unsigned n) override
+   {
+      for(unsigned i = first; (i < (first + n)) && (i <= lines); i++)
+      {
+         if (i >= 1) grid[i - 1].assign(cols, ' ');
+      }
+   }
+
+   virtual void clear() override
+   {
+      for(auto& row : grid)
+      {
+         row.assign(cols, ' ');
+      }
+
+      line = 1;
+      col  = 1;
+
+      events.push_back(Event{Event::CLEAR, 0});
+   }
+
+   virtual void write(uint8_t ch) override
+   {
+      if (line >= getFirstTextLine())
+      {
+         text += char(ch);
+         if (transcript_enable) transcript += char(ch);
+      }
+
+      if (ch == '\n')
+      {
+         newLine();
+      }
+      else if (ch == '\b')
+      {
+         if (col > 1) col--;
+      }
+      else
+      {
+         if (col > cols) newLine();
+
+         grid[line - 1][col - 1] = ch;
+         col++;
+      }
+   }
+
+private:
+   unsigned                 lines;
+   unsigned                 cols;
+   unsigned                 line{1};
+   unsigned                 col{1};
+   unsigned                 top{1};
+   unsigned                 bottom;
+   unsigned                 status_lines{0};
+   std::vector<std::string> grid;
+   std::string              text;
+   bool                     transcript_enable{false};
+   std::string              transcript;
+   std::vector<Event>       events;
+
+   //! First line of the main window
+   unsigned getFirstTextLine() const
+   {
+      return top > status_lines ? top : status_lines + 1;
+   }
+
+   //! Move to the start of the next line, scrolling the scroll region
+   //! at the bottom
+   void newLine()
+   {
+      col = 1;
+
+      if (line != bottom)
+      {
+         if (line < lines) line++;
+         return;
+      }
+
+      for(unsigned i = top; i < bottom; i++)
+      {
+         grid[i - 1] = grid[i];
+      }
+
+      grid[bottom - 1].assign(cols, ' ');
+   }
+};
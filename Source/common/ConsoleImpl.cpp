@@ -9,8 +9,6 @@
 
 #include "PLT/KeyCode.h"
 
-static FILE* input_fp = nullptr;
-
 bool ConsoleImpl::openInputFile(const char* filename)
 {
    input_fp = fopen(filename, "r");
@@ -7,6 +7,7 @@
 
 #include <cctype>
 #include <cstdint>
+#include <cstdio>
 
 #include "TRM/Curses.h"
 #include "TRM/Device.h"
@@ -300,6 +301,7 @@ private:
    }
 
    TRM::Curses curses;
+   FILE*       input_fp{nullptr};
    unsigned    num_fonts_avail{1};
    unsigned    scroll{0};
    bool        colours_avail{true};
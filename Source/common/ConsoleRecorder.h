@@ -0,0 +1,298 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "common/Buffer.h"
+#include "common/Console.h"
+
+//! Console that forwards to another console and can record the output
+//! operations so that they can be replayed later. Also notes when there
+//! has been any output
+class ConsoleRecorder : public Console
+{
+public:
+   //! Give up recording beyond this size (bytes)
+   static const size_t MAX_RECORD_SIZE = 1024 * 1024;
+
+   ConsoleRecorder(Console& target_)
+      : target(target_)
+   {
+   }
+
+   //! Return true while output operations are being recorded
+   bool isRecording() const { return recording; }
+
+   //! Number of characters written to the console so far
+   uint64_t getWriteCount() const { return write_count; }
+
+   //! Memory held by the recording (bytes)
+   size_t getRecordSize() const { return record.capacity(); }
+
+   //! Start recording output operations
+   void start()
+   {
+      record.clear();
+      recording = true;
+   }
+
+   //! Stop recording, returns false if the recording had to be abandoned
+   bool stop()
+   {
+      bool ok = recording;
+      recording = false;
+      return ok;
+   }
+
+   //! Return true if there has been any output since the previous call
+   bool takeOutput()
+   {
+      bool output_ = output;
+      output = false;
+      return output_;
+   }
+
+   //! Append the recorded output operations to a buffer
+   void encode(IF::Buffer& buffer) const
+   {
+      buffer.push32(record.size());
+      buffer.push(record.data(), record.size());
+   }
+
+   //! Replay output operations from a buffer
+   bool replay(IF::Buffer& buffer)
+   {
+      uint32_t       size = buffer.read32();
+      const uint8_t* ops  = buffer.read(size);
+      if (ops == nullptr) return false;
+
+      for(uint32_t i = 0; i < size; )
+      {
+         Op op = Op(ops[i++]);
+
+         // Characters are recorded as bytes, other arguments as 16-bit values
+         unsigned num_args = getNumArgs(op);
+         unsigned arg_size = op == WRITE ? 1 : 2;
+         if ((i + num_args * arg_size) > size) return false;
+
+         uint16_t arg[2];
+         if (op == WRITE)
+         {
+            arg[0] = ops[i++];
+         }
+         else
+         {
+            for(unsigned j = 0; j < num_args; j++)
+            {
+               arg[j] = (ops[i] << 8) | ops[i + 1];
+               i += 2;
+            }
+         }
+
+         switch(op)
+         {
+         case WRITE:          target.write(arg[0]);                         break;
+         case SET_FONT:       (void) target.setFont(arg[0]);                break;
+         case SET_FONT_STYLE: target.setFontStyle(arg[0]);                  break;
+         case SET_BG_COLOUR:  target.setBackgroundColour(Colour(arg[0]));   break;
+         case SET_FG_COLOUR:  target.setForegroundColour(Colour(arg[0]));   break;
+         case SET_CURSOR_VIS: target.setCursorVisibility(arg[0] != 0);      break;
+         case MOVE_CURSOR:    target.moveCursor(arg[0], arg[1]);            break;
+         case ERASE_LINE:     target.eraseLine();                           break;
+         case SCROLL_REGION:  target.setScrollRegion(arg[0], arg[1]);       break;
+         case CLEAR_LINES:    target.clearLines(arg[0], arg[1]);            break;
+         case CLEAR:          target.clear();                               break;
+
+         default: return false;
+         }
+      }
+
+      return true;
+   }
+
+   virtual unsigned getAttr(Attr attr) const override
+   {
+      return target.getAttr(attr);
+   }
+
+   virtual void getCursorPos(unsigned& line, unsigned& col) override
+   {
+      target.getCursorPos(line, col);
+   }
+
+   virtual bool setFont(unsigned font_idx) override
+   {
+      log(SET_FONT, font_idx);
+      return target.setFont(font_idx);
+   }
+
+   virtual void setFontStyle(FontStyle style_bit_mask) override
+   {
+      log(SET_FONT_STYLE, style_bit_mask);
+      target.setFontStyle(style_bit_mask);
+   }
+
+   virtual void setBackgroundColour(Colour colour) override
+   {
+      log(SET_BG_COLOUR, colour);
+      target.setBackgroundColour(colour);
+   }
+
+   virtual void setForegroundColour(Colour colour) override
+   {
+      log(SET_FG_COLOUR, colour);
+      target.setForegroundColour(colour);
+   }
+
+   virtual void setCursorVisibility(bool visible) override
+   {
+      log(SET_CURSOR_VIS, visible);
+      target.setCursorVisibility(visible);
+   }
+
+   virtual void moveCursor(unsigned line, unsigned col) override
+   {
+      log(MOVE_CURSOR, line, col);
+      target.moveCursor(line, col);
+   }
+
+   virtual void eraseLine() override
+   {
+      log(ERASE_LINE);
+      target.eraseLine();
+   }
+
+   virtual void waitForKey() override
+   {
+      target.waitForKey();
+   }
+
+   virtual bool read(uint8_t& ch, unsigned timeout_ms) override
+   {
+      return target.read(ch, timeout_ms);
+   }
+
+   virtual void setScrollRegion(unsigned top, unsigned bottom) override
+   {
+      log(SCROLL_REGION, top, bottom);
+      target.setScrollRegion(top, bottom);
+   }
+
+   virtual void clearLines(unsigned first, unsigned n) override
+   {
+      log(CLEAR_LINES, first, n);
+      target.clearLines(first, n);
+   }
+
+   virtual void clear() override
+   {
+      log(CLEAR);
+      target.clear();
+   }
+
+   virtual void write(uint8_t ch) override
+   {
+      output = true;
+      write_count++;
+
+      if (recording)
+      {
+         record.push_back(WRITE);
+         record.push_back(ch);
+         checkSize();
+      }
+      target.write(ch);
+   }
+
+private:
+   enum Op : uint8_t
+   {
+      WRITE,
+      SET_FONT,
+      SET_FONT_STYLE,
+      SET_BG_COLOUR,
+      SET_FG_COLOUR,
+      SET_CURSOR_VIS,
+      MOVE_CURSOR,
+      ERASE_LINE,
+      SCROLL_REGION,
+      CLEAR_LINES,
+      CLEAR
+   };
+
+   Console&             target;
+   bool                 recording{false};
+   bool                 output{false};
+   std::vector<uint8_t> record;
+   uint64_t             write_count{0};
+
+   //! Number of 16-bit arguments for an operation
+   static unsigned getNumArgs(Op op)
+   {
+      switch(op)
+      {
+      case MOVE_CURSOR:
+      case SCROLL_REGION:
+      case CLEAR_LINES:
+         return 2;
+
+      case ERASE_LINE:
+      case CLEAR:
+         return 0;
+
+      default:
+         return 1;
+      }
+   }
+
+   void log(Op op)
+   {
+      output = true;
+
+      if (!recording) return;
+
+      record.push_back(op);
+      checkSize();
+   }
+
+   void log(Op op, unsigned arg)
+   {
+      output = true;
+
+      if (!recording) return;
+
+      record.push_back(op);
+      record.push_back(uint8_t(arg >> 8));
+      record.push_back(uint8_t(arg));
+      checkSize();
+   }
+
+   void log(Op op, unsigned arg1, unsigned arg2)
+   {
+      output = true;
+
+      if (!recording) return;
+
+      record.push_back(op);
+      record.push_back(uint8_t(arg1 >> 8));
+      record.push_back(uint8_t(arg1));
+      record.push_back(uint8_t(arg2 >> 8));
+      record.push_back(uint8_t(arg2));
+      checkSize();
+   }
+
+   //! Abandon a recording that has grown too big
+   void checkSize()
+   {
+      if (record.size() > MAX_RECORD_SIZE)
+      {
+         recording = false;
+         std::vector<uint8_t>().swap(record);
+      }
+   }
+};
@@ -0,0 +1,220 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "PLT/File.h"
+
+#include "common/Buffer.h"
+
+namespace IF {
+
+//! Marks the instructions executed, the routines called and the bytes of
+//! memory read and written by a story, with a bit for each byte of memory.
+//
+//  The file is a big-endian layout...
+//
+//     0  "ZifC"
+//     4  format version (16-bit) and padding
+//     8  story identity (32-bit length and characters)
+//     .  memory size (32-bit)
+//     .  code, routine, read and write bitmaps, (size + 7) / 8 bytes each
+//
+class Coverage
+{
+public:
+   //! Increment when the layout changes
+   static const uint16_t FORMAT_VERSION = 1;
+
+   Coverage() = default;
+
+   //! Set memory size (bytes) and clear all the marks
+   void resize(size_t size_)
+   {
+      size = size_;
+
+      for(auto& map : maps)
+      {
+         map.assign((size + 7) / 8, 0);
+      }
+   }
+
+   size_t getSize() const { return size; }
+
+   void markCode(uint32_t addr)    { mark(maps[CODE], addr); }
+   void markRoutine(uint32_t addr) { mark(maps[ROUTINE], addr); }
+
+   void markRead(uint32_t addr, uint32_t bytes)
+   {
+      for(uint32_t i = 0; i < bytes; i++) mark(maps[READ], addr + i);
+   }
+
+   void markWrite(uint32_t addr, uint32_t bytes)
+   {
+      for(uint32_t i = 0; i < bytes; i++) mark(maps[WRITE], addr + i);
+   }
+
+   bool isCode(uint32_t addr) const    { return isMarked(maps[CODE], addr); }
+   bool isRoutine(uint32_t addr) const { return isMarked(maps[ROUTINE], addr); }
+   bool isRead(uint32_t addr) const    { return isMarked(maps[READ], addr); }
+   bool isWritten(uint32_t addr) const { return isMarked(maps[WRITE], addr); }
+
+   //! Add the marks of another run of the same story
+   //! \return false if the memory sizes differ
+   bool merge(const Coverage& other)
+   {
+      if (other.size != size) return false;
+
+      for(unsigned m = 0; m < NUM_MAPS; m++)
+      {
+         for(size_t i = 0; i < maps[m].size(); i++)
+         {
+            maps[m][i] |= other.maps[m][i];
+         }
+      }
+
+      return true;
+   }
+
+   bool write(const std::string& path, const std::string& identity) const
+   {
+      Buffer buffer;
+
+      buffer.push("ZifC", 4);
+      buffer.push16(FORMAT_VERSION);
+      buffer.push16(0);
+      buffer.pushString(identity);
+      buffer.push32(uint32_t(size));
+
+      for(const auto& map : maps)
+      {
+         buffer.push(map.data(), map.size());
+      }
+
+      return buffer.write(path);
+   }
+
+   //! Read a file written by write()
+   //! \return false if the file is missing or not valid
+   bool read(const std::string& path, std::string& identity)
+   {
+      Buffer buffer;
+      if (!buffer.read(path)) return false;
+
+      const uint8_t* magic = buffer.read(4);
+      if ((magic == nullptr) || (memcmp(magic, "ZifC", 4) != 0)) return false;
+
+      if (buffer.read16() != FORMAT_VERSION) return false;
+      (void) buffer.read16();
+
+      identity = buffer.readString();
+
+      uint32_t size_ = buffer.read32();
+      if (!buffer.isOk() || (size_ > MAX_SIZE)) return false;
+
+      resize(size_);
+
+      for(auto& map : maps)
+      {
+         const uint8_t* data = buffer.read(map.size());
+         if (data == nullptr) return false;
+         memcpy(map.data(), data, map.size());
+      }
+
+      return buffer.isOk();
+   }
+
+private:
+   enum Map { CODE, ROUTINE, READ, WRITE, NUM_MAPS };
+
+   //! Largest memory accepted from a file (bytes)
+   static const uint32_t MAX_SIZE = 0x10000000;
+
+   size_t               size{0};
+   std::vector<uint8_t> maps[NUM_MAPS];
+
+   void mark(std::vector<uint8_t>& map, uint32_t addr)
+   {
+      if (addr < size) map[addr >> 3] |= 1 << (addr & 7);
+   }
+
+   bool isMarked(const std::vector<uint8_t>& map, uint32_t addr) const
+   {
+      return (addr < size) && ((map[addr >> 3] & (1 << (addr & 7))) != 0);
+   }
+};
+
+//! Process wide coverage of each story, the marks of every machine that
+//! has run it merged together
+class CoverageStore
+{
+public:
+   static CoverageStore& get()
+   {
+      static CoverageStore store;
+      return store;
+   }
+
+   //! Merge the marks of a run of a story
+   void add(const std::string& identity, const std::string& filename, const Coverage& coverage)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      Entry& entry = stories[identity];
+      if (entry.name.empty())
+      {
+         // Story file name without directory or extension
+         size_t start = filename.find_last_of('/');
+         start = start == std::string::npos ? 0 : start + 1;
+         size_t dot = filename.find('.', start);
+
+         entry.name = filename.substr(start, dot == std::string::npos ? std::string::npos : dot - start);
+         entry.coverage.resize(coverage.getSize());
+      }
+
+      (void) entry.coverage.merge(coverage);
+   }
+
+   //! Write a file for each story to the given directory, named after the
+   //! story and its identity
+   bool write(const std::string& dir)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      (void) PLT::File::createDir(dir.c_str());
+
+      bool ok = true;
+
+      for(const auto& story : stories)
+      {
+         std::string path = dir + '/' + story.second.name + '_' + story.first + ".zcv";
+         if (!story.second.coverage.write(path, story.first)) ok = false;
+      }
+
+      return ok;
+   }
+
+private:
+   struct Entry
+   {
+      std::string name;
+      Coverage    coverage;
+   };
+
+   std::mutex                   mutex;
+   std::map<std::string, Entry> stories;
+
+   CoverageStore() = default;
+};
+
+} // namespace IF
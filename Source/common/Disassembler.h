@@ -18,8 +18,8 @@ class Disassembler
 public:
    Disassembler() = default;
 
-   //! Disassemble a single op
-   unsigned disassemble(std::string& text, uint32_t inst_addr, const uint8_t* raw) const
+   //! Disassemble a single op, size is the number of bytes of memory at raw
+   unsigned disassemble(std::string& text, uint32_t inst_addr, const uint8_t* raw, uint32_t size) const
    {
       text = "";
 
@@ -32,13 +32,13 @@ public:
       addHexString(text, inst_addr, 6);
       text += "  ";
 
-      unsigned n = decodeOp(work, raw, !in_trace);
+      unsigned n = decodeOp(work, raw, size, !in_trace);
 
       if (in_trace)
       {
          for(unsigned i=0; i<10; i++)
          {
-            if (i < n)
+            if ((i < n) && (i < size))
             {
                addHexString(text, raw[i], 2);
                text += " ";
@@ -60,11 +60,11 @@ public:
    }
 
    //! Trace an op at the given address
-   unsigned trace(std::string& text, uint32_t inst_addr, const uint8_t* raw)
+   unsigned trace(std::string& text, uint32_t inst_addr, const uint8_t* raw, uint32_t size)
    {
       in_trace = true;
 
-      unsigned n = disassemble(text, inst_addr, raw);
+      unsigned n = disassemble(text, inst_addr, raw, size);
       text += "\n";
 
       in_trace = false;
@@ -78,7 +78,7 @@ protected:
    bool             in_trace{false};
    mutable unsigned trace_count{0};
 
-   virtual unsigned decodeOp(std::string& text, const uint8_t* raw, bool pack) const = 0;
+   virtual unsigned decodeOp(std::string& text, const uint8_t* raw, uint32_t size, bool pack) const = 0;
 };
 
 } // namespace IF
@@ -0,0 +1,323 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "common/Buffer.h"
+#include "common/Snapshot.h"
+#include "common/State.h"
+#include "common/Story.h"
+
+namespace IF {
+
+//! Append-only journal of the machine state at each input request, for
+//! recovery after the interpreter has been killed.
+//
+//  The journal starts with a full checkpoint followed by one record per
+//  turn holding the input line, the registers, the stack and the pages
+//  of writable memory changed since the previous record. Each record is...
+//
+//     tag (4 bytes) | size (32-bit) | body | FNV-1a hash of tag, size and body
+//
+//  ...so that a record torn by a crash can be detected and ignored. The
+//  journal is compacted by starting again with a new checkpoint.
+//
+//  The journal of a story is owned by the session holding a lock on the
+//  file "<story>.jnl.lock" beside it, so sessions of the same story in one
+//  or more processes do not write over each other's journal. A journal
+//  that is not locked was left by a session that has gone.
+class Journal
+{
+public:
+   //! Size of the unit of change in writable memory (bytes)
+   static const unsigned PAGE_SIZE = 64;
+
+   //! Turns between checkpoints
+   static const unsigned CHECKPOINT_INTERVAL = 100;
+
+   //! Get journal filename
+   static std::string filename(const std::string& dir,
+                               const std::string& story_filename)
+   {
+      std::string path = dir;
+      path += '/';
+      path += story_filename;
+      path += ".jnl";
+      return path;
+   }
+
+   //! Take the lock on the journal of a story, without waiting
+   //! \return file descriptor holding the lock or -1 if another session has it
+   static int lock(const std::string& journal_filename)
+   {
+      std::string path = journal_filename + ".lock";
+
+      int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+      if (fd < 0) return -1;
+
+      if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+      {
+         close(fd);
+         return -1;
+      }
+
+      return fd;
+   }
+
+   //! Release a lock taken with lock()
+   static void unlock(int fd)
+   {
+      if (fd >= 0) close(fd);
+   }
+
+   //! Check if a session is running with the journal of a story
+   static bool isLocked(const std::string& journal_filename)
+   {
+      std::string path = journal_filename + ".lock";
+
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) return false;
+
+      bool locked = flock(fd, LOCK_SH | LOCK_NB) != 0;
+      close(fd);
+      return locked;
+   }
+
+   Journal() = default;
+
+   //! Encode a record for the current state.
+   //! \return true if the record is a checkpoint that replaces the journal
+   bool encode(Buffer&            record,
+               const Story&       story,
+               const State&       state,
+               Memory::Address    pc,
+               const std::string& input)
+   {
+      Buffer body;
+      bool   checkpoint = (turns == 0) || (turns >= CHECKPOINT_INTERVAL);
+
+      if (checkpoint)
+      {
+         body.pushString(story.getIdentity());
+         Snapshot::encodeState(body, story, state, pc);
+
+         turns = 0;
+      }
+      else
+      {
+         body.pushString(input);
+         encodeTurn(body, state, pc);
+      }
+
+      updateShadow(state.memory);
+      turns++;
+
+      pushRecord(record, checkpoint ? "CHKP" : "TURN", body);
+
+      return checkpoint;
+   }
+
+   //! Make the next record a checkpoint
+   void restart() { turns = 0; }
+
+   //! Check if an encoded record is a checkpoint
+   static bool isCheckpoint(const Buffer& record)
+   {
+      return (record.size() >= 4) && (memcmp(record.data(), "CHKP", 4) == 0);
+   }
+
+   //! Apply encoded records to the state, a checkpoint only covers
+   //! writable memory. Records are applied up to the first one that is
+   //! torn, corrupt or does not follow on from the previous records
+   //! \return true if all the records were applied
+   bool apply(Buffer& records, const Story& story, State& state)
+   {
+      while(!records.isEnd())
+      {
+         std::string tag;
+         Buffer      body;
+
+         if (!pullRecord(records, tag, body)) return false;
+
+         if (tag == "CHKP")
+         {
+            if ((body.readString() != story.getIdentity()) ||
+                !Snapshot::decodeState(body, story, state))
+            {
+               turns = 0;
+               return false;
+            }
+
+            updateShadow(state.memory);
+            turns = 1;
+         }
+         else if ((tag == "TURN") && (turns != 0))
+         {
+            (void) body.readString();
+
+            if (!decodeTurn(body, state)) return false;
+
+            turns++;
+         }
+         else
+         {
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+   //! Restore the most recent state in a journal file
+   bool replay(const std::string& path, const Story& story, State& state)
+   {
+      Buffer file;
+      if (!file.read(path)) return false;
+
+      turns = 0;
+
+      // A torn record at the end is expected after a crash
+      (void) apply(file, story, state);
+
+      return turns != 0;
+   }
+
+private:
+   std::vector<uint8_t> shadow;   //!< Writable memory at the last record
+   unsigned             turns{0}; //!< Records since the last checkpoint
+
+   static uint32_t hash(const uint8_t* data, size_t size, uint32_t value = 0x811C9DC5)
+   {
+      for(size_t i = 0; i < size; i++)
+      {
+         value = (value ^ data[i]) * 0x01000193;
+      }
+      return value;
+   }
+
+   static void pushRecord(Buffer& record, const char* tag, const Buffer& body)
+   {
+      size_t start = record.size();
+
+      record.push(tag, 4);
+      record.push32(body.size());
+      record.push(body.data(), body.size());
+      record.push32(hash(record.data() + start, record.size() - start));
+   }
+
+   static bool pullRecord(Buffer& file, std::string& tag, Buffer& body)
+   {
+      const uint8_t* header = file.read(8);
+      if (header == nullptr) return false;
+
+      uint32_t       size  = (header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7];
+      const uint8_t* data  = file.read(size);
+      uint32_t       check = file.read32();
+
+      if ((data == nullptr) || !file.isOk()) return false;
+      if (hash(data, size, hash(header, 8)) != check) return false;
+
+      tag.assign((const char*)header, 4);
+      body.push(data, size);
+      return true;
+   }
+
+   //! Length of the page at the given address, the last page may be short
+   uint32_t pageLength(uint32_t addr) const
+   {
+      return shadow.size() - addr < PAGE_SIZE ? shadow.size() - addr : PAGE_SIZE;
+   }
+
+   void updateShadow(const Memory& memory)
+   {
+      shadow.assign(memory.data(), memory.data() + memory.getWriteEnd() + 1);
+   }
+
+   //! Registers, stack and changed pages of writable memory
+   void encodeTurn(Buffer& body, const State& state, Memory::Address pc) const
+   {
+      body.push32(pc);
+      body.push32(state.frame_ptr);
+      body.push64(state.random.internalState());
+
+      body.push32(state.stack.size());
+      body.push(state.stack.data(), state.stack.size());
+
+      const uint8_t* mem  = state.memory.data();
+      uint32_t       size = shadow.size();
+
+      // Pages that differ from the previous record
+      for(uint32_t addr = 0; addr < size; addr += PAGE_SIZE)
+      {
+         uint32_t len = pageLength(addr);
+
+         if (memcmp(mem + addr, shadow.data() + addr, len) != 0)
+         {
+            body.push32(addr);
+            body.push(mem + addr, len);
+         }
+      }
+   }
+
+   bool decodeTurn(Buffer& body, State& state)
+   {
+      Memory::Address pc         = body.read32();
+      Stack::Offset   frame_ptr  = body.read32();
+      uint64_t        rng        = body.read64();
+      uint32_t        stack_size = body.read32();
+      const uint8_t*  stack      = body.read(stack_size);
+      if (stack == nullptr) return false;
+
+      uint32_t size = shadow.size();
+
+      // Check the whole record before changing any state
+      std::vector<std::pair<uint32_t,const uint8_t*>> pages;
+
+      while(!body.isEnd())
+      {
+         uint32_t addr = body.read32();
+         if (!body.isOk() || (addr >= size) || ((addr % PAGE_SIZE) != 0)) return false;
+
+         const uint8_t* page = body.read(pageLength(addr));
+         if (page == nullptr) return false;
+
+         pages.emplace_back(addr, page);
+      }
+
+      uint8_t* mem = state.memory.data();
+
+      for(const auto& page : pages)
+      {
+         uint32_t len = pageLength(page.first);
+
+         memcpy(mem + page.first, page.second, len);
+         memcpy(shadow.data() + page.first, page.second, len);
+      }
+
+      state.stack.clear();
+      for(uint32_t i = 0; i < stack_size; i++)
+      {
+         state.stack.push8(stack[i]);
+      }
+
+      state.jump(pc);
+      state.frame_ptr              = frame_ptr;
+      state.random.internalState() = rng;
+
+      return true;
+   }
+};
+
+} // namespace IF
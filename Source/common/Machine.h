@@ -14,6 +14,16 @@ namespace IF {
 class Machine
 {
 public:
+   //! Reason for a return from resumable execution
+   enum Status
+   {
+      NEED_LINE,       //!< Waiting for a line of input
+      NEED_CHAR,       //!< Waiting for a character of input (may time out)
+      OUTPUT_READY,    //!< Instruction limit reached, output has been sent
+      QUIT,            //!< Game has finished
+      QUANTUM_EXPIRED  //!< Instruction limit reached
+   };
+
    Machine(Console& console_, const Options& options_)
       : console(console_)
       , options(options_)
@@ -5,10 +5,14 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <vector>
 
+#include "common/PagePool.h"
+#include "common/Zobrist.h"
+
 namespace IF {
 
 //! Memory implementation for an interactive fiction VM
@@ -22,8 +26,12 @@ public:
    //! Get memory size (bytes)
    size_t size() const { return raw.size(); }
 
-   //! Get pointer to raw memory
-   uint8_t* data() { return raw.data(); }
+   //! Get pointer to raw memory, for writes that are not seen by getHash()
+   uint8_t* data()
+   {
+      hash_valid = false;
+      return raw.data();
+   }
 
    //! Get read-only pointer to raw memory
    const uint8_t* data() const { return raw.data(); }
@@ -34,10 +42,61 @@ public:
    //! Get address of last writable byte
    Address getWriteEnd() const { return write_end_incl; }
 
+   //! Note that memory was changed through a pointer kept from an earlier
+   //! call to data()
+   void changed() { hash_valid = false; }
+
+   //! Hash of writable memory. Only the blocks written through this class
+   //! since the previous call are hashed again, all of writable memory
+   //! after writes through data()
+   uint64_t getHash() const
+   {
+      if (!hash_valid)
+      {
+         block_hash.assign((write_end_incl >> HASH_BLOCK_SHIFT) + 1, 0);
+         block_dirty.assign(block_hash.size(), 0);
+         dirty_blocks.clear();
+
+         hash = 0;
+         for(Address block = 0; block < block_hash.size(); block++)
+         {
+            block_hash[block] = hashBlock(block);
+            hash ^= block_hash[block];
+         }
+
+         hash_valid = true;
+      }
+
+      for(Address block : dirty_blocks)
+      {
+         uint64_t value = hashBlock(block);
+         hash ^= block_hash[block] ^ value;
+         block_hash[block]  = value;
+         block_dirty[block] = 0;
+      }
+      dirty_blocks.clear();
+
+      return hash;
+   }
+
+   //! Share pages with the same content as pages of other memories, see
+   //! PagePool. The memory must not be written during the call
+   void share()
+   {
+      PagePool::get().share(raw.data(), raw.size());
+   }
+
+   //! Get the number of bytes currently shared with other memories
+   size_t getSharedSize() const
+   {
+      return PagePool::get().sharedBytes(raw.data(), raw.size());
+   }
+
    //! Set memory size (bytes)
    void resize(size_t size)
    {
       raw.resize(size);
+      hash_valid = false;
 
       limitCode(0, size - 1);
       limitWrite(0, size - 1);
@@ -55,6 +114,7 @@ public:
       if ((end_incl >= size()) || (start > end_incl)) throw "memory map fault";
       write_start    = start;
       write_end_incl = end_incl;
+      hash_valid     = false;
    }
 
    //! Read byte from memory
@@ -145,6 +205,7 @@ public:
    void set8(Address addr, uint8_t byte)
    {
       if (addr >= size()) throw "memory set fault";
+      if (addr <= write_end_incl) rehash(addr);
       raw[addr] = byte;
    }
 
@@ -152,6 +213,7 @@ public:
    void write8(Address addr, uint8_t byte)
    {
       if((addr < write_start) || (addr > write_end_incl)) throw "memory write fault";
+      rehash(addr);
       raw[addr] = byte;
    }
 
@@ -159,6 +221,8 @@ public:
    void write16(Address addr, uint16_t word)
    {
       if((addr < write_start) || (addr > (write_end_incl - 1))) throw "memory write fault";
+      rehash(addr);
+      rehash(addr + 1);
       raw[addr    ] = word >> 8;
       raw[addr + 1] = uint8_t(word);
    }
@@ -167,6 +231,9 @@ public:
    void write24(Address addr, uint32_t word)
    {
       if((addr < write_start) || (addr > (write_end_incl - 2))) throw "memory write fault";
+      rehash(addr);
+      rehash(addr + 1);
+      rehash(addr + 2);
       raw[addr    ] = uint8_t(word >> 16);
       raw[addr + 1] = uint8_t(word >>  8);
       raw[addr + 2] = uint8_t(word);
@@ -176,6 +243,10 @@ public:
    void write32(Address addr, uint32_t word)
    {
       if((addr < write_start) || (addr > (write_end_incl - 3))) throw "memory write fault";
+      rehash(addr);
+      rehash(addr + 1);
+      rehash(addr + 2);
+      rehash(addr + 3);
       raw[addr    ] = uint8_t(word >> 24);
       raw[addr + 1] = uint8_t(word >> 16);
       raw[addr + 2] = uint8_t(word >>  8);
@@ -199,11 +270,46 @@ public:
    }
 
 protected:
-   Address              code_start{0};
-   Address              code_end_incl{0};
-   Address              write_start{0};
-   Address              write_end_incl{0};
-   std::vector<uint8_t> raw;
+   //! Size of the blocks of memory hashed again after a write (log2 bytes)
+   static const unsigned HASH_BLOCK_SHIFT = 6;
+
+   //! Note a write, so that the hash of its block is updated by getHash()
+   void rehash(Address addr)
+   {
+      if (!hash_valid) return;
+
+      Address block = addr >> HASH_BLOCK_SHIFT;
+      if (block_dirty[block] == 0)
+      {
+         block_dirty[block] = 1;
+         dirty_blocks.push_back(block);
+      }
+   }
+
+   uint64_t hashBlock(Address block) const
+   {
+      Address  start = block << HASH_BLOCK_SHIFT;
+      Address  end   = std::min(start + (Address(1) << HASH_BLOCK_SHIFT), write_end_incl + 1);
+      uint64_t value = 0;
+
+      for(Address addr = start; addr < end; addr++)
+      {
+         value ^= Zobrist::key(addr, raw[addr]);
+      }
+
+      return value;
+   }
+
+   Address                                     code_start{0};
+   Address                                     code_end_incl{0};
+   Address                                     write_start{0};
+   Address                                     write_end_incl{0};
+   std::vector<uint8_t,PageAllocator<uint8_t>> raw;
+   mutable uint64_t                            hash{0};
+   mutable bool                                hash_valid{false};
+   mutable std::vector<uint64_t>               block_hash;     //!< At the last getHash()
+   mutable std::vector<uint8_t>                block_dirty;
+   mutable std::vector<Address>                dirty_blocks;   //!< Written since the last getHash()
 };
 
 } // namespace IF
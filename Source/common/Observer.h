@@ -0,0 +1,87 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+
+#include "common/Memory.h"
+#include "common/Options.h"
+
+namespace IF {
+
+class State;
+class StatsWriter;
+
+//! Events of a running machine. A machine is a template with an observer
+//! type parameter, and calls these hooks as it runs so that tools such as
+//! a trace can be built without changing the interpreter loop. This
+//! default does nothing and compiles away completely. Observers derive
+//! from it and hide the hooks they use
+class NullObserver
+{
+public:
+   //! Constructed by the machine with its options and story
+   template <typename STORY>
+   NullObserver(const Options&, const STORY&) {}
+
+   //! The machine is starting, resumable if its input is supplied by the
+   //! caller rather than read from the console. Problems are reported with
+   //! report.warning()
+   template <typename REPORT>
+   void begin(const State& /* state */, bool /* resumable */, REPORT& /* report */) {}
+
+   //! The story has finished, problems writing any results are reported
+   //! with report.warning()
+   template <typename REPORT>
+   void end(REPORT& /* report */) {}
+
+   //! Story code starts running, on entry to the machine or after a wait
+   //! for the console
+   void resume() {}
+
+   //! Story code stops running until resume(), on return from the machine
+   //! or while waiting for the console
+   void pause() {}
+
+   //! The instruction at addr is about to be executed
+   void instruction(Memory::Address /* addr */, const Memory& /* memory */) {}
+
+   //! An operand of the instruction was fetched, in order
+   void operand(uint16_t /* value */) {}
+
+   //! The instruction stored a result
+   void store(uint16_t /* value */) {}
+
+   //! The instruction tested a branch condition, taken if the branch was
+   //! followed
+   void branch(bool /* taken */) {}
+
+   //! The routine at addr was called, frame_ptr identifies its stack frame
+   void call(Memory::Address /* addr */, uint32_t /* frame_ptr */) {}
+
+   //! Returning from the routine with the given stack frame
+   void ret(uint32_t /* frame_ptr */) {}
+
+   //! An instruction read size bytes of memory at addr
+   void read(Memory::Address /* addr */, uint32_t /* size */) {}
+
+   //! An instruction wrote size bytes of memory at addr
+   void write(Memory::Address /* addr */, uint32_t /* size */) {}
+
+   //! A character was output
+   void output(uint16_t /* ch */) {}
+
+   //! A character of input was received
+   void input(uint16_t /* ch */) {}
+
+   //! An instruction is about to read input, and may wait for it
+   void requestInput() {}
+
+   //! Add any figures counted by the observer to the machine statistics
+   void stats(StatsWriter& /* writer */) const {}
+};
+
+} // namespace IF
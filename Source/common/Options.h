@@ -15,11 +15,19 @@ struct Options
    STB::Option<unsigned>    width{   'w', "width",    "Override output width", 0};
    STB::Option<bool>        batch{   'b', "batch",    "Batch mode, disable output to screen"};
    STB::Option<bool>        trace{   'T', "trace",    "Trace execution to \"trace.log\""};
+   STB::Option<bool>        trace_bin{0, "trace-bin", "Trace Z-code execution compactly to \"trace.bin\", read with zdmp --trace"};
+   STB::Option<bool>        profile{ 0,   "profile",  "Profile routines to \"profile.log\" and \"profile.folded\""};
+   STB::Option<bool>        stats{   0,   "stats",    "Write run time statistics to \"stats.json\""};
+   STB::Option<bool>        coverage{0,  "coverage", "Mark the story code run and memory used, to \"coverage.zcv\""};
+   STB::Option<unsigned>    sample{  0,   "sample",   "Sample the running routine N times a second to \"sample.log\" (0 for off)", 0};
+   STB::Option<const char*> symbols{ 0,   "symbols",  "Routine names for profiles, a hex address and name per line", ""};
    STB::Option<bool>        print{   'p', "print",    "Print output to \"print.log\""};
    STB::Option<bool>        key{     'k', "key",      "Log key presses to \"key.log\""};
    STB::Option<const char*> input{   'i', "input",    "Read keyboard input from a file"};
    STB::Option<unsigned>    seed{    'S', "seed",     "Initial random number seed", 0};
    STB::Option<unsigned>    undo{    'u', "undo",     "Number of undo buffers", 4};
    STB::Option<const char*> save_dir{'s', "save-dir", "Directory for save files", "Saves"};
+   STB::Option<bool>        cold{    0,   "cold",     "Cold start, ignore any warm start snapshot"};
+   STB::Option<const char*> log_prefix{0, "log-prefix", "Prefix for log file names", ""};
 };
 
@@ -0,0 +1,312 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef PAGE_SHARING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace IF {
+
+#ifdef PAGE_SHARING
+
+//! Process wide store of memory pages, shared copy-on-write between the
+//! memories of VMs that hold the same content. Pages are kept in a memory
+//! file and mapped privately over the matching pages of each memory, so
+//! the first write to a shared page gives the writer its own copy without
+//! any change to how memory is accessed
+class PagePool
+{
+public:
+   static const size_t PAGE_BYTES = 4096;
+
+   //! Memory sharing figures, as of the most recent share() of each memory
+   struct Stats
+   {
+      size_t memory_bytes{0};   //!< Memory allocated for VMs
+      size_t shared_bytes{0};   //!< VM memory mapped from the pool
+      size_t pool_bytes{0};     //!< Memory held by the pool
+   };
+
+   static PagePool& get()
+   {
+      static PagePool pool;
+      return pool;
+   }
+
+   static size_t roundUp(size_t bytes)
+   {
+      return (bytes + PAGE_BYTES - 1) & ~(PAGE_BYTES - 1);
+   }
+
+   Stats getStats()
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      return stats;
+   }
+
+   //! Share the whole pages in a range of memory allocated by PageAllocator
+   //! with any other memory that has the same content. The memory must not
+   //! be written during the call
+   void share(uint8_t* base, size_t size)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      if (fd < 0) return;
+
+      for(uint8_t* page = base; (page + PAGE_BYTES) <= (base + size); page += PAGE_BYTES)
+      {
+         uint64_t hash = hashPage(page);
+
+         auto mapped = mappings.find(page);
+         if (mapped != mappings.end())
+         {
+            // Already mapped from the pool, nothing to do unless a write
+            // has given this memory its own copy with new content
+            if (mapped->second == hash) continue;
+
+            unref(mapped->second);
+            mappings.erase(mapped);
+         }
+
+         auto entry = index.find(hash);
+         if (entry == index.end())
+         {
+            if (!addPage(hash, page)) return;
+            entry = index.find(hash);
+         }
+         else if (!samePage(entry->second.offset, page))
+         {
+            // Hash collision, leave this page private
+            continue;
+         }
+
+         void* addr = mmap(page, PAGE_BYTES, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_FIXED, fd, entry->second.offset);
+         if (addr == MAP_FAILED)
+         {
+            if (entry->second.refs == 0) freePage(entry);
+            continue;
+         }
+
+         entry->second.refs++;
+         mappings[page] = hash;
+         stats.shared_bytes += PAGE_BYTES;
+      }
+   }
+
+   //! Bytes of a range of memory that are mapped from the pool
+   size_t sharedBytes(const uint8_t* base, size_t size)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      size_t total = 0;
+      for(auto it = mappings.lower_bound(base);
+          (it != mappings.end()) && (it->first < (base + size)); ++it)
+      {
+         total += PAGE_BYTES;
+      }
+      return total;
+   }
+
+   //! Note memory allocated by PageAllocator
+   void allocated(size_t size)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      stats.memory_bytes += size;
+   }
+
+   //! Forget the pages of memory that is about to be freed
+   void release(uint8_t* base, size_t size)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      stats.memory_bytes -= size;
+
+      auto it = mappings.lower_bound(base);
+      while((it != mappings.end()) && (it->first < (base + size)))
+      {
+         unref(it->second);
+         it = mappings.erase(it);
+      }
+   }
+
+private:
+   //! Pool memory file is grown by this much at a time
+   static const size_t GROW_SIZE = 256 * PAGE_BYTES;
+
+   struct Entry
+   {
+      off_t    offset;
+      unsigned refs;
+   };
+
+   std::mutex                        mutex;
+   int                               fd{-1};
+   off_t                             file_size{0};
+   std::vector<off_t>                free_pages;
+   std::map<uint64_t,Entry>          index;      //!< Pool pages by content hash
+   std::map<const uint8_t*,uint64_t> mappings;   //!< VM pages mapped from the pool
+   Stats                             stats;
+
+   PagePool()
+   {
+      fd = memfd_create("zif-pages", MFD_CLOEXEC);
+   }
+
+   ~PagePool()
+   {
+      if (fd >= 0) ::close(fd);
+   }
+
+   //! FNV-1a hash of a page
+   static uint64_t hashPage(const uint8_t* page)
+   {
+      uint64_t hash = 0xCBF29CE484222325;
+      for(size_t i = 0; i < PAGE_BYTES; i++)
+      {
+         hash = (hash ^ page[i]) * 0x100000001B3;
+      }
+      return hash;
+   }
+
+   bool samePage(off_t offset, const uint8_t* page)
+   {
+      uint8_t copy[PAGE_BYTES];
+      return (pread(fd, copy, PAGE_BYTES, offset) == ssize_t(PAGE_BYTES)) &&
+             (memcmp(copy, page, PAGE_BYTES) == 0);
+   }
+
+   //! Copy a page into the pool
+   bool addPage(uint64_t hash, const uint8_t* page)
+   {
+      if (free_pages.empty())
+      {
+         if (ftruncate(fd, file_size + GROW_SIZE) != 0) return false;
+
+         for(off_t offset = file_size; offset < off_t(file_size + GROW_SIZE); offset += PAGE_BYTES)
+         {
+            free_pages.push_back(offset);
+         }
+         file_size += GROW_SIZE;
+      }
+
+      off_t offset = free_pages.back();
+
+      if (pwrite(fd, page, PAGE_BYTES, offset) != ssize_t(PAGE_BYTES)) return false;
+
+      free_pages.pop_back();
+      index[hash] = Entry{offset, 0};
+      stats.pool_bytes += PAGE_BYTES;
+      return true;
+   }
+
+   //! Drop a reference to a pool page, and free the page if it was the last
+   void unref(uint64_t hash)
+   {
+      stats.shared_bytes -= PAGE_BYTES;
+
+      auto entry = index.find(hash);
+      if ((entry != index.end()) && (--entry->second.refs == 0))
+      {
+         freePage(entry);
+      }
+   }
+
+   void freePage(std::map<uint64_t,Entry>::iterator entry)
+   {
+      // Give the memory back without changing the size of the file
+      (void) fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                       entry->second.offset, PAGE_BYTES);
+
+      free_pages.push_back(entry->second.offset);
+      index.erase(entry);
+      stats.pool_bytes -= PAGE_BYTES;
+   }
+};
+
+//! Allocator for VM memory that can be shared through the PagePool. Each
+//! allocation is a separate private mapping of whole pages
+template <typename TYPE>
+class PageAllocator
+{
+public:
+   using value_type = TYPE;
+
+   PageAllocator() = default;
+
+   template <typename OTHER>
+   PageAllocator(const PageAllocator<OTHER>&) {}
+
+   TYPE* allocate(size_t n)
+   {
+      size_t bytes = PagePool::roundUp(n * sizeof(TYPE));
+
+      void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (addr == MAP_FAILED) throw std::bad_alloc();
+
+      PagePool::get().allocated(bytes);
+      return (TYPE*)addr;
+   }
+
+   void deallocate(TYPE* ptr, size_t n)
+   {
+      size_t bytes = PagePool::roundUp(n * sizeof(TYPE));
+
+      PagePool::get().release((uint8_t*)ptr, bytes);
+      (void) munmap(ptr, bytes);
+   }
+
+   template <typename OTHER>
+   bool operator==(const PageAllocator<OTHER>&) const { return true; }
+
+   template <typename OTHER>
+   bool operator!=(const PageAllocator<OTHER>&) const { return false; }
+};
+
+#else
+
+//! Page sharing is not available, memory is always private
+class PagePool
+{
+public:
+   struct Stats
+   {
+      size_t memory_bytes{0};
+      size_t shared_bytes{0};
+      size_t pool_bytes{0};
+   };
+
+   static PagePool& get()
+   {
+      static PagePool pool;
+      return pool;
+   }
+
+   Stats getStats() { return Stats{}; }
+
+   void share(uint8_t*, size_t) {}
+
+   size_t sharedBytes(const uint8_t*, size_t) { return 0; }
+};
+
+template <typename TYPE>
+using PageAllocator = std::allocator<TYPE>;
+
+#endif
+
+} // namespace IF
@@ -0,0 +1,268 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/Symbols.h"
+
+namespace IF {
+
+//! Counts the instructions executed and the time spent in each routine of
+//! a story, and in each call path, from the calls and returns reported by
+//! a machine. Time waiting for input is not counted
+class Profiler
+{
+public:
+   //! Measurements for one routine
+   struct Routine
+   {
+      uint32_t addr{0};
+      uint64_t calls{0};
+      uint64_t inclusive_instr{0};   //!< Including the routines called
+      uint64_t exclusive_instr{0};
+      uint64_t inclusive_ns{0};
+      uint64_t exclusive_ns{0};
+      unsigned active{0};            //!< Calls in progress, for recursion
+   };
+
+   Profiler()
+   {
+      nodes.push_back(Node{});
+      stack.push_back(Frame{&top, 0, 0, 0, now(), 0, 0});
+   }
+
+   //! A routine was called, frame_ptr identifies its stack frame
+   void enter(uint32_t addr, uint32_t frame_ptr, uint64_t instructions)
+   {
+      // Frames at or above the new one were discarded by a restore
+      while((stack.size() > 1) && (stack.back().frame_ptr >= frame_ptr))
+      {
+         pop(instructions, now());
+      }
+
+      Routine& routine = routines[addr];
+      routine.addr = addr;
+      routine.calls++;
+      routine.active++;
+
+      unsigned node = child(stack.back().node, addr);
+      nodes[node].calls++;
+
+      stack.push_back(Frame{&routine, node, frame_ptr, instructions, now(), 0, 0});
+   }
+
+   //! Return from the routine with the given frame, and from any called by
+   //! it that are still active (a throw)
+   void leave(uint32_t frame_ptr, uint64_t instructions)
+   {
+      uint64_t time_ns = now();
+
+      while((stack.size() > 1) && (stack.back().frame_ptr > frame_ptr))
+      {
+         pop(instructions, time_ns);
+      }
+
+      if ((stack.size() > 1) && (stack.back().frame_ptr == frame_ptr))
+      {
+         pop(instructions, time_ns);
+      }
+   }
+
+   //! Stop counting time, while waiting for input
+   void pause()
+   {
+      if (paused++ == 0) pause_start = Clock::now();
+   }
+
+   //! Continue counting time
+   void resume()
+   {
+      if ((paused != 0) && (--paused == 0))
+      {
+         idle += Clock::now() - pause_start;
+      }
+   }
+
+   //! Return from every active routine so that all execution so far is counted
+   void finish(uint64_t instructions)
+   {
+      uint64_t time_ns = now();
+
+      while(stack.size() > 1)
+      {
+         pop(instructions, time_ns);
+      }
+
+      // Move the top level frame on
+      Frame& frame = stack.back();
+      top.exclusive_instr += instructions - frame.start_instr - frame.child_instr;
+      top.exclusive_ns    += time_ns - frame.start_ns - frame.child_ns;
+      nodes[0].exclusive_instr += instructions - frame.start_instr - frame.child_instr;
+
+      frame.start_instr = instructions;
+      frame.start_ns    = time_ns;
+      frame.child_instr = 0;
+      frame.child_ns    = 0;
+   }
+
+   //! Write a table of the routines, busiest first. The annotate function
+   //! returns text to describe the routine at the given address
+   template <typename ANNOTATE>
+   void writeTable(FILE* fp, const Symbols& symbols, ANNOTATE annotate) const
+   {
+      std::vector<const Routine*> sorted;
+      for(const auto& entry : routines)
+      {
+         sorted.push_back(&entry.second);
+      }
+
+      std::sort(sorted.begin(), sorted.end(),
+                [](const Routine* a, const Routine* b)
+                {
+                   return a->exclusive_instr != b->exclusive_instr
+                             ? a->exclusive_instr > b->exclusive_instr
+                             : a->addr < b->addr;
+                });
+
+      fprintf(fp, "%-24s %9s %12s %12s %10s %10s  %s\n",
+              "Routine", "Calls", "Incl instr", "Excl instr", "Incl ms", "Excl ms", "Entry");
+
+      fprintf(fp, "%-24s %9s %12s %12llu %10s %10.3f\n",
+              "(top level)", "", "",
+              (unsigned long long)top.exclusive_instr, "", top.exclusive_ns / 1e6);
+
+      for(const Routine* routine : sorted)
+      {
+         fprintf(fp, "%-24s %9llu %12llu %12llu %10.3f %10.3f  %s\n",
+                 symbols.getName(routine->addr).c_str(),
+                 (unsigned long long)routine->calls,
+                 (unsigned long long)routine->inclusive_instr,
+                 (unsigned long long)routine->exclusive_instr,
+                 routine->inclusive_ns / 1e6,
+                 routine->exclusive_ns / 1e6,
+                 annotate(routine->addr).c_str());
+      }
+   }
+
+   //! Write the instructions executed in each call path, one path per
+   //! line, in the collapsed stack format used by flame graph tools
+   void writeCollapsed(FILE* fp, const Symbols& symbols) const
+   {
+      std::vector<std::string> names(nodes.size());
+
+      // Parents are always created before their children
+      for(size_t i = 0; i < nodes.size(); i++)
+      {
+         const Node& node = nodes[i];
+
+         names[i] = i == 0 ? "(top level)" : names[node.parent] + ";" + symbols.getName(node.addr);
+
+         if (node.exclusive_instr != 0)
+         {
+            fprintf(fp, "%s %llu\n", names[i].c_str(), (unsigned long long)node.exclusive_instr);
+         }
+      }
+   }
+
+private:
+   using Clock = std::chrono::steady_clock;
+
+   //! A call path, a node of the call tree
+   struct Node
+   {
+      uint32_t addr{0};
+      unsigned parent{0};
+      unsigned first_child{0};   //!< 0 if none
+      unsigned next_sibling{0};  //!< 0 if none
+      uint64_t calls{0};
+      uint64_t exclusive_instr{0};
+   };
+
+   //! An active routine
+   struct Frame
+   {
+      Routine* routine;
+      unsigned node;
+      uint32_t frame_ptr;
+      uint64_t start_instr;
+      uint64_t start_ns;
+      uint64_t child_instr;   //!< In routines called
+      uint64_t child_ns;
+   };
+
+   std::unordered_map<uint32_t, Routine>     routines;
+   std::vector<Node>                         nodes;
+   std::vector<Frame>                        stack;
+   Routine                                   top;   //!< Outside any routine
+   Clock::time_point                         start{Clock::now()};
+   Clock::time_point                         pause_start{Clock::now()};
+   Clock::duration                           idle{0};
+   unsigned                                  paused{1};
+
+   //! Time counted so far (ns)
+   uint64_t now() const
+   {
+      Clock::duration busy = Clock::now() - start - idle;
+      if (paused != 0) busy -= Clock::now() - pause_start;
+
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count();
+   }
+
+   //! Find or create the call path for a routine called from a path
+   unsigned child(unsigned parent, uint32_t addr)
+   {
+      for(unsigned i = nodes[parent].first_child; i != 0; i = nodes[i].next_sibling)
+      {
+         if (nodes[i].addr == addr) return i;
+      }
+
+      Node node;
+      node.addr         = addr;
+      node.parent       = parent;
+      node.next_sibling = nodes[parent].first_child;
+
+      nodes[parent].first_child = unsigned(nodes.size());
+      nodes.push_back(node);
+
+      return nodes[parent].first_child;
+   }
+
+   //! Return from the most recent routine
+   void pop(uint64_t instructions, uint64_t time_ns)
+   {
+      Frame    frame = stack.back();
+      Routine& routine = *frame.routine;
+
+      stack.pop_back();
+
+      uint64_t inclusive_instr = instructions - frame.start_instr;
+      uint64_t inclusive_ns    = time_ns - frame.start_ns;
+
+      routine.exclusive_instr += inclusive_instr - frame.child_instr;
+      routine.exclusive_ns    += inclusive_ns - frame.child_ns;
+      nodes[frame.node].exclusive_instr += inclusive_instr - frame.child_instr;
+
+      // Only the outermost of recursive calls counts towards the inclusive total
+      if (--routine.active == 0)
+      {
+         routine.inclusive_instr += inclusive_instr;
+         routine.inclusive_ns    += inclusive_ns;
+      }
+
+      Frame& caller = stack.back();
+      caller.child_instr += inclusive_instr;
+      caller.child_ns    += inclusive_ns;
+   }
+};
+
+} // namespace IF
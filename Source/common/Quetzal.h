@@ -9,6 +9,7 @@
 
 #include "STB/IFF.h"
 
+#include "common/Buffer.h"
 #include "common/Story.h"
 #include "common/State.h"
 
@@ -54,12 +55,69 @@ public:
              decodeStacks(state.stack);
    }
 
+   //! Size of the encoded state (bytes)
+   uint32_t getSize()
+   {
+      uint32_t total = 12;  // FORM header
+
+      for(const char* id : CHUNK_IDS)
+      {
+         uint32_t size = 0;
+         if (doc.load<uint8_t>(id, &size) != nullptr)
+         {
+            total += 8 + size + (size & 1);
+         }
+      }
+
+      return total;
+   }
+
    //! Write Quetzal object to a file
    bool write(const std::string& path)
    {
       return doc.write(path);
    }
 
+   //! Append the chunks of the Quetzal object to a buffer
+   void write(Buffer& buffer)
+   {
+      for(const char* id : CHUNK_IDS)
+      {
+         uint32_t       size  = 0;
+         const uint8_t* bytes = doc.load<uint8_t>(id, &size);
+         if (bytes != nullptr)
+         {
+            buffer.push(id, 4);
+            buffer.push32(size);
+            buffer.push(bytes, size);
+         }
+      }
+
+      buffer.push32(0);
+   }
+
+   //! Read the chunks of a Quetzal object written by write(Buffer&)
+   bool read(Buffer& buffer)
+   {
+      error = "";
+
+      while(true)
+      {
+         uint32_t tag = buffer.read32();
+         if (!buffer.isOk()) return false;
+         if (tag == 0) return true;
+
+         char id[5] = {char(tag >> 24), char(tag >> 16), char(tag >> 8), char(tag), '\0'};
+
+         uint32_t       size  = buffer.read32();
+         const uint8_t* bytes = buffer.read(size);
+         if (bytes == nullptr) return false;
+
+         STB::IFF::Chunk* chunk = doc.newChunk(id);
+         chunk->push(bytes, size);
+      }
+   }
+
    //! Read Quetzal object from a file
    bool read(const std::string& path)
    {
@@ -82,6 +140,9 @@ private:
       STB::Big64 rand_num_state;
    };
 
+   //! Chunks that make up a saved state
+   static constexpr const char* CHUNK_IDS[] = {"IFhd", "CMem", "UMem", "Stks", "ZifH"};
+
    STB::IFF::Document doc{"FORM", "IFZS"};
    std::string        path{};
    std::string        error{};
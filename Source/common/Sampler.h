@@ -0,0 +1,477 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef SAMPLING
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+namespace IF {
+
+//! Where a machine was when a sample was taken
+struct Sample
+{
+   static const unsigned MAX_DEPTH = 16;
+
+   uint32_t pc;                  //!< Address of the instruction executing
+   uint8_t  opcode;
+   uint8_t  depth;               //!< Number of return addresses
+   uint32_t frames[MAX_DEPTH];   //!< Return addresses, innermost first
+};
+
+//! Samples of one story, from all the machines running it
+class SampleProfile
+{
+public:
+   SampleProfile(const std::string& name_, size_t memory_size)
+      : name(name_)
+      , size(memory_size)
+      , starts(new std::atomic<uint8_t>[memory_size])
+   {
+      for(size_t addr = 0; addr < size; addr++)
+      {
+         starts[addr].store(0, std::memory_order_relaxed);
+      }
+   }
+
+   //! Note the start of a routine, so that samples can be placed in it
+   void markRoutine(uint32_t addr)
+   {
+      if ((addr < size) && (starts[addr].load(std::memory_order_relaxed) == 0))
+      {
+         starts[addr].store(1, std::memory_order_relaxed);
+      }
+   }
+
+   //! Add samples, the describe function returns the disassembly of the
+   //! instruction at an address and the name function the name of the
+   //! routine at an address. Each is only used for addresses not seen before
+   template <typename DESCRIBE, typename NAME>
+   void add(const Sample* samples, unsigned count, unsigned dropped_,
+            DESCRIBE describe, NAME name_of)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      dropped += dropped_;
+
+      for(unsigned i = 0; i < count; i++)
+      {
+         const Sample& sample = samples[i];
+
+         total++;
+
+         Instruction& inst = instructions[sample.pc];
+         if (inst.count++ == 0) inst.text = describe(sample.pc);
+
+         // Extended op-codes share a first byte so go by the name
+         Instruction& op = opcodes[mnemonic(inst.text)];
+         if (op.count++ == 0)
+         {
+            char hex[4];
+            snprintf(hex, sizeof(hex), "%02X", sample.opcode);
+            op.text = hex;
+         }
+
+         // The call path, outermost first
+         std::vector<uint32_t> path;
+         for(unsigned j = sample.depth; j > 0; j--)
+         {
+            path.push_back(routineOf(sample.frames[j - 1]));
+         }
+         path.push_back(routineOf(sample.pc));
+
+         paths[path]++;
+
+         routineEntry(path.back(), name_of).self++;
+
+         // Count each routine once in its own total, however deep the recursion
+         std::sort(path.begin(), path.end());
+         path.erase(std::unique(path.begin(), path.end()), path.end());
+
+         for(uint32_t addr : path)
+         {
+            routineEntry(addr, name_of).total++;
+         }
+      }
+   }
+
+   //! Write the samples by routine, by instruction and by opcode
+   void write(FILE* fp)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      fprintf(fp, "%s: %llu samples, %llu dropped\n\n", name.c_str(),
+              (unsigned long long)total, (unsigned long long)dropped);
+
+      fprintf(fp, "%-24s %9s %7s %9s %7s\n", "Routine", "Self", "%", "Total", "%");
+      for(const auto* entry : sorted(routines, [](const Routine& r){ return r.self; }))
+      {
+         const Routine& routine = entry->second;
+         fprintf(fp, "%-24s %9llu %6.2f%% %9llu %6.2f%%\n",
+                 routine.name.c_str(),
+                 (unsigned long long)routine.self, percent(routine.self),
+                 (unsigned long long)routine.total, percent(routine.total));
+      }
+
+      fprintf(fp, "\n%-9s %7s  %s\n", "Self", "%", "Instruction");
+      for(const auto* entry : sorted(instructions, [](const Instruction& i){ return i.count; }))
+      {
+         const Instruction& inst = entry->second;
+         fprintf(fp, "%9llu %6.2f%%  %s\n",
+                 (unsigned long long)inst.count, percent(inst.count), inst.text.c_str());
+      }
+
+      fprintf(fp, "\n%-9s %7s  %s\n", "Self", "%", "Opcode");
+      for(const auto* entry : sorted(opcodes, [](const Instruction& i){ return i.count; }))
+      {
+         fprintf(fp, "%9llu %6.2f%%  %s %s\n",
+                 (unsigned long long)entry->second.count, percent(entry->second.count),
+                 entry->second.text.c_str(), entry->first.c_str());
+      }
+
+      fprintf(fp, "\n");
+   }
+
+   //! Write the samples in each call path, in the collapsed stack format
+   //! used by flame graph tools, with the story as the outermost frame
+   void writeCollapsed(FILE* fp)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      for(const auto& entry : paths)
+      {
+         std::string line = name;
+         for(uint32_t addr : entry.first)
+         {
+            line += ';';
+            line += addr == TOP_LEVEL ? std::string("(top level)") : routines[addr].name;
+         }
+
+         fprintf(fp, "%s %llu\n", line.c_str(), (unsigned long long)entry.second);
+      }
+   }
+
+private:
+   static const uint32_t TOP_LEVEL = 0xFFFFFFFF;
+
+   struct Routine
+   {
+      std::string name;
+      uint64_t    self{0};
+      uint64_t    total{0};   //!< Including routines called
+   };
+
+   struct Instruction
+   {
+      std::string text;
+      uint64_t    count{0};
+   };
+
+   const std::string                       name;
+   const size_t                            size;
+   std::unique_ptr<std::atomic<uint8_t>[]> starts;   //!< Non-zero where a routine starts
+   std::mutex                              mutex;    //!< Protects the counts
+   uint64_t                                total{0};
+   uint64_t                                dropped{0};
+   std::unordered_map<uint32_t, Routine>     routines;
+   std::unordered_map<uint32_t, Instruction> instructions;
+   std::map<std::string, Instruction>        opcodes;     //!< By name, text is the first byte
+   std::map<std::vector<uint32_t>, uint64_t> paths;
+   std::unordered_map<uint32_t, uint32_t>    routine_of;
+
+   //! Start of the routine that holds an address, routines are contiguous so
+   //! this is the nearest start below the address
+   uint32_t routineOf(uint32_t addr)
+   {
+      if (addr >= size) return TOP_LEVEL;
+
+      auto it = routine_of.find(addr);
+      if (it != routine_of.end()) return it->second;
+
+      uint32_t routine = TOP_LEVEL;
+      for(uint32_t start = addr + 1; start-- > 0; )
+      {
+         if (starts[start].load(std::memory_order_relaxed) != 0)
+         {
+            routine = start;
+            break;
+         }
+      }
+
+      // Routines are only marked when called so the answer can not change
+      // once one is found
+      if (routine != TOP_LEVEL) routine_of[addr] = routine;
+      return routine;
+   }
+
+   template <typename NAME>
+   Routine& routineEntry(uint32_t addr, NAME name_of)
+   {
+      Routine& routine = routines[addr];
+      if (routine.name.empty())
+      {
+         routine.name = addr == TOP_LEVEL ? std::string("(top level)") : name_of(addr);
+      }
+      return routine;
+   }
+
+   //! The op name from a disassembled instruction "address  name operands"
+   static std::string mnemonic(const std::string& text)
+   {
+      size_t start = text.find_first_not_of(' ', text.find(' '));
+      if (start == std::string::npos) return "";
+
+      return text.substr(start, text.find(' ', start) - start);
+   }
+
+   double percent(uint64_t count) const
+   {
+      return total != 0 ? 100.0 * count / total : 0.0;
+   }
+
+   //! Entries of a map, highest key first
+   template <typename MAP, typename KEY>
+   static std::vector<const typename MAP::value_type*> sorted(const MAP& map, KEY key)
+   {
+      std::vector<const typename MAP::value_type*> order;
+      for(const auto& entry : map)
+      {
+         order.push_back(&entry);
+      }
+
+      std::sort(order.begin(), order.end(),
+                [key](const typename MAP::value_type* a, const typename MAP::value_type* b)
+                {
+                   return key(a->second) != key(b->second) ? key(a->second) > key(b->second)
+                                                           : a->first < b->first;
+                });
+      return order;
+   }
+};
+
+//! Process wide sampling of the machines that are running. A profiling
+//! timer signal interrupts whichever thread is using the CPU, and the
+//! machine running on that thread, if any, records where it is in a buffer
+//! of its own. The buffer is added to the profile of the story between
+//! calls to run()
+class Sampler
+{
+public:
+   //! A machine that can be sampled
+   class Source
+   {
+   public:
+      static const unsigned BUFFER_SIZE = 512;
+
+      //! Allocate the buffer, before samples are recorded
+      void allocate()
+      {
+         if (!buffer) buffer.reset(new Sample[BUFFER_SIZE]);
+      }
+
+      //! Record a sample, called from the signal handler
+      void record()
+      {
+         unsigned n = count.load(std::memory_order_relaxed);
+         if (n < BUFFER_SIZE)
+         {
+            fill(buffer[n]);
+            count.store(n + 1, std::memory_order_relaxed);
+         }
+         else
+         {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+         }
+      }
+
+      //! Record samples of this source on the current thread, until leave()
+      void enter()
+      {
+         previous  = current();
+         current() = this;
+         std::atomic_signal_fence(std::memory_order_seq_cst);
+      }
+
+      //! Stop recording samples of this source
+      void leave()
+      {
+         std::atomic_signal_fence(std::memory_order_seq_cst);
+         current() = previous;
+      }
+
+   protected:
+      //! Fill in a sample of the current state, called from the signal
+      //! handler so must not allocate, lock or throw
+      virtual void fill(Sample& sample) const = 0;
+
+      //! Move the samples recorded into a profile
+      template <typename DESCRIBE, typename NAME>
+      void drain(SampleProfile& profile, DESCRIBE describe, NAME name_of)
+      {
+         if ((count.load(std::memory_order_relaxed) == 0) &&
+             (dropped.load(std::memory_order_relaxed) == 0)) return;
+
+#ifdef SAMPLING
+         // No samples are recorded by this thread while the buffer is read
+         sigset_t block, previous;
+         sigemptyset(&block);
+         sigaddset(&block, SIGPROF);
+         (void) pthread_sigmask(SIG_BLOCK, &block, &previous);
+#endif
+
+         profile.add(buffer.get(), count.load(std::memory_order_relaxed),
+                     dropped.load(std::memory_order_relaxed), describe, name_of);
+
+         count.store(0, std::memory_order_relaxed);
+         dropped.store(0, std::memory_order_relaxed);
+
+#ifdef SAMPLING
+         (void) pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+#endif
+      }
+
+   private:
+      Source*                   previous{nullptr};
+      std::unique_ptr<Sample[]> buffer;
+      std::atomic<unsigned> count{0};
+      std::atomic<unsigned> dropped{0};
+   };
+
+   static Sampler& get()
+   {
+      static Sampler sampler;
+      return sampler;
+   }
+
+   //! Start taking samples at the given rate (per second of CPU time)
+   //! \return false if sampling is not supported
+   bool start(unsigned hz)
+   {
+#ifdef SAMPLING
+      std::unique_lock<std::mutex> lock(mutex);
+
+      if (running) return true;
+
+      struct sigaction action{};
+      action.sa_handler = onSignal;
+      action.sa_flags   = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      if (sigaction(SIGPROF, &action, nullptr) != 0) return false;
+
+      struct itimerval timer{};
+      timer.it_interval.tv_usec = std::max(1000000u / std::max(hz, 1u), 1u);
+      timer.it_value            = timer.it_interval;
+      if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) return false;
+
+      running = true;
+      rate    = hz;
+      return true;
+#else
+      (void) hz;
+      return false;
+#endif
+   }
+
+   //! Stop taking samples
+   void stop()
+   {
+#ifdef SAMPLING
+      std::unique_lock<std::mutex> lock(mutex);
+
+      if (!running) return;
+
+      struct itimerval timer{};
+      (void) setitimer(ITIMER_PROF, &timer, nullptr);
+
+      running = false;
+#endif
+   }
+
+   //! The profile of a story, shared by all the machines running it
+   std::shared_ptr<SampleProfile> getProfile(const std::string& identity,
+                                             const std::string& name,
+                                             size_t             memory_size)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      std::shared_ptr<SampleProfile>& profile = profiles[identity];
+      if (!profile) profile.reset(new SampleProfile(name, memory_size));
+      return profile;
+   }
+
+   //! Write the profile of every story, and the call paths in the collapsed
+   //! stack format to a second file if a name is given
+   bool write(const std::string& filename, const std::string& collapsed_filename = "")
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      FILE* fp = fopen(filename.c_str(), "w");
+      if (fp == nullptr) return false;
+
+      fprintf(fp, "Sampled at %u Hz, %llu samples outside a story\n\n",
+              rate, (unsigned long long)outside.load());
+
+      for(const auto& entry : profiles)
+      {
+         entry.second->write(fp);
+      }
+
+      bool ok = fclose(fp) == 0;
+
+      if (collapsed_filename.empty()) return ok;
+
+      fp = fopen(collapsed_filename.c_str(), "w");
+      if (fp == nullptr) return false;
+
+      for(const auto& entry : profiles)
+      {
+         entry.second->writeCollapsed(fp);
+      }
+
+      return (fclose(fp) == 0) && ok;
+   }
+
+private:
+   std::mutex                                            mutex;
+   bool                                                  running{false};
+   unsigned                                              rate{0};
+   std::atomic<uint64_t>                                 outside{0};
+   std::map<std::string, std::shared_ptr<SampleProfile>> profiles;
+
+   Sampler() = default;
+
+   //! The source being run by this thread
+   static Source*& current()
+   {
+      static thread_local Source* source{nullptr};
+      return source;
+   }
+
+   static void onSignal(int)
+   {
+      Source* source = current();
+
+      if (source != nullptr)
+         source->record();
+      else
+         get().outside++;
+   }
+};
+
+} // namespace IF
@@ -6,9 +6,13 @@
 #pragma once
 
 #include <cstdio>
+#include <memory>
 
+#include "common/Buffer.h"
+#include "common/Journal.h"
 #include "common/Story.h"
 #include "common/Quetzal.h"
+#include "common/SaveWriter.h"
 #include "common/State.h"
 
 namespace IF {
@@ -46,6 +50,20 @@ public:
       return true;
    }
 
+   static bool journalExists(const std::string& dir,
+                             const std::string& story_filename)
+   {
+      std::string path = Journal::filename(dir, story_filename);
+
+      // The journal of a running session is not there to be recovered
+      if (Journal::isLocked(path)) return false;
+
+      FILE* fp = fopen(path.c_str(), "r");
+      if (fp == nullptr) return false;
+      fclose(fp);
+      return true;
+   }
+
    SavableState(const IF::Story&   story_,
                 const std::string& save_dir_,
                 unsigned           num_undo_,
@@ -55,25 +73,135 @@ public:
       , save_dir(save_dir_)
    {
       undo.resize(num_undo_);
+      undo_size.resize(num_undo_);
+   }
+
+   ~SavableState()
+   {
+      // Complete the files of this state before it goes
+      settleWrites();
+
+      Journal::unlock(journal_lock);
+   }
+
+   //! Limit the memory held by the undo buffers and the size of each save
+   //! file (bytes, 0 for no limit)
+   void setLimits(size_t max_undo_bytes_, size_t max_save_bytes_)
+   {
+      max_undo_bytes = max_undo_bytes_;
+      max_save_bytes = max_save_bytes_;
    }
 
-   //! Save the dynamic state to a file
+   //! Make any attempt to read or write a save or data file fail, for a
+   //! state whose effects must stay in memory
+   void blockFiles()
+   {
+      files_blocked       = true;
+      file_access_blocked = false;
+   }
+
+   //! Check if a file access has failed because files are blocked
+   bool isFileAccessBlocked() const { return file_access_blocked; }
+
+   //! Memory held by the undo buffers (bytes)
+   size_t getUndoSize() const
+   {
+      size_t total = 0;
+
+      for(unsigned i = undo_oldest; i != undo_next; i = (i + 1) % undo.size())
+      {
+         total += undo_size[i];
+      }
+
+      return total;
+   }
+
+   //! Size of the largest save file written (bytes)
+   size_t getLargestSave() const { return largest_save; }
+
+   //! Activity of save() and saveUndo() so far
+   struct SaveCounts
+   {
+      uint64_t saves{0};
+      uint64_t save_bytes{0};
+      uint64_t undo_saves{0};
+      uint64_t undo_bytes{0};
+   };
+
+   const SaveCounts& getSaveCounts() const { return counts; }
+
+   //! Save the dynamic state to a file. The file is written by the
+   //! background writer, a failure to write it is reported by the next
+   //! save or by flushSaves()
+   //! \return false if the save was not queued or an earlier write failed
    bool save(const std::string& name = "")
    {
+      if (files_blocked)
+      {
+         file_access_blocked = true;
+         return false;
+      }
+
+      std::unique_ptr<IF::Quetzal> quetzal{new IF::Quetzal};
+
       pushContext();
-      save_file.encode(story, *this);
+      quetzal->encode(story, *this);
       popContext();
 
+      size_t size = quetzal->getSize();
+      if ((max_save_bytes != 0) && (size > max_save_bytes)) return false;
+
+      if (size > largest_save) largest_save = size;
+
+      counts.saves++;
+      counts.save_bytes += size;
+
       // Make sure the save directory exists
       (void) PLT::File::createDir(save_dir.c_str());
 
-      std::string path = getSaveFilename(name);
-      return save_file.write(path);
+      writer().write(this, getSaveFilename(name), std::move(quetzal));
+      return checkWrites();
+   }
+
+   //! Write an auxiliary data file, the buffer is consumed. Like save()
+   //! the file is written in the background
+   bool saveData(const std::string& path, Buffer& data)
+   {
+      if (files_blocked)
+      {
+         file_access_blocked = true;
+         return false;
+      }
+
+      writer().write(this, path, data);
+      return checkWrites();
    }
 
+   //! Wait for any background writes to complete
+   //! \return false if a background write failed
+   bool flushSaves()
+   {
+      bool ok = writer().flush(this) && !write_failed;
+      write_failed = false;
+      return ok;
+   }
+
+   //! Wait for any background writes to complete before a restart, a
+   //! failure is reported by the next save or flushSaves()
+   void settleSaves() { settleWrites(); }
+
    //! Restore the dynamic state from a save file
    bool restore(const std::string& name = "")
    {
+      if (files_blocked)
+      {
+         file_access_blocked = true;
+         return false;
+      }
+
+      // Make sure any save in progress has completed
+      settleWrites();
+
       std::string path = getSaveFilename(name);
 
       if (save_file.read(path) && save_file.decode(story, *this))
@@ -85,6 +213,49 @@ public:
       return false;
    }
 
+   //! Record the state at an input request in the journal
+   void journalTurn(Memory::Address pc, const std::string& input)
+   {
+      // Another session of the story has the journal
+      if (!lockJournal()) return;
+
+      IF::Buffer record;
+
+      if (journal.encode(record, story, *this, pc, input))
+      {
+         // A checkpoint replaces the whole journal
+         writer().write(this, getJournalFilename(), record);
+      }
+      else
+      {
+         writer().append(this, getJournalFilename(), record);
+      }
+   }
+
+   //! Restore the most recent state recorded in the journal
+   bool recoverJournal()
+   {
+      settleWrites();
+
+      // Don't take over the journal of a session still running
+      if (!lockJournal()) return false;
+
+      return journal.replay(getJournalFilename(), story, *this);
+   }
+
+   //! Remove the journal at the end of a session
+   void closeJournal()
+   {
+      settleWrites();
+
+      if (journal_lock < 0) return;
+
+      (void) remove(getJournalFilename().c_str());
+
+      Journal::unlock(journal_lock);
+      journal_lock = -1;
+   }
+
    //! Save the dynamic state into the undo buffer
    bool saveUndo()
    {
@@ -94,15 +265,77 @@ public:
       undo[undo_next].encode(story, *this);
       popContext();
 
+      // The slot at undo_next is not in use so nothing is lost by
+      // refusing an oversize entry
+      undo_size[undo_next] = undo[undo_next].getSize();
+      if ((max_undo_bytes != 0) && (undo_size[undo_next] > max_undo_bytes)) return false;
+
+      counts.undo_saves++;
+      counts.undo_bytes += undo_size[undo_next];
+
       undo_next = (undo_next + 1) % undo.size();
       if (undo_next == undo_oldest)
       {
          undo_oldest = (undo_oldest + 1) % undo.size();
       }
 
+      // Drop the oldest entries until within the limit
+      while((max_undo_bytes != 0) && (getUndoSize() > max_undo_bytes))
+      {
+         undo_oldest = (undo_oldest + 1) % undo.size();
+      }
+
       return true;
    }
 
+   //! Append the undo history to a buffer
+   void encodeUndo(Buffer& buffer)
+   {
+      unsigned n = 0;
+      for(unsigned i = undo_oldest; i != undo_next; i = (i + 1) % undo.size())
+      {
+         n++;
+      }
+
+      buffer.push16(n);
+
+      for(unsigned i = undo_oldest; i != undo_next; i = (i + 1) % undo.size())
+      {
+         undo[i].write(buffer);
+      }
+   }
+
+   //! Replace the undo history with one written by encodeUndo()
+   bool decodeUndo(Buffer& buffer)
+   {
+      unsigned n = buffer.read16();
+
+      undo_oldest = 0;
+      undo_next   = 0;
+
+      for(unsigned i = 0; i < n; i++)
+      {
+         if (undo.size() == 0)
+         {
+            IF::Quetzal discard;
+            if (!discard.read(buffer)) return false;
+            continue;
+         }
+
+         if (!undo[undo_next].read(buffer)) return false;
+
+         undo_size[undo_next] = undo[undo_next].getSize();
+
+         undo_next = (undo_next + 1) % undo.size();
+         if (undo_next == undo_oldest)
+         {
+            undo_oldest = (undo_oldest + 1) % undo.size();
+         }
+      }
+
+      return buffer.isOk();
+   }
+
    //! Restore the dynamic state from the undo buffer
    bool restoreUndo()
    {
@@ -126,15 +359,66 @@ public:
 private:
    std::string              save_dir;
    IF::Quetzal              save_file;
+   IF::Journal              journal;
    std::vector<IF::Quetzal> undo;
+   std::vector<size_t>      undo_size;
    unsigned                 undo_oldest{0};
    unsigned                 undo_next{0};
+   size_t                   max_undo_bytes{0};
+   size_t                   max_save_bytes{0};
+   size_t                   largest_save{0};
+   SaveCounts               counts;
+   bool                     files_blocked{false};
+   bool                     file_access_blocked{false};
+   bool                     write_failed{false};   //!< A background write failed
+   int                      journal_lock{-1};
+
+   static IF::SaveWriter& writer() { return IF::SaveWriter::get(); }
+
+   //! Wait for the writes queued so far, before reading a file they may
+   //! be writing
+   void settleWrites()
+   {
+      if (!writer().flush(this)) write_failed = true;
+   }
+
+   //! Report, once, any background write that has failed so far
+   bool checkWrites()
+   {
+      bool ok = writer().check(this) && !write_failed;
+      write_failed = false;
+      return ok;
+   }
 
    //! Get save filename
    std::string getSaveFilename(const std::string& name)
    {
       return saveFilename(save_dir, story.getFilename(), name);
    }
+
+   //! Get journal filename
+   std::string getJournalFilename()
+   {
+      return Journal::filename(save_dir, story.getFilename());
+   }
+
+   //! Take the lock on the journal of the story, once
+   //! \return false if another session has the journal
+   bool lockJournal()
+   {
+      if (journal_lock < 0)
+      {
+         // Make sure the save directory exists
+         (void) PLT::File::createDir(save_dir.c_str());
+
+         journal_lock = Journal::lock(getJournalFilename());
+
+         // Start the journal of this session with a checkpoint
+         if (journal_lock >= 0) journal.restart();
+      }
+
+      return journal_lock >= 0;
+   }
 };
 
 } // namespace IF
@@ -0,0 +1,334 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "common/Buffer.h"
+#include "common/Quetzal.h"
+#include "common/Thread.h"
+
+namespace IF {
+
+//! Background thread that writes save files so that the interpreter does
+//! not wait on the file system. Each file is written to a temporary file
+//! and renamed into place once the data is on the storage device, or
+//! appended to. Writes and appends to a file are completed in the order
+//! queued. There is one writer for the process, shared by all the machine
+//! states, which identify their files as the owner of each job. The thread
+//! is only started by the first write and any queued writes are completed
+//! before the writer is destroyed
+class SaveWriter : public Thread
+{
+public:
+   //! Identifies the jobs of one machine state
+   using Owner = const void*;
+
+   static SaveWriter& get()
+   {
+      static SaveWriter writer;
+      return writer;
+   }
+
+   ~SaveWriter()
+   {
+      if (isStarted())
+      {
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            stop = true;
+         }
+         work_ready.notify_one();
+
+         join();
+      }
+   }
+
+   //! Queue a Quetzal document to be written to a file
+   void write(Owner owner, const std::string& path, std::unique_ptr<Quetzal> quetzal)
+   {
+      Job job;
+      job.owner   = owner;
+      job.path    = path;
+      job.quetzal = std::move(quetzal);
+      queue(std::move(job));
+   }
+
+   //! Queue a buffer to be written to a file
+   void write(Owner owner, const std::string& path, Buffer& data)
+   {
+      Job job;
+      job.owner = owner;
+      job.path  = path;
+      std::swap(job.data, data);
+      queue(std::move(job));
+   }
+
+   //! Queue a buffer to be appended to a file
+   void append(Owner owner, const std::string& path, Buffer& data)
+   {
+      Job job;
+      job.owner  = owner;
+      job.path   = path;
+      job.append = true;
+      std::swap(job.data, data);
+      queue(std::move(job));
+   }
+
+   //! Wait until all the files queued by an owner have been written
+   //! \return false if any write of the owner failed since its previous flush
+   bool flush(Owner owner)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      auto it = owners.find(owner);
+      if (it == owners.end()) return true;
+
+      while(it->second.pending != 0)
+      {
+         work_done.wait(lock);
+      }
+
+      bool ok_ = it->second.ok;
+      owners.erase(it);
+      return ok_;
+   }
+
+   //! Check the writes of an owner completed so far, without waiting
+   //! \return false if any write of the owner failed since it was last checked
+   bool check(Owner owner)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      auto it = owners.find(owner);
+      if (it == owners.end()) return true;
+
+      bool ok_ = it->second.ok;
+
+      if (it->second.pending == 0)
+      {
+         owners.erase(it);
+      }
+      else
+      {
+         it->second.ok = true;
+      }
+
+      return ok_;
+   }
+
+private:
+   struct Job
+   {
+      Owner                    owner{nullptr};
+      std::string              path;
+      bool                     append{false};
+      std::unique_ptr<Quetzal> quetzal;
+      Buffer                   data;
+   };
+
+   //! Progress of the jobs of an owner
+   struct Status
+   {
+      unsigned pending{0};   //!< Jobs queued or being written
+      bool     ok{true};     //!< No write has failed
+   };
+
+   std::mutex              mutex;
+   std::condition_variable work_ready;
+   std::condition_variable work_done;
+   std::vector<Job>        jobs;
+   std::map<Owner,Status>  owners;
+   bool                    stop{false};
+
+   SaveWriter() = default;
+
+   //! Add a job to the queue, a write replaces any queued jobs for the same file
+   void queue(Job&& job)
+   {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+
+         if (!isStarted()) start();
+
+         if (!job.append)
+         {
+            for(size_t i = 0; i < jobs.size(); )
+            {
+               if (jobs[i].path == job.path)
+               {
+                  owners[jobs[i].owner].pending--;
+                  jobs.erase(jobs.begin() + i);
+               }
+               else
+               {
+                  i++;
+               }
+            }
+         }
+
+         owners[job.owner].pending++;
+         jobs.push_back(std::move(job));
+      }
+
+      work_ready.notify_one();
+   }
+
+   void entry() override
+   {
+      std::vector<Job> batch;
+
+      while(true)
+      {
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while(jobs.empty() && !stop)
+            {
+               work_ready.wait(lock);
+            }
+
+            if (jobs.empty()) break;
+
+            std::swap(batch, jobs);
+         }
+
+         std::vector<bool> written = writeBatch(batch);
+
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            for(size_t i = 0; i < batch.size(); i++)
+            {
+               Status& status = owners[batch[i].owner];
+               status.pending--;
+               if (!written[i]) status.ok = false;
+            }
+         }
+         batch.clear();
+
+         work_done.notify_all();
+      }
+   }
+
+   //! Write all files in a batch, so that the sync of one file to the
+   //! storage device can overlap with the write-back of the others
+   //! \return whether each job was completed
+   static std::vector<bool> writeBatch(std::vector<Job>& batch)
+   {
+      std::vector<bool> written(batch.size());
+
+      for(size_t i = 0; i < batch.size(); i++)
+      {
+         Job& job = batch[i];
+
+         if (job.append)
+         {
+            // Append to the new file if it is written earlier in this batch
+            std::string target = job.path;
+            for(size_t j = 0; j < i; j++)
+            {
+               if (!batch[j].append && (batch[j].path == job.path)) target = tmpFilename(job.path);
+            }
+
+            written[i] = appendFile(target, job.data);
+         }
+         else
+         {
+            std::string tmp = tmpFilename(job.path);
+
+            written[i] = job.quetzal ? job.quetzal->write(tmp)
+                                     : job.data.write(tmp);
+         }
+      }
+
+      std::vector<std::string> dirs;
+
+      for(size_t i = 0; i < batch.size(); i++)
+      {
+         Job& job = batch[i];
+
+         if (job.append)
+         {
+            // Appends to a new file are synced when it is renamed
+            if (written[i] && !syncFile(job.path)) written[i] = false;
+            continue;
+         }
+
+         std::string tmp = tmpFilename(job.path);
+
+         if (written[i] && syncFile(tmp) && (rename(tmp.c_str(), job.path.c_str()) == 0))
+         {
+            std::string dir = getDir(job.path);
+            bool        new_dir = true;
+            for(const auto& d : dirs)
+            {
+               if (d == dir) new_dir = false;
+            }
+            if (new_dir) dirs.push_back(dir);
+         }
+         else
+         {
+            (void) remove(tmp.c_str());
+            written[i] = false;
+         }
+      }
+
+      // Sync each directory once to make the renames durable
+      for(const auto& dir : dirs)
+      {
+         (void) syncFile(dir);
+      }
+
+      return written;
+   }
+
+   //! Temporary file for a write, unique to the process so that processes
+   //! writing the same file do not write over each other's data
+   static std::string tmpFilename(const std::string& path)
+   {
+      return path + "." + std::to_string(getpid()) + ".tmp";
+   }
+
+   //! Append data to a file
+   static bool appendFile(const std::string& path, const Buffer& data)
+   {
+      FILE* fp = fopen(path.c_str(), "a");
+      if (fp == nullptr) return false;
+
+      bool ok_ = data.empty() || (fwrite(data.data(), data.size(), 1, fp) == 1);
+      return (fclose(fp) == 0) && ok_;
+   }
+
+   //! Flush a file or directory to the storage device
+   static bool syncFile(const std::string& path)
+   {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0) return false;
+
+      bool ok_ = fsync(fd) == 0;
+      close(fd);
+      return ok_;
+   }
+
+   static std::string getDir(const std::string& path)
+   {
+      size_t slash = path.rfind('/');
+      return slash == std::string::npos ? "." : path.substr(0, slash);
+   }
+};
+
+} // namespace IF
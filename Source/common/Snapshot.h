@@ -0,0 +1,278 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "common/Buffer.h"
+#include "common/State.h"
+#include "common/Story.h"
+
+namespace IF {
+
+//! Snapshot of a running VM. A list of tagged sections, one holds the
+//! machine state and others are added by the interpreter for its own
+//! state e.g. screen and stream. Unlike a Quetzal save, a snapshot is
+//! only expected to be restored by the same build of the interpreter
+class Snapshot
+{
+public:
+   //! Increment when the encoding of any section changes
+   static const uint16_t FORMAT_VERSION = 1;
+
+   Snapshot() = default;
+
+   //! Remove all sections
+   void clear() { sections.clear(); }
+
+   //! Add an empty section, replacing any existing section with the same tag
+   Buffer& add(const char* tag)
+   {
+      Buffer* section = find(tag);
+      if (section != nullptr)
+      {
+         section->clear();
+         return *section;
+      }
+
+      sections.emplace_back(std::string(tag, 4), Buffer());
+      return sections.back().second;
+   }
+
+   //! Find a section ready for decoding
+   Buffer* find(const char* tag)
+   {
+      for(auto& section : sections)
+      {
+         if (memcmp(section.first.data(), tag, 4) == 0)
+         {
+            section.second.rewind();
+            return &section.second;
+         }
+      }
+
+      return nullptr;
+   }
+
+   //! Save the machine state, with the given PC, in a "STAT" section
+   void encodeState(const Story& story, const State& state, Memory::Address pc)
+   {
+      encodeState(add("STAT"), story, state, pc);
+   }
+
+   //! Restore the machine state from the "STAT" section
+   bool decodeState(const Story& story, State& state)
+   {
+      Buffer* buffer = find("STAT");
+      return (buffer != nullptr) && decodeState(*buffer, story, state);
+   }
+
+   //! Encode the machine state, with the given PC
+   static void encodeState(Buffer& buffer, const Story& story, const State& state, Memory::Address pc)
+   {
+      buffer.push32(pc);
+      buffer.push32(state.frame_ptr);
+      buffer.push64(state.random.internalState());
+
+      encodeMemory(buffer, story, state.memory);
+
+      buffer.push32(state.stack.size());
+      buffer.push(state.stack.data(), state.stack.size());
+   }
+
+   //! Decode the machine state
+   static bool decodeState(Buffer& buffer, const Story& story, State& state)
+   {
+      Memory::Address pc        = buffer.read32();
+      Stack::Offset   frame_ptr = buffer.read32();
+      uint64_t        rng       = buffer.read64();
+
+      if (!decodeMemory(buffer, story, state.memory)) return false;
+
+      uint32_t       stack_size = buffer.read32();
+      const uint8_t* stack      = buffer.read(stack_size);
+      if (stack == nullptr) return false;
+
+      state.stack.clear();
+      for(uint32_t i = 0; i < stack_size; i++)
+      {
+         state.stack.push8(stack[i]);
+      }
+
+      state.jump(pc);
+      state.frame_ptr              = frame_ptr;
+      state.random.internalState() = rng;
+
+      return true;
+   }
+
+   //! Encode all sections into a buffer
+   void encode(Buffer& buffer) const
+   {
+      buffer.push(MAGIC, 4);
+      buffer.push16(FORMAT_VERSION);
+      buffer.push16(sections.size());
+
+      for(const auto& section : sections)
+      {
+         buffer.push(section.first.data(), 4);
+         buffer.push32(section.second.size());
+         buffer.push(section.second.data(), section.second.size());
+      }
+   }
+
+   //! Decode all sections from a buffer
+   bool decode(Buffer& buffer)
+   {
+      clear();
+
+      const uint8_t* magic = buffer.read(4);
+      if ((magic == nullptr) || (memcmp(magic, MAGIC, 4) != 0)) return false;
+
+      if (buffer.read16() != FORMAT_VERSION) return false;
+
+      unsigned num_sections = buffer.read16();
+      for(unsigned i = 0; i < num_sections; i++)
+      {
+         const uint8_t* tag  = buffer.read(4);
+         uint32_t       size = buffer.read32();
+         const uint8_t* body = buffer.read(size);
+         if ((tag == nullptr) || (body == nullptr)) break;
+
+         add((const char*)tag).push(body, size);
+      }
+
+      if (!buffer.isOk() || !buffer.isEnd())
+      {
+         clear();
+         return false;
+      }
+
+      return true;
+   }
+
+   //! Write snapshot to a file. The file is replaced in one step, so that
+   //! another process reading it never sees part of a snapshot
+   bool write(const std::string& path) const
+   {
+      Buffer file;
+      encode(file);
+
+      std::string tmp = path + '.' + std::to_string(getpid()) + ".tmp";
+
+      if (!file.write(tmp) || (rename(tmp.c_str(), path.c_str()) != 0))
+      {
+         (void) remove(tmp.c_str());
+         return false;
+      }
+
+      return true;
+   }
+
+   //! Read snapshot from a file
+   bool read(const std::string& path)
+   {
+      clear();
+
+      Buffer file;
+      return file.read(path) && decode(file);
+   }
+
+private:
+   static constexpr const char* MAGIC = "ZifS";
+
+   std::vector<std::pair<std::string,Buffer>> sections;
+
+   //! Encode writable memory as a run-length encoded XOR against the story
+   //! (same scheme as the Quetzal CMem chunk)
+   static void encodeMemory(Buffer& buffer, const Story& story, const Memory& memory)
+   {
+      const uint8_t* ref = story.data();
+      const uint8_t* mem = memory.data();
+
+      uint32_t end = memory.getWriteEnd() + 1;
+
+      buffer.push32(end);
+
+      uint32_t run_length = 0;
+      for(uint32_t i = 0; i < end; i++)
+      {
+         uint8_t enc_byte = i < story.size() ? ref[i] ^ mem[i]
+                                             : mem[i];
+         if (enc_byte == 0x00)
+         {
+            ++run_length;
+         }
+         else
+         {
+            flushRun(buffer, run_length);
+            buffer.push8(enc_byte);
+         }
+      }
+
+      flushRun(buffer, run_length);
+   }
+
+   static void flushRun(Buffer& buffer, uint32_t& run_length)
+   {
+      while(run_length != 0)
+      {
+         uint32_t n = run_length <= 0x100 ? run_length : 0x100;
+
+         buffer.push8(0x00);
+         buffer.push8(n - 1);
+
+         run_length -= n;
+      }
+   }
+
+   //! Decode writable memory
+   static bool decodeMemory(Buffer& buffer, const Story& story, Memory& memory)
+   {
+      // The whole of writable memory is decoded
+      uint32_t end = buffer.read32();
+      if (!buffer.isOk() || (end != (memory.getWriteEnd() + 1))) return false;
+
+      // Read through a const reference, which leaves the hash of memory valid
+      const Memory&  current = memory;
+      const uint8_t* ref     = story.data();
+      const uint8_t* mem     = current.data();
+
+      for(uint32_t addr = 0; addr < end; )
+      {
+         uint8_t  enc_byte = buffer.read8();
+         uint32_t n        = 1;
+
+         if (enc_byte == 0x00)
+         {
+            n = buffer.read8() + 1;
+         }
+
+         if (!buffer.isOk() || ((addr + n) > end)) return false;
+
+         for(uint32_t i = 0; i < n; i++, addr++)
+         {
+            uint8_t byte = addr < story.size() ? ref[addr] ^ enc_byte
+                                               : enc_byte;
+
+            // Only bytes that change are written, so that pages shared
+            // with other memories stay shared, and through set8() so that
+            // the hash of memory stays up to date
+            if (mem[addr] != byte) memory.set8(addr, byte);
+         }
+      }
+
+      return true;
+   }
+};
+
+} // namespace IF
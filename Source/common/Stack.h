@@ -9,6 +9,8 @@
 #include <cstdint>
 #include <vector>
 
+#include "common/Zobrist.h"
+
 namespace IF {
 
 //! Stack implementation for an interactive fiction VM
@@ -32,6 +34,25 @@ public:
    //! Pointer to raw stack contents
    const uint8_t* data() const { return raw.data(); }
 
+   //! Largest size reached (bytes)
+   Offset getHighWater() const { return high_water; }
+
+   //! Space reserved for the stack (bytes)
+   Offset getMaxSize() const { return max_size; }
+
+   //! Hash of the stack contents. Calculated when first asked for, and
+   //! then kept up to date as the stack changes
+   uint64_t getHash() const
+   {
+      if (!hash_valid)
+      {
+         hash       = Zobrist::hash(raw.data(), raw.size(), SALT);
+         hash_valid = true;
+      }
+
+      return hash;
+   }
+
    //! Read 8-bit value from an absolute offset into the stack
    uint8_t read8(Offset offset) const
    {
@@ -96,12 +117,17 @@ public:
 
 
    //! Make the stack empty
-   void clear() { return raw.clear(); }
+   void clear()
+   {
+      raw.clear();
+      hash = 0;
+   }
 
    //! Write an 8-bit value at an absolute offset into the stack
    void write8(Offset offset, uint8_t value)
    {
       if ((size() < 1) || (offset > (size() - 1))) throw "stack fault";
+      rehash(offset, value);
       raw[offset] = value;
    }
 
@@ -109,6 +135,8 @@ public:
    void write16(Offset offset, uint16_t value)
    {
       if ((size() < 2) || (offset > (size() - 2))) throw "stack fault";
+      rehash(offset,     uint8_t(value >> 8));
+      rehash(offset + 1, uint8_t(value));
       raw[offset    ] = uint8_t(value >> 8);
       raw[offset + 1] = uint8_t(value);
    }
@@ -117,6 +145,9 @@ public:
    void write24(Offset offset, uint32_t value)
    {
       if ((size() < 3) || (offset > (size() - 3))) throw "stack fault";
+      rehash(offset,     uint8_t(value >> 16));
+      rehash(offset + 1, uint8_t(value >>  8));
+      rehash(offset + 2, uint8_t(value));
       raw[offset    ] = uint8_t(value >> 16);
       raw[offset + 1] = uint8_t(value >>  8);
       raw[offset + 2] = uint8_t(value);
@@ -126,6 +157,10 @@ public:
    void write32(Offset offset, uint32_t value)
    {
       if ((size() < 4) || (offset > (size() - 4))) throw "stack fault";
+      rehash(offset,     uint8_t(value >> 24));
+      rehash(offset + 1, uint8_t(value >> 16));
+      rehash(offset + 2, uint8_t(value >>  8));
+      rehash(offset + 3, uint8_t(value));
       raw[offset    ] = uint8_t(value >> 24);
       raw[offset + 1] = uint8_t(value >> 16);
       raw[offset + 2] = uint8_t(value >>  8);
@@ -152,6 +187,13 @@ public:
    void shrink(Offset new_size)
    {
       if (new_size >= size()) throw "stack overflow";
+      if (hash_valid)
+      {
+         for(Offset offset = new_size; offset < size(); offset++)
+         {
+            hash ^= Zobrist::key(offset, raw[offset], SALT);
+         }
+      }
       return raw.resize(new_size);
    }
 
@@ -160,7 +202,9 @@ public:
    {
       assert(size() <= max_size);
       if (size() == max_size) throw "stack overflow";
-      return raw.push_back(value);
+      if (hash_valid) hash ^= Zobrist::key(size(), value, SALT);
+      raw.push_back(value);
+      if (raw.size() > high_water) high_water = raw.size();
    }
 
    //! Push a 16-bit value onto the stack
@@ -190,6 +234,7 @@ public:
       if (empty()) throw "stack underflow";
       uint8_t value = raw.back();
       raw.pop_back();
+      if (hash_valid) hash ^= Zobrist::key(size(), value, SALT);
       return value;
    }
 
@@ -215,8 +260,20 @@ public:
    }
 
 protected:
+   //! Keeps the keys for the stack apart from the keys for memory
+   static const uint64_t SALT = 0x9E3779B97F4A7C15;
+
+   //! Update the hash for a byte about to be written
+   void rehash(Offset offset, uint8_t value)
+   {
+      if (hash_valid) hash ^= Zobrist::change(offset, raw[offset], value, SALT);
+   }
+
    Offset               max_size;
    std::vector<uint8_t> raw;
+   mutable uint64_t     hash{0};
+   mutable bool         hash_valid{false};
+   Offset               high_water{0};
 };
 
 } // namespace IF
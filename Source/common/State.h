@@ -12,6 +12,7 @@
 #include "common/Random.h"
 #include "common/Stack.h"
 #include "common/Story.h"
+#include "common/Zobrist.h"
 
 namespace IF {
 
@@ -38,15 +39,33 @@ public:
    //! Current value of the frame pointer
    Stack::Offset getFramePtr() const { return frame_ptr; }
 
+   //! Hash of the dynamic state, memory, stack, registers and random number
+   //! generator, for finding states that are the same without comparing
+   //! them. Kept up to date as the state changes
+   uint64_t fingerprint() const
+   {
+      return memory.getHash() ^
+             stack.getHash() ^
+             Zobrist::mix(random.internalState() ^ 0xC2B2AE3D27D4EB4F) ^
+             Zobrist::mix((uint64_t(pc) << 32 | frame_ptr) ^ 0x165667B19E3779F9);
+   }
+
    //! Reset the dynamic state to the initial conditions
    void reset()
+   {
+      resetRegisters();
+
+      story.resetMemory(memory);
+   }
+
+   //! Reset the dynamic state, except memory, to the initial conditions.
+   //! For a state about to be decoded that covers all of writable memory
+   void resetRegisters()
    {
       do_quit   = false;
       pc        = story.getEntryPoint();
       frame_ptr = 0;
 
-      story.resetMemory(memory);
-
       stack.clear();
 
       if (initial_rand_seed != 0)
@@ -0,0 +1,169 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace IF {
+
+//! Distribution of a measurement, counted in power of two ranges
+class Histogram
+{
+public:
+   Histogram() = default;
+
+   void add(uint64_t value)
+   {
+      count++;
+      total += value;
+      if (value > max) max = value;
+
+      buckets[bucket(value)]++;
+   }
+
+   uint64_t getCount() const { return count; }
+   uint64_t getTotal() const { return total; }
+   uint64_t getMax() const { return max; }
+
+   //! Upper limit of the range holding the given percentile, or the
+   //! largest value if that is lower
+   uint64_t percentile(unsigned percent) const
+   {
+      uint64_t rank = (count * percent + 99) / 100;
+      uint64_t seen = 0;
+
+      for(unsigned i = 0; i < NUM_BUCKETS; i++)
+      {
+         seen += buckets[i];
+         if ((seen != 0) && (seen >= rank)) return std::min(limit(i), max);
+      }
+
+      return max;
+   }
+
+   //! Number of values up to the limit of each range, from limit(0) up
+   uint64_t getBucket(unsigned i) const { return buckets[i]; }
+
+   //! Values in range i are at most limit(i), and above limit(i - 1)
+   static uint64_t limit(unsigned i) { return i == 0 ? 0 : i >= 64 ? UINT64_MAX : (uint64_t(1) << i) - 1; }
+
+   static const unsigned NUM_BUCKETS = 65;
+
+private:
+   uint64_t count{0};
+   uint64_t total{0};
+   uint64_t max{0};
+   uint64_t buckets[NUM_BUCKETS] = {};
+
+   static unsigned bucket(uint64_t value)
+   {
+      unsigned i = 0;
+      while(value != 0)
+      {
+         value >>= 1;
+         i++;
+      }
+      return i;
+   }
+};
+
+//! Builds the JSON text of a set of statistics, objects of named numbers
+class StatsWriter
+{
+public:
+   StatsWriter()
+   {
+      text = "{";
+   }
+
+   //! Start an object inside the current one
+   void begin(const char* name)
+   {
+      key(name);
+      text += '{';
+      first = true;
+      depth++;
+   }
+
+   //! End the current object
+   void end()
+   {
+      depth--;
+      newline();
+      text += '}';
+      first = false;
+   }
+
+   void add(const char* name, uint64_t value)
+   {
+      char number[24];
+      snprintf(number, sizeof(number), "%" PRIu64, value);
+
+      key(name);
+      text += number;
+   }
+
+   void add(const char* name, const Histogram& histogram)
+   {
+      begin(name);
+      add("count", histogram.getCount());
+      add("total", histogram.getTotal());
+      add("max",   histogram.getMax());
+      add("p50",   histogram.percentile(50));
+      add("p90",   histogram.percentile(90));
+      add("p99",   histogram.percentile(99));
+
+      // Non-empty ranges by their upper limit
+      begin("buckets");
+      for(unsigned i = 0; i < Histogram::NUM_BUCKETS; i++)
+      {
+         if (histogram.getBucket(i) != 0)
+         {
+            add(std::to_string(Histogram::limit(i)).c_str(), histogram.getBucket(i));
+         }
+      }
+      end();
+
+      end();
+   }
+
+   //! The complete JSON text
+   std::string finish()
+   {
+      depth--;
+      newline();
+      text += "}\n";
+      return text;
+   }
+
+private:
+   std::string text;
+   bool        first{true};
+   unsigned    depth{1};
+
+   void newline()
+   {
+      text += '\n';
+      text.append(2 * depth, ' ');
+   }
+
+   void key(const char* name)
+   {
+      if (!first) text += ',';
+      first = false;
+
+      newline();
+      text += '"';
+      text += name;
+      text += "\": ";
+   }
+};
+
+} // namespace IF
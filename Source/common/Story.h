@@ -40,10 +40,11 @@ public:
    //! Return size of story (bytes)
    size_t size() const { return image.size(); }
 
-   //! Clear all state from any previously loaded image
+   //! Clear all state from any previously loaded image, and release the
+   //! memory it used
    void clear()
    {
-      image.clear();
+      std::vector<uint8_t>().swap(image);
 
       is_valid = false;
       filename = "";
@@ -78,48 +79,29 @@ public:
          return false;
       }
 
-      bool ok = false;
+      bool ok = loadFrom(fp, offset, path);
 
-      if (fseek(fp, offset, SEEK_SET) != 0)
-      {
-         error = "Failed to seek to header";
-      }
-      else
-      {
-         image.resize(getSizeOfHeader());
+      fclose(fp);
 
-         if (fread(image.data(), getSizeOfHeader(), 1, fp) != 1)
-         {
-            error = "Failed to read header";
-         }
-         else
-         {
-            size_t file_size;
+      return ok;
+   }
 
-            if (validateHeader(fp, file_size))
-            {
-               image.resize(file_size);
+   //! Load story from a memory buffer, the name is used in place of the
+   //! filename e.g. for save files
+   bool load(const uint8_t* data, size_t size, const std::string& name)
+   {
+      clear();
 
-               if (fread(&image[getSizeOfHeader()], file_size - getSizeOfHeader(), 1, fp) != 1)
-               {
-                  error = "Failed to read body";
-               }
-               else
-               {
-                  is_valid = validateImage();
-                  extractFilename(path);
-                  ok = true;
-               }
-            }
-         }
+      FILE* fp = fmemopen(const_cast<uint8_t*>(data), size, "r");
+      if (fp == nullptr)
+      {
+         error = "Failed to open story buffer";
+         return false;
       }
 
-      fclose(fp);
+      bool ok = loadFrom(fp, 0, name);
 
-      if (!ok)
-      {
-         clear();
-      }
+      fclose(fp);
 
       return ok;
    }
@@ -151,6 +133,21 @@ public:
    //! Decode Quetzal header chunk 
    virtual bool decodeQuetzalHeader(STB::IFF::Document& doc, uint32_t& pc) const = 0;
 
+   //! Return a short string that identifies this story image
+   virtual std::string getIdentity() const
+   {
+      // FNV-1a hash of the whole image
+      uint32_t hash = 0x811C9DC5;
+      for(const auto& byte : image)
+      {
+         hash = (hash ^ byte) * 0x01000193;
+      }
+
+      char text[16];
+      snprintf(text, sizeof(text), "%08X", hash);
+      return text;
+   }
+
 protected:
    std::vector<uint8_t> image;
    mutable std::string  error{};
@@ -159,6 +156,53 @@ private:
    bool        is_valid{false};
    std::string filename{};
 
+   //! Load story from an open file
+   bool loadFrom(FILE* fp, size_t offset, const std::string& path)
+   {
+      bool ok = false;
+
+      if (fseek(fp, offset, SEEK_SET) != 0)
+      {
+         error = "Failed to seek to header";
+      }
+      else
+      {
+         image.resize(getSizeOfHeader());
+
+         if (fread(image.data(), getSizeOfHeader(), 1, fp) != 1)
+         {
+            error = "Failed to read header";
+         }
+         else
+         {
+            size_t file_size;
+
+            if (validateHeader(fp, file_size))
+            {
+               image.resize(file_size);
+
+               if (fread(&image[getSizeOfHeader()], file_size - getSizeOfHeader(), 1, fp) != 1)
+               {
+                  error = "Failed to read body";
+               }
+               else
+               {
+                  is_valid = validateImage();
+                  extractFilename(path);
+                  ok = true;
+               }
+            }
+         }
+      }
+
+      if (!ok)
+      {
+         clear();
+      }
+
+      return ok;
+   }
+
    void extractFilename(const std::string& path)
    {
       size_t slash = path.rfind('/');
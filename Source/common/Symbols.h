@@ -0,0 +1,59 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+namespace IF {
+
+//! Names for routine addresses
+class Symbols
+{
+public:
+   Symbols() = default;
+
+   //! Read names from a file with a hex address and a name on each line.
+   //! Lines starting with '#' are ignored
+   bool load(const std::string& filename)
+   {
+      FILE* fp = fopen(filename.c_str(), "r");
+      if (fp == nullptr) return false;
+
+      char line[256];
+      while(fgets(line, sizeof(line), fp) != nullptr)
+      {
+         unsigned addr;
+         char     name[200];
+
+         if ((line[0] != '#') && (sscanf(line, "%x %199s", &addr, name) == 2))
+         {
+            names[addr] = name;
+         }
+      }
+
+      fclose(fp);
+      return true;
+   }
+
+   //! Name of the routine at the given address
+   std::string getName(uint32_t addr) const
+   {
+      auto it = names.find(addr);
+      if (it != names.end()) return it->second;
+
+      char text[16];
+      snprintf(text, sizeof(text), "r%06X", addr);
+      return text;
+   }
+
+private:
+   std::unordered_map<uint32_t, std::string> names;
+};
+
+} // namespace IF
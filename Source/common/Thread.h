@@ -6,6 +6,8 @@
 #pragma once
 
 #include <atomic>
+#include <cstdio>
+#include <cstdlib>
 
 #include <pthread.h>
 
@@ -18,7 +20,7 @@ public:
 
    virtual ~Thread()
    {
-      if (!joined)
+      if (started && !joined)
       {
          if (pthread_cancel(td) != 0)
          {
@@ -33,6 +35,9 @@ public:
       joined = true;
    }
 
+   //! Return true once the thread has been started
+   bool isStarted() const { return started; }
+
 protected:
    void start()
    {
@@ -48,6 +53,9 @@ protected:
          perror("pthread_create");
          exit(1);
       }
+
+      started = true;
+      joined  = false;
    }
 
    virtual void entry() = 0;
@@ -61,6 +69,7 @@ private:
    }
 
    pthread_t         td{};
+   std::atomic<bool> started{false};
    std::atomic<bool> joined{false};
 };
 
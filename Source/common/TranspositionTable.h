@@ -0,0 +1,77 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace IF {
+
+//! Machine states that have been reached, by fingerprint (see
+//! State::fingerprint()), with the fewest steps taken to reach each. Can
+//! be used from many threads at once
+class TranspositionTable
+{
+public:
+   TranspositionTable() = default;
+
+   //! Record a state reached after a number of steps
+   //! \return true if the state is new or has now been reached in fewer steps
+   bool insert(uint64_t fingerprint, unsigned steps)
+   {
+      Shard&                       shard = shards[fingerprint % NUM_SHARDS];
+      std::unique_lock<std::mutex> lock(shard.mutex);
+
+      auto entry = shard.states.emplace(fingerprint, steps);
+      if (entry.second) return true;
+
+      if (steps < entry.first->second)
+      {
+         entry.first->second = steps;
+         return true;
+      }
+
+      return false;
+   }
+
+   //! Number of different states recorded
+   size_t size()
+   {
+      size_t total = 0;
+
+      for(auto& shard : shards)
+      {
+         std::unique_lock<std::mutex> lock(shard.mutex);
+         total += shard.states.size();
+      }
+
+      return total;
+   }
+
+   void clear()
+   {
+      for(auto& shard : shards)
+      {
+         std::unique_lock<std::mutex> lock(shard.mutex);
+         shard.states.clear();
+      }
+   }
+
+private:
+   //! Independently locked parts of the table, to limit contention
+   static const unsigned NUM_SHARDS = 64;
+
+   struct Shard
+   {
+      std::mutex                            mutex;
+      std::unordered_map<uint64_t,unsigned> states;
+   };
+
+   Shard shards[NUM_SHARDS];
+};
+
+} // namespace IF
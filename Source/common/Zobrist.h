@@ -0,0 +1,51 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+
+namespace IF {
+
+//! Zobrist style hashing of a block of bytes. The hash is the exclusive-or
+//! of a pseudo random key for the value of each byte at its position, so
+//! it can be kept up to date as single bytes change
+class Zobrist
+{
+public:
+   //! Scramble a value (splitmix64 finaliser)
+   static uint64_t mix(uint64_t value)
+   {
+      value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+      value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+      return value ^ (value >> 31);
+   }
+
+   //! Key for a byte value at a position, the salt separates the keys of
+   //! different blocks
+   static uint64_t key(uint64_t pos, uint8_t byte, uint64_t salt = 0)
+   {
+      return mix(((pos << 8) | byte) ^ salt);
+   }
+
+   //! Change to the hash when a byte changes
+   static uint64_t change(uint64_t pos, uint8_t old_byte, uint8_t new_byte, uint64_t salt = 0)
+   {
+      return old_byte == new_byte ? 0 : key(pos, old_byte, salt) ^ key(pos, new_byte, salt);
+   }
+
+   //! Hash of a block of bytes
+   static uint64_t hash(const uint8_t* data, uint64_t size, uint64_t salt = 0)
+   {
+      uint64_t value = 0;
+      for(uint64_t pos = 0; pos < size; pos++)
+      {
+         value ^= key(pos, data[pos], salt);
+      }
+      return value;
+   }
+};
+
+} // namespace IF
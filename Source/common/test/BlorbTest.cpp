@@ -0,0 +1,298 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Blorb index and chunk bounds, on files built by the test
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "common/Blorb.h"
+#include "common/BlorbCache.h"
+
+#include "common/test/Check.h"
+
+using Bytes = std::vector<uint8_t>;
+
+static const char* FILENAME = "test-blorb.blb";
+
+static void push32(Bytes& bytes, uint32_t value)
+{
+   bytes.push_back(uint8_t(value >> 24));
+   bytes.push_back(uint8_t(value >> 16));
+   bytes.push_back(uint8_t(value >>  8));
+   bytes.push_back(uint8_t(value));
+}
+
+static void pushTag(Bytes& bytes, const char* tag)
+{
+   bytes.insert(bytes.end(), tag, tag + 4);
+}
+
+//! Builder for a Blorb file, with the resource index as the first chunk
+class BlorbFile
+{
+public:
+   //! Add a resource chunk, size is the chunk size written in its header
+   void add(const char* usage, uint32_t number, const char* type, const Bytes& body,
+            uint32_t size)
+   {
+      resources.push_back(Resource{usage, number, type, body, size});
+   }
+
+   void add(const char* usage, uint32_t number, const char* type, const Bytes& body)
+   {
+      add(usage, number, type, body, body.size());
+   }
+
+   //! Change the entry count written in the resource index
+   void setIndexCount(uint32_t count) { index_count = count; }
+
+   //! Change the chunk size written in the resource index header
+   void setIndexSize(uint32_t size) { index_size = size; }
+
+   void setRelease(uint16_t release_) { release = release_; }
+
+   Bytes encode() const
+   {
+      uint32_t ridx_size = 4 + 12 * resources.size();
+      uint32_t offset    = 12 + 8 + ridx_size + (release != 0 ? 10 : 0);
+
+      Bytes body;
+
+      pushTag(body, "IFRS");
+
+      pushTag(body, "RIdx");
+      push32(body, index_size != 0 ? index_size : ridx_size);
+      push32(body, index_count != 0 ? index_count : resources.size());
+      for(const auto& res : resources)
+      {
+         pushTag(body, res.usage);
+         push32(body, res.number);
+         push32(body, offset);
+         offset += 8 + res.body.size() + (res.body.size() & 1);
+      }
+
+      if (release != 0)
+      {
+         pushTag(body, "RelN");
+         push32(body, 2);
+         body.push_back(uint8_t(release >> 8));
+         body.push_back(uint8_t(release));
+      }
+
+      for(const auto& res : resources)
+      {
+         pushTag(body, res.type);
+         push32(body, res.size);
+         body.insert(body.end(), res.body.begin(), res.body.end());
+         if ((res.body.size() & 1) != 0) body.push_back(0);
+      }
+
+      Bytes file;
+      pushTag(file, "FORM");
+      push32(file, body.size());
+      file.insert(file.end(), body.begin(), body.end());
+      return file;
+   }
+
+   bool write() const
+   {
+      Bytes file = encode();
+      return writeFile(file);
+   }
+
+   static bool writeFile(const Bytes& file)
+   {
+      FILE* fp = fopen(FILENAME, "w");
+      if (fp == nullptr) return false;
+
+      bool ok = fwrite(file.data(), file.size(), 1, fp) == 1;
+      return (fclose(fp) == 0) && ok;
+   }
+
+private:
+   struct Resource
+   {
+      const char* usage;
+      uint32_t    number;
+      const char* type;
+      Bytes       body;
+      uint32_t    size;
+   };
+
+   std::vector<Resource> resources;
+   uint32_t              index_count{0};
+   uint32_t              index_size{0};
+   uint16_t              release{0};
+};
+
+//! Placeholder picture of the given size
+static Bytes rect(uint32_t width, uint32_t height)
+{
+   Bytes body;
+   push32(body, width);
+   push32(body, height);
+   return body;
+}
+
+//! Start of a PNG file, up to the end of the image size in the IHDR chunk
+static Bytes png(uint32_t width, uint32_t height)
+{
+   Bytes body{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+   push32(body, 13);
+   pushTag(body, "IHDR");
+   push32(body, width);
+   push32(body, height);
+   return body;
+}
+
+static void testValidFile()
+{
+   BlorbFile file;
+   file.add("Pict", 1, "Rect", rect(30, 20));
+   file.add("Pict", 2, "PNG ", png(640, 480));
+   file.add("Snd ", 3, "OGGV", Bytes(101, 0x5A));
+   file.setRelease(7);
+   CHECK(file.write());
+
+   Blorb blorb;
+   CHECK(blorb.open(FILENAME));
+   CHECK(blorb.getRelease() == 7);
+   CHECK(blorb.count(Blorb::Resource::PICT) == 2);
+   CHECK(blorb.count(Blorb::Resource::SND) == 1);
+   CHECK(blorb.find(Blorb::Resource::PICT, 2) != nullptr);
+   CHECK(blorb.find(Blorb::Resource::PICT, 3) == nullptr);
+
+   BlorbCache cache;
+   CHECK(cache.open(FILENAME));
+
+   unsigned width  = 0;
+   unsigned height = 0;
+   CHECK(cache.getPictureSize(1, width, height) && (width == 30) && (height == 20));
+   CHECK(cache.getPictureSize(2, width, height) && (width == 640) && (height == 480));
+   CHECK(!cache.getPictureSize(3, width, height));
+
+   const BlorbCache::Resource* sound = cache.getSound(3);
+   CHECK((sound != nullptr) && (sound->type == "OGGV") && (sound->data == Bytes(101, 0x5A)));
+   CHECK(cache.getLoadedBytes() == 101);
+}
+
+static void testIndexCount()
+{
+   BlorbFile file;
+   file.add("Pict", 1, "Rect", rect(1, 1));
+
+   // One more entry than the index holds
+   file.setIndexCount(2);
+   CHECK(file.write());
+
+   Blorb blorb;
+   CHECK(!blorb.open(FILENAME));
+
+   // Twelve bytes for each of this many entries wraps a 32-bit size
+   file.setIndexCount(0x15555556);
+   CHECK(file.write());
+   CHECK(!blorb.open(FILENAME));
+}
+
+static void testIndexSize()
+{
+   BlorbFile file;
+   file.add("Pict", 1, "Rect", rect(1, 1));
+
+   // Index runs past the end of the file
+   file.setIndexSize(0x10000);
+   CHECK(file.write());
+
+   Blorb blorb;
+   CHECK(!blorb.open(FILENAME));
+
+   file.setIndexSize(0xFFFFFFF0);
+   CHECK(file.write());
+   CHECK(!blorb.open(FILENAME));
+}
+
+static void testChunkSize()
+{
+   BlorbFile file;
+   file.add("Pict", 1, "Rect", rect(1, 1));
+   file.add("Snd ", 2, "OGGV", Bytes(16, 0), 0x7FFFFFF0);
+   CHECK(file.write());
+
+   Blorb blorb;
+   CHECK(blorb.open(FILENAME));
+
+   const Blorb::Entry* entry = blorb.find(Blorb::Resource::SND, 2);
+   CHECK(entry != nullptr);
+
+   std::string type;
+   uint32_t    size;
+   CHECK((entry != nullptr) && !blorb.readChunkHeader(*entry, type, size));
+
+   // The chunk size is not trusted for the allocation
+   BlorbCache cache;
+   CHECK(cache.open(FILENAME));
+   CHECK(cache.getSound(2) == nullptr);
+   CHECK(cache.getLoadedBytes() == 0);
+}
+
+static void testBudget()
+{
+   BlorbFile file;
+   file.add("Snd ", 1, "OGGV", Bytes(64, 1));
+   file.add("Snd ", 2, "OGGV", Bytes(64, 2));
+   file.add("Snd ", 3, "OGGV", Bytes(64, 3));
+   file.add("Snd ", 4, "OGGV", Bytes(200, 4));
+   CHECK(file.write());
+
+   BlorbCache cache(128);
+   CHECK(cache.open(FILENAME));
+
+   const BlorbCache::Resource* first  = cache.getSound(1);
+   const BlorbCache::Resource* second = cache.getSound(2);
+   CHECK((first != nullptr) && (second != nullptr));
+   CHECK(cache.getLoadedBytes() == 128);
+
+   // The least recently used sound is evicted to make room
+   CHECK(cache.getSound(1) == first);
+   CHECK(cache.getSound(3) != nullptr);
+   CHECK(cache.getLoadedBytes() == 128);
+   CHECK(!first->data.empty() && second->data.empty());
+
+   // Larger than the whole cache
+   CHECK(cache.getSound(4) == nullptr);
+   CHECK(cache.getLoadedBytes() == 128);
+}
+
+static void testNotBlorb()
+{
+   Blorb blorb;
+
+   CHECK(BlorbFile::writeFile(Bytes{'F', 'O', 'R', 'M', 0, 0}));
+   CHECK(!blorb.open(FILENAME));
+
+   Bytes file;
+   pushTag(file, "FORM");
+   push32(file, 4);
+   pushTag(file, "AIFF");
+   CHECK(BlorbFile::writeFile(file));
+   CHECK(!blorb.open(FILENAME));
+}
+
+int main()
+{
+   testValidFile();
+   testIndexCount();
+   testIndexSize();
+   testChunkSize();
+   testBudget();
+   testNotBlorb();
+
+   (void) remove(FILENAME);
+
+   return Check::result();
+}
@@ -0,0 +1,47 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdio>
+
+//! Checks for the unit tests. Each test is a program that makes some
+//! checks and returns a non-zero exit status if any of them failed
+class Check
+{
+public:
+   //! Record the result of a check, reporting it if it failed
+   static bool report(bool ok, const char* expr, const char* file, unsigned line)
+   {
+      if (!ok)
+      {
+         fprintf(stderr, "%s:%u: check failed: %s\n", file, line, expr);
+         failures()++;
+      }
+
+      return ok;
+   }
+
+   //! Exit status for the test
+   static int result()
+   {
+      if (failures() != 0)
+      {
+         fprintf(stderr, "%u check(s) failed\n", failures());
+         return 1;
+      }
+
+      return 0;
+   }
+
+private:
+   static unsigned& failures()
+   {
+      static unsigned count = 0;
+      return count;
+   }
+};
+
+#define CHECK(expr) Check::report((expr), #expr, __FILE__, __LINE__)
@@ -0,0 +1,205 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Incremental hashes of the stack and memory, and the state fingerprint
+
+#include <cstdint>
+#include <vector>
+
+#include "common/Memory.h"
+#include "common/Stack.h"
+#include "common/State.h"
+
+#include "Z/Story.h"
+#include "Z/test/TestStory.h"
+
+#include "common/test/Check.h"
+
+static const IF::Stack::Offset STACK_SIZE = 1024;
+
+//! Repeatable sequence of pseudo random numbers
+class Sequence
+{
+public:
+   uint32_t next(uint32_t limit)
+   {
+      value = value * 6364136223846793005 + 1442695040888963407;
+      return uint32_t(value >> 33) % limit;
+   }
+
+private:
+   uint64_t value{1};
+};
+
+//! Hash of a stack calculated from scratch
+static uint64_t freshHash(const IF::Stack& stack)
+{
+   IF::Stack copy(STACK_SIZE);
+
+   for(IF::Stack::Offset offset = 0; offset < stack.size(); offset++)
+   {
+      copy.push8(stack.data()[offset]);
+   }
+
+   return copy.getHash();
+}
+
+//! Hash of writable memory calculated from scratch
+static uint64_t freshHash(IF::State& fresh, const IF::Memory& memory)
+{
+   uint8_t* raw = fresh.memory.data();
+
+   for(uint32_t addr = 0; addr <= memory.getWriteEnd(); addr++)
+   {
+      raw[addr] = memory.data()[addr];
+   }
+
+   return fresh.memory.getHash();
+}
+
+static void testStack()
+{
+   IF::Stack stack(STACK_SIZE);
+   Sequence  seq;
+
+   CHECK(stack.getHash() == freshHash(stack));
+
+   for(unsigned i = 0; i < 2000; i++)
+   {
+      unsigned size = stack.size();
+
+      switch(seq.next(10))
+      {
+      case 0: if (size < (STACK_SIZE - 1)) stack.push8(seq.next(256)); break;
+      case 1: if (size < (STACK_SIZE - 2)) stack.push16(seq.next(0x10000)); break;
+      case 2: if (size < (STACK_SIZE - 4)) stack.push32(seq.next(0xFFFFFFFF)); break;
+      case 3: if (size >= 1) (void) stack.pop8(); break;
+      case 4: if (size >= 4) (void) stack.pop32(); break;
+      case 5: if (size >= 1) stack.write8(seq.next(size), seq.next(256)); break;
+      case 6: if (size >= 2) stack.write16(seq.next(size - 1), seq.next(0x10000)); break;
+      case 7: if (size >= 4) stack.write32(seq.next(size - 3), seq.next(0xFFFFFFFF)); break;
+      case 8: if (size >= 1) stack.shrink(seq.next(size)); break;
+      case 9: if (seq.next(20) == 0) stack.clear(); break;
+      }
+
+      // Only check some of the time, so that changes are also made
+      // while the hash is not valid
+      if (seq.next(4) == 0)
+      {
+         CHECK(stack.getHash() == freshHash(stack));
+      }
+   }
+
+   // The same contents reached another way
+   IF::Stack other(STACK_SIZE);
+   other.push32(0x12345678);
+   other.shrink(2);
+   other.push16(0x5678);
+
+   IF::Stack direct(STACK_SIZE);
+   direct.push32(0x12345678);
+
+   CHECK(other.getHash() == direct.getHash());
+
+   direct.write8(3, 0x79);
+   CHECK(other.getHash() != direct.getHash());
+}
+
+static void testMemory(const Z::Story& story)
+{
+   IF::State state(story, 1, STACK_SIZE);
+   IF::State fresh(story, 1, STACK_SIZE);
+   Sequence  seq;
+
+   state.reset();
+   fresh.reset();
+
+   IF::Memory& memory = state.memory;
+   uint32_t    end    = memory.getWriteEnd();
+
+   CHECK(memory.getHash() == freshHash(fresh, memory));
+
+   for(unsigned i = 0; i < 2000; i++)
+   {
+      switch(seq.next(6))
+      {
+      case 0: memory.write8(seq.next(end + 1), seq.next(256)); break;
+      case 1: memory.write16(seq.next(end), seq.next(0x10000)); break;
+      case 2: memory.write32(seq.next(end - 2), seq.next(0xFFFFFFFF)); break;
+      case 3: memory.set8(seq.next(end + 1), seq.next(256)); break;
+
+      // Beyond writable memory, not in the hash
+      case 4: memory.set8(end + 1 + seq.next(0x1000), seq.next(256)); break;
+
+      case 5:
+         // A write that is not seen, followed by the note of it
+         if (seq.next(10) == 0)
+         {
+            memory.data()[seq.next(end + 1)] ^= 0xFF;
+            memory.changed();
+         }
+         break;
+      }
+
+      if (seq.next(4) == 0)
+      {
+         CHECK(memory.getHash() == freshHash(fresh, memory));
+      }
+   }
+}
+
+static void testState(const Z::Story& story)
+{
+   IF::State first(story, 1, STACK_SIZE);
+   IF::State second(story, 1, STACK_SIZE);
+
+   first.reset();
+   second.reset();
+
+   CHECK(first.fingerprint() == second.fingerprint());
+
+   // The same changes in a different order
+   first.memory.write8(0x0200, 1);
+   first.memory.write8(0x0300, 2);
+   first.stack.push16(0xABCD);
+
+   second.stack.push16(0xABCD);
+   second.memory.write8(0x0300, 2);
+   second.memory.write16(0x0200, 0x0100);
+   second.memory.write8(0x0201, 0x00);
+
+   CHECK(first.fingerprint() == second.fingerprint());
+
+   // Each register counts
+   uint64_t same = first.fingerprint();
+
+   first.jump(first.getPC() + 1);
+   CHECK(first.fingerprint() != same);
+   first.jump(second.getPC());
+   CHECK(first.fingerprint() == same);
+
+   first.frame_ptr = 2;
+   CHECK(first.fingerprint() != same);
+   first.frame_ptr = second.frame_ptr;
+
+   (void) first.random.get();
+   CHECK(first.fingerprint() != same);
+   first.random.internalState() = second.random.internalState();
+   CHECK(first.fingerprint() == same);
+}
+
+int main()
+{
+   std::vector<uint8_t> image = TestStory::build({0xBA}); // quit
+
+   Z::Story story;
+   if (!CHECK(story.load(image.data(), image.size(), "test.z5"))) return Check::result();
+
+   testStack();
+   testMemory(story);
+   testState(story);
+
+   return Check::result();
+}
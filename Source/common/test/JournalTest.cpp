@@ -0,0 +1,241 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Journal encode and apply round trip, and recovery from damaged records
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "common/Journal.h"
+#include "common/Snapshot.h"
+#include "common/State.h"
+
+#include "Z/Story.h"
+#include "Z/test/TestStory.h"
+
+#include "common/test/Check.h"
+
+using Bytes = std::vector<uint8_t>;
+
+static const char* FILENAME = "test-journal.jnl";
+
+static const IF::Stack::Offset STACK_SIZE = 1024;
+
+static const unsigned TURNS = 5;
+
+//! Everything a journal record restores, for comparing states
+static Bytes encode(const IF::Story& story, const IF::State& state)
+{
+   IF::Buffer buffer;
+   IF::Snapshot::encodeState(buffer, story, state, state.getPC());
+   return Bytes(buffer.data(), buffer.data() + buffer.size());
+}
+
+//! Change the state for the next turn
+static void play(IF::State& state, unsigned turn)
+{
+   state.memory.write8(0x0040 + turn, 'a' + turn);
+   state.memory.write16(0x0800 + turn * 0x100, turn);
+
+   // The last page of writable memory is a single byte
+   state.memory.write8(TestStory::CODE, turn);
+
+   state.stack.push16(turn);
+   state.frame_ptr = state.stack.size();
+   state.jump(TestStory::CODE + turn);
+   (void) state.random.get();
+}
+
+//! Journal of a game played for some turns, with the state after each turn
+struct Recording
+{
+   Recording(const IF::Story& story)
+   {
+      IF::State   state(story, 1, STACK_SIZE);
+      IF::Journal journal;
+
+      state.reset();
+
+      for(unsigned turn = 0; turn < TURNS; turn++)
+      {
+         IF::Buffer record;
+
+         bool checkpoint = journal.encode(record, story, state, state.getPC(), "turn");
+         CHECK(checkpoint == (turn == 0));
+         CHECK(checkpoint == IF::Journal::isCheckpoint(record));
+
+         records.push(record.data(), record.size());
+         ends.push_back(records.size());
+         states.push_back(encode(story, state));
+
+         play(state, turn + 1);
+      }
+   }
+
+   IF::Buffer          records;
+   std::vector<size_t> ends;     //!< Size of the journal after each record
+   std::vector<Bytes>  states;   //!< State recorded by each record
+};
+
+//! Apply the first part of a journal, returning the result of apply()
+static bool applyPart(const IF::Story& story, const IF::Buffer& records, size_t size,
+                      IF::State& state)
+{
+   IF::Buffer  part;
+   IF::Journal journal;
+
+   part.push(records.data(), size);
+   return journal.apply(part, story, state);
+}
+
+static void testRoundTrip(const IF::Story& story)
+{
+   Recording recording(story);
+
+   for(unsigned turn = 0; turn < TURNS; turn++)
+   {
+      IF::State state(story, 1, STACK_SIZE);
+      state.reset();
+
+      CHECK(applyPart(story, recording.records, recording.ends[turn], state));
+      CHECK(encode(story, state) == recording.states[turn]);
+   }
+}
+
+static void testDamage(const IF::Story& story)
+{
+   Recording recording(story);
+
+   const IF::Buffer& records = recording.records;
+   size_t            last    = TURNS - 1;
+
+   // A record torn part way through is ignored, leaving the previous state
+   for(size_t size = recording.ends[last - 1] + 1; size < recording.ends[last]; size++)
+   {
+      IF::State state(story, 1, STACK_SIZE);
+      state.reset();
+
+      CHECK(!applyPart(story, records, size, state));
+      CHECK(encode(story, state) == recording.states[last - 1]);
+   }
+
+   // A corrupt record is not applied, nor any after it
+   Bytes bytes(records.data(), records.data() + records.size());
+   bytes[recording.ends[1] + 20] ^= 0x01;
+
+   IF::Buffer corrupt;
+   corrupt.push(bytes.data(), bytes.size());
+
+   IF::State state(story, 1, STACK_SIZE);
+   state.reset();
+   CHECK(!applyPart(story, corrupt, corrupt.size(), state));
+   CHECK(encode(story, state) == recording.states[1]);
+
+   // Turns without the checkpoint they follow on from
+   IF::Buffer turns;
+   turns.push(records.data() + recording.ends[0], records.size() - recording.ends[0]);
+
+   IF::State fresh(story, 1, STACK_SIZE);
+   fresh.reset();
+   Bytes initial = encode(story, fresh);
+   CHECK(!applyPart(story, turns, turns.size(), fresh));
+   CHECK(encode(story, fresh) == initial);
+}
+
+static void testOtherStory(const IF::Story& story)
+{
+   Recording recording(story);
+
+   // Same layout, another release
+   Bytes image = TestStory::build({0xBA});
+   image[0x03] = 2;
+
+   Z::Story other;
+   CHECK(other.load(image.data(), image.size(), "other.z5"));
+
+   IF::State state(other, 1, STACK_SIZE);
+   state.reset();
+   CHECK(!applyPart(other, recording.records, recording.records.size(), state));
+}
+
+static void testCheckpoints(const IF::Story& story)
+{
+   IF::State   state(story, 1, STACK_SIZE);
+   IF::Journal journal;
+
+   state.reset();
+
+   for(unsigned turn = 0; turn <= IF::Journal::CHECKPOINT_INTERVAL; turn++)
+   {
+      IF::Buffer record;
+      bool checkpoint = journal.encode(record, story, state, state.getPC(), "");
+      CHECK(checkpoint == ((turn % IF::Journal::CHECKPOINT_INTERVAL) == 0));
+      CHECK(checkpoint == IF::Journal::isCheckpoint(record));
+   }
+
+   journal.restart();
+
+   IF::Buffer record;
+   CHECK(journal.encode(record, story, state, state.getPC(), ""));
+}
+
+static void testFile(const IF::Story& story)
+{
+   Recording recording(story);
+
+   // The last record torn, as after a crash
+   IF::Buffer file;
+   file.push(recording.records.data(), recording.records.size() - 1);
+   CHECK(file.write(FILENAME));
+
+   IF::State   state(story, 1, STACK_SIZE);
+   IF::Journal journal;
+
+   state.reset();
+   CHECK(journal.replay(FILENAME, story, state));
+   CHECK(encode(story, state) == recording.states[TURNS - 2]);
+
+   (void) remove(FILENAME);
+
+   CHECK(!journal.replay(FILENAME, story, state));
+}
+
+static void testLock()
+{
+   int fd = IF::Journal::lock(FILENAME);
+   CHECK(fd >= 0);
+   CHECK(IF::Journal::isLocked(FILENAME));
+
+   // Already held by another session
+   CHECK(IF::Journal::lock(FILENAME) < 0);
+
+   IF::Journal::unlock(fd);
+   CHECK(!IF::Journal::isLocked(FILENAME));
+
+   fd = IF::Journal::lock(FILENAME);
+   CHECK(fd >= 0);
+   IF::Journal::unlock(fd);
+
+   (void) remove((std::string(FILENAME) + ".lock").c_str());
+}
+
+int main()
+{
+   Bytes image = TestStory::build({0xBA}); // quit
+
+   Z::Story story;
+   if (!CHECK(story.load(image.data(), image.size(), "test.z5"))) return Check::result();
+
+   testRoundTrip(story);
+   testDamage(story);
+   testOtherStory(story);
+   testCheckpoints(story);
+   testFile(story);
+   testLock();
+
+   return Check::result();
+}
@@ -0,0 +1,168 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Sharing of memory pages between states, and across a snapshot restore
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common/PagePool.h"
+#include "common/Snapshot.h"
+#include "common/State.h"
+
+#include "Z/Story.h"
+#include "Z/test/TestStory.h"
+
+#include "common/test/Check.h"
+
+#ifdef PAGE_SHARING
+
+static const IF::Stack::Offset STACK_SIZE = 1024;
+
+//! Addresses in pages of dynamic memory, of writable memory that is not
+//! written and of memory beyond the story
+static const uint32_t DYNAMIC = 0x0200;
+static const uint32_t UNUSED  = TestStory::CODE;
+static const uint32_t BEYOND  = 0x10000;
+
+//! Check if the page holding an address is mapped from the pool and has
+//! not been copied by a write. A page in the pool is a file page, from
+//! /proc/self/pagemap, and a private copy of it is not
+static bool isShared(const IF::Memory& memory, uint32_t addr)
+{
+   const volatile uint8_t* byte = memory.data() + addr;
+   (void) *byte;
+
+   int fd = open("/proc/self/pagemap", O_RDONLY);
+   if (fd < 0) return false;
+
+   uint64_t entry = 0;
+   off_t    index = off_t(uintptr_t(byte) / IF::PagePool::PAGE_BYTES);
+   bool     ok    = pread(fd, &entry, sizeof(entry), index * sizeof(entry)) == sizeof(entry);
+
+   close(fd);
+
+   const uint64_t PRESENT   = uint64_t(1) << 63;
+   const uint64_t FILE_PAGE = uint64_t(1) << 61;
+
+   return ok && ((entry & PRESENT) != 0) && ((entry & FILE_PAGE) != 0);
+}
+
+static void testShare(const Z::Story& story)
+{
+   IF::State first(story, 1, STACK_SIZE);
+   IF::State second(story, 1, STACK_SIZE);
+
+   first.reset();
+   second.reset();
+
+   first.memory.share();
+   second.memory.share();
+
+   size_t size = IF::PagePool::roundUp(second.memory.size());
+   CHECK(second.memory.getSharedSize() == size);
+
+   for(uint32_t addr : {DYNAMIC, UNUSED, BEYOND})
+   {
+      CHECK(isShared(first.memory, addr));
+      CHECK(isShared(second.memory, addr));
+   }
+
+   // A write gives the writer its own copy of the page
+   second.memory.write8(DYNAMIC, 0x55);
+
+   CHECK(!isShared(second.memory, DYNAMIC));
+   CHECK(isShared(first.memory, DYNAMIC));
+   CHECK(first.memory.read8(DYNAMIC) == 0x00);
+   CHECK(second.memory.read8(DYNAMIC) == 0x55);
+
+   CHECK(isShared(second.memory, UNUSED));
+   CHECK(isShared(second.memory, BEYOND));
+
+   // The copy is shared again once it has new content
+   second.memory.share();
+   CHECK(isShared(second.memory, DYNAMIC));
+   CHECK(second.memory.read8(DYNAMIC) == 0x55);
+   CHECK(first.memory.read8(DYNAMIC) == 0x00);
+}
+
+static void testRestore(const Z::Story& story)
+{
+   IF::State saved(story, 1, STACK_SIZE);
+   saved.reset();
+   saved.memory.write8(DYNAMIC, 0x66);
+   saved.stack.push16(0x1234);
+
+   IF::Snapshot snapshot;
+   snapshot.encodeState(story, saved, saved.getPC());
+
+   IF::State other(story, 1, STACK_SIZE);
+   other.reset();
+   other.memory.share();
+
+   IF::State restored(story, 1, STACK_SIZE);
+   restored.reset();
+   restored.memory.share();
+
+   CHECK(snapshot.decodeState(story, restored));
+   CHECK(restored.memory.read8(DYNAMIC) == 0x66);
+   CHECK(restored.fingerprint() == saved.fingerprint());
+
+   // Only the page with a change is copied by the restore
+   CHECK(!isShared(restored.memory, DYNAMIC));
+   CHECK(isShared(restored.memory, UNUSED));
+   CHECK(isShared(restored.memory, BEYOND));
+
+   CHECK(other.memory.read8(DYNAMIC) == 0x00);
+   CHECK(isShared(other.memory, DYNAMIC));
+}
+
+static void testRelease(const Z::Story& story)
+{
+   IF::PagePool::Stats before = IF::PagePool::get().getStats();
+
+   {
+      IF::State state(story, 1, STACK_SIZE);
+      state.reset();
+      state.memory.share();
+
+      IF::PagePool::Stats during = IF::PagePool::get().getStats();
+      CHECK(during.memory_bytes > before.memory_bytes);
+      CHECK(during.shared_bytes > before.shared_bytes);
+   }
+
+   // The pages of a memory that is freed are forgotten
+   IF::PagePool::Stats after = IF::PagePool::get().getStats();
+   CHECK(after.memory_bytes == before.memory_bytes);
+   CHECK(after.shared_bytes == before.shared_bytes);
+}
+
+int main()
+{
+   std::vector<uint8_t> image = TestStory::build({0xBA}); // quit
+
+   Z::Story story;
+   if (!CHECK(story.load(image.data(), image.size(), "test.z5"))) return Check::result();
+
+   testShare(story);
+   testRestore(story);
+   testRelease(story);
+
+   return Check::result();
+}
+
+#else
+
+int main()
+{
+   printf("Page sharing is not supported\n");
+   return 0;
+}
+
+#endif
@@ -0,0 +1,199 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Snapshot encode and decode round trip
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "common/Snapshot.h"
+#include "common/State.h"
+
+#include "Z/Story.h"
+#include "Z/test/TestStory.h"
+
+#include "common/test/Check.h"
+
+static const char* FILENAME = "test-snapshot.zss";
+
+static const IF::Stack::Offset STACK_SIZE = 1024;
+
+//! Change every part of the state saved by a snapshot
+static void play(IF::State& state)
+{
+   state.memory.write8(0x0041, 0x55);
+   state.memory.write16(0x0100, 0x1234);
+
+   // Runs of unchanged bytes longer than one encoded run
+   state.memory.write8(0x0300, 0xAA);
+   state.memory.write8(0x0FFF, 0x01);
+
+   // Back to the value in the story
+   state.memory.write8(0x0200, 0x77);
+   state.memory.write8(0x0200, 0x00);
+
+   for(unsigned i = 0; i < 100; i++)
+   {
+      state.stack.push16(i * 3);
+   }
+
+   state.frame_ptr = 40;
+   state.jump(TestStory::CODE + 1);
+   state.random.predictableSeed(99);
+   (void) state.random.get();
+}
+
+static bool isSame(const IF::State& a, const IF::State& b)
+{
+   const IF::Memory& mem_a = a.memory;
+   const IF::Memory& mem_b = b.memory;
+
+   for(uint32_t addr = 0; addr <= mem_a.getWriteEnd(); addr++)
+   {
+      if (mem_a.data()[addr] != mem_b.data()[addr]) return false;
+   }
+
+   return (a.getPC() == b.getPC()) &&
+          (a.frame_ptr == b.frame_ptr) &&
+          (a.random.internalState() == b.random.internalState()) &&
+          (a.stack.size() == b.stack.size()) &&
+          (memcmp(a.stack.data(), b.stack.data(), a.stack.size()) == 0) &&
+          (a.fingerprint() == b.fingerprint());
+}
+
+static void testRoundTrip(const Z::Story& story)
+{
+   IF::State state(story, 1, STACK_SIZE);
+   state.reset();
+   play(state);
+
+   IF::Snapshot snapshot;
+   snapshot.encodeState(story, state, state.getPC());
+   snapshot.add("XTRA").push32(0xDEADBEEF);
+
+   IF::Buffer buffer;
+   snapshot.encode(buffer);
+
+   IF::Snapshot decoded;
+   CHECK(decoded.decode(buffer));
+
+   IF::Buffer* extra = decoded.find("XTRA");
+   CHECK((extra != nullptr) && (extra->read32() == 0xDEADBEEF) && extra->isEnd());
+   CHECK(decoded.find("NONE") == nullptr);
+
+   // Into a state that has moved on from the start, with its hashes valid
+   IF::State restored(story, 1, STACK_SIZE);
+   restored.reset();
+   restored.memory.write8(0x0500, 0x66);
+   restored.stack.push32(0x01020304);
+   (void) restored.fingerprint();
+
+   CHECK(decoded.decodeState(story, restored));
+   CHECK(isSame(state, restored));
+
+   // A section can be decoded more than once
+   IF::State again(story, 1, STACK_SIZE);
+   again.reset();
+   CHECK(decoded.decodeState(story, again));
+   CHECK(isSame(state, again));
+}
+
+static void testCorrupt(const Z::Story& story)
+{
+   IF::State state(story, 1, STACK_SIZE);
+   state.reset();
+   play(state);
+
+   IF::Snapshot snapshot;
+   snapshot.encodeState(story, state, state.getPC());
+
+   IF::Buffer good;
+   snapshot.encode(good);
+
+   IF::Snapshot decoded;
+
+   // Cut short at every length
+   for(size_t size = 0; size < good.size(); size++)
+   {
+      IF::Buffer buffer;
+      buffer.push(good.data(), size);
+      CHECK(!decoded.decode(buffer));
+   }
+
+   // Trailing bytes
+   IF::Buffer longer;
+   longer.push(good.data(), good.size());
+   longer.push8(0);
+   CHECK(!decoded.decode(longer));
+
+   // Another version of the encoding
+   std::vector<uint8_t> bytes(good.data(), good.data() + good.size());
+   bytes[5]++;
+
+   IF::Buffer version;
+   version.push(bytes.data(), bytes.size());
+   CHECK(!decoded.decode(version));
+
+   // State cut short, at the end of each part of the encoding
+   IF::Buffer stat;
+   IF::Snapshot::encodeState(stat, story, state, state.getPC());
+
+   for(size_t size : {size_t(0), size_t(8), size_t(16), size_t(20), stat.size() - 1})
+   {
+      IF::Buffer buffer;
+      buffer.push(stat.data(), size);
+
+      IF::State restored(story, 1, STACK_SIZE);
+      restored.reset();
+      CHECK(!IF::Snapshot::decodeState(buffer, story, restored));
+   }
+}
+
+static void testFile(const Z::Story& story)
+{
+   IF::State state(story, 1, STACK_SIZE);
+   state.reset();
+   play(state);
+
+   IF::Snapshot snapshot;
+   snapshot.encodeState(story, state, state.getPC());
+   CHECK(snapshot.write(FILENAME));
+
+   // Written through a temporary file that is renamed into place
+   std::string tmp = std::string(FILENAME) + '.' + std::to_string(getpid()) + ".tmp";
+   CHECK(access(tmp.c_str(), F_OK) != 0);
+
+   IF::Snapshot read;
+   CHECK(read.read(FILENAME));
+
+   IF::State restored(story, 1, STACK_SIZE);
+   restored.reset();
+   CHECK(read.decodeState(story, restored));
+   CHECK(isSame(state, restored));
+
+   CHECK(!snapshot.write("missing-dir/test.zss"));
+   CHECK(!read.read("missing-dir/test.zss"));
+
+   (void) remove(FILENAME);
+}
+
+int main()
+{
+   std::vector<uint8_t> image = TestStory::build({0xBA}); // quit
+
+   Z::Story story;
+   if (!CHECK(story.load(image.data(), image.size(), "test.z5"))) return Check::result();
+
+   testRoundTrip(story);
+   testCorrupt(story);
+   testFile(story);
+
+   return Check::result();
+}
@@ -17,7 +17,7 @@
 #include <atomic>
 #include <mutex>
 
-#include "Thread.h"
+#include "common/Thread.h"
 #include "Pipe.h"
 
 #include "TRM/Curses.h"
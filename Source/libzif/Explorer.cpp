@@ -0,0 +1,365 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include "Explorer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "WorkStealingPool.h"
+
+#include "common/Buffer.h"
+#include "common/BufferConsole.h"
+#include "common/Options.h"
+#include "common/TranspositionTable.h"
+
+#include "Z/Machine.h"
+#include "Z/Story.h"
+
+namespace Zif {
+
+class Explorer::Impl
+{
+public:
+   Impl(const Config& config_)
+      : config(config_)
+   {
+      options.batch.set(true);
+      options.seed.set(config.session.seed);
+      options.undo.set(config.session.undo);
+      options.save_dir.set(config.session.save_dir.c_str());
+      options.log_prefix.set(config.session.log_prefix.c_str());
+   }
+
+   bool loadFile(const std::string& path)
+   {
+      if (!story.load(path)) return fail(story.getLastError());
+      return true;
+   }
+
+   bool explore(const std::vector<uint8_t>& snapshot,
+                const Generator&            generator,
+                Report&                     report_)
+   {
+      if (!story.isLoadedOk()) return fail("No story loaded");
+
+      unsigned threads = config.threads;
+      if (threads == 0)
+      {
+         threads = std::thread::hardware_concurrency();
+         if (threads == 0) threads = 1;
+      }
+
+      runners.clear();
+      for(unsigned i = 0; i < threads; i++)
+      {
+         runners.emplace_back(new Runner(*this));
+      }
+
+      std::shared_ptr<Node> root{new Node};
+      std::string           output;
+      if (!startRoot(snapshot, *root, output)) return false;
+
+      report       = Report{};
+      states       = 0;
+      instructions = 0;
+      repeats      = 0;
+
+      seen.clear();
+      (void) seen.insert(root->fingerprint, 0);
+
+      {
+         WorkStealingPool pool(threads);
+
+         for(const auto& command : generator(root->commands, output))
+         {
+            pool.queue([this, &pool, &generator, root, command](unsigned worker)
+                       {
+                          expand(pool, generator, root, command, worker);
+                       });
+         }
+
+         pool.wait();
+      }
+
+      runners.clear();
+
+      report.states       = std::min(uint64_t(states), config.max_states);
+      report.instructions = instructions;
+      report.repeats      = repeats;
+
+      std::sort(report.findings.begin(), report.findings.end(),
+                [](const Finding& a, const Finding& b)
+                {
+                   return a.commands != b.commands ? a.commands < b.commands
+                                                   : a.type < b.type;
+                });
+
+      std::swap(report_, report);
+      error = "";
+      return true;
+   }
+
+   const Config config;
+   Options      options;
+   Z::Story     story;
+   std::string  error;
+
+private:
+   //! Instructions executed between checks of the turn limits
+   static const unsigned QUANTUM = 100000;
+
+   //! A machine for each worker thread, reset from a snapshot for each command
+   struct Runner
+   {
+      Runner(Impl& impl)
+         : console(impl.config.session.lines, impl.config.session.cols)
+         , machine(console, impl.options, impl.story)
+      {
+         console.setStatusLines(impl.story.getVersion() <= 3 ? 1 : 0);
+         machine.setStateLimits(impl.config.session.max_undo_bytes, 0);
+         machine.blockFiles();
+      }
+
+      BufferConsole console;
+      Z::Machine    machine;
+   };
+
+   //! A state reached, shared by the commands that continue from it
+   struct Node
+   {
+      IF::Buffer               snapshot;
+      IF::Machine::Status      status{IF::Machine::NEED_LINE};   //!< Input waited for
+      std::vector<std::string> commands;
+      bool                     has_score{false};
+      int16_t                  score{0};
+      uint64_t                 fingerprint{0};
+   };
+
+   std::vector<std::unique_ptr<Runner>> runners;
+   std::mutex                           mutex;          //!< Protects the report
+   Report                               report;
+   std::atomic<uint64_t>                states{0};
+   std::atomic<uint64_t>                instructions{0};
+   std::atomic<uint64_t>                repeats{0};
+   IF::TranspositionTable               seen;
+
+   bool fail(const std::string& message)
+   {
+      error = message;
+      return false;
+   }
+
+   //! Bring the game to the starting point, on the first runner
+   bool startRoot(const std::vector<uint8_t>& snapshot, Node& root, std::string& output)
+   {
+      Runner& runner = *runners[0];
+
+      IF::Machine::Status status;
+
+      if (snapshot.empty())
+      {
+         runner.machine.start(/* restore */ false);
+         status = run(runner.machine, nullptr);
+      }
+      else
+      {
+         IF::Buffer buffer;
+         buffer.push(snapshot.data(), snapshot.size());
+
+         if (!runner.machine.restoreSnapshot(buffer))
+         {
+            return fail("Snapshot is not valid for this story");
+         }
+
+         status = runner.machine.run(0);
+      }
+
+      output = runner.console.takeText();
+
+      if (((status != IF::Machine::NEED_LINE) && (status != IF::Machine::NEED_CHAR)) ||
+          !runner.machine.saveSnapshot(root.snapshot))
+      {
+         return fail("Game is not waiting for input at the starting point");
+      }
+
+      int16_t  score = 0;
+      uint16_t moves = 0;
+      root.status      = status;
+      root.has_score   = runner.machine.getScore(score, moves);
+      root.score       = score;
+      root.fingerprint = runner.machine.fingerprint();
+
+      // The runners have the same story, share the pages it does not change
+      for(auto& other : runners)
+      {
+         other->machine.shareMemory();
+      }
+
+      return true;
+   }
+
+   //! Run until input is needed or the game stops, or a turn limit is
+   //! exceeded, which is noted in hang if given
+   IF::Machine::Status run(Z::Machine& machine, bool* hang)
+   {
+      Z::Machine::Usage start = machine.getUsage();
+      uint64_t          limit = config.session.max_turn_instructions;
+
+      while(true)
+      {
+         uint64_t quantum = QUANTUM;
+         if (limit != 0)
+         {
+            quantum = std::min(quantum, limit - (machine.getUsage().instructions - start.instructions));
+         }
+
+         IF::Machine::Status status = machine.run(unsigned(quantum));
+
+         if ((status == IF::Machine::NEED_LINE) || (status == IF::Machine::NEED_CHAR) ||
+             (status == IF::Machine::QUIT))
+         {
+            return status;
+         }
+
+         Z::Machine::Usage usage = machine.getUsage();
+
+         if (((limit != 0) && ((usage.instructions - start.instructions) >= limit)) ||
+             ((config.session.max_turn_output != 0) &&
+              ((usage.output - start.output) > config.session.max_turn_output)))
+         {
+            if (hang != nullptr) *hang = true;
+            return status;
+         }
+      }
+   }
+
+   //! Enter one command in a state and queue the commands that follow
+   void expand(WorkStealingPool&            pool,
+               const Generator&             generator,
+               std::shared_ptr<const Node>  node,
+               const std::string&           command,
+               unsigned                     worker)
+   {
+      if (states++ >= config.max_states) return;
+
+      Runner&     runner  = *runners[worker];
+      Z::Machine& machine = runner.machine;
+
+      IF::Buffer snapshot;
+      snapshot.push(node->snapshot.data(), node->snapshot.size());
+
+      (void) runner.console.takeText();
+
+      if (!machine.restoreSnapshot(snapshot)) return;
+
+      if (node->status == IF::Machine::NEED_CHAR)
+         machine.provideChar(command.empty() ? '\n' : command[0]);
+      else
+         machine.provideLine(command);
+
+      uint64_t            start  = machine.getUsage().instructions;
+      bool                hang   = false;
+      IF::Machine::Status status = run(machine, &hang);
+
+      instructions += machine.getUsage().instructions - start;
+
+      std::shared_ptr<Node> child{new Node};
+      child->commands = node->commands;
+      child->commands.push_back(command);
+
+      std::string output = runner.console.takeText();
+
+      if (hang)
+      {
+         addFinding(Finding::HANG, child->commands, output);
+         return;
+      }
+
+      if (status == IF::Machine::QUIT)
+      {
+         addFinding(machine.hasFailed() ? Finding::ERROR : Finding::QUIT, child->commands, output);
+         return;
+      }
+
+      uint16_t moves;
+      child->status    = status;
+      child->has_score = machine.getScore(child->score, moves);
+      if (child->has_score && node->has_score && (child->score != node->score))
+      {
+         addFinding(Finding::SCORE, child->commands, output, child->score);
+      }
+
+      if (!config.pattern.empty() && (output.find(config.pattern) != std::string::npos))
+      {
+         addFinding(Finding::MATCH, child->commands, output);
+      }
+
+      if (child->commands.size() >= config.max_depth) return;
+
+      if (config.skip_repeats && !seen.insert(machine.fingerprint(), child->commands.size()))
+      {
+         repeats++;
+         return;
+      }
+
+      if (!machine.saveSnapshot(child->snapshot)) return;
+
+      for(const auto& next : generator(child->commands, output))
+      {
+         pool.queue([this, &pool, &generator, child, next](unsigned worker_)
+                    {
+                       expand(pool, generator, child, next, worker_);
+                    });
+      }
+   }
+
+   void addFinding(Finding::Type                   type,
+                   const std::vector<std::string>& commands,
+                   const std::string&              output,
+                   int                             score = 0)
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      report.findings.push_back(Finding{type, commands, output, score});
+   }
+};
+
+//------------------------------------------------------------------------------
+
+Explorer::Generator Explorer::fixedCommands(const std::vector<std::string>& commands)
+{
+   return [commands](const std::vector<std::string>&, const std::string&)
+          {
+             return commands;
+          };
+}
+
+Explorer::Explorer(const Config& config)
+   : impl(new Impl(config))
+{
+}
+
+Explorer::~Explorer() = default;
+
+bool Explorer::loadFile(const std::string& path)
+{
+   return impl->loadFile(path);
+}
+
+const std::string& Explorer::getLastError() const
+{
+   return impl->error;
+}
+
+bool Explorer::explore(const std::vector<uint8_t>& snapshot,
+                       const Generator&            generator,
+                       Report&                     report)
+{
+   return impl->explore(snapshot, generator, report);
+}
+
+} // namespace Zif
@@ -0,0 +1,94 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Session.h"
+
+namespace Zif {
+
+//! Tries the commands that can be entered from a point in a game, and
+//! the commands that can follow those, on many threads at once. Reports
+//! crashes, hangs, score changes and output of interest, e.g. for testing
+//! a story. Currently Z stories only
+class Explorer
+{
+public:
+   struct Config
+   {
+      Session::Config session{};            //!< Screen size, seed, undo and turn limits
+      unsigned        threads{0};           //!< Worker threads, 0 for one per CPU
+      unsigned        max_depth{2};         //!< Commands entered from the starting point
+      uint64_t        max_states{100000};   //!< Give up after reaching this many states
+      std::string     pattern{};            //!< Report output containing this, if not empty
+      bool            skip_repeats{true};   //!< Do not continue from a state already
+                                            //!< reached in as few commands
+   };
+
+   struct Finding
+   {
+      enum Type
+      {
+         ERROR,   //!< Game stopped with an error
+         HANG,    //!< Turn limit exceeded
+         QUIT,    //!< Game finished
+         SCORE,   //!< Score changed, v1-3 stories only
+         MATCH    //!< Output contains the pattern
+      };
+
+      Type                     type;
+      std::vector<std::string> commands;   //!< Commands from the starting point
+      std::string              output;     //!< Output from the last command
+      int                      score{0};   //!< New score
+   };
+
+   struct Report
+   {
+      uint64_t             states{0};         //!< States reached
+      uint64_t             instructions{0};   //!< Instructions executed
+      uint64_t             repeats{0};        //!< States already reached in as few commands
+      std::vector<Finding> findings;          //!< In order of the commands
+   };
+
+   //! Return the commands to try in a state, given the commands that
+   //! reached it and the output of the last one. Called from many threads
+   //! at once. A game waiting for a key press is sent the first character
+   using Generator = std::function<std::vector<std::string>(const std::vector<std::string>& commands,
+                                                            const std::string&              output)>;
+
+   //! Generator that tries the same commands in every state
+   static Generator fixedCommands(const std::vector<std::string>& commands);
+
+   Explorer(const Config& config);
+   ~Explorer();
+
+   Explorer(const Explorer&) = delete;
+   Explorer& operator=(const Explorer&) = delete;
+
+   //! Load a story file
+   bool loadFile(const std::string& path);
+
+   //! Get error message for the last failure
+   const std::string& getLastError() const;
+
+   //! Explore from a snapshot made by Session::snapshot() for the same
+   //! story, or from the start of the story if the snapshot is empty
+   bool explore(const std::vector<uint8_t>& snapshot,
+                const Generator&            generator,
+                Report&                     report);
+
+private:
+   class Impl;
+
+   std::unique_ptr<Impl> impl;
+};
+
+} // namespace Zif
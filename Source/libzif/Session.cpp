@@ -0,0 +1,790 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include "Session.h"
+#include "Speculation.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "common/Buffer.h"
+#include "common/BufferConsole.h"
+#include "common/Coverage.h"
+#include "common/Options.h"
+#include "common/Sampler.h"
+#include "common/Snapshot.h"
+
+#include "Z/Instruments.h"
+#include "Z/Machine.h"
+#include "Z/Story.h"
+
+namespace Zif {
+
+class Session::Impl
+{
+public:
+   Impl(const Config& config_)
+      : config(config_)
+      , console(config_.lines, config_.cols)
+   {
+      options.batch.set(true);
+      options.seed.set(config.seed);
+      options.undo.set(config.undo);
+      options.save_dir.set(config.save_dir.c_str());
+      options.log_prefix.set(config.log_prefix.c_str());
+      options.cold.set(!config.warm_start);
+      options.sample.set(config.sample);
+      options.stats.set(config.stats);
+      options.coverage.set(config.coverage);
+
+      if (config.replicate) console.enableTranscript();
+   }
+
+   ~Impl()
+   {
+      cancelSpeculations();
+      discardHibernation();
+   }
+
+   bool loadFile(const std::string& path)
+   {
+      retire();
+
+      story_path = path;
+
+      if (!story.load(path)) return fail(story.getLastError());
+      return true;
+   }
+
+   bool loadBuffer(const uint8_t* data, size_t size, const std::string& name)
+   {
+      retire();
+
+      // The story can not be reloaded after hibernation
+      story_path = "";
+
+      if (!story.load(data, size, name)) return fail(story.getLastError());
+      return true;
+   }
+
+   Status start(unsigned max_instructions)
+   {
+      if (!create()) return status;
+
+      machine->start(/* restore */ false);
+      beginTurn();
+      return runFor(max_instructions);
+   }
+
+   Status sendCommand(const std::string& line, unsigned max_instructions)
+   {
+      if (!isWaiting() || !wake()) return status;
+
+      noteCommand(line);
+
+      if (useSpeculation(line)) return status;
+
+      machine->provideLine(line);
+      beginTurn();
+      return runFor(max_instructions);
+   }
+
+   Status sendKey(uint8_t key, unsigned max_instructions)
+   {
+      if (!isWaiting() || !wake()) return status;
+
+      machine->provideChar(key);
+      beginTurn();
+      return runFor(max_instructions);
+   }
+
+   unsigned getInputTimeout() const
+   {
+      if (!isWaiting()) return 0;
+
+      return isHibernating() ? hibernated_timeout : machine->getInputTimeout();
+   }
+
+   Status sendTimeout(unsigned max_instructions)
+   {
+      if (!isWaiting() || !wake()) return status;
+
+      machine->provideTimeout();
+      beginTurn();
+      return runFor(max_instructions);
+   }
+
+   Status resume(unsigned max_instructions)
+   {
+      if (status != RUNNING) return status;
+
+      return runFor(max_instructions);
+   }
+
+   Usage getUsage() const
+   {
+      Usage usage = usage_before;
+
+      if (machine)
+      {
+         Z::Resumable::Usage machine_usage = machine->getUsage();
+
+         usage.instructions += machine_usage.instructions;
+         usage.output       += machine_usage.output;
+         usage.undo_bytes    = machine_usage.undo_bytes;
+         usage.save_bytes    = std::max(usage.save_bytes, machine_usage.save_bytes);
+         usage.memory_bytes  = machine_usage.memory_bytes;
+         usage.shared_bytes  = machine_usage.shared_bytes;
+      }
+
+      return usage;
+   }
+
+   std::string getStats() const
+   {
+      return machine ? machine->getStats() : std::string("{}\n");
+   }
+
+   bool snapshot(std::vector<uint8_t>& data) const
+   {
+      if (!isWaiting()) return false;
+
+      IF::Buffer buffer;
+
+      // The hibernation file is a snapshot
+      if (isHibernating() ? !buffer.read(hibernate_path)
+                          : !machine->saveSnapshot(buffer))
+      {
+         return false;
+      }
+
+      data.assign(buffer.data(), buffer.data() + buffer.size());
+      return true;
+   }
+
+   bool restore(const std::vector<uint8_t>& data)
+   {
+      IF::Buffer buffer;
+      buffer.push(data.data(), data.size());
+
+      return restoreFrom(buffer);
+   }
+
+   bool hibernate(const std::string& path)
+   {
+      if (isHibernating()) return true;
+
+      if (!isWaiting()) return fail("Game is not waiting for input");
+
+      IF::Buffer buffer;
+      if (!machine->saveSnapshot(buffer) || !buffer.write(path))
+      {
+         (void) remove(path.c_str());
+         return fail("Failed to write '" + path + "'");
+      }
+
+      hibernated_timeout = machine->getInputTimeout();
+
+      Status waiting = status;
+      retire();
+      status = waiting;
+
+      hibernate_path = path;
+
+      // A story loaded from a file is read again on waking
+      if (story_path != "") story.clear();
+
+      return true;
+   }
+
+   bool wake()
+   {
+      if (!isHibernating()) return true;
+
+      std::string path;
+      std::swap(path, hibernate_path);
+
+      IF::Buffer buffer;
+      bool       ok = (story.isLoadedOk() || story.load(story_path)) && buffer.read(path);
+
+      (void) remove(path.c_str());
+
+      if (!ok || !restoreFrom(buffer))
+      {
+         status = ERROR;
+         return fail("Failed to wake from '" + path + "'");
+      }
+
+      return true;
+   }
+
+   bool isHibernating() const { return hibernate_path != ""; }
+
+   bool takeUpdate(std::vector<uint8_t>& data)
+   {
+      if (!config.replicate) return fail("Replication is not enabled");
+
+      if ((status == NOT_STARTED) || (status == RUNNING))
+      {
+         return fail("Game is not between turns");
+      }
+
+      if (!wake()) return false;
+
+      IF::Snapshot update;
+
+      IF::Buffer& stat = update.add("STAT");
+      stat.push8(status);
+      stat.pushString(error);
+
+      update.add("TEXT").pushString(console.takeTranscript());
+
+      IF::Buffer& upper = update.add("UPPR");
+      upper.push8(console.getUpperLines());
+      for(unsigned line = 1; line <= console.getUpperLines(); line++)
+      {
+         upper.pushString(console.getLine(line));
+      }
+
+      if (isWaiting() && !machine->encodeUpdate(update.add("MACH")))
+      {
+         return fail("Failed to encode update");
+      }
+
+      IF::Buffer buffer;
+      update.encode(buffer);
+      data.assign(buffer.data(), buffer.data() + buffer.size());
+      return true;
+   }
+
+   bool applyUpdate(const std::vector<uint8_t>& data)
+   {
+      IF::Buffer buffer;
+      buffer.push(data.data(), data.size());
+
+      IF::Snapshot update;
+      if (!update.decode(buffer)) return fail("Update is not valid");
+
+      IF::Buffer* stat  = update.find("STAT");
+      IF::Buffer* text  = update.find("TEXT");
+      IF::Buffer* upper = update.find("UPPR");
+      IF::Buffer* mach  = update.find("MACH");
+
+      if ((stat == nullptr) || (text == nullptr) || (upper == nullptr))
+      {
+         return fail("Update is not valid");
+      }
+
+      Status      status_ = Status(stat->read8());
+      std::string error_  = stat->readString();
+      bool        waiting = (status_ == NEED_LINE) || (status_ == NEED_CHAR);
+
+      if ((!waiting && (status_ != QUIT) && (status_ != ERROR)) ||
+          (waiting != (mach != nullptr)) || !stat->isOk())
+      {
+         return fail("Update is not valid");
+      }
+
+      if (!wake()) return false;
+
+      // The output goes through the console, as it did for the primary,
+      // before the machine puts the cursor where the primary left it
+      for(uint8_t ch : text->readString())
+      {
+         console.write(ch);
+      }
+
+      unsigned num_upper = upper->read8();
+      for(unsigned line = 1; line <= num_upper; line++)
+      {
+         console.setLine(line, upper->readString());
+      }
+
+      if (waiting)
+      {
+         if (!machine && !create()) return false;
+
+         if (!machine->applyUpdate(*mach))
+         {
+            retire();
+            return fail("Update does not follow on from the previous update");
+         }
+      }
+
+      status = status_;
+      error  = error_;
+      return true;
+   }
+
+   const Config                config;
+   Options                     options;
+   Z::Story                    story;
+   BufferConsole               console;
+   std::unique_ptr<Z::Resumable> machine;
+   Status                      status{NOT_STARTED};
+   std::string                 error;
+   Usage                       usage_before;   //!< Used by previous machines
+   Z::Resumable::Usage         turn_start{};
+   std::string                 story_path;
+   std::string                 hibernate_path;  //!< Snapshot file while hibernating
+   unsigned                    hibernated_timeout{0};
+   std::vector<std::unique_ptr<Speculation>> speculations;   //!< Commands being run ahead
+   std::vector<std::unique_ptr<Speculation>> idle_speculations;   //!< Kept for the next commands
+   std::vector<std::string>    history;         //!< Recent commands, most recent first
+
+private:
+   //! Instructions executed between checks for input requests
+   static const unsigned QUANTUM = 100000;
+
+   bool fail(const std::string& message)
+   {
+      error = message;
+      return false;
+   }
+
+   bool isWaiting() const
+   {
+      return (status == NEED_LINE) || (status == NEED_CHAR);
+   }
+
+   //! Create a new machine for the loaded story
+   bool create()
+   {
+      retire();
+
+      if (!story.isLoadedOk())
+      {
+         error = "No story loaded";
+         return false;
+      }
+
+      // The v1-3 status line is drawn over the top line of the screen
+      console.setStatusLines(story.getVersion() <= 3 ? 1 : 0);
+
+      error = "";
+
+      // The measurement tools are a separate machine so that others are not slowed
+      if (Z::Instruments::isEnabled(options))
+         machine.reset(new Z::BasicMachine<Z::Instruments>(console, options, story));
+      else
+         machine.reset(new Z::Machine(console, options, story));
+      machine->setStateLimits(config.max_undo_bytes, config.max_save_bytes);
+      return true;
+   }
+
+   //! Discard the machine, keeping a record of the resources it used
+   void retire()
+   {
+      usage_before = getUsage();
+      usage_before.undo_bytes   = 0;
+      usage_before.memory_bytes = 0;
+      usage_before.shared_bytes = 0;
+
+      cancelSpeculations();
+
+      // The copies of the game may be of a different story next
+      idle_speculations.clear();
+
+      machine.reset();
+      status = NOT_STARTED;
+
+      discardHibernation();
+   }
+
+   void discardHibernation()
+   {
+      if (isHibernating())
+      {
+         (void) remove(hibernate_path.c_str());
+         hibernate_path = "";
+      }
+   }
+
+   //! Start a new machine from a snapshot
+   bool restoreFrom(IF::Buffer& buffer)
+   {
+      if (!create()) return false;
+
+      if (!machine->restoreSnapshot(buffer))
+      {
+         retire();
+         return fail("Snapshot is not valid for this story");
+      }
+
+      status = machine->run(0) == IF::Machine::NEED_CHAR ? NEED_CHAR : NEED_LINE;
+      return true;
+   }
+
+   void beginTurn()
+   {
+      cancelSpeculations();
+
+      turn_start = machine->getUsage();
+      usage_before.turns++;
+   }
+
+   //! Run until input is needed or the allowance runs out, checking the
+   //! limits for the turn after each quantum
+   Status runFor(unsigned max_instructions)
+   {
+      uint64_t allowance = max_instructions == 0 ? UINT64_MAX : max_instructions;
+
+      while(allowance != 0)
+      {
+         uint64_t quantum = std::min(allowance, uint64_t(QUANTUM));
+         if (config.max_turn_instructions != 0)
+         {
+            uint64_t used = machine->getUsage().instructions - turn_start.instructions;
+            quantum = std::min(quantum, config.max_turn_instructions - used);
+         }
+
+         IF::Machine::Status machine_status = machine->run(unsigned(quantum));
+
+         allowance -= quantum;
+
+         if (machine_status == IF::Machine::QUIT)
+         {
+            if (machine->hasFailed()) error = machine->getFault();
+            return status = machine->end() ? QUIT : ERROR;
+         }
+
+         bool need_input = (machine_status == IF::Machine::NEED_LINE) ||
+                           (machine_status == IF::Machine::NEED_CHAR);
+
+         Z::Resumable::Usage usage = machine->getUsage();
+
+         if ((config.max_turn_instructions != 0) && !need_input &&
+             ((usage.instructions - turn_start.instructions) >= config.max_turn_instructions))
+         {
+            return stop("Instruction limit for one turn exceeded");
+         }
+
+         if ((config.max_turn_output != 0) &&
+             ((usage.output - turn_start.output) > config.max_turn_output))
+         {
+            return stop("Output limit for one turn exceeded");
+         }
+
+         if (need_input)
+         {
+            if (machine_status == IF::Machine::NEED_LINE)
+            {
+               speculate();
+               return status = NEED_LINE;
+            }
+
+            return status = NEED_CHAR;
+         }
+      }
+
+      return status = RUNNING;
+   }
+
+   //! Keep a list of recent different commands to speculate on
+   void noteCommand(const std::string& line)
+   {
+      if (config.speculate == 0) return;
+
+      history.erase(std::remove(history.begin(), history.end(), line), history.end());
+      history.insert(history.begin(), line);
+
+      if (history.size() > config.speculate) history.resize(config.speculate);
+   }
+
+   //! Start running likely next commands in the background
+   void speculate()
+   {
+      if (config.speculate == 0) return;
+
+      IF::Buffer snapshot;
+      if (!machine->saveSnapshot(snapshot)) return;
+
+      std::vector<std::string> commands;
+
+      for(const auto& list : {config.speculate_commands, history})
+      {
+         for(const auto& command : list)
+         {
+            if ((commands.size() < config.speculate) &&
+                (std::find(commands.begin(), commands.end(), command) == commands.end()))
+            {
+               commands.push_back(command);
+            }
+         }
+      }
+
+      for(const auto& command : commands)
+      {
+         std::unique_ptr<Speculation> speculation;
+
+         // Re-use the copy of the game of a previous speculation, the
+         // background thread builds a new one
+         if (idle_speculations.empty())
+         {
+            speculation.reset(new Speculation(story, options));
+         }
+         else
+         {
+            speculation = std::move(idle_speculations.back());
+            idle_speculations.pop_back();
+         }
+
+         speculation->begin(snapshot, console, command,
+                            config.max_turn_instructions, config.max_turn_output);
+
+         speculations.push_back(std::move(speculation));
+      }
+   }
+
+   //! Stop the commands being run ahead, without waiting for the
+   //! background threads, and keep them for the next commands
+   void cancelSpeculations()
+   {
+      for(auto& speculation : speculations)
+      {
+         speculation->cancel();
+         idle_speculations.push_back(std::move(speculation));
+      }
+
+      speculations.clear();
+   }
+
+   //! Complete a command from the result of running it in the background
+   //! \return false if the command has not been run in the background
+   bool useSpeculation(const std::string& line)
+   {
+      std::unique_ptr<Speculation> match;
+
+      for(auto& speculation : speculations)
+      {
+         if (speculation->getCommand() == line)
+         {
+            std::swap(match, speculation);
+            break;
+         }
+      }
+
+      speculations.erase(std::remove(speculations.begin(), speculations.end(), nullptr),
+                         speculations.end());
+      cancelSpeculations();
+
+      if (!match) return false;
+
+      // A command still running is not waited for, it is run again
+      if (!match->isUsable())
+      {
+         match->cancel();
+         idle_speculations.push_back(std::move(match));
+         return false;
+      }
+
+      Z::Resumable::Usage usage = match->getUsage();
+      usage_before.turns++;
+      usage_before.instructions += usage.instructions;
+      usage_before.output       += usage.output;
+
+      bool                applied = match->apply(*machine, console);
+      IF::Machine::Status result  = match->getStatus();
+
+      idle_speculations.push_back(std::move(match));
+
+      if (!applied)
+      {
+         (void) stop("Failed to use the result of a speculative command");
+         return true;
+      }
+
+      if (result == IF::Machine::NEED_CHAR)
+      {
+         status = NEED_CHAR;
+      }
+      else
+      {
+         status = NEED_LINE;
+         speculate();
+      }
+
+      return true;
+   }
+
+   //! Stop a game that has exceeded a limit
+   Status stop(const std::string& message)
+   {
+      error = message;
+      (void) machine->end();
+      return status = ERROR;
+   }
+};
+
+//------------------------------------------------------------------------------
+
+Session::Session()
+   : impl(new Impl(Config()))
+{
+}
+
+Session::Session(const Config& config)
+   : impl(new Impl(config))
+{
+}
+
+Session::~Session() = default;
+
+bool Session::loadFile(const std::string& path)
+{
+   return impl->loadFile(path);
+}
+
+bool Session::loadBuffer(const uint8_t* data, size_t size, const std::string& name)
+{
+   return impl->loadBuffer(data, size, name);
+}
+
+const std::string& Session::getLastError() const
+{
+   return impl->error;
+}
+
+Session::Status Session::start(unsigned max_instructions)
+{
+   return impl->start(max_instructions);
+}
+
+Session::Status Session::sendCommand(const std::string& line, unsigned max_instructions)
+{
+   return impl->sendCommand(line, max_instructions);
+}
+
+Session::Status Session::sendKey(uint8_t key, unsigned max_instructions)
+{
+   return impl->sendKey(key, max_instructions);
+}
+
+unsigned Session::getInputTimeout() const
+{
+   return impl->getInputTimeout();
+}
+
+Session::Status Session::sendTimeout(unsigned max_instructions)
+{
+   return impl->sendTimeout(max_instructions);
+}
+
+Session::Status Session::resume(unsigned max_instructions)
+{
+   return impl->resume(max_instructions);
+}
+
+bool Session::hibernate(const std::string& path)
+{
+   return impl->hibernate(path);
+}
+
+bool Session::wake()
+{
+   return impl->wake();
+}
+
+bool Session::isHibernating() const
+{
+   return impl->isHibernating();
+}
+
+void Session::shareMemory()
+{
+   if (impl->machine) impl->machine->shareMemory();
+}
+
+Session::Sharing Session::getSharing()
+{
+   IF::PagePool::Stats stats = IF::PagePool::get().getStats();
+
+   Sharing sharing;
+   sharing.memory_bytes = stats.memory_bytes;
+   sharing.shared_bytes = stats.shared_bytes;
+   sharing.pool_bytes   = stats.pool_bytes;
+   return sharing;
+}
+
+bool Session::writeSamples(const std::string& filename, const std::string& collapsed_filename)
+{
+   return IF::Sampler::get().write(filename, collapsed_filename);
+}
+
+bool Session::writeCoverage(const std::string& dir)
+{
+   return IF::CoverageStore::get().write(dir);
+}
+
+Session::Status Session::getStatus() const
+{
+   return impl->status;
+}
+
+Session::Usage Session::getUsage() const
+{
+   return impl->getUsage();
+}
+
+std::string Session::getStats() const
+{
+   return impl->getStats();
+}
+
+std::string Session::takeOutput()
+{
+   return impl->console.takeText();
+}
+
+std::string Session::getStatusLine() const
+{
+   return impl->console.getStatusLine();
+}
+
+std::string Session::getScreenLine(unsigned line) const
+{
+   return impl->console.getLine(line);
+}
+
+std::vector<Session::WindowEvent> Session::takeEvents()
+{
+   std::vector<WindowEvent> events;
+
+   for(const auto& event : impl->console.takeEvents())
+   {
+      events.push_back(WindowEvent{event.type == BufferConsole::Event::CLEAR ? WindowEvent::CLEAR
+                                                                             : WindowEvent::SPLIT,
+                                   event.value});
+   }
+
+   return events;
+}
+
+bool Session::takeUpdate(std::vector<uint8_t>& data)
+{
+   return impl->takeUpdate(data);
+}
+
+void Session::restartUpdates()
+{
+   if (impl->machine) impl->machine->restartUpdates();
+}
+
+bool Session::applyUpdate(const std::vector<uint8_t>& data)
+{
+   return impl->applyUpdate(data);
+}
+
+bool Session::snapshot(std::vector<uint8_t>& data) const
+{
+   return impl->snapshot(data);
+}
+
+bool Session::restore(const std::vector<uint8_t>& data)
+{
+   return impl->restore(data);
+}
+
+} // namespace Zif
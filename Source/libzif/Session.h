@@ -0,0 +1,213 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Zif {
+
+//! A game running in the library, driven one command at a time without
+//! a terminal. Currently Z stories only
+class Session
+{
+public:
+   enum Status
+   {
+      NOT_STARTED,
+      NEED_LINE,     //!< Waiting for a command, use sendCommand()
+      NEED_CHAR,     //!< Waiting for a key press, use sendKey()
+      QUIT,          //!< Game has finished
+      ERROR,         //!< Game stopped with an error, see the output text
+                     //!< and getLastError()
+      RUNNING        //!< Instruction allowance used up, use resume()
+   };
+
+   //! Change to the layout of the screen
+   struct WindowEvent
+   {
+      enum Type
+      {
+         CLEAR,   //!< Screen cleared
+         SPLIT    //!< Lines above the main window changed, value is the new number
+      };
+
+      Type     type;
+      unsigned value;
+   };
+
+   struct Config
+   {
+      unsigned    lines{24};
+      unsigned    cols{80};
+      uint32_t    seed{0};            //!< Initial random number seed, 0 for random
+      unsigned    undo{4};            //!< Number of undo buffers
+      std::string save_dir{"Saves"};  //!< Directory for save and cache files
+      std::string log_prefix{};       //!< Prefix for any log file names
+      bool        replicate{false};   //!< Keep the output for takeUpdate()
+      bool        warm_start{true};   //!< Use and save a snapshot of the start-up sequence
+      unsigned    sample{0};          //!< Samples a second of the routine running, 0 for none
+      bool        stats{false};       //!< Count instruction forms and turn figures for getStats()
+      bool        coverage{false};    //!< Mark the code run and memory used, see writeCoverage()
+
+      // Resource limits, 0 for no limit. A session that exceeds a limit
+      // for a single input is stopped with an ERROR
+      uint64_t    max_turn_instructions{0};  //!< Instructions executed for one input
+      uint64_t    max_turn_output{0};        //!< Characters output for one input
+      size_t      max_undo_bytes{0};         //!< Memory held by the undo buffers
+      size_t      max_save_bytes{0};         //!< Size of each save file
+
+      // Speculation runs likely next commands on background threads while
+      // the game waits for a line of input, so that the result is ready
+      // at once if one of them is entered. Commands that save or restore
+      // are not sped up
+      unsigned                 speculate{0};          //!< Commands run ahead, 0 for none
+      std::vector<std::string> speculate_commands{};  //!< Run ahead first, then recent commands
+   };
+
+   //! Resources used by the session so far
+   struct Usage
+   {
+      uint64_t turns{0};          //!< Inputs sent
+      uint64_t instructions{0};   //!< Instructions executed
+      uint64_t output{0};         //!< Characters written to any output stream
+      size_t   undo_bytes{0};     //!< Memory held by the undo buffers now
+      size_t   save_bytes{0};     //!< Size of the largest save file
+      size_t   memory_bytes{0};   //!< Size of the game memory now
+      size_t   shared_bytes{0};   //!< Game memory shared with other sessions
+   };
+
+   //! Memory shared between all the sessions in this process
+   struct Sharing
+   {
+      size_t memory_bytes{0};   //!< Game memory of all sessions
+      size_t shared_bytes{0};   //!< Game memory mapped from shared pages
+      size_t pool_bytes{0};     //!< Memory holding the shared pages
+   };
+
+   //! Get figures for the memory shared between sessions
+   static Sharing getSharing();
+
+   //! Write the samples taken of all the sessions with Config::sample set,
+   //! by story, and the call paths sampled in collapsed stack format
+   static bool writeSamples(const std::string& filename, const std::string& collapsed_filename);
+
+   //! Write the coverage of all the finished sessions with Config::coverage
+   //! set, a file for each story in the given directory
+   static bool writeCoverage(const std::string& dir);
+
+   Session();
+   Session(const Config& config);
+   ~Session();
+
+   Session(const Session&) = delete;
+   Session& operator=(const Session&) = delete;
+
+   //! Load a story file
+   bool loadFile(const std::string& path);
+
+   //! Load a story from memory, the name is used in place of a filename
+   bool loadBuffer(const uint8_t* data, size_t size, const std::string& name);
+
+   //! Get error message for the last failure
+   const std::string& getLastError() const;
+
+   // The calls that run the game stop when more input is needed, or
+   // with status RUNNING after max_instructions, if it is not 0. This
+   // lets a caller share a thread between many sessions
+
+   //! Start the loaded story and run until it needs input
+   Status start(unsigned max_instructions = 0);
+
+   //! Send a line of input and run until more input is needed
+   Status sendCommand(const std::string& line, unsigned max_instructions = 0);
+
+   //! Send a key press and run until more input is needed
+   Status sendKey(uint8_t key, unsigned max_instructions = 0);
+
+   //! Time limit for the input requested (ms), 0 if there is no limit
+   unsigned getInputTimeout() const;
+
+   //! Report that the time limit for the input has expired, and run until
+   //! more input is needed
+   Status sendTimeout(unsigned max_instructions = 0);
+
+   //! Continue running after a call returned RUNNING
+   Status resume(unsigned max_instructions = 0);
+
+   //! Current status
+   Status getStatus() const;
+
+   //! Resources used so far
+   Usage getUsage() const;
+
+   //! Run time statistics of the game now running, as JSON text. See
+   //! Config::stats
+   std::string getStats() const;
+
+   //! Return the text written to the main window since the previous call
+   std::string takeOutput();
+
+   //! Return the current status line, if there is one
+   std::string getStatusLine() const;
+
+   //! Return a line of the screen
+   std::string getScreenLine(unsigned line) const;
+
+   //! Return the window events since the previous call
+   std::vector<WindowEvent> takeEvents();
+
+   //! Encode the state of the game while it is waiting for input
+   bool snapshot(std::vector<uint8_t>& data) const;
+
+   //! Continue a game from a snapshot of the same story, in place of start()
+   bool restore(const std::vector<uint8_t>& data);
+
+   //! Write the state of a game waiting for input, including the undo
+   //! history, to a file and free the memory used to run it. The game
+   //! wakes up when it is next sent input, or by calling wake()
+   bool hibernate(const std::string& path);
+
+   //! Restore a hibernating game from its file ahead of the next input
+   bool wake();
+
+   //! Check if the game is hibernating
+   bool isHibernating() const;
+
+   //! Share pages of game memory that are the same as pages of other
+   //! sessions in this process, copy-on-write. Only effective on Linux,
+   //! call from time to time as games change their memory
+   void shareMemory();
+
+   // Replication keeps a follower session, usually in another process,
+   // in step with a primary session without running the game. The
+   // follower is a read-only view of the game and can take over from the
+   // primary by being sent the next input. The undo history is not kept
+
+   //! Encode the changes to the game since the previous update, with the
+   //! output produced, for a follower to apply with applyUpdate(). Call
+   //! after each input once the game is waiting again or has finished.
+   //! The first update holds the whole game. Requires Config::replicate
+   bool takeUpdate(std::vector<uint8_t>& data);
+
+   //! Make the next update hold the whole game, for a new follower or
+   //! one that failed to apply an update
+   void restartUpdates();
+
+   //! Apply an update from takeUpdate() of a primary session of the same
+   //! story, in place of start(). The output becomes available from
+   //! takeOutput() as if this session had run the game
+   bool applyUpdate(const std::vector<uint8_t>& data);
+
+private:
+   class Impl;
+
+   std::unique_ptr<Impl> impl;
+};
+
+} // namespace Zif
@@ -0,0 +1,202 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "common/Buffer.h"
+#include "common/BufferConsole.h"
+#include "common/ConsoleRecorder.h"
+#include "common/Options.h"
+#include "common/Thread.h"
+
+#include "Z/Machine.h"
+#include "Z/Story.h"
+
+namespace Zif {
+
+//! A command run ahead, on a background thread, by a copy of a game that
+//! is waiting for a line of input. If the player enters the same command
+//! the state of the copy replaces the state of the game and the output of
+//! the copy is replayed to the console of the game.
+//
+//  The copy of the game is built by the background thread, the first time
+//  it runs, and then kept for the next command run ahead, each time
+//  restored from a snapshot of the game
+class Speculation : public Thread
+{
+public:
+   //! Instructions executed between checks for cancellation
+   static const unsigned QUANTUM = 10000;
+
+   Speculation(const Z::Story& story_, const Options& game_options)
+      : story(story_)
+      , recorder(console)
+   {
+      // The settings of the game without the coverage, statistics and
+      // sampling, which would count the commands run ahead and not used
+      options.batch.set(true);
+      options.seed.set(game_options.seed);
+      options.undo.set(game_options.undo);
+      options.save_dir.set(game_options.save_dir);
+      options.log_prefix.set(game_options.log_prefix);
+      options.cold.set(true);
+   }
+
+   ~Speculation()
+   {
+      cancel();
+      finish();
+   }
+
+   const std::string& getCommand() const { return command; }
+
+   //! Start running a command from a snapshot of the game and a copy of
+   //! its console, the limits for one turn apply (0 for no limit)
+   void begin(const IF::Buffer&    snapshot_,
+              const BufferConsole& console_,
+              const std::string&   command_,
+              uint64_t             max_instructions_,
+              uint64_t             max_output_)
+   {
+      // A previous command may still be giving up
+      finish();
+
+      snapshot         = snapshot_;
+      console          = console_;
+      command          = command_;
+      max_instructions = max_instructions_;
+      max_output       = max_output_;
+      cancelled        = false;
+      ready            = false;
+      done             = false;
+      finished         = false;
+
+      start();
+   }
+
+   //! Ask the background thread to give up
+   void cancel() { cancelled = true; }
+
+   //! Wait for the background thread to stop
+   void finish()
+   {
+      if (isStarted() && !finished)
+      {
+         join();
+         finished = true;
+      }
+   }
+
+   //! Resources used by the command
+   Z::Resumable::Usage getUsage() const
+   {
+      Z::Resumable::Usage usage = machine->getUsage();
+      usage.instructions -= usage_start.instructions;
+      usage.output       -= usage_start.output;
+      return usage;
+   }
+
+   //! Check that the command has completed and left the game waiting for
+   //! input, without saving or restoring. Does not wait for a command
+   //! still running
+   bool isUsable()
+   {
+      if (!done) return false;
+
+      finish();
+
+      return ready && recorder.stop() && !machine->isFileAccessBlocked();
+   }
+
+   //! The input the command left the game waiting for
+   IF::Machine::Status getStatus() const { return result; }
+
+   //! Move the result of a usable command into the game. After a failure
+   //! the game must be restarted
+   bool apply(Z::Resumable& target, Console& target_console)
+   {
+      IF::Buffer state;
+      IF::Buffer ops;
+
+      if (!machine->saveSnapshot(state)) return false;
+      recorder.encode(ops);
+
+      // Replay the output before the restore puts the cursor where the
+      // copy left it
+      ConsoleRecorder player(target_console);
+      return player.replay(ops) && target.restoreSnapshot(state);
+   }
+
+private:
+   const Z::Story&             story;
+   Options                     options;
+   std::string                 command;
+   IF::Buffer                  snapshot;   //!< Game the command runs from
+   BufferConsole               console;    //!< Copy of the console of the game
+   ConsoleRecorder             recorder;   //!< Records the output for replay
+   std::unique_ptr<Z::Machine> machine;
+   Z::Resumable::Usage         usage_start{};
+   uint64_t                    max_instructions{0};
+   uint64_t                    max_output{0};
+   std::atomic<bool>           cancelled{false};
+   std::atomic<bool>           ready{false};   //!< Completed, waiting for the next input
+   std::atomic<bool>           done{false};    //!< Background thread has stopped
+   IF::Machine::Status         result{IF::Machine::NEED_LINE};
+   bool                        finished{false};
+
+   void entry() override
+   {
+      run();
+      done = true;
+   }
+
+   void run()
+   {
+      if (!machine)
+      {
+         machine.reset(new Z::Machine(recorder, options, story));
+      }
+
+      // Any earlier attempt at file access was by a previous command
+      machine->blockFiles();
+
+      snapshot.rewind();
+      if (!machine->restoreSnapshot(snapshot)) return;
+
+      usage_start = machine->getUsage();
+
+      machine->provideLine(command);
+      recorder.start();
+
+      while(!cancelled)
+      {
+         IF::Machine::Status status = machine->run(QUANTUM);
+
+         Z::Resumable::Usage usage = getUsage();
+
+         if (((max_output != 0) && (usage.output > max_output)) ||
+             (status == IF::Machine::QUIT))
+         {
+            return;
+         }
+
+         if ((status == IF::Machine::NEED_LINE) || (status == IF::Machine::NEED_CHAR))
+         {
+            result = status;
+            ready  = true;
+            return;
+         }
+
+         if ((max_instructions != 0) && (usage.instructions >= max_instructions)) return;
+      }
+   }
+};
+
+} // namespace Zif
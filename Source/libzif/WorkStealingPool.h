@@ -0,0 +1,184 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common/Thread.h"
+
+//! Fixed set of threads, each with its own queue of jobs. A job queued by
+//! a running job goes on the queue of the same thread, which runs the most
+//! recent job first. A thread with an empty queue takes the oldest job
+//! from the queue of another thread
+class WorkStealingPool
+{
+public:
+   //! A job is given the index of the thread running it
+   using Job = std::function<void(unsigned)>;
+
+   WorkStealingPool(unsigned num_workers)
+   {
+      for(unsigned i = 0; i < num_workers; i++)
+      {
+         workers.emplace_back(new Worker(*this, i));
+      }
+
+      for(auto& worker : workers)
+      {
+         worker->begin();
+      }
+   }
+
+   ~WorkStealingPool()
+   {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         stop = true;
+      }
+      work_ready.notify_all();
+
+      for(auto& worker : workers)
+      {
+         worker->join();
+      }
+   }
+
+   unsigned size() const { return workers.size(); }
+
+   //! Queue a job, on the queue of the calling thread if it is a worker
+   void queue(Job&& job)
+   {
+      unsigned index = current_pool == this ? current_worker
+                                            : next_queue++ % workers.size();
+
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         workers[index]->push(std::move(job));
+         available++;
+         pending++;
+      }
+      work_ready.notify_one();
+   }
+
+   //! Wait until every queued job, including jobs queued by jobs, is done
+   void wait()
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      all_done.wait(lock, [this]{ return pending == 0; });
+   }
+
+private:
+   class Worker : public Thread
+   {
+   public:
+      Worker(WorkStealingPool& pool_, unsigned index_)
+         : pool(pool_)
+         , index(index_)
+      {
+      }
+
+      void begin() { start(); }
+
+      void push(Job&& job)
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         jobs.push_back(std::move(job));
+      }
+
+      //! Take the most recent job
+      bool pop(Job& job)
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         if (jobs.empty()) return false;
+
+         job = std::move(jobs.back());
+         jobs.pop_back();
+         return true;
+      }
+
+      //! Take the oldest job, for another thread
+      bool steal(Job& job)
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         if (jobs.empty()) return false;
+
+         job = std::move(jobs.front());
+         jobs.pop_front();
+         return true;
+      }
+
+   private:
+      WorkStealingPool& pool;
+      unsigned          index;
+      std::mutex        mutex;
+      std::deque<Job>   jobs;
+
+      void entry() override { pool.work(index); }
+   };
+
+   //! Pool and index of the worker running on this thread
+   static inline thread_local const WorkStealingPool* current_pool{nullptr};
+   static inline thread_local unsigned                current_worker{0};
+
+   std::mutex                           mutex;
+   std::condition_variable              work_ready;
+   std::condition_variable              all_done;
+   unsigned                             available{0};   //!< Jobs in the queues
+   unsigned                             pending{0};     //!< Jobs not yet completed
+   bool                                 stop{false};
+   std::atomic<unsigned>                next_queue{0};
+   std::vector<std::unique_ptr<Worker>> workers;
+
+   //! Take a job from the queue of this thread, or from another thread
+   bool take(unsigned index, Job& job)
+   {
+      if (workers[index]->pop(job)) return true;
+
+      for(unsigned i = 1; i < workers.size(); i++)
+      {
+         if (workers[(index + i) % workers.size()]->steal(job)) return true;
+      }
+
+      return false;
+   }
+
+   //! Run jobs until the pool is destroyed
+   void work(unsigned index)
+   {
+      current_pool   = this;
+      current_worker = index;
+
+      while(true)
+      {
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [this]{ return stop || (available != 0); });
+            if (stop) return;
+         }
+
+         Job job;
+         if (!take(index, job)) continue;
+
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            available--;
+         }
+
+         job(index);
+
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (--pending == 0) all_done.notify_all();
+         }
+      }
+   }
+};
@@ -0,0 +1,139 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/Buffer.h"
+
+//! Framing for the zif-server protocol. All values are big-endian and
+//! each frame, in either direction, is...
+//
+//     0  length of the rest of the frame (32-bit)
+//     4  frame type (8-bit)
+//     5  session id (32-bit)
+//     9  payload
+//
+//  Requests from the client...
+//
+//     START    payload is the path of a story file, relative to the story
+//              directory of the server, the session id is ignored. The
+//              OUTPUT reply carries the id of the new session
+//     LINE     payload is a line of input
+//     KEY      payload is a single key code
+//     SAVE     reply is a SNAPSHOT
+//     RESTORE  payload is a SNAPSHOT payload for the session's story
+//     CLOSE    end the session, reply is CLOSED
+//     STATS    reply is USAGE
+//     HIBERNATE  the session is likely to be idle for a while, write it
+//              to disk and free its memory. No reply
+//     WAKE     the session is likely to be used soon, read it back from
+//              disk ahead of the next request. No reply
+//     SHARE    share pages of game memory that are the same as pages of
+//              other sessions. No reply
+//     METRICS  reply is JSON
+//
+//  Replies from the server...
+//
+//     OUTPUT    status (8-bit), status line and output text since the
+//               previous reply, each a 32-bit length and characters
+//     SNAPSHOT  encoded state of a session
+//     ERROR     error message, also follows the OUTPUT of a session
+//               stopped for exceeding a resource limit
+//     CLOSED    no payload
+//     USAGE     resources used by the session, 64-bit counts of turns,
+//               instructions, output characters, undo memory (bytes), the
+//               largest save file (bytes), game memory (bytes) and game
+//               memory shared with other sessions (bytes). Followed by
+//               the game memory, shared game memory and memory holding
+//               shared pages for all sessions (bytes)
+//     JSON      run time statistics of the session as JSON text
+namespace Protocol {
+
+//! Largest frame accepted (bytes)
+static const uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+//! Size of the fixed part of a frame (bytes)
+static const uint32_t HEADER_SIZE = 9;
+
+enum Type : uint8_t
+{
+   START    = 0x01,
+   LINE     = 0x02,
+   KEY      = 0x03,
+   SAVE     = 0x04,
+   RESTORE  = 0x05,
+   CLOSE    = 0x06,
+   STATS    = 0x07,
+   HIBERNATE = 0x08,
+   WAKE     = 0x09,
+   SHARE    = 0x0A,
+   METRICS  = 0x0B,
+
+   OUTPUT   = 0x81,
+   SNAPSHOT = 0x82,
+   ERROR    = 0x83,
+   CLOSED   = 0x84,
+   USAGE    = 0x85,
+   JSON     = 0x86
+};
+
+//! A decoded frame
+struct Frame
+{
+   uint8_t              type{0};
+   uint32_t             session{0};
+   std::vector<uint8_t> payload;
+
+   std::string getText() const { return std::string(payload.begin(), payload.end()); }
+};
+
+//! Append a frame to an output buffer
+inline void encode(IF::Buffer& out, uint8_t type, uint32_t session,
+                   const void* payload, size_t size)
+{
+   out.push32(uint32_t(HEADER_SIZE - 4 + size));
+   out.push8(type);
+   out.push32(session);
+   out.push(payload, size);
+}
+
+//! Append a frame with a text payload to an output buffer
+inline void encode(IF::Buffer& out, uint8_t type, uint32_t session,
+                   const std::string& text = "")
+{
+   encode(out, type, session, text.data(), text.size());
+}
+
+//! Take the next complete frame from the start of a receive buffer
+//! \return false if more data is needed, or the frame is too big
+inline bool decode(std::vector<uint8_t>& in, Frame& frame, bool& bad)
+{
+   bad = false;
+
+   if (in.size() < 4) return false;
+
+   uint32_t length = (in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+
+   if ((length < (HEADER_SIZE - 4)) || (length > MAX_FRAME_SIZE))
+   {
+      bad = true;
+      return false;
+   }
+
+   if (in.size() < (4 + length)) return false;
+
+   frame.type    = in[4];
+   frame.session = (in[5] << 24) | (in[6] << 16) | (in[7] << 8) | in[8];
+   frame.payload.assign(in.begin() + HEADER_SIZE, in.begin() + 4 + length);
+
+   in.erase(in.begin(), in.begin() + 4 + length);
+   return true;
+}
+
+} // namespace Protocol
@@ -0,0 +1,817 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "PLT/File.h"
+
+#include "common/Buffer.h"
+
+#include "libzif/Session.h"
+
+#include "server/Protocol.h"
+#include "server/WorkerPool.h"
+
+//! Hosts many game sessions in one process. A single thread runs an epoll
+//! event loop for all the client connections on a Unix domain socket and
+//! the sessions are run on a pool of worker threads. The requests for a
+//! session are handled one at a time, in the order received. A session
+//! runs for at most one time slice before giving up its worker, so one
+//! that computes for a long time only delays others by a slice. Sessions
+//! that are idle for long enough are hibernated to disk. Stories are only
+//! loaded from the story directory and each session has a directory of
+//! its own for its files, removed when the session ends
+class Server
+{
+public:
+   struct Config
+   {
+      std::string          socket_path{"zif.sock"};
+      std::string          story_dir{"Games"};  //!< Stories START may load
+      unsigned             workers{1};
+      unsigned             slice{100000};       //!< Instructions per time slice
+      unsigned             hibernate_after{0};  //!< Idle seconds before hibernation, 0 for never
+      unsigned             share_period{0};     //!< Seconds between memory sharing, 0 for never
+      Zif::Session::Config session;
+   };
+
+   Server(const Config& config_)
+      : config(config_)
+   {
+   }
+
+   ~Server()
+   {
+      // Let the workers finish before anything they use is destroyed
+      pool.reset();
+
+      for(auto& entry : connections)
+      {
+         ::close(entry.first);
+      }
+
+      if (listen_fd >= 0)
+      {
+         ::close(listen_fd);
+         ::unlink(config.socket_path.c_str());
+      }
+
+      if (wake_fd >= 0)  ::close(wake_fd);
+      if (epoll_fd >= 0) ::close(epoll_fd);
+   }
+
+   //! Create the listening socket
+   bool open()
+   {
+      epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd < 0) return fail("epoll_create1");
+
+      wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if ((wake_fd < 0) || !watch(wake_fd, EPOLLIN)) return fail("eventfd");
+
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+      if (config.socket_path.size() >= sizeof(addr.sun_path))
+      {
+         fprintf(stderr, "ERR: socket path too long\n");
+         return false;
+      }
+      strcpy(addr.sun_path, config.socket_path.c_str());
+
+      // Hibernation files are written here
+      (void) PLT::File::createDir(config.session.save_dir.c_str());
+
+      listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listen_fd < 0) return fail("socket");
+
+      // Remove a socket left by a previous run
+      (void) ::unlink(config.socket_path.c_str());
+
+      if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0) return fail("bind");
+      if (listen(listen_fd, SOMAXCONN) != 0)                   return fail("listen");
+      if (!watch(listen_fd, EPOLLIN))                          return fail("epoll_ctl");
+
+      pool.reset(new WorkerPool(config.workers));
+
+      return true;
+   }
+
+   //! Run the event loop until stop() is called
+   int run()
+   {
+      epoll_event events[MAX_EVENTS];
+
+      // Wake up regularly to look after idle sessions
+      bool sweep      = (config.hibernate_after != 0) || (config.share_period != 0);
+      int  timeout_ms = sweep ? 1000 : -1;
+
+      while(!stopping)
+      {
+         if (sweep) sweepSessions();
+
+         int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+         if (n < 0)
+         {
+            if (errno == EINTR) continue;
+
+            perror("epoll_wait");
+            return 1;
+         }
+
+         for(int i = 0; i < n; i++)
+         {
+            int fd = events[i].data.fd;
+
+            if (fd == listen_fd)
+            {
+               acceptConnections();
+            }
+            else if (fd == wake_fd)
+            {
+               uint64_t count;
+               (void) ::read(wake_fd, &count, sizeof(count));
+
+               sendReady();
+            }
+            else
+            {
+               auto it = connections.find(fd);
+               if (it == connections.end()) continue;
+
+               std::shared_ptr<Connection> connection = it->second;
+
+               if ((events[i].events & EPOLLOUT) != 0)
+               {
+                  send(connection);
+               }
+
+               if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+               {
+                  receive(connection);
+               }
+            }
+         }
+      }
+
+      return 0;
+   }
+
+   //! Stop the event loop, safe to call from a signal handler
+   void stop()
+   {
+      stopping = true;
+      wake();
+   }
+
+private:
+   using Clock = std::chrono::steady_clock;
+
+   static const unsigned MAX_EVENTS = 64;
+   static const size_t   READ_SIZE  = 4096;
+
+   //! Output held for a client that is not reading it before the
+   //! connection is closed (bytes)
+   static const size_t   MAX_PENDING_OUTPUT = 4 * Protocol::MAX_FRAME_SIZE;
+
+   //! A client connection, only the event loop reads and writes the socket
+   struct Connection
+   {
+      int                   fd;
+      std::vector<uint8_t>  in;
+      std::vector<uint32_t> session_ids;
+      bool                  want_write{false};
+
+      std::mutex            mutex;         //!< Protects the members below
+      std::vector<uint8_t>  out;
+      bool                  overflow{false};   //!< Output is not being read
+      bool                  closed{false};
+   };
+
+   //! Directory for the files of one session, unique to the session and
+   //! removed with it so that a session never sees the files of another
+   struct SessionDir
+   {
+      SessionDir(const std::string& parent)
+      {
+         std::string       name = parent + "/sessionXXXXXX";
+         std::vector<char> path_(name.begin(), name.end());
+         path_.push_back('\0');
+
+         created = mkdtemp(path_.data()) != nullptr;
+         path    = created ? path_.data() : parent;
+      }
+
+      ~SessionDir()
+      {
+         if (!created) return;
+
+         DIR* dir = opendir(path.c_str());
+         if (dir != nullptr)
+         {
+            while(struct dirent* file = readdir(dir))
+            {
+               if ((strcmp(file->d_name, ".") != 0) && (strcmp(file->d_name, "..") != 0))
+               {
+                  (void) ::unlink((path + "/" + file->d_name).c_str());
+               }
+            }
+            closedir(dir);
+         }
+
+         (void) ::rmdir(path.c_str());
+      }
+
+      bool        created;
+      std::string path;
+   };
+
+   //! A session and the requests waiting for it
+   struct SessionEntry
+   {
+      SessionEntry(uint32_t id_, const std::shared_ptr<Connection>& connection_,
+                   const Zif::Session::Config& config_)
+         : id(id_)
+         , connection(connection_)
+         , dir(config_.save_dir)
+         , session(getConfig(config_, dir.path))
+         , hibernate_path(dir.path + "/session.hib")
+      {
+      }
+
+      uint32_t                    id;
+      std::shared_ptr<Connection> connection;
+      SessionDir                  dir;       //!< Outlives the session
+      Zif::Session                session;
+      std::string                 hibernate_path;
+
+      Clock::time_point           last_request{Clock::now()};  //!< Event loop only
+      bool                        sleeping{false};             //!< Event loop only
+      bool                        shared{false};               //!< Event loop only
+
+      bool                        running{false};  //!< Current request is not complete
+
+      std::mutex                  mutex;   //!< Protects the members below
+      std::deque<Protocol::Frame> requests;
+      bool                        scheduled{false};
+
+   private:
+      static Zif::Session::Config getConfig(const Zif::Session::Config& config_,
+                                            const std::string&          dir_)
+      {
+         Zif::Session::Config session_config = config_;
+         session_config.save_dir   = dir_;
+         session_config.log_prefix = dir_ + "/";
+         return session_config;
+      }
+   };
+
+   Clock::time_point                                 last_sweep{Clock::now()};
+   Clock::time_point                                 last_share{Clock::now()};
+   Config                                            config;
+   int                                               epoll_fd{-1};
+   int                                               wake_fd{-1};
+   int                                               listen_fd{-1};
+   std::atomic<bool>                                 stopping{false};
+   std::map<int,std::shared_ptr<Connection>>         connections;
+   std::map<uint32_t,std::shared_ptr<SessionEntry>>  sessions;
+   uint32_t                                          next_id{1};
+
+   std::mutex                                        ready_mutex;
+   std::vector<std::shared_ptr<Connection>>          ready;     //!< Connections with output
+
+   std::unique_ptr<WorkerPool>                       pool;
+
+   static bool fail(const char* what)
+   {
+      perror(what);
+      return false;
+   }
+
+   bool watch(int fd, uint32_t events)
+   {
+      epoll_event event{};
+      event.events  = events;
+      event.data.fd = fd;
+      return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+   }
+
+   void modify(int fd, uint32_t events)
+   {
+      epoll_event event{};
+      event.events  = events;
+      event.data.fd = fd;
+      (void) epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+   }
+
+   //! Wake up the event loop
+   void wake()
+   {
+      uint64_t one = 1;
+      (void) ::write(wake_fd, &one, sizeof(one));
+   }
+
+   void acceptConnections()
+   {
+      while(true)
+      {
+         int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+         if (fd < 0) return;
+
+         if (!watch(fd, EPOLLIN))
+         {
+            ::close(fd);
+            continue;
+         }
+
+         std::shared_ptr<Connection> connection{new Connection};
+         connection->fd = fd;
+         connections[fd] = connection;
+      }
+   }
+
+   void closeConnection(const std::shared_ptr<Connection>& connection)
+   {
+      {
+         std::unique_lock<std::mutex> lock(connection->mutex);
+         connection->closed = true;
+      }
+
+      // Sessions are destroyed once any request being handled is complete
+      for(uint32_t id : connection->session_ids)
+      {
+         sessions.erase(id);
+      }
+
+      (void) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+      ::close(connection->fd);
+      connections.erase(connection->fd);
+   }
+
+   //! Read from a connection and dispatch any complete requests
+   void receive(const std::shared_ptr<Connection>& connection)
+   {
+      {
+         // May have been closed by send()
+         std::unique_lock<std::mutex> lock(connection->mutex);
+         if (connection->closed) return;
+      }
+
+      uint8_t block[READ_SIZE];
+
+      while(true)
+      {
+         ssize_t n = ::read(connection->fd, block, sizeof(block));
+         if (n > 0)
+         {
+            connection->in.insert(connection->in.end(), block, block + n);
+         }
+         else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+         {
+            break;
+         }
+         else if ((n < 0) && (errno == EINTR))
+         {
+            continue;
+         }
+         else
+         {
+            closeConnection(connection);
+            return;
+         }
+      }
+
+      Protocol::Frame frame;
+      bool            bad;
+
+      while(Protocol::decode(connection->in, frame, bad))
+      {
+         dispatch(connection, frame);
+      }
+
+      if (bad)
+      {
+         // The stream can not be re-synchronised
+         closeConnection(connection);
+      }
+   }
+
+   //! Pass a request to its session
+   void dispatch(const std::shared_ptr<Connection>& connection, Protocol::Frame& frame)
+   {
+      std::shared_ptr<SessionEntry> entry;
+
+      if (frame.type == Protocol::START)
+      {
+         entry.reset(new SessionEntry(next_id++, connection, config.session));
+
+         sessions[entry->id] = entry;
+         connection->session_ids.push_back(entry->id);
+      }
+      else
+      {
+         auto it = sessions.find(frame.session);
+         if ((it == sessions.end()) || (it->second->connection != connection))
+         {
+            IF::Buffer reply;
+            Protocol::encode(reply, Protocol::ERROR, frame.session, "Unknown session");
+            queueOutput(connection, reply);
+            sendReady();
+            return;
+         }
+
+         entry = it->second;
+
+         if (frame.type == Protocol::CLOSE)
+         {
+            sessions.erase(it);
+
+            auto& ids = connection->session_ids;
+            for(size_t i = 0; i < ids.size(); i++)
+            {
+               if (ids[i] == entry->id)
+               {
+                  ids.erase(ids.begin() + i);
+                  break;
+               }
+            }
+         }
+      }
+
+      entry->last_request = Clock::now();
+      entry->sleeping     = frame.type == Protocol::HIBERNATE;
+      entry->shared       = frame.type == Protocol::SHARE;
+
+      queueRequest(entry, frame);
+   }
+
+   //! Add a request to the queue for a session, and make sure the session
+   //! is scheduled to run
+   void queueRequest(const std::shared_ptr<SessionEntry>& entry, Protocol::Frame& frame)
+   {
+      bool schedule;
+
+      {
+         std::unique_lock<std::mutex> lock(entry->mutex);
+         entry->requests.push_back(std::move(frame));
+         schedule = !entry->scheduled;
+         entry->scheduled = true;
+      }
+
+      if (schedule)
+      {
+         pool->queue([this, entry](){ serve(entry); });
+      }
+   }
+
+   //! Look after sessions that have had no requests for a while (once a
+   //! second). Sessions idle for long enough are hibernated and the memory
+   //! of sessions that have changed is shared with other sessions
+   void sweepSessions()
+   {
+      Clock::time_point now = Clock::now();
+
+      if ((now - last_sweep) < std::chrono::seconds(1)) return;
+      last_sweep = now;
+
+      bool share = (config.share_period != 0) &&
+                   ((now - last_share) >= std::chrono::seconds(config.share_period));
+      if (share) last_share = now;
+
+      for(auto& it : sessions)
+      {
+         SessionEntry& entry = *it.second;
+
+         if (entry.sleeping) continue;
+
+         uint8_t type;
+
+         if ((config.hibernate_after != 0) &&
+             ((now - entry.last_request) >= std::chrono::seconds(config.hibernate_after)))
+         {
+            type = Protocol::HIBERNATE;
+         }
+         else if (share && !entry.shared)
+         {
+            type = Protocol::SHARE;
+         }
+         else
+         {
+            continue;
+         }
+
+         // Leave sessions that are still busy until the next sweep
+         {
+            std::unique_lock<std::mutex> lock(entry.mutex);
+            if (entry.scheduled) continue;
+         }
+
+         entry.sleeping = type == Protocol::HIBERNATE;
+         entry.shared   = true;
+
+         Protocol::Frame frame;
+         frame.type    = type;
+         frame.session = entry.id;
+         queueRequest(it.second, frame);
+      }
+   }
+
+   //! Run a session for one time slice (on a worker thread)
+   void serve(const std::shared_ptr<SessionEntry>& entry)
+   {
+      IF::Buffer reply;
+
+      if (entry->running)
+      {
+         (void) entry->session.resume(config.slice);
+         replyOutput(*entry, reply);
+      }
+      else
+      {
+         Protocol::Frame frame;
+
+         {
+            std::unique_lock<std::mutex> lock(entry->mutex);
+            frame = std::move(entry->requests.front());
+            entry->requests.pop_front();
+         }
+
+         handle(*entry, frame, reply);
+      }
+
+      if (reply.size() != 0)
+      {
+         queueOutput(entry->connection, reply);
+         wake();
+      }
+
+      bool more;
+
+      {
+         std::unique_lock<std::mutex> lock(entry->mutex);
+         more = entry->running || !entry->requests.empty();
+         entry->scheduled = more;
+      }
+
+      // Go to the back of the queue so that a busy session can not hold
+      // on to a worker
+      if (more)
+      {
+         pool->queue([this, entry](){ serve(entry); });
+      }
+   }
+
+   void handle(SessionEntry& entry, const Protocol::Frame& frame, IF::Buffer& reply)
+   {
+      Zif::Session& session = entry.session;
+
+      switch(frame.type)
+      {
+      case Protocol::START:
+         if (!isStoryPath(frame.getText()))
+         {
+            Protocol::encode(reply, Protocol::ERROR, entry.id, "Story must be a path in the story directory");
+            return;
+         }
+         if (!session.loadFile(config.story_dir + "/" + frame.getText()))
+         {
+            Protocol::encode(reply, Protocol::ERROR, entry.id, session.getLastError());
+            return;
+         }
+         (void) session.start(config.slice);
+         break;
+
+      case Protocol::LINE:
+         (void) session.sendCommand(frame.getText(), config.slice);
+         break;
+
+      case Protocol::KEY:
+         if (frame.payload.size() != 1)
+         {
+            Protocol::encode(reply, Protocol::ERROR, entry.id, "Bad key");
+            return;
+         }
+         (void) session.sendKey(frame.payload[0], config.slice);
+         break;
+
+      case Protocol::SAVE:
+         {
+            std::vector<uint8_t> data;
+            if (!session.snapshot(data))
+            {
+               Protocol::encode(reply, Protocol::ERROR, entry.id, "Session is not waiting for input");
+               return;
+            }
+            Protocol::encode(reply, Protocol::SNAPSHOT, entry.id, data.data(), data.size());
+         }
+         return;
+
+      case Protocol::RESTORE:
+         if (!session.restore(frame.payload))
+         {
+            Protocol::encode(reply, Protocol::ERROR, entry.id, session.getLastError());
+            return;
+         }
+         break;
+
+      case Protocol::STATS:
+         {
+            Zif::Session::Usage usage = session.getUsage();
+
+            IF::Buffer stats;
+            stats.push64(usage.turns);
+            stats.push64(usage.instructions);
+            stats.push64(usage.output);
+            stats.push64(usage.undo_bytes);
+            stats.push64(usage.save_bytes);
+            stats.push64(usage.memory_bytes);
+            stats.push64(usage.shared_bytes);
+
+            Zif::Session::Sharing sharing = Zif::Session::getSharing();
+            stats.push64(sharing.memory_bytes);
+            stats.push64(sharing.shared_bytes);
+            stats.push64(sharing.pool_bytes);
+
+            Protocol::encode(reply, Protocol::USAGE, entry.id, stats.data(), stats.size());
+         }
+         return;
+
+      case Protocol::METRICS:
+         Protocol::encode(reply, Protocol::JSON, entry.id, session.getStats());
+         return;
+
+      case Protocol::HIBERNATE:
+         (void) session.hibernate(entry.hibernate_path);
+         return;
+
+      case Protocol::WAKE:
+         (void) session.wake();
+         return;
+
+      case Protocol::SHARE:
+         session.shareMemory();
+         return;
+
+      case Protocol::CLOSE:
+         Protocol::encode(reply, Protocol::CLOSED, entry.id);
+         return;
+
+      default:
+         Protocol::encode(reply, Protocol::ERROR, entry.id, "Unknown request");
+         return;
+      }
+
+      replyOutput(entry, reply);
+   }
+
+   //! Check that a story path is relative and does not leave the story directory
+   static bool isStoryPath(const std::string& path)
+   {
+      if (path.empty() || (path[0] == '/')) return false;
+
+      size_t start = 0;
+
+      while(true)
+      {
+         size_t end = path.find('/', start);
+         if (path.compare(start, end == std::string::npos ? std::string::npos : end - start, "..") == 0)
+         {
+            return false;
+         }
+
+         if (end == std::string::npos) return true;
+         start = end + 1;
+      }
+   }
+
+   //! Reply with the output of a session once it needs input or has stopped
+   void replyOutput(SessionEntry& entry, IF::Buffer& reply)
+   {
+      Zif::Session& session = entry.session;
+
+      entry.running = session.getStatus() == Zif::Session::RUNNING;
+      if (entry.running) return;
+
+      IF::Buffer output;
+      output.push8(session.getStatus());
+      output.pushString(session.getStatusLine());
+      output.pushString(session.takeOutput());
+
+      Protocol::encode(reply, Protocol::OUTPUT, entry.id, output.data(), output.size());
+
+      if ((session.getStatus() == Zif::Session::ERROR) && (session.getLastError() != ""))
+      {
+         Protocol::encode(reply, Protocol::ERROR, entry.id, session.getLastError());
+      }
+   }
+
+   //! Add a reply to the output of a connection (from any thread)
+   void queueOutput(const std::shared_ptr<Connection>& connection, const IF::Buffer& reply)
+   {
+      {
+         std::unique_lock<std::mutex> lock(connection->mutex);
+         if (connection->closed) return;
+
+         // The client is not reading its output, it is dropped by send()
+         if ((connection->out.size() + reply.size()) > MAX_PENDING_OUTPUT)
+         {
+            connection->overflow = true;
+         }
+         else
+         {
+            connection->out.insert(connection->out.end(), reply.data(), reply.data() + reply.size());
+         }
+      }
+
+      std::unique_lock<std::mutex> lock(ready_mutex);
+      ready.push_back(connection);
+   }
+
+   //! Send output for all connections that have some
+   void sendReady()
+   {
+      std::vector<std::shared_ptr<Connection>> ready_;
+
+      {
+         std::unique_lock<std::mutex> lock(ready_mutex);
+         std::swap(ready_, ready);
+      }
+
+      for(const auto& connection : ready_)
+      {
+         send(connection);
+      }
+   }
+
+   //! Write as much output as the socket will take, and wait until it
+   //! can take more if necessary
+   void send(const std::shared_ptr<Connection>& connection)
+   {
+      bool pending;
+      bool overflow;
+
+      {
+         std::unique_lock<std::mutex> lock(connection->mutex);
+         if (connection->closed) return;
+
+         overflow = connection->overflow;
+
+         auto&  out = connection->out;
+         size_t sent = 0;
+
+         while(sent < out.size())
+         {
+            ssize_t n = ::send(connection->fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+            if (n > 0)
+            {
+               sent += n;
+            }
+            else if ((n < 0) && (errno == EINTR))
+            {
+               continue;
+            }
+            else
+            {
+               break;
+            }
+         }
+
+         out.erase(out.begin(), out.begin() + sent);
+         pending = !out.empty();
+      }
+
+      if (overflow)
+      {
+         closeConnection(connection);
+         return;
+      }
+
+      if (pending != connection->want_write)
+      {
+         connection->want_write = pending;
+         modify(connection->fd, pending ? EPOLLIN | EPOLLOUT : EPOLLIN);
+      }
+   }
+};
@@ -0,0 +1,101 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common/Thread.h"
+
+//! Fixed set of threads that run queued jobs in the order queued
+class WorkerPool
+{
+public:
+   using Job = std::function<void()>;
+
+   WorkerPool(unsigned num_workers)
+   {
+      for(unsigned i = 0; i < num_workers; i++)
+      {
+         workers.emplace_back(new Worker(*this));
+      }
+   }
+
+   ~WorkerPool()
+   {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         stop = true;
+      }
+      job_ready.notify_all();
+
+      for(auto& worker : workers)
+      {
+         worker->join();
+      }
+   }
+
+   //! Queue a job to be run by the next free worker
+   void queue(Job&& job)
+   {
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         jobs.push_back(std::move(job));
+      }
+      job_ready.notify_one();
+   }
+
+private:
+   class Worker : public Thread
+   {
+   public:
+      Worker(WorkerPool& pool_)
+         : pool(pool_)
+      {
+         start();
+      }
+
+   private:
+      WorkerPool& pool;
+
+      void entry() override { pool.work(); }
+   };
+
+   std::mutex                           mutex;
+   std::condition_variable              job_ready;
+   std::deque<Job>                      jobs;
+   bool                                 stop{false};
+   std::vector<std::unique_ptr<Worker>> workers;
+
+   //! Run jobs until the pool is destroyed
+   void work()
+   {
+      while(true)
+      {
+         Job job;
+
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while(jobs.empty() && !stop)
+            {
+               job_ready.wait(lock);
+            }
+
+            if (jobs.empty()) return;
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+         }
+
+         job();
+      }
+   }
+};
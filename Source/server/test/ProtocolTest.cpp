@@ -0,0 +1,135 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Framing of the zif-server protocol
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/Buffer.h"
+
+#include "server/Protocol.h"
+
+#include "common/test/Check.h"
+
+using Bytes = std::vector<uint8_t>;
+
+static Bytes toBytes(const IF::Buffer& buffer)
+{
+   return Bytes(buffer.data(), buffer.data() + buffer.size());
+}
+
+//! Frame header with the given length field
+static Bytes header(uint32_t length)
+{
+   IF::Buffer buffer;
+   buffer.push32(length);
+   buffer.push8(Protocol::LINE);
+   buffer.push32(1);
+   return toBytes(buffer);
+}
+
+static void testRoundTrip()
+{
+   IF::Buffer out;
+   Protocol::encode(out, Protocol::LINE, 0x80000001, "open mailbox");
+   Protocol::encode(out, Protocol::CLOSE, 0xFFFFFFFF);
+
+   Bytes key{0x00, 0xFF};
+   Protocol::encode(out, Protocol::KEY, 7, key.data(), key.size());
+
+   CHECK(out.size() == (3 * Protocol::HEADER_SIZE + 12 + 0 + 2));
+
+   Bytes           in = toBytes(out);
+   Protocol::Frame frame;
+   bool            bad;
+
+   CHECK(Protocol::decode(in, frame, bad) && !bad);
+   CHECK(frame.type == Protocol::LINE);
+   CHECK(frame.session == 0x80000001);
+   CHECK(frame.getText() == "open mailbox");
+
+   CHECK(Protocol::decode(in, frame, bad) && !bad);
+   CHECK(frame.type == Protocol::CLOSE);
+   CHECK(frame.session == 0xFFFFFFFF);
+   CHECK(frame.payload.empty());
+
+   CHECK(Protocol::decode(in, frame, bad) && !bad);
+   CHECK(frame.type == Protocol::KEY);
+   CHECK(frame.session == 7);
+   CHECK(frame.payload == key);
+
+   CHECK(in.empty());
+   CHECK(!Protocol::decode(in, frame, bad) && !bad);
+}
+
+static void testPartial()
+{
+   IF::Buffer out;
+   Protocol::encode(out, Protocol::START, 0, "Games/Infocom/Dungeon.z5");
+   Protocol::encode(out, Protocol::STATS, 3);
+
+   Bytes           all = toBytes(out);
+   Bytes           in;
+   Protocol::Frame frame;
+   bool            bad;
+   unsigned        frames = 0;
+
+   // A byte at a time, as from a slow connection
+   for(uint8_t byte : all)
+   {
+      in.push_back(byte);
+
+      if (Protocol::decode(in, frame, bad))
+      {
+         frames++;
+         CHECK(in.empty());
+         CHECK(frame.type == (frames == 1 ? Protocol::START : Protocol::STATS));
+      }
+
+      CHECK(!bad);
+   }
+
+   CHECK(frames == 2);
+}
+
+static void testBadLength()
+{
+   Protocol::Frame frame;
+   bool            bad;
+
+   // Shorter than the fixed part of a frame
+   for(uint32_t length = 0; length < (Protocol::HEADER_SIZE - 4); length++)
+   {
+      Bytes in = header(length);
+      CHECK(!Protocol::decode(in, frame, bad) && bad);
+   }
+
+   // Larger than any frame accepted
+   Bytes in = header(Protocol::MAX_FRAME_SIZE + 1);
+   CHECK(!Protocol::decode(in, frame, bad) && bad);
+
+   in = header(0xFFFFFFFF);
+   CHECK(!Protocol::decode(in, frame, bad) && bad);
+
+   // The largest frame is waited for
+   in = header(Protocol::MAX_FRAME_SIZE);
+   CHECK(!Protocol::decode(in, frame, bad) && !bad);
+   CHECK(in.size() == Protocol::HEADER_SIZE);
+
+   // Only the length is needed to find a frame too big
+   in = Bytes{0x7F, 0xFF, 0xFF, 0xFF};
+   CHECK(!Protocol::decode(in, frame, bad) && bad);
+}
+
+int main()
+{
+   testRoundTrip();
+   testPartial();
+   testBadLength();
+
+   return Check::result();
+}
@@ -4,10 +4,14 @@
 //-------------------------------------------------------------------------------
 
 #include "common/Quetzal.h"
+#include "Z/BinaryTracer.h"
+#include "Z/Disassembler.h"
 #include "Z/Story.h"
 
 #include "STB/ConsoleApp.h"
 
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
@@ -26,6 +30,10 @@ private:
    STB::Option<bool>        dump_mem{'d', "mem", "Dump memory", false};
    STB::Option<const char*> save_file{'s', "save", "Save file"};
    STB::Option<const char*> output_file{'o', "out", "Output file"};
+   STB::Option<const char*> trace_file{'t', "trace", "Decode a binary trace written by zif --trace-bin"};
+   STB::Option<unsigned>    trace_from{'f', "from", "First instruction of the trace to decode", 0};
+   STB::Option<unsigned>    trace_to{'l', "last", "Last instruction of the trace to decode (0 for all)", 0};
+   STB::Option<const char*> trace_routine{'r', "routine", "Only decode the trace of the routine at this hex address"};
 
    std::ofstream out_file_stream;
    std::ostream* out{&std::cout};
@@ -140,6 +148,143 @@ private:
       *out << "  ]" << std::endl;
    }
 
+   //! Write one line of decoded trace
+   void traceLine(uint64_t number, unsigned depth, const std::string& text)
+   {
+      char prefix[32];
+      snprintf(prefix, sizeof(prefix), "%10llu %3u  ", (unsigned long long)number, depth);
+      *out << prefix << text << std::endl;
+   }
+
+   //! Write the characters output or input since the last instruction
+   void traceText(uint64_t number, unsigned depth, uint32_t kind, std::string& text)
+   {
+      if (text.empty()) return;
+
+      traceLine(number, depth, std::string(kind == Z::TraceRecord::OUTPUT ? "OUT \"" : "IN  \"") + text + "\"");
+      text.clear();
+   }
+
+   //! Disassemble the instructions of a binary trace, with their operand
+   //! values and results, and the text output and input
+   int decodeTrace()
+   {
+      Z::TraceReader reader;
+      std::string    identity;
+
+      if (!reader.open((const char*)trace_file, identity))
+      {
+         return error("failed to read trace \"" + std::string(trace_file) + "\"");
+      }
+
+      if (identity != story.getIdentity())
+      {
+         return error("trace is of story " + identity + " not " + story.getIdentity());
+      }
+
+      uint32_t routine = trace_routine != nullptr ? strtoul(trace_routine, nullptr, 16) : 0;
+
+      Z::Disassembler dis(story.getVersion());
+      Z::TraceStack   stack;
+      Z::TraceRecord  record;
+      uint64_t        number    = 0;   // Of the next instruction
+      uint32_t        text_kind = 0;   // Of the characters in text
+      std::string     text;
+      std::string     line;
+
+      while(reader.next(record))
+      {
+         bool in_range = (number >= trace_from) && ((trace_to == 0) || (number <= trace_to));
+
+         switch(record.pc)
+         {
+         case Z::TraceRecord::CHECKPOINT:
+            number = (uint64_t(record.get32(0)) << 32) | record.get32(2);
+            stack.sync(record.get32(4), record.result);
+            break;
+
+         case Z::TraceRecord::CALL:
+            stack.call(record.get32(0), record.get32(2));
+            break;
+
+         case Z::TraceRecord::RETURN:
+            stack.ret(record.get32(0));
+            break;
+
+         case Z::TraceRecord::OUTPUT:
+         case Z::TraceRecord::INPUT:
+            if (!in_range) break;
+
+            if (record.pc != text_kind) traceText(number, stack.getDepth(), text_kind, text);
+            text_kind = record.pc;
+
+            if (record.result == '\n')
+               text += "\\n";
+            else if ((record.result >= ' ') && (record.result < 0x7F))
+               text += char(record.result);
+            break;
+
+         default:
+            if ((trace_to != 0) && (number > trace_to))
+            {
+               traceText(number, stack.getDepth(), text_kind, text);
+               return 0;
+            }
+
+            if (in_range && ((trace_routine == nullptr) || (stack.getRoutine() == routine)))
+            {
+               traceText(number, stack.getDepth(), text_kind, text);
+
+               if (record.pc < state.memory.size())
+               {
+                  (void) dis.disassemble(line, record.pc, state.memory.data() + record.pc,
+                                        state.memory.size() - record.pc);
+               }
+               else
+               {
+                  line = "?";
+               }
+
+               // Operand values and results
+               std::string values;
+
+               for(unsigned i = 0; i < record.getNumOperands(); i++)
+               {
+                  char value[8];
+                  snprintf(value, sizeof(value), " %04X", record.operand[i]);
+                  values += value;
+               }
+
+               if (record.hasFlag(Z::TraceRecord::STORE))
+               {
+                  char value[16];
+                  snprintf(value, sizeof(value), " -> %04X", record.result);
+                  values += value;
+               }
+
+               if (record.hasFlag(Z::TraceRecord::BRANCH))
+               {
+                  values += record.hasFlag(Z::TraceRecord::TAKEN) ? " branch" : " no branch";
+               }
+
+               if (!values.empty())
+               {
+                  if (line.size() < 48) line.append(48 - line.size(), ' ');
+                  line += " ;" + values;
+               }
+
+               traceLine(number, stack.getDepth(), line);
+            }
+
+            number++;
+            break;
+         }
+      }
+
+      traceText(number, stack.getDepth(), text_kind, text);
+      return 0;
+   }
+
    virtual int startConsoleApp() override
    {
       if (output_file != nullptr)
@@ -151,6 +296,19 @@ private:
          }
       }
 
+      if (trace_file != nullptr)
+      {
+         if (!story.load(filename))
+         {
+            return error(story.getLastError());
+         }
+
+         story.prepareMemory(state.memory);
+         story.resetMemory(state.memory);
+
+         return decodeTrace();
+      }
+
       *out << "{" << std::endl;
 
       attr("story", filename);
@@ -8,7 +8,11 @@
 #include "common/Blorb.h"
 
 #include "Z/Machine.h"
+#include "Z/BinaryTracer.h"
+#include "Z/Instruments.h"
+#include "Z/Tracer.h"
 #include "Glulx/Machine.h"
+#include "Glulx/Tracer.h"
 #include "Level9/Machine.h"
 
 #include "launcher/Launcher.h"
@@ -33,12 +37,35 @@ private:
       return 1;
    }
 
+   //! Play a Z story with the given machine
+   template <typename MACHINE>
+   int playZ(Console& console, const Z::Story& story, const std::string& exec_type,
+             const char* story_file, bool restore)
+   {
+      MACHINE machine(console, options, story);
+      if (exec_type == "ZCOD")
+      {
+         (void) machine.openResources(story_file);
+      }
+      return machine.play(restore) ? 0 : 1;
+   }
+
+   //! Play a Glulx story with the given machine
+   template <typename MACHINE>
+   int playGlulx(Console& console, const Glulx::Story& story, bool restore)
+   {
+      MACHINE machine(console, options, story);
+      return machine.play(restore) ? 0 : 1;
+   }
+
    virtual bool hasSaveFile(const std::string& story_file) const override
    {
       size_t slash = story_file.rfind('/');
 
       return IF::SavableState::saveFileExists((const char*)options.save_dir,
-                                              story_file.c_str() + slash);
+                                              story_file.c_str() + slash) ||
+             IF::SavableState::journalExists((const char*)options.save_dir,
+                                             story_file.c_str() + slash);
    }
 
    virtual int runGame(const char* story_file, bool restore) override
@@ -70,8 +97,16 @@ private:
       {
          if (z_story.load(story_file, exec_offset))
          {
-            Z::Machine machine(console, options, z_story);
-            return machine.play(restore) ? 0 : 1;
+            // Tracing and the measurement tools are separate machines so
+            // that normal play is not slowed
+            if (options.trace)
+               return playZ<Z::BasicMachine<Z::Tracer>>(console, z_story, exec_type, story_file, restore);
+            else if (options.trace_bin)
+               return playZ<Z::BasicMachine<Z::BinaryTracer>>(console, z_story, exec_type, story_file, restore);
+            else if (Z::Instruments::isEnabled(options))
+               return playZ<Z::BasicMachine<Z::Instruments>>(console, z_story, exec_type, story_file, restore);
+            else
+               return playZ<Z::Machine>(console, z_story, exec_type, story_file, restore);
          }
          else
          {
@@ -84,8 +119,8 @@ private:
       {
          if (glulx_story.load(story_file, exec_offset))
          {
-            Glulx::Machine machine(console, options, glulx_story);
-            return machine.play(restore) ? 0 : 1;
+            return options.trace ? playGlulx<Glulx::BasicMachine<Glulx::Tracer>>(console, glulx_story, restore)
+                                 : playGlulx<Glulx::Machine>(console, glulx_story, restore);
          }
          else
          {
@@ -0,0 +1,466 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common/Buffer.h"
+
+#include "libzif/Session.h"
+
+#include "STB/ConsoleApp.h"
+
+#define  PROGRAM         "zif-bench"
+#define  DESCRIPTION     "Measure interpreter performance on the bundled games"
+#define  LINK            "https://github.com/AnotherJohnH/Zif"
+#define  AUTHOR          "John D. Haughton"
+#define  VERSION         PROJ_VERSION
+#define  COPYRIGHT_YEAR  "2019"
+
+//! A story and the commands to send it, one per line
+struct Game
+{
+   const char* story;
+   const char* script;
+};
+
+static const Game games[] =
+{
+   {"Infocom/Dungeon.z5",                  "Dungeon.txt"},
+   {"CrowtherAndWoods/Adventure/Advent.z5", "Advent.txt"},
+   {"Phoenix/Doom/CountdownToDoom.z5",     "CountdownToDoom.txt"}
+};
+
+//! Measurements for one game, over all the runs
+struct Result
+{
+   std::string           story;
+   unsigned              turns{0};          //!< Inputs sent in one run
+   uint64_t              instructions{0};   //!< Instructions executed in one run
+   uint64_t              characters{0};     //!< Characters output in one run
+   uint32_t              output_hash{0};    //!< Hash of the output text of one run
+   double                seconds{0.0};      //!< Total time of all the runs
+   std::vector<unsigned> start_us;          //!< Time to the first input of each run
+   std::vector<unsigned> turn_us;           //!< Time of every turn of every run
+   long                  peak_rss_kib{0};   //!< Peak resident set size of the process running the game
+};
+
+//!
+class ZifBench : public STB::ConsoleApp
+{
+private:
+   STB::Option<const char*> games_dir{  'g', "games",   "Directory holding the bundled games", "Games"};
+   STB::Option<const char*> scripts_dir{'c', "scripts", "Directory holding the benchmark scripts", "Bench"};
+   STB::Option<const char*> output{     'o', "output",  "Machine readable result file", "bench.json"};
+   STB::Option<unsigned>    repeat{     'r', "repeat",  "Number of runs of each game", 20};
+   STB::Option<unsigned>    seed{       'S', "seed",    "Random number seed", 1};
+   STB::Option<const char*> save_dir{   'd', "save-dir", "Directory for save files", "Saves"};
+
+   using Clock = std::chrono::steady_clock;
+
+   unsigned runs() const { return repeat == 0 ? 1 : unsigned(repeat); }
+
+   static unsigned elapsedUs(Clock::time_point start)
+   {
+      return unsigned(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+   }
+
+   //! Value below which the given percentage of the sorted samples fall
+   static unsigned percentile(const std::vector<unsigned>& sorted, unsigned percent)
+   {
+      if (sorted.empty()) return 0;
+
+      size_t rank = (sorted.size() * percent + 99) / 100;
+      return sorted[rank == 0 ? 0 : rank - 1];
+   }
+
+   static uint32_t hashText(uint32_t hash, const std::string& text)
+   {
+      for(uint8_t ch : text)
+      {
+         hash = (hash ^ ch) * 0x01000193;
+      }
+      return hash;
+   }
+
+   bool readScript(const std::string& path, std::vector<std::string>& commands)
+   {
+      FILE* fp = fopen(path.c_str(), "r");
+      if (fp == nullptr)
+      {
+         fprintf(stderr, "ERR - failed to open \"%s\"\n", path.c_str());
+         return false;
+      }
+
+      char line[256];
+      while(fgets(line, sizeof(line), fp) != nullptr)
+      {
+         std::string command = line;
+         while(!command.empty() && ((command.back() == '\n') || (command.back() == '\r')))
+         {
+            command.pop_back();
+         }
+         commands.push_back(command);
+      }
+
+      fclose(fp);
+      return true;
+   }
+
+   //! Run a game once from a cold start to the end of its script
+   bool run(const std::string&              path,
+            const std::vector<std::string>& commands,
+            Result&                         result)
+   {
+      Zif::Session::Config config;
+      config.seed       = seed;
+      config.save_dir   = (const char*)save_dir;
+      config.warm_start = false;
+
+      Zif::Session session(config);
+
+      if (!session.loadFile(path))
+      {
+         fprintf(stderr, "ERR - %s\n", session.getLastError().c_str());
+         return false;
+      }
+
+      Clock::time_point run_start = Clock::now();
+
+      Zif::Session::Status status = session.start();
+      result.start_us.push_back(elapsedUs(run_start));
+
+      uint32_t hash = hashText(0x811C9DC5, session.takeOutput());
+      unsigned turns = 0;
+
+      for(const auto& command : commands)
+      {
+         if ((status != Zif::Session::NEED_LINE) && (status != Zif::Session::NEED_CHAR)) break;
+
+         Clock::time_point turn_start = Clock::now();
+
+         if (status == Zif::Session::NEED_CHAR)
+            status = session.sendKey(command.empty() ? '\n' : command[0]);
+         else
+            status = session.sendCommand(command);
+
+         result.turn_us.push_back(elapsedUs(turn_start));
+         turns++;
+
+         hash = hashText(hash, session.takeOutput());
+      }
+
+      result.seconds += std::chrono::duration<double>(Clock::now() - run_start).count();
+
+      if (status == Zif::Session::ERROR)
+      {
+         fprintf(stderr, "ERR - \"%s\" stopped with an error after %u turns\n", path.c_str(), turns);
+         return false;
+      }
+
+      Zif::Session::Usage usage = session.getUsage();
+
+      if ((result.start_us.size() > 1) && (hash != result.output_hash))
+      {
+         fprintf(stderr, "ERR - \"%s\" output differs between runs\n", path.c_str());
+         return false;
+      }
+
+      result.turns        = turns;
+      result.instructions = usage.instructions;
+      result.characters   = usage.output;
+      result.output_hash  = hash;
+
+      return true;
+   }
+
+   //! Pass the measurements of the runs of a game from the child process
+   static bool writeRuns(int fd, const Result& result)
+   {
+      uint64_t seconds;
+      memcpy(&seconds, &result.seconds, sizeof(seconds));
+
+      IF::Buffer buffer;
+      buffer.push32(result.turns);
+      buffer.push64(result.instructions);
+      buffer.push64(result.characters);
+      buffer.push32(result.output_hash);
+      buffer.push64(seconds);
+
+      for(const auto* times : {&result.start_us, &result.turn_us})
+      {
+         buffer.push32(times->size());
+         for(unsigned us : *times)
+         {
+            buffer.push32(us);
+         }
+      }
+
+      const uint8_t* data = buffer.data();
+      size_t         size = buffer.size();
+
+      while(size != 0)
+      {
+         ssize_t n = write(fd, data, size);
+         if (n <= 0) return false;
+         data += n;
+         size -= n;
+      }
+
+      return true;
+   }
+
+   //! Read the measurements written by writeRuns()
+   static bool readRuns(int fd, Result& result)
+   {
+      IF::Buffer buffer;
+      uint8_t    block[4096];
+
+      while(true)
+      {
+         ssize_t n = read(fd, block, sizeof(block));
+         if (n < 0) return false;
+         if (n == 0) break;
+         buffer.push(block, n);
+      }
+
+      result.turns        = buffer.read32();
+      result.instructions = buffer.read64();
+      result.characters   = buffer.read64();
+      result.output_hash  = buffer.read32();
+
+      uint64_t seconds = buffer.read64();
+      memcpy(&result.seconds, &seconds, sizeof(seconds));
+
+      for(auto* times : {&result.start_us, &result.turn_us})
+      {
+         uint32_t count = buffer.read32();
+         for(uint32_t i = 0; (i < count) && buffer.isOk(); i++)
+         {
+            times->push_back(buffer.read32());
+         }
+      }
+
+      return buffer.isOk();
+   }
+
+   //! Run a game --repeat times in a child process, so that the peak
+   //! resident memory is that of the one game
+   bool runGame(const std::string&              path,
+                const std::vector<std::string>& commands,
+                Result&                         result)
+   {
+      int fds[2];
+      if (pipe(fds) != 0) return false;
+
+      fflush(stdout);
+
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+         close(fds[0]);
+         close(fds[1]);
+         return false;
+      }
+
+      if (pid == 0)
+      {
+         close(fds[0]);
+
+         bool ok = true;
+         for(unsigned i = 0; ok && (i < runs()); i++)
+         {
+            ok = run(path, commands, result);
+         }
+
+         _exit(ok && writeRuns(fds[1], result) ? 0 : 1);
+      }
+
+      close(fds[1]);
+      bool ok = readRuns(fds[0], result);
+      close(fds[0]);
+
+      int           wstatus;
+      struct rusage usage;
+
+      if ((wait4(pid, &wstatus, 0, &usage) != pid) ||
+          !WIFEXITED(wstatus) || (WEXITSTATUS(wstatus) != 0))
+      {
+         return false;
+      }
+
+      result.peak_rss_kib = usage.ru_maxrss;
+      return ok;
+   }
+
+   static double perSecond(uint64_t count, double seconds)
+   {
+      return seconds > 0.0 ? double(count) / seconds : 0.0;
+   }
+
+   void printResult(const Result& result)
+   {
+      std::vector<unsigned> sorted = result.turn_us;
+      std::sort(sorted.begin(), sorted.end());
+
+      printf("%-38s %5u %11.0f %10.0f %8u %8u %9ld\n",
+             result.story.c_str(),
+             result.turns,
+             perSecond(result.instructions * runs(), result.seconds),
+             perSecond(result.characters * runs(), result.seconds),
+             percentile(sorted, 50),
+             percentile(sorted, 99),
+             result.peak_rss_kib);
+   }
+
+   //! Write a string as a quoted JSON string
+   static void writeString(FILE* fp, const std::string& text)
+   {
+      fputc('"', fp);
+      for(char ch : text)
+      {
+         switch(ch)
+         {
+         case '"':  fputs("\\\"", fp); break;
+         case '\\': fputs("\\\\", fp); break;
+         case '\n': fputs("\\n", fp); break;
+         case '\t': fputs("\\t", fp); break;
+
+         default:
+            if ((unsigned char)ch < 0x20)
+               fprintf(fp, "\\u%04x", (unsigned char)ch);
+            else
+               fputc(ch, fp);
+            break;
+         }
+      }
+      fputc('"', fp);
+   }
+
+   void writeResult(FILE* fp, const Result& result, bool last)
+   {
+      std::vector<unsigned> sorted_turn = result.turn_us;
+      std::sort(sorted_turn.begin(), sorted_turn.end());
+
+      std::vector<unsigned> sorted_start = result.start_us;
+      std::sort(sorted_start.begin(), sorted_start.end());
+
+      fprintf(fp, "    {\n");
+      fprintf(fp, "      \"story\": ");
+      writeString(fp, result.story);
+      fprintf(fp, ",\n");
+      fprintf(fp, "      \"turns\": %u,\n", result.turns);
+      fprintf(fp, "      \"instructions\": %llu,\n", (unsigned long long)result.instructions);
+      fprintf(fp, "      \"characters\": %llu,\n", (unsigned long long)result.characters);
+      fprintf(fp, "      \"output_hash\": \"%08x\",\n", result.output_hash);
+      fprintf(fp, "      \"seconds\": %.6f,\n", result.seconds);
+      fprintf(fp, "      \"instructions_per_sec\": %.0f,\n",
+              perSecond(result.instructions * runs(), result.seconds));
+      fprintf(fp, "      \"characters_per_sec\": %.0f,\n",
+              perSecond(result.characters * runs(), result.seconds));
+      fprintf(fp, "      \"start_us_p50\": %u,\n", percentile(sorted_start, 50));
+      fprintf(fp, "      \"turn_us_p50\": %u,\n", percentile(sorted_turn, 50));
+      fprintf(fp, "      \"turn_us_p99\": %u,\n", percentile(sorted_turn, 99));
+      fprintf(fp, "      \"peak_rss_kib\": %ld\n", result.peak_rss_kib);
+      fprintf(fp, "    }%s\n", last ? "" : ",");
+   }
+
+   bool writeResults(const std::vector<Result>& results,
+                     uint64_t                   instructions,
+                     uint64_t                   characters,
+                     double                     seconds)
+   {
+      long peak_rss_kib = 0;
+      for(const auto& result : results)
+      {
+         peak_rss_kib = std::max(peak_rss_kib, result.peak_rss_kib);
+      }
+
+      FILE* fp = fopen(output, "w");
+      if (fp == nullptr)
+      {
+         fprintf(stderr, "ERR - failed to create \"%s\"\n", (const char*)output);
+         return false;
+      }
+
+      fprintf(fp, "{\n");
+      fprintf(fp, "  \"version\": \"%s\",\n", VERSION);
+      fprintf(fp, "  \"seed\": %u,\n", unsigned(seed));
+      fprintf(fp, "  \"repeat\": %u,\n", runs());
+      fprintf(fp, "  \"games\": [\n");
+
+      for(size_t i = 0; i < results.size(); i++)
+      {
+         writeResult(fp, results[i], i == (results.size() - 1));
+      }
+
+      fprintf(fp, "  ],\n");
+      fprintf(fp, "  \"instructions_per_sec\": %.0f,\n", perSecond(instructions, seconds));
+      fprintf(fp, "  \"characters_per_sec\": %.0f,\n", perSecond(characters, seconds));
+      fprintf(fp, "  \"peak_rss_kib\": %ld\n", peak_rss_kib);
+      fprintf(fp, "}\n");
+
+      return fclose(fp) == 0;
+   }
+
+   virtual int startConsoleApp() override
+   {
+      std::vector<Result> results;
+      uint64_t            instructions = 0;
+      uint64_t            characters   = 0;
+      double              seconds      = 0.0;
+
+      printf("%-38s %5s %11s %10s %8s %8s %9s\n",
+             "Story", "Turns", "Instr/s", "Chars/s", "p50 us", "p99 us", "RSS KiB");
+
+      for(const auto& game : games)
+      {
+         std::vector<std::string> commands;
+         if (!readScript(std::string(scripts_dir) + "/" + game.script, commands)) return 1;
+
+         std::string path = std::string(games_dir) + "/" + game.story;
+
+         Result result;
+         result.story = game.story;
+
+         if (!runGame(path, commands, result)) return 1;
+
+         printResult(result);
+
+         instructions += result.instructions * runs();
+         characters   += result.characters * runs();
+         seconds      += result.seconds;
+
+         results.push_back(result);
+      }
+
+      printf("%-38s %5s %11.0f %10.0f\n", "Total", "",
+             perSecond(instructions, seconds),
+             perSecond(characters, seconds));
+
+      return writeResults(results, instructions, characters, seconds) ? 0 : 1;
+   }
+
+public:
+   ZifBench()
+      : ConsoleApp(PROGRAM, DESCRIPTION, LINK, AUTHOR, VERSION, COPYRIGHT_YEAR)
+   {
+   }
+};
+
+
+int main(int argc, const char* argv[])
+{
+   ZifBench app;
+   return app.parseArgsAndStart(argc, argv);
+}
@@ -0,0 +1,248 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "common/Coverage.h"
+#include "common/Memory.h"
+#include "common/Symbols.h"
+
+#include "Z/CodeMap.h"
+#include "Z/Story.h"
+#include "Z/Text.h"
+
+#include "STB/ConsoleApp.h"
+
+#define  PROGRAM         "zif-cover"
+#define  DESCRIPTION     "Merge the coverage files of Z story runs and report what was exercised"
+#define  LINK            "https://github.com/AnotherJohnH/Zif"
+#define  AUTHOR          "John D. Haughton"
+#define  VERSION         PROJ_VERSION
+#define  COPYRIGHT_YEAR  "2019"
+
+//!
+class ZifCover : public STB::ConsoleApp
+{
+private:
+   STB::Option<const char*> output{      'o', "output",  "Write the merged coverage to a file", ""};
+   STB::Option<const char*> symbols_file{0,   "symbols", "Routine names, a hex address and name per line", ""};
+   STB::Option<bool>        strings{     's', "strings", "List each string and whether it was printed"};
+   STB::Option<bool>        missed{      'm', "missed",  "Only list the routines and strings not fully covered"};
+
+   std::vector<std::string> args;
+
+   Z::Story     story;
+   IF::Memory   memory;
+   IF::Coverage coverage;
+   IF::Symbols  symbols;
+
+   static double percent(uint32_t part, uint32_t whole)
+   {
+      return whole == 0 ? 100.0 : 100.0 * part / whole;
+   }
+
+   //! Merge the coverage files into one for the story
+   bool merge(const std::vector<std::string>& paths)
+   {
+      std::string identity = story.getIdentity();
+
+      coverage.resize(memory.size());
+
+      for(const auto& path : paths)
+      {
+         IF::Coverage run;
+         std::string  run_identity;
+
+         if (!run.read(path, run_identity))
+         {
+            fprintf(stderr, "ERR - failed to read coverage file \"%s\"\n", path.c_str());
+            return false;
+         }
+
+         if ((run_identity != identity) || !coverage.merge(run))
+         {
+            fprintf(stderr, "ERR - \"%s\" is the coverage of story %s not %s\n",
+                    path.c_str(), run_identity.c_str(), identity.c_str());
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+   void reportRoutines(Z::CodeMap& map)
+   {
+      // Routines that were called but not found by the scan of high memory
+      for(uint32_t addr = 0; addr < coverage.getSize(); addr++)
+      {
+         if (coverage.isRoutine(addr) && !map.addRoutine(addr))
+         {
+            fprintf(stderr, "WRN - no routine found at called address %06X\n", addr);
+         }
+      }
+
+      uint32_t total_instr      = 0;
+      uint32_t covered_instr    = 0;
+      uint32_t covered_routines = 0;
+
+      printf("Routine     Instr  Covered       %%  Name\n");
+
+      for(const auto& routine : map.getRoutines())
+      {
+         uint32_t instr   = 0;
+         uint32_t covered = 0;
+
+         map.forEachInstruction(routine,
+                                [&](uint32_t addr)
+                                {
+                                   instr++;
+                                   if (coverage.isCode(addr)) covered++;
+                                });
+
+         total_instr   += instr;
+         covered_instr += covered;
+         if (covered != 0) covered_routines++;
+
+         if (!missed || (covered != instr))
+         {
+            printf("%06X   %8u %8u  %5.1f%%  %s\n", routine.addr, instr, covered,
+                   percent(covered, instr), symbols.getName(routine.addr).c_str());
+         }
+      }
+
+      printf("\nRoutines     %6u of %6u run       %5.1f%%\n",
+             covered_routines, unsigned(map.getRoutines().size()),
+             percent(covered_routines, map.getRoutines().size()));
+      printf("Instructions %6u of %6u run       %5.1f%%\n",
+             covered_instr, total_instr, percent(covered_instr, total_instr));
+   }
+
+   void reportStrings(const Z::CodeMap& map)
+   {
+      Z::Text  text((const Z::Header*)memory.data(), memory);
+      uint32_t printed = 0;
+
+      if (strings) printf("\nString   Printed  Text\n");
+
+      for(const auto& string : map.getStrings())
+      {
+         bool is_read = coverage.isRead(string.addr);
+         if (is_read) printed++;
+
+         if (strings && (!missed || !is_read))
+         {
+            std::string line;
+            (void) text.print([&](uint16_t ch)
+                              {
+                                 if (ch == '\n')
+                                    line += "\\n";
+                                 else if ((ch >= ' ') && (ch < 0x7F))
+                                    line += char(ch);
+                              },
+                              string.addr);
+
+            printf("%06X   %-7s  \"%s\"\n", string.addr, is_read ? "yes" : "no", line.c_str());
+         }
+      }
+
+      if (strings) printf("\n");
+
+      printf("Strings      %6u of %6u printed   %5.1f%%\n",
+             printed, unsigned(map.getStrings().size()),
+             percent(printed, map.getStrings().size()));
+   }
+
+   //! Bytes of dynamic and static memory read and written
+   void reportData()
+   {
+      const Z::Header* header = (const Z::Header*)memory.data();
+
+      uint32_t dynamic_read  = 0;
+      uint32_t dynamic_write = 0;
+      uint32_t static_read   = 0;
+
+      for(uint32_t addr = sizeof(Z::Header); addr < header->stat; addr++)
+      {
+         if (coverage.isRead(addr))    dynamic_read++;
+         if (coverage.isWritten(addr)) dynamic_write++;
+      }
+
+      for(uint32_t addr = header->stat; addr < header->himem; addr++)
+      {
+         if (coverage.isRead(addr)) static_read++;
+      }
+
+      uint32_t dynamic_size = header->stat - sizeof(Z::Header);
+      uint32_t static_size  = header->himem - header->stat;
+
+      printf("Dynamic data %6u of %6u read      %5.1f%%\n",
+             dynamic_read, dynamic_size, percent(dynamic_read, dynamic_size));
+      printf("             %6u of %6u written   %5.1f%%\n",
+             dynamic_write, dynamic_size, percent(dynamic_write, dynamic_size));
+      printf("Static data  %6u of %6u read      %5.1f%%\n",
+             static_read, static_size, percent(static_read, static_size));
+   }
+
+   virtual int startConsoleApp() override
+   {
+      if (args.size() < 2)
+      {
+         fprintf(stderr, "ERR - expected a story and one or more coverage files\n");
+         return 1;
+      }
+
+      if (!story.load(args[0]) || !story.isValid())
+      {
+         fprintf(stderr, "ERR - failed to load story \"%s\"\n", args[0].c_str());
+         return 1;
+      }
+
+      story.prepareMemory(memory);
+      story.resetMemory(memory);
+
+      if ((strlen(symbols_file) != 0) && !symbols.load((const char*)symbols_file))
+      {
+         fprintf(stderr, "ERR - failed to read symbol file \"%s\"\n", (const char*)symbols_file);
+         return 1;
+      }
+
+      if (!merge(std::vector<std::string>(args.begin() + 1, args.end()))) return 1;
+
+      if ((strlen(output) != 0) && !coverage.write((const char*)output, story.getIdentity()))
+      {
+         fprintf(stderr, "ERR - failed to write \"%s\"\n", (const char*)output);
+         return 1;
+      }
+
+      Z::CodeMap map(memory.data(), story.size());
+
+      reportRoutines(map);
+      reportStrings(map);
+      reportData();
+
+      return 0;
+   }
+
+   virtual void parseArg(const char* arg) override
+   {
+      args.push_back(arg);
+   }
+
+public:
+   ZifCover()
+      : ConsoleApp(PROGRAM, DESCRIPTION, LINK, AUTHOR, VERSION, COPYRIGHT_YEAR)
+   {
+   }
+};
+
+
+int main(int argc, const char* argv[])
+{
+   ZifCover app;
+   return app.parseArgsAndStart(argc, argv);
+}
@@ -0,0 +1,548 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "common/BufferConsole.h"
+#include "common/Options.h"
+#include "common/Quetzal.h"
+
+#include "Z/Analysis.h"
+#include "Z/Object.h"
+#include "Z/Parser.h"
+#include "Z/State.h"
+#include "Z/Story.h"
+#include "Z/Stream.h"
+#include "Z/Text.h"
+
+#include "Glulx/Machine.h"
+
+#include "STB/ConsoleApp.h"
+
+#define  PROGRAM         "zif-micro"
+#define  DESCRIPTION     "Measure the interpreter components on the bundled games"
+#define  LINK            "https://github.com/AnotherJohnH/Zif"
+#define  AUTHOR          "John D. Haughton"
+#define  VERSION         PROJ_VERSION
+#define  COPYRIGHT_YEAR  "2019"
+
+//------------------------------------------------------------------------------
+// Count the memory allocated by everything in this program
+
+static uint64_t alloc_bytes = 0;
+static uint64_t alloc_count = 0;
+
+void* operator new(size_t size)
+{
+   alloc_bytes += size;
+   alloc_count++;
+
+   void* ptr = malloc(size == 0 ? 1 : size);
+   if (ptr == nullptr) throw std::bad_alloc();
+   return ptr;
+}
+
+void* operator new[](size_t size)                    { return operator new(size); }
+void  operator delete(void* ptr) noexcept            { free(ptr); }
+void  operator delete[](void* ptr) noexcept          { free(ptr); }
+void  operator delete(void* ptr, size_t) noexcept    { free(ptr); }
+void  operator delete[](void* ptr, size_t) noexcept  { free(ptr); }
+
+//------------------------------------------------------------------------------
+
+//! A story and the commands used for the parser
+struct Game
+{
+   const char* story;
+   const char* script;
+};
+
+static const Game games[] =
+{
+   {"Infocom/Dungeon.z5",                  "Dungeon.txt"},
+   {"CrowtherAndWoods/Adventure/Advent.z5", "Advent.txt"},
+   {"Phoenix/Doom/CountdownToDoom.z5",     "CountdownToDoom.txt"}
+};
+
+//! Glulx machine with the instruction decode exposed, running on a made up
+//! stream of operands as no Glulx story is bundled
+class GlulxDecoder : public Glulx::Machine
+{
+public:
+   //! Address of the first operand
+   static const uint32_t CODE = 0x100;
+
+   //! Number of instructions in the stream
+   static const unsigned NUM_INST = 64;
+
+   //! Build a story holding the operand stream
+   static std::vector<uint8_t> makeImage()
+   {
+      static const uint8_t modes[] = {0x1, 0x2, 0x3, 0x5, 0x6, 0x7, 0x9, 0xD, 0xE, 0xF};
+
+      std::vector<uint8_t> image(CODE);
+
+      auto put32 = [&image](uint32_t offset, uint32_t value)
+                   {
+                      image[offset + 0] = value >> 24;
+                      image[offset + 1] = value >> 16;
+                      image[offset + 2] = value >> 8;
+                      image[offset + 3] = value;
+                   };
+
+      for(unsigned inst = 0; inst < NUM_INST; inst++)
+      {
+         uint8_t mode[3];
+         for(unsigned i = 0; i < 3; i++)
+         {
+            mode[i] = modes[(inst * 3 + i) % sizeof(modes)];
+         }
+
+         image.push_back(mode[0] | (mode[1] << 4));
+         image.push_back(mode[2]);
+
+         for(unsigned i = 0; i < 3; i++)
+         {
+            // Constants, memory addresses and local offsets that are all
+            // in range
+            uint32_t value = mode[i] == 0x9 ? (inst % 16) * 4
+                                            : (inst * 37 + i * 11) % 0xF0;
+
+            switch(mode[i] & 0b11)
+            {
+            case 1: image.push_back(value); break;
+            case 2: image.push_back(value >> 8); image.push_back(value); break;
+            case 3: image.resize(image.size() + 4); put32(image.size() - 4, value); break;
+            }
+         }
+      }
+
+      image.resize((image.size() + 0xFF) & ~0xFF);
+
+      image[0] = 'G'; image[1] = 'l'; image[2] = 'u'; image[3] = 'l';
+      put32(4,  0x00030102);     // version
+      put32(8,  CODE);           // RAM start
+      put32(12, image.size());   // extension start
+      put32(16, image.size());   // end of memory
+      put32(20, 0x400);          // stack size
+      put32(24, CODE);           // start function
+
+      return image;
+   }
+
+   GlulxDecoder(Console& console_, const Options& options_, const Glulx::Story& story_)
+      : Glulx::Machine(console_, options_, story_)
+   {
+      state.reset();
+
+      // Locals for the local variable address modes
+      for(unsigned i = 0; i < 16; i++)
+      {
+         state.stack.push32(i);
+      }
+   }
+
+   //! Decode and load the operands of every instruction in the stream
+   uint32_t decode()
+   {
+      uint32_t sum = 0;
+
+      state.jump(CODE);
+
+      for(unsigned inst = 0; inst < NUM_INST; inst++)
+      {
+         fetchA(3);
+         sum += uLd(0) ^ uLd(1) ^ uLd(2);
+      }
+
+      return sum;
+   }
+};
+
+//!
+class ZifMicro : public STB::ConsoleApp
+{
+private:
+   STB::Option<const char*> games_dir{  'g', "games",    "Directory holding the bundled games", "Games"};
+   STB::Option<const char*> scripts_dir{'c', "scripts",  "Directory holding the benchmark scripts", "Bench"};
+   STB::Option<const char*> filter{     'f', "filter",   "Only run benchmarks with names containing this", ""};
+   STB::Option<const char*> output{     'o', "output",   "Machine readable result file", ""};
+   STB::Option<unsigned>    min_time{   't', "time",     "Minimum time for each benchmark (ms)", 250};
+   STB::Option<const char*> save_dir{   'd', "save-dir", "Directory for cache files", "Saves"};
+
+   using Clock = std::chrono::steady_clock;
+
+   struct Result
+   {
+      std::string name;
+      std::string subject;
+      uint64_t    ops;
+      double      ns_per_op;
+      double      bytes_per_op;
+      double      allocs_per_op;
+   };
+
+   std::vector<Result> results;
+   uint32_t            checksum{0};   //!< Keeps results that are otherwise unused
+
+   //! Time repeated passes of a benchmark, each pass returns the number of
+   //! operations it performed
+   template <typename PASS>
+   void measure(const char* name, const std::string& subject, PASS pass)
+   {
+      if (strstr(name, filter) == nullptr) return;
+
+      // Warm up caches and any lazily allocated buffers
+      (void) pass();
+
+      uint64_t ops         = 0;
+      uint64_t start_bytes = alloc_bytes;
+      uint64_t start_count = alloc_count;
+      double   seconds     = 0.0;
+
+      Clock::time_point start = Clock::now();
+
+      do
+      {
+         ops += pass();
+         seconds = std::chrono::duration<double>(Clock::now() - start).count();
+      }
+      while((seconds * 1000) < min_time);
+
+      Result result;
+      result.name          = name;
+      result.subject       = subject;
+      result.ops           = ops;
+      result.ns_per_op     = ops == 0 ? 0.0 : seconds * 1e9 / ops;
+      result.bytes_per_op  = ops == 0 ? 0.0 : double(alloc_bytes - start_bytes) / ops;
+      result.allocs_per_op = ops == 0 ? 0.0 : double(alloc_count - start_count) / ops;
+
+      printf("%-24s %-22s %10.1f %10.1f %9.2f\n",
+             result.name.c_str(), result.subject.c_str(),
+             result.ns_per_op, result.bytes_per_op, result.allocs_per_op);
+
+      results.push_back(result);
+   }
+
+   bool readScript(const std::string& path, std::vector<std::string>& commands)
+   {
+      FILE* fp = fopen(path.c_str(), "r");
+      if (fp == nullptr)
+      {
+         fprintf(stderr, "ERR - failed to open \"%s\"\n", path.c_str());
+         return false;
+      }
+
+      char line[256];
+      while(fgets(line, sizeof(line), fp) != nullptr)
+      {
+         std::string command;
+         for(const char* s = line; (*s != '\0') && (*s != '\n') && (*s != '\r'); s++)
+         {
+            command += char(tolower(*s));
+         }
+         if (!command.empty()) commands.push_back(command);
+      }
+
+      fclose(fp);
+      return true;
+   }
+
+   bool benchStory(const Game& game)
+   {
+      std::string path = std::string(games_dir) + "/" + game.story;
+      std::string name = strrchr(game.story, '/') + 1;
+
+      std::vector<std::string> commands;
+      if (!readScript(std::string(scripts_dir) + "/" + game.script, commands)) return false;
+
+      Z::Story story;
+      if (!story.load(path))
+      {
+         fprintf(stderr, "ERR - %s\n", story.getLastError().c_str());
+         return false;
+      }
+
+      Z::State state(story, (const char*)save_dir, /* undo */ 4, /* seed */ 1);
+      state.reset();
+
+      IF::Memory&      memory = state.memory;
+      const Z::Header* header = (const Z::Header*)((const IF::Memory&)memory).data();
+
+      Z::Object object(memory);
+      object.init(header->obj, header->version);
+
+      // Objects are followed by the first property table
+      uint32_t first_obj  = header->obj + (header->version <= 3 ? 31 * 2 : 63 * 2);
+      unsigned obj_size   = header->version <= 3 ? 9 : 14;
+      unsigned num_object = (object.getPropTableAddress(1) - first_obj) / obj_size;
+
+      // Encoded strings of the story, the dictionary words and object names
+      std::vector<uint32_t> strings;
+      {
+         uint32_t dict         = header->dict;
+         uint8_t  num_sep      = memory.read8(dict);
+         uint8_t  entry_length = memory.read8(dict + 1 + num_sep);
+         int16_t  num_entry    = memory.read16(dict + 2 + num_sep);
+         uint32_t first        = dict + 4 + num_sep;
+
+         for(int i = 0; i < (num_entry < 0 ? -num_entry : num_entry); i++)
+         {
+            strings.push_back(first + i * entry_length);
+         }
+
+         for(unsigned obj = 1; obj <= num_object; obj++)
+         {
+            if (memory.read8(object.getPropTableAddress(obj)) != 0)
+            {
+               strings.push_back(object.getName(obj));
+            }
+         }
+      }
+
+      Z::Text text(header, memory);
+
+      std::vector<uint16_t> zscii;
+      Z::Text::Writer       sink = [&zscii](uint16_t ch){ zscii.push_back(ch); };
+
+      measure("text.print", name,
+              [&]()
+              {
+                 zscii.clear();
+                 for(uint32_t addr : strings)
+                 {
+                    (void) text.print(sink, addr);
+                 }
+                 return strings.size();
+              });
+
+      // Parse buffers at the top of dynamic memory
+      uint32_t in  = header->stat - 0x200;
+      uint32_t out = header->stat - 0x100;
+
+      auto tokenise = [&](Z::Parser& parser)
+                      {
+                         for(const auto& command : commands)
+                         {
+                            memcpy(memory.data() + in, command.c_str(), command.size() + 1);
+                            memory.write8(out, 16);
+                            parser.tokenise(memory, out, in, header->dict, false);
+                         }
+                         return commands.size();
+                      };
+
+      Z::Parser parser(header->version);
+      measure("parser.tokenise", name, [&](){ return tokenise(parser); });
+
+      Z::Analysis analysis;
+      analysis.prepare(story, (const char*)save_dir);
+      parser.setAnalysis(&analysis);
+      measure("parser.tokenise.index", name, [&](){ return tokenise(parser); });
+
+      state.reset();
+
+      measure("object.getProp", name,
+              [&]()
+              {
+                 uint64_t ops = 0;
+                 uint32_t sum = 0;
+                 for(unsigned obj = 1; obj <= num_object; obj++)
+                 {
+                    for(unsigned p = object.getPropNext(obj, 0); p != 0; p = object.getPropNext(obj, p))
+                    {
+                       sum += object.getProp(obj, p);
+                       ops++;
+                    }
+                 }
+                 checksum += sum;
+                 return ops;
+              });
+
+      measure("object.move", name,
+              [&]()
+              {
+                 uint64_t ops = 0;
+                 for(unsigned obj = 1; obj <= num_object; obj++)
+                 {
+                    uint16_t parent = object.getParent(obj);
+                    if (parent != 0)
+                    {
+                       object.remove(obj);
+                       object.insert(obj, parent);
+                       ops++;
+                    }
+                 }
+                 return ops;
+              });
+
+      // Give the save and undo benchmarks changes to encode
+      for(uint32_t addr = 0x40; addr < header->stat; addr += 61)
+      {
+         memory.write8(addr, memory.read8(addr) ^ 0x5A);
+      }
+      for(unsigned i = 0; i < 32; i++)
+      {
+         state.push(i);
+      }
+
+      IF::Quetzal quetzal;
+
+      measure("quetzal.encode", name,
+              [&]()
+              {
+                 quetzal.encode(story, state);
+                 return 1;
+              });
+
+      measure("quetzal.decode", name,
+              [&]()
+              {
+                 if (!quetzal.decode(story, state)) throw "quetzal decode failed";
+                 return 1;
+              });
+
+      measure("undo.save", name,
+              [&]()
+              {
+                 (void) state.saveUndo();
+                 return 1;
+              });
+
+      measure("undo.save+restore", name,
+              [&]()
+              {
+                 (void) state.saveUndo();
+                 if (!state.restoreUndo()) throw "undo restore failed";
+                 return 1;
+              });
+
+      // Word wrap the text of the story
+      std::vector<uint16_t> paragraph;
+      zscii.clear();
+      for(size_t i = 0; i < strings.size(); i++)
+      {
+         (void) text.print(sink, strings[i]);
+         zscii.push_back((i % 16) == 15 ? '\n' : ' ');
+      }
+      paragraph.swap(zscii);
+
+      Options       options;
+      BufferConsole console(24, 80);
+      Z::Stream     stream(console, options, header->version, memory);
+
+      measure("stream.writeChar", name,
+              [&]()
+              {
+                 for(uint16_t ch : paragraph)
+                 {
+                    stream.writeChar(ch);
+                 }
+                 stream.flush();
+                 (void) console.takeText();
+                 return paragraph.size();
+              });
+
+      return true;
+   }
+
+   bool benchGlulx()
+   {
+      std::vector<uint8_t> image = GlulxDecoder::makeImage();
+
+      Glulx::Story story;
+      if (!story.load(image.data(), image.size(), "decode.ulx"))
+      {
+         fprintf(stderr, "ERR - %s\n", story.getLastError().c_str());
+         return false;
+      }
+
+      Options       options;
+      BufferConsole console(24, 80);
+      GlulxDecoder  decoder(console, options, story);
+
+      measure("glulx.fetchA+load", "operands",
+              [&]()
+              {
+                 checksum += decoder.decode();
+                 return GlulxDecoder::NUM_INST;
+              });
+
+      return true;
+   }
+
+   bool writeResults()
+   {
+      FILE* fp = fopen(output, "w");
+      if (fp == nullptr)
+      {
+         fprintf(stderr, "ERR - failed to create \"%s\"\n", (const char*)output);
+         return false;
+      }
+
+      fprintf(fp, "{\n");
+      fprintf(fp, "  \"version\": \"%s\",\n", VERSION);
+      fprintf(fp, "  \"benchmarks\": [\n");
+
+      for(size_t i = 0; i < results.size(); i++)
+      {
+         const Result& result = results[i];
+
+         fprintf(fp, "    {\"name\": \"%s\", \"subject\": \"%s\", \"ops\": %llu, "
+                     "\"ns_per_op\": %.2f, \"bytes_per_op\": %.2f, \"allocs_per_op\": %.3f}%s\n",
+                 result.name.c_str(), result.subject.c_str(), (unsigned long long)result.ops,
+                 result.ns_per_op, result.bytes_per_op, result.allocs_per_op,
+                 i == (results.size() - 1) ? "" : ",");
+      }
+
+      fprintf(fp, "  ]\n");
+      fprintf(fp, "}\n");
+
+      return fclose(fp) == 0;
+   }
+
+   virtual int startConsoleApp() override
+   {
+      printf("%-24s %-22s %10s %10s %9s\n",
+             "Benchmark", "Subject", "ns/op", "bytes/op", "allocs/op");
+
+      try
+      {
+         for(const auto& game : games)
+         {
+            if (!benchStory(game)) return 1;
+         }
+
+         if (!benchGlulx()) return 1;
+      }
+      catch(const char* message)
+      {
+         fprintf(stderr, "ERR - %s\n", message);
+         return 1;
+      }
+
+      if ((strlen(output) != 0) && !writeResults()) return 1;
+
+      return 0;
+   }
+
+public:
+   ZifMicro()
+      : ConsoleApp(PROGRAM, DESCRIPTION, LINK, AUTHOR, VERSION, COPYRIGHT_YEAR)
+   {
+   }
+};
+
+
+int main(int argc, const char* argv[])
+{
+   ZifMicro app;
+   return app.parseArgsAndStart(argc, argv);
+}
@@ -0,0 +1,458 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libzif/Session.h"
+#include "libzif/WorkStealingPool.h"
+
+#include "STB/ConsoleApp.h"
+
+#define  PROGRAM         "zif-regress"
+#define  DESCRIPTION     "Replay input scripts and check the output of each game"
+#define  LINK            "https://github.com/AnotherJohnH/Zif"
+#define  AUTHOR          "John D. Haughton"
+#define  VERSION         PROJ_VERSION
+#define  COPYRIGHT_YEAR  "2019"
+
+//! Compares the output of a game, as it is produced, with a hash or a golden
+//! transcript. Only the current line of output is kept
+class Checker
+{
+public:
+   //! Expect output with the given hash
+   Checker(uint64_t expected_hash_)
+      : expected_hash(expected_hash_)
+   {
+   }
+
+   //! Expect the output in a golden transcript
+   Checker(const std::string& golden_)
+      : golden(golden_)
+      , has_golden(true)
+   {
+   }
+
+   //! Check output produced by the given turn, 0 is the start of the game
+   void write(const std::string& text, unsigned turn)
+   {
+      for(uint8_t ch : text)
+      {
+         hash = (hash ^ ch) * 0x100000001B3;
+
+         if (diverged)
+         {
+            // Complete the line that differs
+            if (!line_complete)
+            {
+               if ((ch == '\n') || (actual_line.size() >= MAX_LINE))
+                  line_complete = true;
+               else
+                  actual_line += char(ch);
+            }
+            continue;
+         }
+
+         if (has_golden && ((pos >= golden.size()) || (uint8_t(golden[pos]) != ch)))
+         {
+            diverge(turn);
+            line_complete = ch == '\n';
+            if (!line_complete) actual_line += char(ch);
+            continue;
+         }
+
+         pos++;
+
+         if (ch == '\n')
+         {
+            line++;
+            line_start = pos;
+            actual_line.clear();
+         }
+         else
+         {
+            actual_line += char(ch);
+         }
+      }
+
+      last_turn = turn;
+   }
+
+   //! Check the end of the output
+   //! \return true if all the output matched
+   bool finish()
+   {
+      if (has_golden)
+      {
+         if (!diverged && (pos != golden.size())) diverge(last_turn);
+         return !diverged;
+      }
+
+      return hash == expected_hash;
+   }
+
+   uint64_t           getHash() const { return hash; }
+   bool               hasGolden() const { return has_golden; }
+   unsigned           getLine() const { return diverge_line; }
+   unsigned           getTurn() const { return diverge_turn; }
+   const std::string& getExpectedLine() const { return expected_line; }
+   const std::string& getActualLine() const { return actual_line; }
+
+private:
+   static const size_t MAX_LINE = 200;
+
+   uint64_t    hash{0xCBF29CE484222325};
+   uint64_t    expected_hash{0};
+   std::string golden;
+   bool        has_golden{false};
+   size_t      pos{0};              //!< Of the next golden character
+   size_t      line_start{0};       //!< Of the current golden line
+   unsigned    line{1};
+   unsigned    last_turn{0};
+   bool        diverged{false};
+   bool        line_complete{false};
+   unsigned    diverge_line{0};
+   unsigned    diverge_turn{0};
+   std::string expected_line;
+   std::string actual_line;         //!< Current line, or the line that differs
+
+   void diverge(unsigned turn)
+   {
+      diverged     = true;
+      diverge_line = line;
+      diverge_turn = turn;
+
+      size_t end = golden.find('\n', line_start);
+      expected_line = golden.substr(line_start,
+                                    std::min(MAX_LINE, (end == std::string::npos ? golden.size() : end) - line_start));
+   }
+};
+
+//! An entry in the manifest
+struct Entry
+{
+   std::string dir;           //!< Of the manifest
+   std::string story;
+   std::string script;
+   uint32_t    seed{0};
+   std::string golden;        //!< Golden transcript, if not empty
+   uint64_t    hash{0};       //!< Otherwise the expected hash
+
+   //! Path of a file named in the manifest
+   std::string path(const std::string& name) const
+   {
+      return name[0] == '/' ? name : dir + name;
+   }
+
+   // Result
+   bool        ok{false};
+   unsigned    turns{0};
+   uint64_t    actual_hash{0};
+   std::string report;
+};
+
+//!
+class ZifRegress : public STB::ConsoleApp
+{
+private:
+   STB::Option<unsigned>    jobs{     'j', "jobs",     "Games run at once (0 for one per CPU)", 0};
+   STB::Option<unsigned>    max_instr{0,   "max-turn-instructions", "Instructions allowed for one input (0 for no limit)", 100000000};
+   STB::Option<bool>        record{   'r', "record",   "Write the golden transcripts and print the manifest with new hashes"};
+   STB::Option<const char*> save_dir{ 'd', "save-dir", "Directory for save and cache files", "Saves"};
+   STB::Option<const char*> coverage{ 'c', "coverage", "Write the coverage of each story to this directory, for zif-cover", ""};
+
+   using Clock = std::chrono::steady_clock;
+
+   std::vector<std::string> manifests;
+   std::vector<Entry>       entries;
+
+   static bool readFile(const std::string& path, std::string& text)
+   {
+      FILE* fp = fopen(path.c_str(), "rb");
+      if (fp == nullptr) return false;
+
+      char   buffer[4096];
+      size_t n;
+      while((n = fread(buffer, 1, sizeof(buffer), fp)) != 0)
+      {
+         text.append(buffer, n);
+      }
+
+      fclose(fp);
+      return true;
+   }
+
+   static bool isHash(const std::string& text)
+   {
+      return (text.size() == 16) && (text.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos);
+   }
+
+   //! Read a manifest, paths in it are relative to its directory
+   bool readManifest(const std::string& path)
+   {
+      FILE* fp = fopen(path.c_str(), "r");
+      if (fp == nullptr)
+      {
+         fprintf(stderr, "ERR - failed to open \"%s\"\n", path.c_str());
+         return false;
+      }
+
+      std::string dir;
+      size_t      slash = path.rfind('/');
+      if (slash != std::string::npos) dir = path.substr(0, slash + 1);
+
+      char     line[1024];
+      unsigned line_no = 0;
+      bool     ok      = true;
+
+      while(fgets(line, sizeof(line), fp) != nullptr)
+      {
+         line_no++;
+
+         char     story[256], script[256], expected[256];
+         unsigned seed;
+         int      n = sscanf(line, "%255s %255s %u %255s", story, script, &seed, expected);
+
+         if ((n <= 0) || (story[0] == '#')) continue;
+
+         if (n != 4)
+         {
+            fprintf(stderr, "ERR - %s:%u expected: story script seed hash|golden-file\n",
+                    path.c_str(), line_no);
+            ok = false;
+            continue;
+         }
+
+         Entry entry;
+         entry.dir    = dir;
+         entry.story  = story;
+         entry.script = script;
+         entry.seed   = seed;
+
+         if (isHash(expected))
+            entry.hash = strtoull(expected, nullptr, 16);
+         else
+            entry.golden = expected;
+
+         entries.push_back(entry);
+      }
+
+      fclose(fp);
+      return ok;
+   }
+
+   //! Play the script of an entry and check the output
+   void run(Entry& entry)
+   {
+      std::string script;
+      if (!readFile(entry.path(entry.script), script))
+      {
+         entry.report = "failed to read script \"" + entry.script + "\"";
+         return;
+      }
+
+      std::string golden;
+      if (!entry.golden.empty() && !record && !readFile(entry.path(entry.golden), golden))
+      {
+         entry.report = "failed to read golden transcript \"" + entry.golden + "\"";
+         return;
+      }
+
+      Zif::Session::Config config;
+      config.seed                  = entry.seed;
+      config.save_dir              = (const char*)save_dir;
+      config.warm_start            = false;
+      config.max_turn_instructions = max_instr;
+      config.coverage              = strlen(coverage) != 0;
+
+      Zif::Session session(config);
+
+      if (!session.loadFile(entry.path(entry.story)))
+      {
+         entry.report = session.getLastError();
+         return;
+      }
+
+      Checker checker = entry.golden.empty() ? Checker(entry.hash) : Checker(golden);
+      std::string transcript;
+
+      auto output = [&](unsigned turn)
+                    {
+                       std::string text = session.takeOutput();
+                       checker.write(text, turn);
+                       if (record && !entry.golden.empty()) transcript += text;
+                    };
+
+      Zif::Session::Status status = session.start();
+      output(0);
+
+      size_t pos = 0;
+
+      while(pos < script.size())
+      {
+         if (status == Zif::Session::NEED_LINE)
+         {
+            size_t end = script.find('\n', pos);
+            if (end == std::string::npos) end = script.size();
+
+            std::string line = script.substr(pos, end - pos);
+            if (!line.empty() && (line.back() == '\r')) line.pop_back();
+
+            status = session.sendCommand(line);
+            pos = end + 1;
+         }
+         else if (status == Zif::Session::NEED_CHAR)
+         {
+            status = session.sendKey(uint8_t(script[pos++]));
+         }
+         else
+         {
+            break;
+         }
+
+         output(++entry.turns);
+      }
+
+      bool matched = checker.finish();
+
+      entry.actual_hash = checker.getHash();
+
+      if (status == Zif::Session::ERROR)
+      {
+         entry.report = "stopped at turn " + std::to_string(entry.turns) + ": " + session.getLastError();
+         return;
+      }
+
+      if (record)
+      {
+         FILE* fp = entry.golden.empty() ? nullptr : fopen(entry.path(entry.golden).c_str(), "wb");
+         if (!entry.golden.empty() &&
+             ((fp == nullptr) || (fwrite(transcript.data(), 1, transcript.size(), fp) != transcript.size())))
+         {
+            entry.report = "failed to write \"" + entry.golden + "\"";
+         }
+         else
+         {
+            entry.ok = true;
+         }
+         if (fp != nullptr) fclose(fp);
+         return;
+      }
+
+      if (matched)
+      {
+         entry.ok = true;
+      }
+      else if (checker.hasGolden())
+      {
+         entry.report = "differs at line " + std::to_string(checker.getLine()) +
+                        ", turn " + std::to_string(checker.getTurn()) +
+                        "\n      expected: \"" + checker.getExpectedLine() + "\"" +
+                        "\n      actual:   \"" + checker.getActualLine() + "\"";
+      }
+      else
+      {
+         char text[64];
+         snprintf(text, sizeof(text), "hash %016llx after %u turns",
+                  (unsigned long long)entry.actual_hash, entry.turns);
+         entry.report = text;
+      }
+   }
+
+   virtual int startConsoleApp() override
+   {
+      if (manifests.empty())
+      {
+         fprintf(stderr, "ERR - no manifest given\n");
+         return 1;
+      }
+
+      for(const auto& manifest : manifests)
+      {
+         if (!readManifest(manifest)) return 1;
+      }
+
+      unsigned threads = jobs;
+      if (threads == 0)
+      {
+         threads = std::thread::hardware_concurrency();
+         if (threads == 0) threads = 1;
+      }
+
+      Clock::time_point start = Clock::now();
+
+      {
+         WorkStealingPool pool(threads);
+
+         for(auto& entry : entries)
+         {
+            Entry* ptr = &entry;
+            pool.queue([this, ptr](unsigned){ run(*ptr); });
+         }
+
+         pool.wait();
+      }
+
+      double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+      if ((strlen(coverage) != 0) && !Zif::Session::writeCoverage((const char*)coverage))
+      {
+         fprintf(stderr, "ERR - failed to write coverage to \"%s\"\n", (const char*)coverage);
+      }
+
+      unsigned failed = 0;
+
+      for(const auto& entry : entries)
+      {
+         if (record)
+         {
+            // A manifest with the new hashes
+            if (entry.golden.empty())
+               printf("%s %s %u %016llx\n", entry.story.c_str(), entry.script.c_str(),
+                      entry.seed, (unsigned long long)entry.actual_hash);
+            else
+               printf("%s %s %u %s\n", entry.story.c_str(), entry.script.c_str(),
+                      entry.seed, entry.golden.c_str());
+         }
+         else
+         {
+            printf("%s %s %s\n", entry.ok ? "PASS" : "FAIL", entry.story.c_str(), entry.script.c_str());
+         }
+
+         if (!entry.ok)
+         {
+            fprintf(record ? stderr : stdout, "      %s\n", entry.report.c_str());
+            failed++;
+         }
+      }
+
+      fprintf(record ? stderr : stdout, "\n%zu run, %u failed in %.1f s\n", entries.size(), failed, seconds);
+
+      return failed == 0 ? 0 : 1;
+   }
+
+   virtual void parseArg(const char* arg) override
+   {
+      manifests.push_back(arg);
+   }
+
+public:
+   ZifRegress()
+      : ConsoleApp(PROGRAM, DESCRIPTION, LINK, AUTHOR, VERSION, COPYRIGHT_YEAR)
+   {
+   }
+};
+
+
+int main(int argc, const char* argv[])
+{
+   ZifRegress app;
+   return app.parseArgsAndStart(argc, argv);
+}
@@ -0,0 +1,352 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+// Example of replication between processes. A primary session runs a story
+// from a script and sends an update after each turn, over a socket pair,
+// to a follower session in a child process. The follower applies each
+// update and checks that its output is the primary's output. After the
+// hand-over turn the follower takes over, running the rest of the script
+// itself, and is still checked against the primary
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libzif/Session.h"
+
+#include "STB/ConsoleApp.h"
+
+#define  PROGRAM         "zif-replica"
+#define  DESCRIPTION     "Keep a follower process in step with a primary game, then hand over to it"
+#define  LINK            "https://github.com/AnotherJohnH/Zif"
+#define  AUTHOR          "John D. Haughton"
+#define  VERSION         PROJ_VERSION
+#define  COPYRIGHT_YEAR  "2019"
+
+//! Frames sent from the primary to the follower, each a type (8-bit),
+//! a length (32-bit, big-endian) and the payload
+class Link
+{
+public:
+   enum Type : uint8_t
+   {
+      UPDATE = 'U',   //!< An update from Session::takeUpdate()
+      LINE   = 'L',   //!< Input for the follower to run itself
+      OUTPUT = 'O',   //!< Output of the primary for the turn
+      END    = 'E'    //!< No more turns
+   };
+
+   Link(int fd_)
+      : fd(fd_)
+   {
+   }
+
+   ~Link()
+   {
+      close(fd);
+   }
+
+   bool send(Type type, const void* data, size_t size)
+   {
+      uint8_t header[5] = {type,
+                           uint8_t(size >> 24), uint8_t(size >> 16),
+                           uint8_t(size >> 8),  uint8_t(size)};
+
+      return writeAll(header, sizeof(header)) && writeAll(data, size);
+   }
+
+   bool send(Type type, const std::string& text = "")
+   {
+      return send(type, text.data(), text.size());
+   }
+
+   bool receive(Type& type, std::vector<uint8_t>& payload)
+   {
+      uint8_t header[5];
+      if (!readAll(header, sizeof(header))) return false;
+
+      uint32_t size = (header[1] << 24) | (header[2] << 16) | (header[3] << 8) | header[4];
+      if (size > MAX_FRAME_SIZE) return false;
+
+      type = Type(header[0]);
+      payload.resize(size);
+      return readAll(payload.data(), size);
+   }
+
+private:
+   static const uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+   int fd;
+
+   bool writeAll(const void* data, size_t size)
+   {
+      const uint8_t* ptr = (const uint8_t*)data;
+
+      while(size != 0)
+      {
+         ssize_t n = write(fd, ptr, size);
+         if (n <= 0) return false;
+         ptr  += n;
+         size -= n;
+      }
+
+      return true;
+   }
+
+   bool readAll(void* data, size_t size)
+   {
+      uint8_t* ptr = (uint8_t*)data;
+
+      while(size != 0)
+      {
+         ssize_t n = read(fd, ptr, size);
+         if (n <= 0) return false;
+         ptr  += n;
+         size -= n;
+      }
+
+      return true;
+   }
+};
+
+//!
+class ZifReplica : public STB::ConsoleApp
+{
+private:
+   STB::Option<unsigned>    handover{'H', "handover", "The follower takes over after this many commands (0 for never)", 0};
+   STB::Option<unsigned>    seed{    'S', "seed",     "Initial random number seed", 1};
+   STB::Option<const char*> save_dir{'d', "save-dir", "Directory for save and cache files", "Saves"};
+
+   std::vector<std::string> args;
+
+   static bool isWaiting(Zif::Session::Status status)
+   {
+      return (status == Zif::Session::NEED_LINE) || (status == Zif::Session::NEED_CHAR);
+   }
+
+   static Zif::Session::Status sendInput(Zif::Session& session, const std::string& input)
+   {
+      if (session.getStatus() == Zif::Session::NEED_CHAR)
+         return session.sendKey(input.empty() ? '\n' : input[0]);
+
+      return session.sendCommand(input);
+   }
+
+   bool readScript(const std::string& path, std::vector<std::string>& commands)
+   {
+      FILE* fp = fopen(path.c_str(), "r");
+      if (fp == nullptr)
+      {
+         fprintf(stderr, "ERR - failed to open \"%s\"\n", path.c_str());
+         return false;
+      }
+
+      char line[256];
+      while(fgets(line, sizeof(line), fp) != nullptr)
+      {
+         std::string command = line;
+         while(!command.empty() && ((command.back() == '\n') || (command.back() == '\r')))
+         {
+            command.pop_back();
+         }
+         commands.push_back(command);
+      }
+
+      fclose(fp);
+      return true;
+   }
+
+   Zif::Session::Config getConfig(const char* dir) const
+   {
+      Zif::Session::Config config;
+      config.seed      = seed;
+      config.save_dir  = std::string(save_dir) + dir;
+      config.replicate = true;
+      return config;
+   }
+
+   //! Run the game and send the follower what it needs to keep in step
+   bool runPrimary(Link& link, const std::string& path, const std::vector<std::string>& commands)
+   {
+      Zif::Session session(getConfig("/primary"));
+
+      if (!session.loadFile(path))
+      {
+         fprintf(stderr, "ERR - %s\n", session.getLastError().c_str());
+         return false;
+      }
+
+      Zif::Session::Status status = session.start();
+      unsigned             turn   = 0;
+
+      while(true)
+      {
+         bool leading = (handover == 0) || (turn <= handover);
+
+         if (leading)
+         {
+            std::vector<uint8_t> update;
+
+            if (!session.takeUpdate(update))
+            {
+               fprintf(stderr, "ERR - %s\n", session.getLastError().c_str());
+               return false;
+            }
+
+            if (!link.send(Link::UPDATE, update.data(), update.size())) return false;
+         }
+
+         if (!link.send(Link::OUTPUT, session.takeOutput())) return false;
+
+         if (!isWaiting(status) || (turn == commands.size())) break;
+
+         const std::string& command = commands[turn++];
+
+         // Once handed over the follower runs the game, the primary only
+         // runs it to check the follower
+         if ((handover != 0) && (turn > handover))
+         {
+            if (!link.send(Link::LINE, command)) return false;
+         }
+
+         status = sendInput(session, command);
+      }
+
+      printf("%u turns, %s\n", turn,
+             handover == 0 ? "no hand-over" : ("hand-over after turn " + std::to_string(handover)).c_str());
+
+      return link.send(Link::END);
+   }
+
+   //! Follow the primary, or run the game once handed over, and check the
+   //! output is the same as the primary's
+   bool runFollower(Link& link, const std::string& path)
+   {
+      Zif::Session session(getConfig("/follower"));
+
+      if (!session.loadFile(path))
+      {
+         fprintf(stderr, "ERR - %s\n", session.getLastError().c_str());
+         return false;
+      }
+
+      unsigned             turn = 0;
+      Link::Type           type;
+      std::vector<uint8_t> payload;
+
+      while(link.receive(type, payload))
+      {
+         switch(type)
+         {
+         case Link::UPDATE:
+            if (!session.applyUpdate(payload))
+            {
+               fprintf(stderr, "ERR - follower: %s\n", session.getLastError().c_str());
+               return false;
+            }
+            break;
+
+         case Link::LINE:
+            (void) sendInput(session, std::string(payload.begin(), payload.end()));
+            break;
+
+         case Link::OUTPUT:
+            if (session.takeOutput() != std::string(payload.begin(), payload.end()))
+            {
+               fprintf(stderr, "ERR - follower output differs from the primary at turn %u\n", turn);
+               return false;
+            }
+            turn++;
+            break;
+
+         case Link::END:
+            return true;
+
+         default:
+            fprintf(stderr, "ERR - follower: unexpected frame\n");
+            return false;
+         }
+      }
+
+      fprintf(stderr, "ERR - follower: lost the primary\n");
+      return false;
+   }
+
+   virtual int startConsoleApp() override
+   {
+      if (args.size() != 2)
+      {
+         fprintf(stderr, "ERR - expected a story and a script of commands\n");
+         return 1;
+      }
+
+      std::vector<std::string> commands;
+      if (!readScript(args[1], commands)) return 1;
+
+      int fds[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+      {
+         fprintf(stderr, "ERR - failed to create a socket pair\n");
+         return 1;
+      }
+
+      fflush(stdout);
+
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+         fprintf(stderr, "ERR - failed to start the follower\n");
+         return 1;
+      }
+
+      if (pid == 0)
+      {
+         close(fds[0]);
+         Link link(fds[1]);
+         _exit(runFollower(link, args[0]) ? 0 : 1);
+      }
+
+      close(fds[1]);
+
+      bool ok;
+      {
+         Link link(fds[0]);
+         ok = runPrimary(link, args[0], commands);
+      }
+
+      int wstatus;
+      if ((waitpid(pid, &wstatus, 0) != pid) ||
+          !WIFEXITED(wstatus) || (WEXITSTATUS(wstatus) != 0))
+      {
+         ok = false;
+      }
+
+      printf("%s\n", ok ? "PASS" : "FAIL");
+      return ok ? 0 : 1;
+   }
+
+   virtual void parseArg(const char* arg) override
+   {
+      args.push_back(arg);
+   }
+
+public:
+   ZifReplica()
+      : ConsoleApp(PROGRAM, DESCRIPTION, LINK, AUTHOR, VERSION, COPYRIGHT_YEAR)
+   {
+   }
+};
+
+
+int main(int argc, const char* argv[])
+{
+   ZifReplica app;
+   return app.parseArgsAndStart(argc, argv);
+}
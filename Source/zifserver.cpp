@@ -0,0 +1,110 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include <csignal>
+#include <cstdio>
+#include <thread>
+
+#include "server/Server.h"
+
+#include "STB/ConsoleApp.h"
+
+#define  PROGRAM         "zif-server"
+#define  DESCRIPTION     "Host many interactive fiction sessions in one process"
+#define  LINK            "https://github.com/AnotherJohnH/Zif"
+#define  AUTHOR          "John D. Haughton"
+#define  VERSION         PROJ_VERSION
+#define  COPYRIGHT_YEAR  "2019"
+
+static Server* server = nullptr;
+
+static void stopServer(int)
+{
+   if (server != nullptr) server->stop();
+}
+
+//!
+class ZifServer : public STB::ConsoleApp
+{
+private:
+   STB::Option<const char*> socket_path{'s', "socket",   "Unix domain socket path", "zif.sock"};
+   STB::Option<const char*> story_dir{  'g', "games",    "Directory of the stories that clients may start", "Games"};
+   STB::Option<unsigned>    workers{    'w', "workers",  "Number of worker threads (0 for one per CPU)", 0};
+   STB::Option<const char*> save_dir{   'd', "save-dir", "Directory for save and cache files", "Saves"};
+   STB::Option<unsigned>    seed{       'S', "seed",     "Initial random number seed", 0};
+   STB::Option<unsigned>    undo{       'u', "undo",     "Number of undo buffers per session", 4};
+   STB::Option<unsigned>    hibernate{  'H', "hibernate", "Seconds idle before a session is moved to disk (0 for never)", 300};
+   STB::Option<unsigned>    share{      0,   "share",    "Seconds between sharing identical memory pages between sessions (0 for never)", 60};
+   STB::Option<unsigned>    slice{      0,   "slice",    "Instructions run before a session gives up its worker", 100000};
+   STB::Option<unsigned>    max_instr{  0,   "max-turn-instructions", "Instructions allowed for one input (0 for no limit)", 100000000};
+   STB::Option<unsigned>    max_output{ 0,   "max-turn-output", "Characters of output allowed for one input (0 for no limit)", 1000000};
+   STB::Option<unsigned>    max_undo{   0,   "max-undo", "Undo memory allowed per session, bytes (0 for no limit)", 4000000};
+   STB::Option<unsigned>    max_save{   0,   "max-save", "Largest save file allowed, bytes (0 for no limit)", 1000000};
+   STB::Option<unsigned>    speculate{  0,   "speculate", "Recent commands run ahead while a session waits for input (0 for none)", 0};
+   STB::Option<unsigned>    sample{     0,   "sample",   "Sample running games N times a second, to \"sample.log\" at exit (0 for off)", 0};
+   STB::Option<bool>        stats{      0,   "stats",    "Count instruction forms and turn figures for METRICS requests"};
+
+   virtual int startConsoleApp() override
+   {
+      Server::Config config;
+      config.socket_path     = (const char*)socket_path;
+      config.story_dir       = (const char*)story_dir;
+      config.workers         = workers;
+      config.slice           = slice == 0 ? 1 : unsigned(slice);
+      config.hibernate_after = hibernate;
+      config.share_period    = share;
+
+      if (config.workers == 0)
+      {
+         config.workers = std::thread::hardware_concurrency();
+         if (config.workers == 0) config.workers = 1;
+      }
+
+      config.session.save_dir = (const char*)save_dir;
+      config.session.seed     = seed;
+      config.session.undo     = undo;
+
+      config.session.max_turn_instructions = max_instr;
+      config.session.max_turn_output       = max_output;
+      config.session.max_undo_bytes        = max_undo;
+      config.session.max_save_bytes        = max_save;
+      config.session.speculate             = speculate;
+      config.session.sample                = sample;
+      config.session.stats                 = stats;
+
+      Server instance(config);
+      if (!instance.open()) return 1;
+
+      server = &instance;
+      signal(SIGINT,  stopServer);
+      signal(SIGTERM, stopServer);
+
+      int status = instance.run();
+
+      signal(SIGINT,  SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      server = nullptr;
+
+      if ((sample != 0) && !Zif::Session::writeSamples("sample.log", "sample.folded"))
+      {
+         fprintf(stderr, "ERR - failed to write \"sample.log\"\n");
+      }
+
+      return status;
+   }
+
+public:
+   ZifServer()
+      : ConsoleApp(PROGRAM, DESCRIPTION, LINK, AUTHOR, VERSION, COPYRIGHT_YEAR)
+   {
+   }
+};
+
+
+int main(int argc, const char* argv[])
+{
+   ZifServer app;
+   return app.parseArgsAndStart(argc, argv);
+}
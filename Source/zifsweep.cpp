@@ -0,0 +1,437 @@
+//-------------------------------------------------------------------------------
+// Copyright (c) 2019 John D. Haughton
+// SPDX-License-Identifier: MIT
+//-------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "libzif/Session.h"
+
+#include "STB/ConsoleApp.h"
+
+#define  PROGRAM         "zif-sweep"
+#define  DESCRIPTION     "Start every story in a directory and report how it went"
+#define  LINK            "https://github.com/AnotherJohnH/Zif"
+#define  AUTHOR          "John D. Haughton"
+#define  VERSION         PROJ_VERSION
+#define  COPYRIGHT_YEAR  "2019"
+
+//! How far a story got
+enum Outcome
+{
+   OK,        //!< Waiting for input
+   FINISHED,  //!< Finished before asking for input
+   LOAD,      //!< Not a story that can be loaded
+   FAULT,     //!< Stopped with an error
+   HANG,      //!< Instruction limit reached before the first input
+   TIMEOUT,   //!< Time limit reached before the first input
+   CRASH,     //!< The interpreter itself failed
+   NUM_OUTCOME
+};
+
+static const char* outcome_name[NUM_OUTCOME] =
+{
+   "OK", "FINISHED", "LOAD", "FAULT", "HANG", "TIMEOUT", "CRASH"
+};
+
+//! Start-up of one story
+struct Result
+{
+   std::string path;
+   Outcome     outcome{CRASH};
+   unsigned    start_us{0};       //!< Time to load and run to the first input
+   uint64_t    instructions{0};   //!< Instructions executed before the first input
+   long        peak_rss_kib{0};   //!< Peak resident set size of the process running it
+   std::string message;           //!< Fault or reason for failure
+};
+
+//!
+class ZifSweep : public STB::ConsoleApp
+{
+private:
+   STB::Option<unsigned>    jobs{     'j', "jobs",     "Stories started at once (0 for one per CPU)", 0};
+   STB::Option<unsigned>    max_instr{0,   "max-instructions", "Instructions allowed before the first input", 100000000};
+   STB::Option<unsigned>    timeout{  't', "timeout",  "Seconds allowed before the first input", 10};
+   STB::Option<const char*> output{   'o', "output",   "Machine readable result file", ""};
+   STB::Option<const char*> save_dir{ 'd', "save-dir", "Directory for cache files", "Saves"};
+
+   using Clock = std::chrono::steady_clock;
+
+   std::vector<std::string> dirs;
+
+   //! A story being started in a child process
+   struct Child
+   {
+      size_t index;   //!< Into the results
+      int    fd;      //!< Read end of the pipe for the outcome
+   };
+
+   static bool isStory(const std::string& name)
+   {
+      size_t dot = name.rfind('.');
+      if ((dot == std::string::npos) || ((dot + 3) != name.size())) return false;
+
+      char type    = tolower(name[dot + 1]);
+      char version = name[dot + 2];
+      return (type == 'z') && (version >= '1') && (version <= '8');
+   }
+
+   //! Find the stories in a directory and its sub-directories
+   static void findStories(const std::string& dir, std::vector<std::string>& paths)
+   {
+      DIR* handle = opendir(dir.c_str());
+      if (handle == nullptr) return;
+
+      while(struct dirent* entry = readdir(handle))
+      {
+         if (entry->d_name[0] == '.') continue;
+
+         std::string path = dir + "/" + entry->d_name;
+
+         struct stat info;
+         if (stat(path.c_str(), &info) != 0) continue;
+
+         if (S_ISDIR(info.st_mode))
+         {
+            findStories(path, paths);
+         }
+         else if (S_ISREG(info.st_mode) && isStory(entry->d_name))
+         {
+            paths.push_back(path);
+         }
+      }
+
+      closedir(handle);
+   }
+
+   //! Run a story to its first input in this (child) process and write the
+   //! outcome as a line of tab separated fields
+   void startStory(const std::string& path, int fd)
+   {
+      alarm(timeout);
+
+      Zif::Session::Config config;
+      config.seed                  = 1;
+      config.undo                  = 1;
+      config.save_dir              = (const char*)save_dir;
+      config.warm_start            = false;
+      config.max_turn_instructions = max_instr;
+
+      Clock::time_point start = Clock::now();
+
+      Zif::Session         session(config);
+      Zif::Session::Status status = Zif::Session::ERROR;
+      Outcome              outcome = LOAD;
+
+      if (session.loadFile(path))
+      {
+         status = session.start();
+
+         switch(status)
+         {
+         case Zif::Session::NEED_LINE:
+         case Zif::Session::NEED_CHAR: outcome = OK;       break;
+         case Zif::Session::QUIT:      outcome = FINISHED; break;
+         default:
+            outcome = (config.max_turn_instructions != 0) &&
+                      (session.getUsage().instructions >= config.max_turn_instructions) ? HANG : FAULT;
+            break;
+         }
+      }
+
+      unsigned us = unsigned(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+
+      std::string message = session.getLastError();
+      std::replace(message.begin(), message.end(), '\t', ' ');
+      std::replace(message.begin(), message.end(), '\n', ' ');
+
+      char line[512];
+      int  size = snprintf(line, sizeof(line), "%u\t%u\t%llu\t%.400s\n",
+                           unsigned(outcome), us,
+                           (unsigned long long)session.getUsage().instructions,
+                           message.c_str());
+
+      (void) write(fd, line, std::min(size, int(sizeof(line) - 1)));
+   }
+
+   //! Read the outcome written by startStory()
+   static bool readOutcome(int fd, Result& result)
+   {
+      char   line[512];
+      size_t size = 0;
+
+      while(size < (sizeof(line) - 1))
+      {
+         ssize_t n = read(fd, line + size, sizeof(line) - 1 - size);
+         if (n <= 0) break;
+         size += n;
+      }
+      line[size] = '\0';
+
+      unsigned           outcome;
+      unsigned long long instructions;
+      int                message_start = 0;
+
+      if (sscanf(line, "%u\t%u\t%llu\t%n", &outcome, &result.start_us, &instructions, &message_start) < 3)
+      {
+         return false;
+      }
+
+      result.outcome      = outcome < NUM_OUTCOME ? Outcome(outcome) : CRASH;
+      result.instructions = instructions;
+      result.message      = line + message_start;
+
+      if (!result.message.empty() && (result.message.back() == '\n')) result.message.pop_back();
+
+      return true;
+   }
+
+   //! Start a story in a child process
+   bool launch(std::map<pid_t,Child>& children, size_t index, const std::string& path)
+   {
+      int fds[2];
+      if (pipe(fds) != 0) return false;
+
+      fflush(stdout);
+
+      pid_t pid = fork();
+      if (pid < 0)
+      {
+         close(fds[0]);
+         close(fds[1]);
+         return false;
+      }
+
+      if (pid == 0)
+      {
+         close(fds[0]);
+         startStory(path, fds[1]);
+         _exit(0);
+      }
+
+      close(fds[1]);
+      children[pid] = Child{index, fds[0]};
+      return true;
+   }
+
+   //! Wait for a child process to finish and record its result
+   bool reap(std::map<pid_t,Child>& children, std::vector<Result>& results)
+   {
+      int           wstatus;
+      struct rusage usage;
+
+      pid_t pid = wait4(-1, &wstatus, 0, &usage);
+      if (pid < 0) return false;
+
+      auto it = children.find(pid);
+      if (it == children.end()) return true;
+
+      Result& result = results[it->second.index];
+
+      if (!readOutcome(it->second.fd, result))
+      {
+         if (WIFSIGNALED(wstatus) && (WTERMSIG(wstatus) == SIGALRM))
+         {
+            result.outcome = TIMEOUT;
+            result.message = "Time limit exceeded";
+         }
+         else
+         {
+            result.outcome = CRASH;
+            result.message = WIFSIGNALED(wstatus) ? strsignal(WTERMSIG(wstatus))
+                                                  : "No result";
+         }
+      }
+
+      result.peak_rss_kib = usage.ru_maxrss;
+
+      close(it->second.fd);
+      children.erase(it);
+      return true;
+   }
+
+   //! Value below which the given percentage of the sorted samples fall
+   static unsigned percentile(const std::vector<unsigned>& sorted, unsigned percent)
+   {
+      if (sorted.empty()) return 0;
+
+      size_t rank = (sorted.size() * percent + 99) / 100;
+      return sorted[rank == 0 ? 0 : rank - 1];
+   }
+
+   static void writeString(FILE* fp, const std::string& text)
+   {
+      fputc('"', fp);
+      for(uint8_t ch : text)
+      {
+         if ((ch == '"') || (ch == '\\'))
+            fprintf(fp, "\\%c", ch);
+         else if (ch < ' ')
+            fprintf(fp, "\\u%04x", ch);
+         else
+            fputc(ch, fp);
+      }
+      fputc('"', fp);
+   }
+
+   bool writeResults(const std::vector<Result>& results)
+   {
+      FILE* fp = fopen(output, "w");
+      if (fp == nullptr)
+      {
+         fprintf(stderr, "ERR - failed to create \"%s\"\n", (const char*)output);
+         return false;
+      }
+
+      fprintf(fp, "{\n");
+      fprintf(fp, "  \"version\": \"%s\",\n", VERSION);
+      fprintf(fp, "  \"stories\": [\n");
+
+      for(size_t i = 0; i < results.size(); i++)
+      {
+         const Result& result = results[i];
+
+         fprintf(fp, "    {\"story\": ");
+         writeString(fp, result.path);
+         fprintf(fp, ", \"outcome\": \"%s\", \"start_us\": %u, \"instructions\": %llu, "
+                     "\"peak_rss_kib\": %ld, \"message\": ",
+                 outcome_name[result.outcome], result.start_us,
+                 (unsigned long long)result.instructions, result.peak_rss_kib);
+         writeString(fp, result.message);
+         fprintf(fp, "}%s\n", i == (results.size() - 1) ? "" : ",");
+      }
+
+      fprintf(fp, "  ]\n");
+      fprintf(fp, "}\n");
+
+      return fclose(fp) == 0;
+   }
+
+   void printResults(const std::vector<Result>& results, double seconds)
+   {
+      printf("%-9s %9s %12s %9s  %s\n", "Outcome", "Start ms", "Instructions", "RSS KiB", "Story");
+
+      unsigned              count[NUM_OUTCOME] = {};
+      std::vector<unsigned> start_us;
+
+      for(const auto& result : results)
+      {
+         printf("%-9s %9.1f %12llu %9ld  %s\n",
+                outcome_name[result.outcome], result.start_us / 1000.0,
+                (unsigned long long)result.instructions, result.peak_rss_kib,
+                result.path.c_str());
+
+         if (result.outcome != OK)
+         {
+            printf("%-9s %s\n", "", result.message.c_str());
+         }
+
+         count[result.outcome]++;
+         if (result.outcome == OK) start_us.push_back(result.start_us);
+      }
+
+      std::sort(start_us.begin(), start_us.end());
+
+      printf("\n%zu stories in %.1f s\n", results.size(), seconds);
+      for(unsigned i = 0; i < NUM_OUTCOME; i++)
+      {
+         if (count[i] != 0) printf("   %-9s %u\n", outcome_name[i], count[i]);
+      }
+
+      if (!start_us.empty())
+      {
+         printf("Start ms p50 %.1f  p99 %.1f  max %.1f\n",
+                percentile(start_us, 50) / 1000.0,
+                percentile(start_us, 99) / 1000.0,
+                start_us.back() / 1000.0);
+      }
+   }
+
+   virtual int startConsoleApp() override
+   {
+      if (dirs.empty())
+      {
+         fprintf(stderr, "ERR - no story directory given\n");
+         return 1;
+      }
+
+      std::vector<std::string> paths;
+      for(const auto& dir : dirs)
+      {
+         findStories(dir, paths);
+      }
+      std::sort(paths.begin(), paths.end());
+
+      std::vector<Result> results(paths.size());
+      for(size_t i = 0; i < paths.size(); i++)
+      {
+         results[i].path = paths[i];
+      }
+
+      unsigned max_children = jobs;
+      if (max_children == 0)
+      {
+         max_children = std::thread::hardware_concurrency();
+         if (max_children == 0) max_children = 1;
+      }
+
+      Clock::time_point start = Clock::now();
+
+      std::map<pid_t,Child> children;
+      size_t                next = 0;
+
+      while((next < paths.size()) || !children.empty())
+      {
+         while((next < paths.size()) && (children.size() < max_children))
+         {
+            if (!launch(children, next, paths[next]))
+            {
+               results[next].message = "Failed to start a process";
+            }
+            next++;
+         }
+
+         if (!children.empty() && !reap(children, results)) break;
+      }
+
+      double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+      printResults(results, seconds);
+
+      if ((strlen(output) != 0) && !writeResults(results)) return 1;
+
+      return 0;
+   }
+
+   virtual void parseArg(const char* arg) override
+   {
+      dirs.push_back(arg);
+   }
+
+public:
+   ZifSweep()
+      : ConsoleApp(PROGRAM, DESCRIPTION, LINK, AUTHOR, VERSION, COPYRIGHT_YEAR)
+   {
+   }
+};
+
+
+int main(int argc, const char* argv[])
+{
+   ZifSweep app;
+   return app.parseArgsAndStart(argc, argv);
+}